@@ -18,12 +18,17 @@
 #include "colorscheme.h"
 #include "raw_sig.h"
 #include "nanox.h"
+#include "perf.h"
+#include "rx_cache.h"
+#include "ws_grep.h"
+#include "search_hits.h"
 #include <unistd.h>
 #include <sys/stat.h>
 #include <limits.h>
 
 #define CMD_BUF_SIZE 256
 #define REPLACE_PREVIEW 48
+#define SED_CHUNK_LINES 128    /* lines per packed chunk, as readin() */
 
 
 
@@ -34,8 +39,9 @@
 
 static int parse_sed_expression(const char *expr, char *pattern, size_t pat_sz,
     char *replacement, size_t rep_sz, int *is_global, int *is_caseless);
-static int apply_regex_to_line(struct line *lp, pcre2_code *code, pcre2_match_data *match_data,
+static int apply_regex_to_line(struct line *lp, struct rx *rx,
     const char *replacement, size_t repl_len, int is_global, int *total_count);
+static int sed_replace_bulk(struct rx *rx, const char *replacement, size_t repl_len, int *total_count);
 static size_t utf8_advance(const char *text, size_t len, size_t offset);
 static void build_preview(const char *text, size_t len, char *dest, size_t dest_sz);
 static char *splice_text(char *text, size_t text_len, size_t start, size_t end,
@@ -636,6 +642,21 @@ static void execute_command(const char *input) {
         return;
     }
 
+    /* grep command */
+    if (strncasecmp(cmd, "grep", 4) == 0 && (cmd[4] == ' ' || cmd[4] == '\0')) {
+        char *args = cmd + 4;
+        while (*args && isspace((unsigned char)*args)) args++;
+        ws_grep_command(args);
+        return;
+    }
+
+    /* nohl: stop marking the search hits until the next search */
+    if (strcasecmp(cmd, "nohl") == 0) {
+        search_hits_show(false);
+        curwp->w_flag |= WFHARD;
+        return;
+    }
+
     /* Check for multi-cursor command */
     if (strncasecmp(cmd, "cursor", 6) == 0 && (cmd[6] == ' ' || cmd[6] == '\0')) {
         char *args = cmd + 6;
@@ -721,6 +742,10 @@ static void execute_command(const char *input) {
         extern int command_mode_handle_colors_command(const char *input);
         command_mode_handle_colors_command(args);
     }
+    /* Latency instrumentation */
+    else if (strncasecmp(cmd, "perf", 4) == 0 && (cmd[4] == ' ' || cmd[4] == '\0')) {
+        perf_command(cmd + 4);
+    }
     /* Check for Help command (case insensitive) */
     else if (strcasecmp(cmd, "help") == 0 || strcasecmp(cmd, "h") == 0) {
         execute_help();
@@ -1630,7 +1655,7 @@ int command_mode_swap_ranges(int first_start, int first_end, int second_start, i
 
     if (cursor_line >= 1)
         restore_cursor_to_index(cursor_line - 1, cursor_off);
-    lchange(WFHARD);
+    lchange_rest(lforw(pre_a));     /* every line from here may have moved */
     curwp->w_flag |= WFMOVE | WFHARD | WFMODE;
     return TRUE;
 }
@@ -1743,28 +1768,30 @@ int command_mode_block_selection_contains(struct line *lp, int col_start, int co
 
 int command_mode_block_handle_key(int c, int f, int n) { return viblock_handle_key(c, f, n); }
 
-static int apply_regex_to_line(struct line *lp, pcre2_code *code, pcre2_match_data *match_data,
+static int apply_regex_to_line(struct line *lp, struct rx *rx,
     const char *replacement, size_t repl_len, int is_global, int *total_count)
 {
-    char *text = malloc(lp->used + 1);
+    char *text;
     size_t text_len = lp->used;
     size_t search_offset = 0;
     int changed = FALSE;
 
+    text = malloc(text_len + 1);
     if (text == NULL) {
         mlwrite("%%Out of memory");
         return FALSE;
     }
 
-    memcpy(text, ltext(lp), text_len);
+    if (text_len > 0)
+        memcpy(text, ltext(lp), text_len);
     text[text_len] = '\0';
 
     while (search_offset <= text_len) {
-        int rc = pcre2_match(code, (PCRE2_SPTR)text, text_len, search_offset, 0, match_data, NULL);
+        int rc = rx_match(rx, text, text_len, search_offset);
         if (rc < 0)
             break;
 
-        PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(match_data);
+        PCRE2_SIZE *ovector = rx_ovector(rx);
         size_t match_start = ovector[0];
         size_t match_end = ovector[1];
 
@@ -1804,9 +1831,12 @@ static int apply_regex_to_line(struct line *lp, pcre2_code *code, pcre2_match_da
             next_offset = match_start + repl_len;
         }
 
-        if (zero_width && next_offset == match_start) {
-            next_offset = utf8_advance(text, text_len, match_start);
-            if (next_offset == match_start)
+        /* Step past an empty match and the text it was replaced with,
+         * or a pattern like "x*" matches there again forever. */
+        if (zero_width) {
+            size_t at = next_offset;
+            next_offset = utf8_advance(text, text_len, at);
+            if (next_offset == at)
                 next_offset++;
         }
 
@@ -1828,6 +1858,274 @@ static int apply_regex_to_line(struct line *lp, pcre2_code *code, pcre2_match_da
     return TRUE;
 }
 
+/*
+ * Global s///g without confirmation.
+ *
+ * apply_regex_to_line() edits a line in place, which unshares it from its
+ * read chunk into a handle of its own and redraws per hit.  Here the buffer
+ * is read once; lines without a match are left alone, still sharing their
+ * (possibly COLD) chunks, and the rewritten lines are packed SED_CHUNK_LINES
+ * to a handle like readin() does.  Nothing is linked in until every line
+ * has been done, so running out of memory leaves the buffer untouched.
+ */
+struct sed_edit {
+    struct line *old;
+    struct line *first;         /* its replacement lines, chained first..last */
+    struct line *last;
+};
+
+struct sed_bulk {
+    struct rx *rx;
+    const char *repl;
+    size_t repl_len;
+
+    char *work;                 /* line being rewritten */
+    size_t work_cap;
+    char *peek;                 /* scratch for reading COLD chunks */
+    size_t peek_cap;
+
+    char *chunk;                /* text of the chunk being packed */
+    size_t chunk_len;
+    size_t chunk_cap;
+    struct line *pending[SED_CHUNK_LINES];
+    int npending;
+
+    struct sed_edit *edits;
+    size_t nedits;
+    size_t edits_cap;
+};
+
+static int sed_reserve(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+        return TRUE;
+    size_t want = *cap ? *cap : 256;
+    while (want < need)
+        want *= 2;
+    char *grown = realloc(*buf, want);
+    if (grown == NULL)
+        return FALSE;
+    *buf = grown;
+    *cap = want;
+    return TRUE;
+}
+
+/* Give the pending lines a handle of their own. */
+static int sed_flush_chunk(struct sed_bulk *sb)
+{
+    MemoryHandle h;
+
+    if (sb->npending == 0)
+        return TRUE;
+    h = my_handle_alloc(sb->chunk_len ? sb->chunk_len : 1);
+    if (h == NULL)
+        return FALSE;
+    memcpy(handle_deref(h), sb->chunk, sb->chunk_len);
+    for (int i = 0; i < sb->npending; i++) {
+        sb->pending[i]->l_handle = h;
+        my_handle_ref(h);
+    }
+    mymemory_freeze(h);
+    my_handle_free(h);          /* the lines hold it now */
+    sb->npending = 0;
+    sb->chunk_len = 0;
+    return TRUE;
+}
+
+/* Append one replacement line to the edit being built. */
+static int sed_add_line(struct sed_bulk *sb, struct sed_edit *ed, const char *text, size_t len)
+{
+    struct line *lp;
+
+    if (!sed_reserve(&sb->chunk, &sb->chunk_cap, sb->chunk_len + len))
+        return FALSE;
+    if ((lp = malloc(sizeof(struct line))) == NULL)
+        return FALSE;
+    memcpy(sb->chunk + sb->chunk_len, text, len);
+    lp->l_handle = NULL;
+    lp->l_offset = (uint32_t)sb->chunk_len;
+    lp->used = (int)len;
+    lp->size = (int)len;
+    lp->l_hl = NULL;
+    lp->l_diag = 0;
+    lp->next = NULL;
+    lp->prev = ed->last;
+    if (ed->last != NULL)
+        ed->last->next = lp;
+    else
+        ed->first = lp;
+    ed->last = lp;
+    sb->chunk_len += len;
+
+    sb->pending[sb->npending++] = lp;
+    if (sb->npending == SED_CHUNK_LINES)
+        return sed_flush_chunk(sb);
+    return TRUE;
+}
+
+/*
+ * Replace every match on one line, with the same rules as the global case
+ * of apply_regex_to_line(): matching resumes after the inserted text, and a
+ * replacement containing a line break splits the line as linsert_block()
+ * would.  Returns the number of replacements, or -1 when out of memory.
+ */
+static int sed_rewrite_line(struct sed_bulk *sb, struct line *lp, const char *src)
+{
+    size_t len = (size_t)llength(lp);
+    size_t offset = 0;
+    int count = 0;
+    struct sed_edit *ed;
+
+    /* PCRE2 may look one byte past a truncated UTF-8 sequence at the end
+     * of the subject, so always match a NUL-terminated copy. */
+    if (!sed_reserve(&sb->work, &sb->work_cap, len + 1))
+        return -1;
+    if (len > 0)
+        memcpy(sb->work, src, len);
+    sb->work[len] = '\0';
+    if (rx_match(sb->rx, sb->work, len, 0) < 0)
+        return 0;
+
+    while (offset <= len) {
+        if (rx_match(sb->rx, sb->work, len, offset) < 0)
+            break;
+
+        PCRE2_SIZE *ovector = rx_ovector(sb->rx);
+        size_t match_start = ovector[0];
+        size_t match_end = ovector[1];
+        size_t new_len = len - (match_end - match_start) + sb->repl_len;
+
+        if (!sed_reserve(&sb->work, &sb->work_cap, new_len + 1))
+            return -1;
+        memmove(sb->work + match_start + sb->repl_len, sb->work + match_end, len - match_end);
+        memcpy(sb->work + match_start, sb->repl, sb->repl_len);
+        len = new_len;
+        sb->work[len] = '\0';
+        count++;
+
+        offset = match_start + sb->repl_len;
+        if (match_start == match_end) {
+            size_t at = offset;
+            offset = utf8_advance(sb->work, len, at);
+            if (offset == at)
+                offset++;
+        }
+    }
+
+    if (sb->nedits == sb->edits_cap) {
+        size_t cap = sb->edits_cap ? sb->edits_cap * 2 : 64;
+        struct sed_edit *grown = realloc(sb->edits, cap * sizeof(*grown));
+
+        if (grown == NULL)
+            return -1;
+        sb->edits = grown;
+        sb->edits_cap = cap;
+    }
+    ed = &sb->edits[sb->nedits++];
+    ed->old = lp;
+    ed->first = ed->last = NULL;
+
+    size_t start = 0;
+    for (size_t i = 0; i <= len; i++) {
+        if (i < len && sb->work[i] != '\n' && sb->work[i] != '\r')
+            continue;
+        if (!sed_add_line(sb, ed, sb->work + start, i - start))
+            return -1;
+        if (i < len && sb->work[i] == '\r' && i + 1 < len && sb->work[i + 1] == '\n')
+            i++;
+        start = i + 1;
+    }
+    return count;
+}
+
+static void sed_free_line(struct line *lp)
+{
+    if (lp->l_handle != NULL)
+        my_handle_free(lp->l_handle);
+    lhl_free(lp);
+    free(lp);
+}
+
+/* Put each edit's lines in place of the old line, all in one go. */
+static void sed_relink(struct sed_bulk *sb)
+{
+    struct window *wp = curwp;
+
+    for (size_t i = 0; i < sb->nedits; i++) {
+        struct sed_edit *ed = &sb->edits[i];
+        struct line *old = ed->old;
+
+        ed->first->prev = old->prev;
+        ed->last->next = old->next;
+        old->prev->next = ed->first;
+        old->next->prev = ed->last;
+
+        if (wp->w_linep == old)
+            wp->w_linep = ed->first;
+        if (wp->w_dotp == old) {
+            wp->w_dotp = ed->first;
+            wp->w_doto = 0;
+        }
+        if (wp->w_markp == old) {
+            wp->w_markp = ed->first;
+            wp->w_marko = 0;
+        }
+        sed_free_line(old);
+    }
+}
+
+static int sed_replace_bulk(struct rx *rx, const char *replacement, size_t repl_len, int *total_count)
+{
+    struct sed_bulk sb = { .rx = rx, .repl = replacement, .repl_len = repl_len };
+    MemoryHandle handle = NULL;
+    const char *base = NULL;
+    int total = 0;
+    int ok = TRUE;
+
+    for (struct line *lp = lforw(curbp->b_linep); lp != curbp->b_linep; lp = lforw(lp)) {
+        const char *src = NULL;
+
+        if (llength(lp) > 0) {
+            if (base == NULL || lp->l_handle != handle) {
+                handle = lp->l_handle;
+                base = handle_peek(handle, &sb.peek, &sb.peek_cap);
+            }
+            src = base != NULL ? base + lp->l_offset : (const char *)ltext(lp);
+        }
+
+        int n = sed_rewrite_line(&sb, lp, src);
+        if (n < 0) {
+            ok = FALSE;
+            break;
+        }
+        total += n;
+    }
+    if (ok)
+        ok = sed_flush_chunk(&sb);
+
+    if (!ok) {
+        for (size_t i = 0; i < sb.nedits; i++) {
+            for (struct line *lp = sb.edits[i].first, *next; lp != NULL; lp = next) {
+                next = lp->next;
+                sed_free_line(lp);
+            }
+        }
+        mlwrite("%%Out of memory");
+    } else if (sb.nedits > 0) {
+        struct line *first = sb.edits[0].old->prev;
+
+        sed_relink(&sb);
+        lchange_rest(lforw(first));
+        *total_count += total;
+    }
+
+    free(sb.edits);
+    free(sb.chunk);
+    free(sb.work);
+    free(sb.peek);
+    return ok;
+}
+
 int sed_replace_command(int f, int n)
 {
     char expr[NSTRING];
@@ -1839,10 +2137,8 @@ int sed_replace_command(int f, int n)
     int total = 0;
     int original_index;
     int original_offset;
-    pcre2_code *code;
-    pcre2_match_data *match_data;
-    int errornumber;
-    PCRE2_SIZE erroffset;
+    struct rx *rx;
+    char errbuf[160];
     uint32_t options = PCRE2_UTF | PCRE2_UCP | PCRE2_MULTILINE;
     size_t repl_len;
 
@@ -1866,19 +2162,9 @@ int sed_replace_command(int f, int n)
     if (is_caseless)
         options |= PCRE2_CASELESS;
 
-    code = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED, options, &errornumber, &erroffset, NULL);
-    if (code == NULL) {
-        char errbuf[128];
-        pcre2_get_error_message(errornumber, (PCRE2_UCHAR *)errbuf, sizeof(errbuf));
-        mlwrite("Regex error at %d: %s", (int)erroffset, errbuf);
-        nanox_request_underbar_redraw();
-        return FALSE;
-    }
-
-    match_data = pcre2_match_data_create_from_pattern(code, NULL);
-    if (match_data == NULL) {
-        pcre2_code_free(code);
-        mlwrite("%%Out of memory");
+    rx = rx_get(pattern, options, errbuf, sizeof(errbuf));
+    if (rx == NULL) {
+        mlwrite("%s", errbuf);
         nanox_request_underbar_redraw();
         return FALSE;
     }
@@ -1887,22 +2173,25 @@ int sed_replace_command(int f, int n)
     original_offset = curwp->w_doto;
     repl_len = strlen(replacement);
 
-    struct line *lp = lforw(curbp->b_linep);
-    while (lp != curbp->b_linep) {
-        struct line *next = lforw(lp);
-        if (!apply_regex_to_line(lp, code, match_data, replacement, repl_len, is_global, &total)) {
-            pcre2_match_data_free(match_data);
-            pcre2_code_free(code);
+    if (is_global) {
+        if (!sed_replace_bulk(rx, replacement, repl_len, &total)) {
             restore_saved_cursor(original_index, original_offset);
             nanox_request_underbar_redraw();
             return FALSE;
         }
-        lp = next;
+    } else {
+        struct line *lp = lforw(curbp->b_linep);
+        while (lp != curbp->b_linep) {
+            struct line *next = lforw(lp);
+            if (!apply_regex_to_line(lp, rx, replacement, repl_len, is_global, &total)) {
+                restore_saved_cursor(original_index, original_offset);
+                nanox_request_underbar_redraw();
+                return FALSE;
+            }
+            lp = next;
+        }
     }
 
-    pcre2_match_data_free(match_data);
-    pcre2_code_free(code);
-
     restore_saved_cursor(original_index, original_offset);
 
     if (total == 0)
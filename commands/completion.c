@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <wctype.h>
 #include <strings.h>
@@ -88,6 +89,7 @@ typedef struct {
     int count;
     int capacity;
     int max_items;
+    uint64_t *masks;   /* pool_char_mask() of each item */
 } completion_pool_t;
 
 typedef struct {
@@ -107,13 +109,13 @@ typedef struct {
 #define MAX_SOURCE_SYMBOLS 2048
 #define MAX_SOURCE_FILE_BYTES 262144
 
-static completion_pool_t c_symbol_cache = { NULL, 0, 0, MAX_C_SYMBOLS };
-static completion_pool_t c_include_paths = { NULL, 0, 0, 0 };
+static completion_pool_t c_symbol_cache = { NULL, 0, 0, MAX_C_SYMBOLS, NULL };
+static completion_pool_t c_include_paths = { NULL, 0, 0, 0, NULL };
 static int c_symbols_loaded = 0;
 static int c_files_scanned = 0;
 
-static completion_pool_t java_class_cache = { NULL, 0, 0, MAX_JAVA_SYMBOLS };
-static completion_pool_t java_classpath_entries = { NULL, 0, 0, 0 };
+static completion_pool_t java_class_cache = { NULL, 0, 0, MAX_JAVA_SYMBOLS, NULL };
+static completion_pool_t java_classpath_entries = { NULL, 0, 0, 0, NULL };
 static int java_classpath_loaded = 0;
 static int java_symbols_loaded = 0;
 static int java_symbols_loading = 0;
@@ -172,7 +174,7 @@ static int completion_display_width(const char *text)
 
 /* Source-level symbol cache: structs, typedefs, enums, functions from
  * the current buffer and file-reserve slot files. */
-static completion_pool_t source_symbol_cache = { NULL, 0, 0, MAX_SOURCE_SYMBOLS };
+static completion_pool_t source_symbol_cache = { NULL, 0, 0, MAX_SOURCE_SYMBOLS, NULL };
 static char source_symbol_last_fname[NFILEN]; /* fname of last scanned buffer */
 
 static const char *common_keywords[] = {
@@ -399,6 +401,17 @@ static int completion_write_utf8_ellipsized(const char *text, int max_width)
     return truncated;
 }
 
+/* One bit per case-folded byte value (mod 64) occurring in s.  A candidate
+ * can only match a query whose bits it all has, whether fuzzily or by
+ * prefix, so pools skip the others without scoring them. */
+static uint64_t pool_char_mask(const char *s)
+{
+    uint64_t mask = 0;
+    for (; *s; s++)
+        mask |= 1ull << (tolower((unsigned char)*s) & 63);
+    return mask;
+}
+
 static void pool_add(completion_pool_t *pool, const char *value)
 {
     if (pool == NULL || value == NULL || *value == '\0')
@@ -415,11 +428,16 @@ static void pool_add(completion_pool_t *pool, const char *value)
         if (!tmp)
             return;
         pool->items = tmp;
+        uint64_t *masks = realloc(pool->masks, (size_t)new_capacity * sizeof(uint64_t));
+        if (!masks)
+            return;
+        pool->masks = masks;
         pool->capacity = new_capacity;
     }
     char *copy = strdup(value);
     if (!copy)
         return;
+    pool->masks[pool->count] = pool_char_mask(copy);
     pool->items[pool->count++] = copy;
 }
 
@@ -427,8 +445,9 @@ static void add_matches_from_pool(const completion_pool_t *pool, const char *pre
 {
     if (pool == NULL || prefix == NULL)
         return;
+    uint64_t need = pool_char_mask(prefix);
     for (int i = 0; i < pool->count; i++) {
-        if (pool->items[i] == NULL)
+        if (pool->items[i] == NULL || (need & ~pool->masks[i]) != 0)
             continue;
         completion_consider_candidate(pool->items[i], prefix);
         if (completion_state.count >= MAX_COMPLETIONS)
@@ -814,10 +833,11 @@ static void completion_consider_candidate_with_kind(const char *candidate, const
     completion_add_match_with_sort_score_kind(candidate, score, NULL, kind_val);
 }
 
-static void collect_keyword_array_with_kind(const char entries[][MAX_TOKEN_LEN], int count, const char *prefix, int kind_val)
+static void collect_keyword_array_with_kind(const HighlightProfile *profile, const HlStrList *entries,
+                                            const char *prefix, int kind_val)
 {
-    for (int i = 0; i < count && completion_state.count < MAX_COMPLETIONS; i++) {
-        completion_consider_candidate_with_kind(entries[i], prefix, kind_val);
+    for (int i = 0; i < entries->count && completion_state.count < MAX_COMPLETIONS; i++) {
+        completion_consider_candidate_with_kind(hl_str(profile, entries->items[i]), prefix, kind_val);
         if (completion_state.count >= MAX_COMPLETIONS)
             break;
     }
@@ -828,15 +848,15 @@ static void collect_language_keywords(const char *prefix)
     if (curbp == NULL)
         return;
 
-    const HighlightProfile *profile = highlight_get_profile(curbp->b_fname);
+    const HighlightProfile *profile = highlight_buffer_profile(curbp);
     if (profile == NULL)
         return;
 
-    collect_keyword_array_with_kind(profile->keywords, profile->keyword_count, prefix, 14);
-    collect_keyword_array_with_kind(profile->type_keywords, profile->type_keyword_count, prefix, 25);
-    collect_keyword_array_with_kind(profile->flow_keywords, profile->flow_keyword_count, prefix, 14);
-    collect_keyword_array_with_kind(profile->preproc_keywords, profile->preproc_keyword_count, prefix, 14);
-    collect_keyword_array_with_kind(profile->return_keywords, profile->return_keyword_count, prefix, 14);
+    collect_keyword_array_with_kind(profile, &profile->keywords, prefix, 14);
+    collect_keyword_array_with_kind(profile, &profile->type_keywords, prefix, 25);
+    collect_keyword_array_with_kind(profile, &profile->flow_keywords, prefix, 14);
+    collect_keyword_array_with_kind(profile, &profile->preproc_keywords, prefix, 14);
+    collect_keyword_array_with_kind(profile, &profile->return_keywords, prefix, 14);
 }
 
 static void collect_common_keywords(const char *prefix)
@@ -2014,6 +2034,7 @@ static java_member_entry_t *get_java_member_entry(const char *class_name)
     entry->members.count = 0;
     entry->members.capacity = 0;
     entry->members.max_items = MAX_JAVA_MEMBERS;
+    entry->members.masks = NULL;
     entry->loaded = 0;
     return entry;
 }
@@ -2375,7 +2396,9 @@ static void pool_free(completion_pool_t *pool)
         if (pool->items[i]) free(pool->items[i]);
     }
     if (pool->items) free(pool->items);
+    free(pool->masks);
     pool->items = NULL;
+    pool->masks = NULL;
     pool->count = 0;
     pool->capacity = 0;
 }
@@ -2775,7 +2798,7 @@ static void completion_insert_terminator_if_needed(void)
     if (curbp == NULL || curwp == NULL || curwp->w_dotp == NULL)
         return;
 
-    const HighlightProfile *profile = highlight_get_profile(curbp->b_fname);
+    const HighlightProfile *profile = highlight_buffer_profile(curbp);
     if (profile == NULL || profile->completion_end_line_char == '\0')
         return;
     if (!completion_is_import_include_context(curwp->w_dotp))
@@ -17,6 +17,7 @@
 #include "wrapper.h"
 
 #include "util.h"
+#include "perf.h"
 
 extern struct name_bind names[];
 extern struct terminal  *term;
@@ -270,6 +271,7 @@ int tgetc(void)
 
     /* fetch a character from the terminal driver */
     c = TTgetc();
+    perf_key_arrived();
 
     /* record it for $lastkey */
     lastkey = c;
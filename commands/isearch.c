@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "estruct.h"
 #include "edef.h"
@@ -21,6 +22,8 @@
 #include "utf8.h"
 #include "util.h"
 #include "completion.h"
+#include "lit_search.h"
+#include "mb_history.h"
 
 /* ====================================================================
  * MINIBUFFER WINDOW SYSTEM
@@ -66,6 +69,13 @@ void minibuf_init(void)
     minibuf_bp->b_active = TRUE;
     minibuf_bp->b_nwnd = 1;
     minibuf_bp->b_flag = 0;
+    minibuf_bp->b_hl_ndirty = 0;
+    minibuf_bp->b_hl_full = FALSE;
+    minibuf_bp->b_hl_epoch = 0;
+    minibuf_bp->b_hl_sparse = FALSE;
+    minibuf_bp->b_hl_profile = NULL;
+    minibuf_bp->b_hl_profile_key = NULL;
+    minibuf_bp->b_hl_profile_gen = 0;
     strcpy(minibuf_bp->b_fname, "");
     strcpy(minibuf_bp->b_bname, "*minibuf*");
     
@@ -347,11 +357,63 @@ void minibuf_get_text(char *dest, int max_len)
     dest[i] = '\0';
 }
 
+/* Replace the minibuffer contents with the UTF-8 string text */
+static void minibuf_set_text(const char *text)
+{
+    int i = 0;
+    int len = (int)strlen(text);
+
+    minibuf_clear();
+    while (i < len) {
+        unicode_t uc;
+        int bytes = utf8_to_unicode((const unsigned char *)text, i, len, &uc);
+        if (bytes <= 0)
+            break;
+        minibuf_insert_char(uc);
+        i += bytes;
+    }
+}
+
+/* History recall in minibuf_input() */
+struct minibuf_recall {
+    int kind;               /* mb_history kind of the prompt */
+    int at;                 /* entry shown, -1 for the typed text */
+    bool regex;
+    char typed[NPAT];       /* what was typed before recalling */
+};
+
+/* Show the next older (or newer) entry containing the typed text */
+static void minibuf_recall_step(struct minibuf_recall *r, bool older, bool regex)
+{
+    int id;
+
+    if (r->at < 0 || r->regex != regex) {
+        if (r->at < 0)
+            minibuf_get_text(r->typed, NPAT);
+        r->at = -1;
+        r->regex = regex;
+    }
+    if (older)
+        id = mb_history_prev(r->kind, r->typed, regex, r->at);
+    else if (r->at >= 0)
+        id = mb_history_next(r->kind, r->typed, regex, r->at);
+    else
+        return;
+    if (id < 0 && older) {
+        TTbeep();
+        return;
+    }
+    r->at = id;
+    minibuf_set_text(id >= 0 ? mb_history_text(id) : r->typed);
+    completion_hide();
+}
+
 /* Generic minibuffer input function - returns TRUE if input was accepted, FALSE if cancelled */
 int minibuf_input(const char *prompt, char *dest, int max_len)
 {
     int c;
     char current_text[NPAT];
+    struct minibuf_recall recall = { mb_history_kind(prompt), -1, false, "" };
     
     /* Initialize minibuffer system */
     minibuf_init();
@@ -394,6 +456,7 @@ int minibuf_input(const char *prompt, char *dest, int max_len)
             nanox_request_underbar_redraw();
             if (dest[0] == '\0')
                 return FALSE;
+            mb_history_add(recall.kind, dest);
             return TRUE;
             
         case IS_BACKSP:
@@ -401,6 +464,7 @@ int minibuf_input(const char *prompt, char *dest, int max_len)
         case (CONTROL | 'H'):
             /* Backspace/Delete - remove last character */
             minibuf_delete_char(1);
+            recall.at = -1;
             minibuf_get_text(current_text, NPAT);
             completion_update(current_text, COMPLETION_CONTEXT_DEFAULT);
             minibuf_update(prompt);
@@ -414,28 +478,34 @@ int minibuf_input(const char *prompt, char *dest, int max_len)
             return FALSE;
             
         case (SPEC | 'A'): /* Up Arrow */
-            completion_prev();
+            if (completion_state.is_visible)
+                completion_prev();
+            else
+                minibuf_recall_step(&recall, true, false);
+            minibuf_update(prompt);
             break;
             
         case (SPEC | 'B'): /* Down Arrow */
-            completion_next();
+            if (completion_state.is_visible)
+                completion_next();
+            else
+                minibuf_recall_step(&recall, false, false);
+            minibuf_update(prompt);
+            break;
+
+        case (CONTROL | 'P'): /* Ctrl+P - Older history entry containing the typed text */
+        case (CONTROL | 'N'): /* Ctrl+N - Newer one */
+        case (CONTROL | 'R'): /* Ctrl+R - Older one matching the typed text as a regex */
+            minibuf_recall_step(&recall, c != (CONTROL | 'N'), c == (CONTROL | 'R'));
+            minibuf_update(prompt);
             break;
             
         case (CONTROL | SHIFT | 'A'): /* Ctrl+Shift+A - Accept completion */
             {
                 const char *selected = completion_get_selected();
                 if (selected) {
-                    minibuf_clear();
-                    /* Insert selected word - decode UTF-8 to Unicode before inserting */
-                    int i = 0;
-                    int sel_len = strlen(selected);
-                    while (i < sel_len) {
-                        unicode_t uc;
-                        int bytes = utf8_to_unicode((const unsigned char *)selected, i, sel_len, &uc);
-                        if (bytes <= 0) break;
-                        minibuf_insert_char(uc);
-                        i += bytes;
-                    }
+                    minibuf_set_text(selected);
+                    recall.at = -1;
                     completion_hide();
                     minibuf_update(prompt);
                 }
@@ -447,6 +517,7 @@ int minibuf_input(const char *prompt, char *dest, int max_len)
             /* Match main.c execute() logic: (c >= 0x20 && c <= 0x7E) || (c >= 0xA0 && c <= 0x10FFFF) */
             if ((c >= 0x20 && c <= 0x7E) || (c >= 0xA0 && c <= 0x10FFFF)) {
                 minibuf_insert_char(c);
+                recall.at = -1;
                 minibuf_get_text(current_text, NPAT);
                 completion_update(current_text, COMPLETION_CONTEXT_DEFAULT);
                 minibuf_update(prompt);
@@ -513,6 +584,240 @@ int get_char(void)
     return c;
 }
 
+/* ====================================================================
+ * ISEARCH CANDIDATES
+ * ==================================================================== */
+
+/*
+ * Typing a pattern only ever narrows its matches down.  The first scan of
+ * an isearch finds every position the pattern matches at, and later keys
+ * only check those candidates for the characters added since.  A
+ * candidate's depth is how much of isc.pat matches at it, so the shorter
+ * patterns met again after a backspace cost nothing either.  Positions
+ * carry their line number, and "." is placed among them by the lines whose
+ * number is known: the isearch origin and the last match found here.
+ *
+ * Finding the candidates takes a pass over the whole buffer, so it is only
+ * done for a pattern scanner() was slow to search for.  Patterns with too
+ * many matches, or with a newline, are left to scanner(), as is a "." on a
+ * line whose number is not known.
+ */
+#define ISC_MAX (1 << 17)               /* candidates kept at most */
+#define ISC_SLOW_NS (2 * 1000000L)      /* a scan slower than this finds them */
+
+struct isc_cand {
+    struct line *lp;
+    int lineno;
+    int off;
+    int depth;                          /* bytes of isc.pat matching at off */
+};
+
+static struct {
+    struct buffer *bp;                  /* NULL: nothing cached */
+    int version;                        /* bp->b_version the lines are numbered for */
+    bool fold;
+    bool overflow;                      /* base matched more than ISC_MAX times */
+    char base[NPAT];                    /* the pattern the candidates were found for */
+    char pat[NPAT];                     /* the pattern the depths are checked against */
+    struct lsearch ls;
+    struct isc_cand *cand;              /* in buffer order */
+    int ncand;
+    int cap;
+    int nlines;                         /* number of the header line */
+    struct line *origin;
+    int origin_no;
+    struct line *last;                  /* line of the last match found here */
+    int last_no;
+    char *scratch;                      /* handle_peek() of a COLD chunk */
+    size_t scratch_cap;
+} isc;
+
+/* A new isearch from lp: the buffer may have changed since the last. */
+static void isc_begin(struct line *lp)
+{
+    isc.bp = NULL;
+    isc.origin = lp;
+    isc.last = NULL;
+}
+
+/* The text of lp without thawing its chunk; *h and *base cache the chunk. */
+static const unsigned char *isc_text(struct line *lp, MemoryHandle *h, const unsigned char **base)
+{
+    if (*base == NULL || lp->l_handle != *h) {
+        *h = lp->l_handle;
+        *base = handle_peek(lp->l_handle, &isc.scratch, &isc.scratch_cap);
+        if (*base == NULL)
+            return NULL;
+    }
+    return *base + lp->l_offset;
+}
+
+static int isc_lineno(struct line *lp)
+{
+    if (lp == isc.bp->b_linep)
+        return isc.nlines;
+    if (lp == isc.origin)
+        return isc.origin_no;
+    if (lp == isc.last)
+        return isc.last_no;
+    return -1;
+}
+
+/* Find every position of the len bytes of patrn in curbp. */
+static void isc_build(const char *patrn, int len, bool fold)
+{
+    struct line *hdr = curbp->b_linep;
+    struct line *dot = curwp->w_dotp;
+    MemoryHandle h = NULL;
+    const unsigned char *base = NULL;
+    int lineno = 0;
+
+    isc.bp = curbp;
+    isc.version = curbp->b_version;
+    isc.fold = fold;
+    isc.overflow = false;
+    memcpy(isc.base, patrn, (size_t)len + 1);
+    memcpy(isc.pat, patrn, (size_t)len + 1);
+    isc.ncand = 0;
+    isc.last = NULL;
+    lsearch_compile(&isc.ls, patrn, len, fold);
+
+    for (struct line *lp = lforw(hdr); lp != hdr; lp = lforw(lp), lineno++) {
+        const unsigned char *text;
+
+        if (lp == isc.origin)
+            isc.origin_no = lineno;
+        if (lp == dot) {
+            isc.last = lp;
+            isc.last_no = lineno;
+        }
+        if (llength(lp) < len || (text = isc_text(lp, &h, &base)) == NULL)
+            continue;
+        for (int pos = 0; (pos = lsearch_find(&isc.ls, text, llength(lp), pos)) >= 0; pos++) {
+            if (isc.ncand == isc.cap) {
+                int cap = isc.cap ? isc.cap * 2 : 1024;
+                struct isc_cand *cand;
+
+                if (isc.cap == ISC_MAX ||
+                    (cand = realloc(isc.cand, (size_t)cap * sizeof(*cand))) == NULL) {
+                    isc.overflow = true;
+                    return;
+                }
+                isc.cand = cand;
+                isc.cap = cap;
+            }
+            isc.cand[isc.ncand++] = (struct isc_cand){ lp, lineno, pos, len };
+        }
+    }
+    isc.nlines = lineno;
+}
+
+/* Bring the depths up to date for the len bytes of patrn. */
+static void isc_refine(const char *patrn, int len)
+{
+    MemoryHandle h = NULL;
+    const unsigned char *base = NULL;
+    int same = 0;
+
+    while (same < len && isc.pat[same] == patrn[same])
+        same++;
+    for (int i = 0; i < isc.ncand; i++) {
+        struct isc_cand *c = &isc.cand[i];
+        const unsigned char *text;
+
+        if (c->depth < same)
+            continue;                   /* failed where patrn agrees with isc.pat */
+        c->depth = same;
+        if (same == len || (text = isc_text(c->lp, &h, &base)) == NULL)
+            continue;
+        while (c->depth < len && c->off + c->depth < llength(c->lp) &&
+               eq(text[c->off + c->depth], (unsigned char)patrn[c->depth]))
+            c->depth++;
+    }
+    memcpy(isc.pat, patrn, (size_t)len + 1);
+}
+
+/* First candidate at or after (lineno, off). */
+static int isc_lower_bound(int lineno, int off)
+{
+    int lo = 0, hi = isc.ncand;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const struct isc_cand *c = &isc.cand[mid];
+
+        if (c->lineno < lineno || (c->lineno == lineno && c->off < off))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * scanner() for isearch through the candidates: TRUE or FALSE, or -1 when
+ * the candidates cannot tell and scanner() has to search.
+ */
+static int isc_scan(const char *patrn, int dir)
+{
+    int len = (int)strlen(patrn);
+    bool fold = (curbp->b_mode & MDEXACT) == 0;
+    int baselen, dotno, i;
+    bool usable = false;
+    const struct isc_cand *c = NULL;
+
+    if (len == 0 || strchr(patrn, '\n') != NULL || curwp->w_bufp != curbp)
+        return -1;
+    if (isc.bp == curbp && isc.version == curbp->b_version && isc.fold == fold) {
+        baselen = (int)strlen(isc.base);
+        if (len >= baselen && strncmp(isc.base, patrn, (size_t)baselen) == 0) {
+            if (isc.overflow && len == baselen)
+                return -1;
+            usable = !isc.overflow;
+        } else if (strncmp(isc.base, patrn, (size_t)len) == 0) {
+            return -1;                  /* a prefix of base: matches may be missing */
+        }
+    }
+    if (!usable)
+        return -1;
+    if ((dotno = isc_lineno(curwp->w_dotp)) < 0)
+        return -1;
+    isc_refine(patrn, len);
+
+    if (dir > 0) {
+        /* like lsearch_buffer(), from the header line it starts at the top */
+        int from = curwp->w_dotp == curbp->b_linep ? 0 : curwp->w_doto;
+
+        if (curwp->w_dotp == curbp->b_linep)
+            dotno = 0;
+        for (i = isc_lower_bound(dotno, from); i < isc.ncand; i++)
+            if (isc.cand[i].depth >= len) {
+                c = &isc.cand[i];
+                break;
+            }
+    } else {
+        for (i = isc_lower_bound(dotno, curwp->w_doto + 1) - 1; i >= 0; i--) {
+            const struct isc_cand *e = &isc.cand[i];
+
+            if (e->depth >= len && (e->lineno < dotno || e->off + len <= curwp->w_doto)) {
+                c = e;
+                break;
+            }
+        }
+    }
+    if (c == NULL)
+        return FALSE;
+
+    matchline = c->lp;
+    matchoff = c->off;
+    curwp->w_dotp = c->lp;
+    curwp->w_doto = dir > 0 ? c->off + len : c->off;
+    curwp->w_flag |= WFMOVE;
+    isc.last = c->lp;
+    isc.last_no = c->lineno;
+    return TRUE;
+}
+
 /* Subroutine to do incremental reverse search */
 int risearch(int f, int n)
 {
@@ -593,6 +898,7 @@ int isearch(int f, int n)
     curline = curwp->w_dotp;
     curoff = curwp->w_doto;
     init_direction = n;
+    isc_begin(curline);
     
 start_over:
     /* Clear and display minibuffer */
@@ -766,13 +1072,24 @@ int checknext(char chr, char *patrn, int dir)
 int scanmore(char *patrn, int dir)
 {
     int sts;
+    struct timespec t0, t1;
     
+    if ((sts = isc_scan(patrn, dir)) >= 0)
+        return sts;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
     if (dir < 0) {
         rvstrscpy(tap, patrn, NPAT);
         sts = scanner(tap, REVERSE, PTBEG);
     } else {
         sts = scanner(patrn, FORWARD, PTEND);
     }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (sts != ABORT &&
+        (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec) >= ISC_SLOW_NS &&
+        strchr(patrn, '\n') == NULL)
+        isc_build(patrn, (int)strlen(patrn), (curbp->b_mode & MDEXACT) == 0);
+    if (sts == ABORT)           /* stopped by a key, which isearch reads next */
+        sts = FALSE;
     
     if (!sts) {
         /* Bell disabled */
@@ -19,6 +19,7 @@
 #include "nanox.h"
 #include "completion.h"
 #include "highlight.h"
+#include "ws_grep.h"
 
 int tabsize;                    /* Tab size (0: use real tabs) */
 
@@ -1011,6 +1012,8 @@ int insert_newline(int f, int n)
 {
     int s;
 
+    if (ws_grep_owns(curbp))        /* Enter opens a grep hit           */
+        return ws_grep_visit();
     if (curbp->b_mode & MDVIEW)     /* don't allow this command if      */
         return rdonly();        /* we are in read only mode     */
     if (n < 0)
@@ -1047,7 +1050,7 @@ int insert_newline(int f, int n)
 
 static bool is_inside_block_comment(struct line *lp)
 {
-    const HighlightProfile *profile = highlight_get_profile(curbp->b_fname);
+    const HighlightProfile *profile = highlight_buffer_profile(curbp);
     if (!profile || profile->block_comment_count == 0)
         return false;
 
@@ -1080,7 +1083,7 @@ int cinsert(void)
 
     /* check for /** comment start for auto-completion */
     int comment_auto_insert = 0;
-    const HighlightProfile *profile = highlight_get_profile(curbp->b_fname);
+    const HighlightProfile *profile = highlight_buffer_profile(curbp);
     if (profile && !profile->suppress_comment_autocomplete) {
         /* Look for /** pattern at cursor position */
         if (doto >= 3) {
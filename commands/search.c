@@ -66,6 +66,11 @@
 #include "edef.h"
 #include "efunc.h"
 #include "line.h"
+#include "lit_search.h"
+#include "match_index.h"
+#include "par_search.h"
+#include "rx_cache.h"
+#include "search_hits.h"
 
 /*
  * The variables magical and rmagical determine if there
@@ -118,14 +123,14 @@ int forwsearch(int f, int n)
                 status = mcscanner(&mcpat[0], FORWARD, PTEND);
             else
                 status = scanner(&pat[0], FORWARD, PTEND);
-        } while ((--n > 0) && status);
+        } while ((--n > 0) && status == TRUE);
 
         /* Save away the match, or complain
          * if not there.
          */
         if (status == TRUE)
             savematch();
-        else
+        else if (status == FALSE)
             mlwrite("Not found");
     }
     return status;
@@ -204,13 +209,19 @@ int nanox_search_engine(int f, int n)
             }
 
             if (status != TRUE) {
-                mlwrite("No more matches.");
+                if (status == FALSE)
+                    mlwrite("No more matches.");
                 break;
             }
 
             update(TRUE);
 
             mlwrite("Search Next? (y/n or Enter new)");
+            if (match_index_pump(curbp)) {      /* count them meanwhile */
+                while (!typahead() && match_index_pump(curbp))
+                    ;
+                update(TRUE);
+            }
             int c = tgetc();
             if (c == 'y' || c == 'Y') {
                 continue;
@@ -267,14 +278,14 @@ int forwhunt(int f, int n)
             status = mcscanner(&mcpat[0], FORWARD, PTEND);
         else
             status = scanner(&pat[0], FORWARD, PTEND);
-    } while ((--n > 0) && status);
+    } while ((--n > 0) && status == TRUE);
 
     /* Save away the match, or complain
      * if not there.
      */
     if (status == TRUE)
         savematch();
-    else
+    else if (status == FALSE)
         mlwrite("Not found");
 
     return status;
@@ -310,14 +321,14 @@ int backsearch(int f, int n)
                 status = mcscanner(&tapcm[0], REVERSE, PTBEG);
             else
                 status = scanner(&tap[0], REVERSE, PTBEG);
-        } while ((--n > 0) && status);
+        } while ((--n > 0) && status == TRUE);
 
         /* Save away the match, or complain
          * if not there.
          */
         if (status == TRUE)
             savematch();
-        else
+        else if (status == FALSE)
             mlwrite("Not found");
     }
     return status;
@@ -360,19 +371,91 @@ int backhunt(int f, int n)
             status = mcscanner(&tapcm[0], REVERSE, PTBEG);
         else
             status = scanner(&tap[0], REVERSE, PTBEG);
-    } while ((--n > 0) && status);
+    } while ((--n > 0) && status == TRUE);
 
     /* Save away the match, or complain
      * if not there.
      */
     if (status == TRUE)
         savematch();
-    else
+    else if (status == FALSE)
         mlwrite("Not found");
 
     return status;
 }
 
+/*
+ * Append the bytes mceq() accepts for mt as a PCRE2 byte class.  A closure
+ * never matches a newline; anything else that could is left to amatch().
+ */
+static bool prefilter_class(char *buf, size_t size, size_t *pos, struct magic *mt)
+{
+    bool set[256];
+    int n = 0;
+
+    for (int c = 0; c < 256; c++) {
+        set[c] = mceq(c, mt) && !(c == '\n' && (mt->mc_type & CLOSURE));
+        n += set[c];
+    }
+    if (n == 0 || set['\n'])
+        return false;
+
+    *pos += (size_t)snprintf(buf + *pos, size - *pos, "[");
+    for (int c = 0; c < 256 && *pos < size; c++) {
+        int end = c;
+
+        if (!set[c])
+            continue;
+        while (end < 255 && set[end + 1])
+            end++;
+        if (end == c)
+            *pos += (size_t)snprintf(buf + *pos, size - *pos, "\\x%02x", c);
+        else
+            *pos += (size_t)snprintf(buf + *pos, size - *pos, "\\x%02x-\\x%02x", c, end);
+        c = end;
+    }
+    if (*pos < size)
+        *pos += (size_t)snprintf(buf + *pos, size - *pos, "]%s", (mt->mc_type & CLOSURE) ? "*" : "");
+    return *pos < size;
+}
+
+/*
+ * The magic pattern as a byte-mode PCRE2 pattern, or NULL when it cannot
+ * be expressed within a line.  It matches on every line where amatch()
+ * could succeed, so lines it rejects need not be scanned.
+ */
+static struct rx *magic_prefilter(void)
+{
+    static char buf[8192];
+    char err[160];
+    size_t pos = 0;
+
+    for (struct magic *mt = &mcpat[0]; mt->mc_type != MCNIL; mt++) {
+        if (mt->mc_type == BOL || mt->mc_type == EOL) {
+            if (pos + 1 >= sizeof(buf))
+                return NULL;
+            buf[pos++] = mt->mc_type == BOL ? '^' : '$';
+        } else if (!prefilter_class(buf, sizeof(buf), &pos, mt)) {
+            return NULL;
+        }
+    }
+    buf[pos] = '\0';
+    return rx_get(buf, 0, err, sizeof(err));
+}
+
+/*
+ * Could a match be found on lp from curoff on?  Forward that is a match
+ * starting at or after curoff, in reverse one ending at or before it.
+ */
+static bool line_may_match(struct rx *rx, struct line *lp, int curoff, int direct)
+{
+    const char *text = llength(lp) ? (const char *)ltext(lp) : "";
+
+    if (direct == FORWARD)
+        return rx_match(rx, text, (size_t)llength(lp), (size_t)curoff) >= 0;
+    return rx_match(rx, text, (size_t)curoff, 0) >= 0;
+}
+
 /*
  * mcscanner -- Search for a meta-pattern in either direction.  If found,
  *  reset the "." to be at the start or just after the match string,
@@ -386,6 +469,8 @@ int mcscanner(struct magic *mcpatrn, int direct, int beg_or_end)
 {
     struct line *curline;           /* current line during scan */
     int curoff;             /* position within current line */
+    struct rx *rx;          /* line prefilter, or NULL */
+    struct line *checked = NULL;    /* line the prefilter passed */
 
     /* If we are going in reverse, then the 'end' is actually
      * the beginning of the pattern.  Toggle it.
@@ -404,10 +489,31 @@ int mcscanner(struct magic *mcpatrn, int direct, int beg_or_end)
      */
     curline = curwp->w_dotp;
     curoff = curwp->w_doto;
+    rx = magic_prefilter();
 
     /* Scan each character until we hit the head link record.
      */
     while (!boundry(curline, curoff, direct)) {
+        /* Skip lines the compiled pattern finds nothing on.
+         */
+        if (rx != NULL && curline != checked) {
+            if (!line_may_match(rx, curline, curoff, direct)) {
+                if (direct == FORWARD) {
+                    if (lforw(curline) == curbp->b_linep)
+                        break;
+                    curline = lforw(curline);
+                    curoff = 0;
+                } else {
+                    if (lback(curline) == curbp->b_linep)
+                        break;
+                    curline = lback(curline);
+                    curoff = llength(curline);
+                }
+                continue;
+            }
+            checked = curline;
+        }
+
         /* Save the current position in case we need to
          * restore it on a match, and initialize matchlen to
          * zero in case we are doing a search for replacement.
@@ -619,7 +725,17 @@ static int amatch(struct magic *mcptr, int direct, struct line **pcwline, int *p
 /*
  * scanner -- Search for a pattern in either direction.  If found,
  *  reset the "." to be at the start or just after the match string,
- *  and (perhaps) repaint the display.
+ *  and (perhaps) repaint the display.  The pattern is literal; for
+ *  REVERSE it is given reversed (tap), like the magic pattern.
+ *
+ *  The search itself is done a line at a time by lsearch_buffer(), with
+ *  the compiled pattern kept for the next call, since the hunt commands
+ *  and the search engine search for the same string over and over; a
+ *  reverse search reads whole chunks right to left.  A search through a
+ *  large buffer runs on several threads (psearch_forward(),
+ *  psearch_reverse()) and returns ABORT when a key stops it.  Once the
+ *  matches of the pattern are counted (match_index.c), the index says
+ *  which line holds the next one and nothing else is searched.
  *
  * unsigned char *patrn;    string to scan for
  * int direct;          which way to go.
@@ -627,73 +743,64 @@ static int amatch(struct magic *mcptr, int direct, struct line **pcwline, int *p
  */
 int scanner(const char *patrn, int direct, int beg_or_end)
 {
-    int c;                  /* character at current position */
-    const char *patptr;         /* pointer into pattern */
-    struct line *curline;           /* current line during scan */
-    int curoff;             /* position within current line */
-    struct line *scanline;          /* current line during scanning */
-    int scanoff;                /* position in scanned line */
-
-    /* If we are going in reverse, then the 'end' is actually
-     * the beginning of the pattern.  Toggle it.
-     */
-    beg_or_end ^= direct;
-
-    /* Set up local pointers to global ".".
-     */
-    curline = curwp->w_dotp;
-    curoff = curwp->w_doto;
-
-    /* Scan each character until we hit the head link record.
-     */
-    while (!boundry(curline, curoff, direct)) {
-        /* Save the current position in case we match
-         * the search string at this point.
-         */
-        matchline = curline;
-        matchoff = curoff;
-
-        /* Get the character resolving newlines, and
-         * test it against first char in pattern.
-         */
-        c = nextch(&curline, &curoff, direct);
-
-        if (eq(c, patrn[0])) {      /* if we find it.. */
-            /* Setup scanning pointers.
-             */
-            scanline = curline;
-            scanoff = curoff;
-            patptr = &patrn[0];
-
-            /* Scan through the pattern for a match.
-             */
-            while (*++patptr != '\0') {
-                c = nextch(&scanline, &scanoff, direct);
-
-                if (!eq(c, *patptr))
-                    goto fail;
-            }
+    static struct lsearch ls;
+    static char compiled[NPAT];         /* pattern ls was compiled from */
+    char fwd[NPAT];                     /* patrn the right way round */
+    const char *p = patrn;
+    bool fold = (curwp->w_bufp->b_mode & MDEXACT) == 0;
+    struct lsearch_match m;
+    int status;
 
-            /* A SUCCESSFULL MATCH!!!
-             * reset the global "." pointers
-             */
-            if (beg_or_end == PTEND) {  /* at end of string */
-                curwp->w_dotp = scanline;
-                curwp->w_doto = scanoff;
-            } else {        /* at beginning of string */
+    search_hits_show(true);
+    if (direct == REVERSE) {
+        int len = (int)strnlen(patrn, NPAT - 1);
 
-                curwp->w_dotp = matchline;
-                curwp->w_doto = matchoff;
-            }
+        for (int i = 0; i < len; i++)
+            fwd[i] = patrn[len - 1 - i];
+        fwd[len] = '\0';
+        p = fwd;
+    }
+    if (ls.len == 0 || ls.fold != fold || strcmp(compiled, p) != 0) {
+        lsearch_compile(&ls, p, (int)strnlen(p, NPAT - 1), fold);
+        memcpy(compiled, p, (size_t)ls.len);
+        compiled[ls.len] = '\0';
+    }
 
-            curwp->w_flag |= WFMOVE;    /* Flag that we have moved. */
-            return TRUE;
+    if (match_index_ready(curwp->w_bufp, &ls))
+        status = match_index_find(&ls, curwp->w_bufp, curwp->w_dotp, curwp->w_doto, direct, &m);
+    else if (ls.nl_first < 0 && psearch_worthwhile(curwp->w_bufp, curwp->w_dotp, direct))
+        status = direct == FORWARD
+            ? psearch_forward(&ls, curwp->w_bufp, curwp->w_dotp, curwp->w_doto, &m)
+            : psearch_reverse(&ls, curwp->w_bufp, curwp->w_dotp, curwp->w_doto, &m);
+    else
+        status = lsearch_buffer(&ls, curwp->w_bufp, curwp->w_dotp, curwp->w_doto, direct, &m);
+    if (status != TRUE)
+        return status;          /* We could not find a match, or were stopped */
 
-        }
- fail:      ;               /* continue to search */
+    /* A SUCCESSFULL MATCH!!!
+     * reset the global "." pointers
+     */
+    matchline = m.start_lp;
+    matchoff = m.start_off;
+    if (beg_or_end == PTEND) {  /* at end of string */
+        curwp->w_dotp = m.end_lp;
+        curwp->w_doto = m.end_off;
+    } else {                    /* at beginning of string */
+        curwp->w_dotp = m.start_lp;
+        curwp->w_doto = m.start_off;
     }
 
-    return FALSE;               /* We could not find a match */
+    curwp->w_flag |= WFMOVE;    /* Flag that we have moved. */
+    return TRUE;
+}
+
+/*
+ * magic_search -- Does a search of bp for pat go through mcscanner()
+ *  rather than scanner()?
+ */
+int magic_search(struct buffer *bp)
+{
+    return (magical && bp->b_mode & MDMAGIC) != 0;
 }
 
 /*
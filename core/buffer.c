@@ -20,6 +20,10 @@
 #include "edef.h"
 #include "efunc.h"
 #include "line.h"
+#include "hl_worker.h"
+#include "hl_checkpoint.h"
+#include "match_index.h"
+#include "ws_grep.h"
 
 /*
  * Attach a buffer to a window. The
@@ -153,9 +157,13 @@ int zotbuf(struct buffer *bp)
         return FALSE;
     }
     strcpy(closed_fname, bp->b_fname);
+    hl_worker_forget(bp);
+    match_index_forget(bp);
+    ws_grep_forget(bp);
     if ((s = bclear(bp)) != TRUE)       /* Blow text away.      */
         return s;
     free(bp->b_linep);      /* Release header line. */
+    free(bp->b_hl_profile_key);
     bp1 = NULL;             /* Find the header.     */
     bp2 = bheadp;
     while (bp2 != bp) {
@@ -182,6 +190,7 @@ void bfreeall(void)
             struct line *lp = hlp->next;
             while (lp != hlp) {
                 struct line *nlp = lp->next;
+                lhl_free(lp);
                 free(lp);
                 lp = nlp;
             }
@@ -341,7 +350,13 @@ struct buffer *bfind(char *bname, int cflag, int bflag)
         bp->b_nwnd = 0;
         bp->b_linep = lp;
         bp->b_tabsize = tabsize;
-        bp->b_hl_dirty_line = NULL;
+        bp->b_hl_ndirty = 0;
+        bp->b_hl_full = FALSE;
+        bp->b_hl_epoch = 0;
+        bp->b_hl_sparse = FALSE;
+        bp->b_hl_profile = NULL;
+        bp->b_hl_profile_key = NULL;
+        bp->b_hl_profile_gen = 0;
         strcpy(bp->b_fname, "");
         strcpy(bp->b_bname, bname);
         lp->next = lp;
@@ -400,8 +415,11 @@ int bclear(struct buffer *bp)
         && (s = mlyesno("Discard changes")) != TRUE)
         return s;
     bp->b_flag &= ~BFCHG;           /* Not changed          */
+    match_index_forget(bp);
     while ((lp = lforw(bp->b_linep)) != bp->b_linep)
         lfree(lp);
+    hl_checkpoint_setup(bp, 0);
+    highlight_buffer_forget(bp);
     bp->b_dotp = bp->b_linep;       /* Fix "."              */
     bp->b_doto = 0;
     bp->b_markp = NULL;         /* Invalidate "mark"    */
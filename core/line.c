@@ -24,6 +24,9 @@
 #include "efunc.h"
 #include "utf8.h"
 #include "nanox.h"
+#include "hl_checkpoint.h"
+#include "match_index.h"
+#include "search_hits.h"
 
 extern struct kill *kbufp;
 
@@ -58,12 +61,56 @@ struct line *lalloc(int used)
     lp->l_offset = 0;
     lp->size = size;
     lp->used = used;
-    lp->hl_start_state = (HighlightState){0};
-    lp->hl_end_state = (HighlightState){0};
+    lp->l_hl = NULL;
     lp->l_diag = 0;
     return lp;
 }
 
+const HighlightState hl_zero_state;
+
+/* lp's states, allocated on first use unless state is the zero state */
+static struct line_hl *lhl_get(struct line *lp, const HighlightState *state)
+{
+    if (lp->l_hl == NULL && memcmp(state, &hl_zero_state, sizeof(HighlightState)) != 0)
+        lp->l_hl = calloc(1, sizeof(struct line_hl));
+    return lp->l_hl;
+}
+
+/* Free lp's states once both are back to the zero state. */
+static void lhl_trim(struct line *lp)
+{
+    if (memcmp(&lp->l_hl->start, &hl_zero_state, sizeof(HighlightState)) == 0 &&
+        memcmp(&lp->l_hl->end, &hl_zero_state, sizeof(HighlightState)) == 0)
+        lhl_free(lp);
+}
+
+/* Store a highlight state; returns true if it differs from the old one. */
+bool lhl_set_start(struct line *lp, const HighlightState *state)
+{
+    struct line_hl *hl = lhl_get(lp, state);
+    if (hl == NULL || memcmp(&hl->start, state, sizeof(HighlightState)) == 0)
+        return false;
+    hl->start = *state;
+    lhl_trim(lp);
+    return true;
+}
+
+bool lhl_set_end(struct line *lp, const HighlightState *state)
+{
+    struct line_hl *hl = lhl_get(lp, state);
+    if (hl == NULL || memcmp(&hl->end, state, sizeof(HighlightState)) == 0)
+        return false;
+    hl->end = *state;
+    lhl_trim(lp);
+    return true;
+}
+
+void lhl_free(struct line *lp)
+{
+    free(lp->l_hl);
+    lp->l_hl = NULL;
+}
+
 int l_unshare(struct line *lp) {
     if (lp->l_offset == 0 && my_handle_ref_count(lp->l_handle) == 1)
         return TRUE;
@@ -103,13 +150,11 @@ void lfree(struct line *lp)
         wp->w_marko = 0;
     }
 
+    match_index_replace(curbp, lp, lp->next);
+    search_hits_touch(lp);
     bp = bheadp;
     while (bp != NULL) {
-        if (bp->b_hl_dirty_line == lp) {
-            bp->b_hl_dirty_line = lp->next;
-            if (bp->b_hl_dirty_line == bp->b_linep)
-                bp->b_hl_dirty_line = NULL;
-        }
+        hl_dirty_replace(bp, lp, lp->next);
         if (bp->b_nwnd == 0) {
             if (bp->b_dotp == lp) {
                 bp->b_dotp = lp->next;
@@ -126,9 +171,77 @@ void lfree(struct line *lp)
     lp->next->prev = lp->prev;
     if (lp->l_handle != NULL)
         my_handle_free(lp->l_handle);
+    lhl_free(lp);
     free(lp);
 }
 
+/*
+ * Dirty highlight intervals.
+ *
+ * Each entry in b_hl_dirty is the first line of a region whose highlight
+ * states must be recomputed; the region extends until the computed states
+ * agree with the stored ones again.  Entries are unordered.  When a
+ * propagation pass walks over another entry it consumes it, so nearby edits
+ * merge naturally.  If the set overflows, the buffer falls back to a full
+ * pass from the first line (b_hl_full) that does not stop early.
+ */
+bool hl_dirty_contains(struct buffer *bp, struct line *lp)
+{
+    for (int i = 0; i < bp->b_hl_ndirty; i++) {
+        if (bp->b_hl_dirty[i] == lp)
+            return true;
+    }
+    return false;
+}
+
+void hl_dirty_remove(struct buffer *bp, struct line *lp)
+{
+    for (int i = 0; i < bp->b_hl_ndirty; i++) {
+        if (bp->b_hl_dirty[i] == lp) {
+            bp->b_hl_dirty[i] = bp->b_hl_dirty[--bp->b_hl_ndirty];
+            if (bp->b_hl_ndirty == 0)
+                bp->b_hl_full = FALSE;
+            return;
+        }
+    }
+}
+
+void hl_dirty_add(struct buffer *bp, struct line *lp)
+{
+    if (lp == NULL || lp == bp->b_linep || hl_dirty_contains(bp, lp))
+        return;
+    if (bp->b_hl_full)
+        return;     /* a full pass is already pending and covers lp */
+    if (bp->b_hl_ndirty == HL_DIRTY_MAX) {
+        bp->b_hl_dirty[0] = lforw(bp->b_linep);
+        bp->b_hl_ndirty = 1;
+        bp->b_hl_full = TRUE;
+        return;
+    }
+    bp->b_hl_dirty[bp->b_hl_ndirty++] = lp;
+}
+
+/* Move the interval starting at lp so that it starts at repl instead (lp is
+ * going away, or propagation has advanced past it).  NULL drops it. */
+void hl_dirty_replace(struct buffer *bp, struct line *lp, struct line *repl)
+{
+    for (int i = 0; i < bp->b_hl_ndirty; i++) {
+        if (bp->b_hl_dirty[i] != lp)
+            continue;
+        if (repl == NULL || repl == bp->b_linep || hl_dirty_contains(bp, repl))
+            hl_dirty_remove(bp, lp);
+        else
+            bp->b_hl_dirty[i] = repl;
+        return;
+    }
+}
+
+void hl_dirty_clear(struct buffer *bp)
+{
+    bp->b_hl_ndirty = 0;
+    bp->b_hl_full = FALSE;
+}
+
 /*
  * This routine gets called when a character is changed in place in the current
  * buffer. It updates all of the required flags in the buffer and window
@@ -139,36 +252,12 @@ void lfree(struct line *lp)
 void lmark_dirty(struct line *lp)
 {
     if (lp == NULL || lp == curbp->b_linep) return;
-    if (curbp->b_hl_dirty_line == NULL) {
-        curbp->b_hl_dirty_line = lp;
+    curbp->b_hl_epoch++;
+    if (curbp->b_hl_sparse) {
+        hl_checkpoint_edit(curbp, lp, curbp->b_hl_epoch - 1);
         return;
     }
-    if (curbp->b_hl_dirty_line == lp) return;
-
-    /* Scan forward and backward to see which is first */
-    struct line *fw = lp;
-    struct line *bw = lp;
-    const int MAX_SCAN = 500;
-
-    for (int i = 0; i < MAX_SCAN; i++) {
-        fw = lforw(fw);
-        if (fw == curbp->b_hl_dirty_line) {
-            curbp->b_hl_dirty_line = lp;
-            return;
-        }
-        if (fw == curbp->b_linep) break;
-    }
-    for (int i = 0; i < MAX_SCAN; i++) {
-        bw = lback(bw);
-        if (bw == curbp->b_hl_dirty_line) {
-            /* curbp->b_hl_dirty_line is already before lp */
-            return;
-        }
-        if (bw == curbp->b_linep) break;
-    }
-    
-    /* If still not found (jumped > 500 lines), be safe and set to beginning */
-    curbp->b_hl_dirty_line = lforw(curbp->b_linep);
+    hl_dirty_add(curbp, lp);
 }
 
 void lchange(int flag)
@@ -185,7 +274,42 @@ void lchange(int flag)
     if (wp->w_bufp == curbp) {
         wp->w_flag |= flag;
         lmark_dirty(wp->w_dotp);
+        match_index_touch(curbp, wp->w_dotp);
+        search_hits_touch(wp->w_dotp);
+    }
+}
+
+/*
+ * lchange(WFHARD) for an edit that may have changed any line from lp to the
+ * end of the buffer, such as a bulk replace that relinked many lines at
+ * once.  Highlighting is invalidated once: a single full pass from lp, or
+ * from the first line if other dirty intervals were pending (they may point
+ * at lines that are gone).
+ */
+void lchange_rest(struct line *lp)
+{
+    if ((curbp->b_flag & BFCHG) == 0) {
+        curwp->w_flag |= WFMODE;
+        curbp->b_flag |= BFCHG;
+    }
+    if (curwp->w_bufp == curbp)
+        curwp->w_flag |= WFHARD;
+    curbp->b_version++;
+    match_index_forget(curbp);
+    search_hits_forget();
+    if (lp == NULL || lp == curbp->b_linep)
+        return;
+
+    curbp->b_hl_epoch++;
+    if (curbp->b_hl_sparse) {
+        hl_checkpoint_edit(curbp, lp, curbp->b_hl_epoch - 1);
+        return;
     }
+    if (curbp->b_hl_ndirty > 0)
+        lp = lforw(curbp->b_linep);
+    curbp->b_hl_dirty[0] = lp;
+    curbp->b_hl_ndirty = 1;
+    curbp->b_hl_full = TRUE;
 }
 
 /*
@@ -738,6 +862,8 @@ int ldelnewline(void)
         cp2 = &ltext(lp2)[0];
         while (cp2 != &ltext(lp2)[lp2->used])
             *cp1++ = *cp2++;
+        match_index_replace(curbp, lp2, lp1);
+        search_hits_touch(lp2);
         wp = curwp;
         if (wp->w_linep == lp2)
             wp->w_linep = lp1;
@@ -752,9 +878,9 @@ int ldelnewline(void)
         lp1->used += lp2->used;
         lp1->next = lp2->next;
         lp2->next->prev = lp1;
-        if (curbp->b_hl_dirty_line == lp2)
-            curbp->b_hl_dirty_line = lp1;
+        hl_dirty_replace(curbp, lp2, lp1);
         if (lp2->l_handle) my_handle_free(lp2->l_handle);
+        lhl_free(lp2);
         free(lp2);
         return TRUE;
     }
@@ -767,6 +893,10 @@ int ldelnewline(void)
     cp1 = &ltext(lp2)[0];
     while (cp1 != &ltext(lp2)[lp2->used])
         *cp2++ = *cp1++;
+    match_index_replace(curbp, lp2, lp3);
+    match_index_replace(curbp, lp1, lp3);
+    search_hits_touch(lp1);
+    search_hits_touch(lp2);
     lp1->prev->next = lp3;
     lp3->next = lp2->next;
     lp2->next->prev = lp3;
@@ -786,11 +916,13 @@ int ldelnewline(void)
         wp->w_markp = lp3;
         wp->w_marko += lp1->used;
     }
-    if (curbp->b_hl_dirty_line == lp1 || curbp->b_hl_dirty_line == lp2)
-        curbp->b_hl_dirty_line = lp3;
+    hl_dirty_replace(curbp, lp1, lp3);
+    hl_dirty_replace(curbp, lp2, lp3);
     if (lp1->l_handle) my_handle_free(lp1->l_handle);
+    lhl_free(lp1);
     free(lp1);
     if (lp2->l_handle) my_handle_free(lp2->l_handle);
+    lhl_free(lp2);
     free(lp2);
     return TRUE;
 }
@@ -7,6 +7,8 @@
 #include "highlight.h"
 #include "../utils/mymemory.h"
 
+struct buffer;
+
 /*
  * All text is kept in circularly linked lists of "struct line" structures. These
  * begin at the header line (which is the blank line beyond the end of the
@@ -15,12 +17,23 @@
  * and the text. The end of line is not stored as a byte; it's implied. Future
  * additions will include update hints, and a list of marks into the line.
  */
+/*
+ * Highlight states of a line.  They live outside struct line and are only
+ * allocated once a state other than the zero state is stored, so lines that
+ * were never highlighted cost nothing.  Buffers in checkpoint mode (see
+ * hl_checkpoint.h) keep them on one line in HL_CHECKPOINT_LINES only.
+ */
+struct line_hl {
+    HighlightState start;
+    HighlightState end;
+    unsigned epoch;                       /* checkpoint mode: b_hl_epoch start is valid for */
+};
+
 struct line {
     _Atomic(struct line *) next;          /* 8 bytes */
     _Atomic(struct line *) prev;          /* 8 bytes */
     MemoryHandle l_handle;                /* 8 bytes */
-    HighlightState hl_start_state;        /* 112 bytes */
-    HighlightState hl_end_state;          /* 112 bytes */
+    struct line_hl *l_hl;                 /* 8 bytes, NULL = zero states */
     _Atomic int size;                     /* 4 bytes */
     _Atomic int used;                     /* 4 bytes */
     uint32_t l_offset;                    /* 4 bytes */
@@ -36,9 +49,31 @@ struct line {
 #define lputc(lp, n, c) (ltext(lp)[(n)]=(c))
 #define llength(lp)     ((lp)->used)
 
+extern const HighlightState hl_zero_state;
+
+static inline const HighlightState *lhl_start(const struct line *lp)
+{
+    return lp->l_hl ? &lp->l_hl->start : &hl_zero_state;
+}
+
+static inline const HighlightState *lhl_end(const struct line *lp)
+{
+    return lp->l_hl ? &lp->l_hl->end : &hl_zero_state;
+}
+
+extern bool lhl_set_start(struct line *lp, const HighlightState *state);
+extern bool lhl_set_end(struct line *lp, const HighlightState *state);
+extern void lhl_free(struct line *lp);
+
 extern void lfree(struct line *lp);
 extern void lmark_dirty(struct line *lp);
+extern bool hl_dirty_contains(struct buffer *bp, struct line *lp);
+extern void hl_dirty_add(struct buffer *bp, struct line *lp);
+extern void hl_dirty_remove(struct buffer *bp, struct line *lp);
+extern void hl_dirty_replace(struct buffer *bp, struct line *lp, struct line *repl);
+extern void hl_dirty_clear(struct buffer *bp);
 extern void lchange(int flag);
+extern void lchange_rest(struct line *lp);
 extern int l_unshare(struct line *lp);
 extern int insspace(int f, int n);
 extern int linstr(char *instr);
@@ -76,6 +76,10 @@
 #include "lsp_client.h"
 #include "scraper.h"
 #include "command_mode.h"           /* F1 command mode */
+#include "perf.h"
+#include "hl_worker.h"
+#include "match_index.h"
+#include "ws_grep.h"
 
 #include <signal.h>
 static void emergencyexit(int);
@@ -375,6 +379,7 @@ int main(int argc, char **argv)
 
             if (typahead()) {
                 while ((newc = getcmd()) == 0);
+                perf_end(PERF_GETCMD, perf_key_start());
                 nanox_refresh_ui();
                 do {
                     fn_t execfunc;
@@ -387,13 +392,20 @@ int main(int argc, char **argv)
                 } while (typahead());
                 c = newc;
             } else {
-                while (!typahead() && buffer_needs_hl_update(curbp)) {
-                    highlight_incremental_step(curbp);
-                    /* Optional: refresh UI every few steps to show progress */
-                    /* But for now, let's just do it and then refresh once at the end */
-                }
-                nanox_refresh_ui();
+                /* Propagation runs on the highlight worker; wake up every
+                 * few ms to publish results and to notice typeahead.  A
+                 * redraw can start more work (e.g. the dynamic keyword
+                 * sample of a new buffer), so go on until nothing is left.
+                 * The search matches are counted in between, a slice at a
+                 * time, and a running grep hands over its results. */
+                do {
+                    while (!typahead() && hl_worker_pump(curbp, 5))
+                        ;
+                    nanox_refresh_ui();
+                } while (!typahead() && (hl_worker_pump(curbp, 0) || match_index_pump(curbp)
+                                              || ws_grep_pump(20)));
                 while ((c = getcmd()) == 0);
+                perf_end(PERF_GETCMD, perf_key_start());
             }    /* if there is something on the command line, clear it */
     if (mpresf != FALSE) {
         mlerase();
@@ -504,7 +516,9 @@ int main(int argc, char **argv)
     }
 
     int was_completion_active = completion_dropdown_is_active();
+    uint64_t t_exec = perf_begin();
     execute(c, f, n);
+    perf_end(PERF_EXECUTE, t_exec);
     if (was_completion_active) {
         completion_post_execute();
     }
@@ -916,15 +916,40 @@ const char *nanox_startup_file_at(size_t index)
     return startup_slot_queue[index];
 }
 
+/* path resolved into canon (PATH_MAX bytes), or empty if it does not resolve */
+static void canonical_path(const char *path, char *canon)
+{
+    if (!realpath(path, canon))
+        canon[0] = '\0';
+}
+
+/*
+ * Does slot hold the file at path?  Slots keep paths as given (relative
+ * from the command line, absolute from a grep hit), so they are compared
+ * resolved; canon is path resolved, or empty if it does not resolve.
+ */
+static bool slot_holds(int slot, const char *path, const char *canon)
+{
+    char real[PATH_MAX];
+
+    if (!file_reserve[slot][0])
+        return false;
+    if (strcmp(file_reserve[slot], path) == 0)
+        return true;
+    return canon[0] && realpath(file_reserve[slot], real) && strcmp(real, canon) == 0;
+}
+
 void nanox_handle_closed_file(const char *path)
 {
     int max_slots = nanox_slot_capacity();
+    char canon[PATH_MAX];
 
     if (!path || !*path)
         return;
 
+    canonical_path(path, canon);
     for (int i = 0; i < max_slots; ++i) {
-        if (strcmp(file_reserve[i], path) != 0)
+        if (!slot_holds(i, path, canon))
             continue;
         file_reserve[i][0] = '\0';
         if (startup_slot_queue_next < startup_slot_queue_count) {
@@ -980,6 +1005,33 @@ static int reserve_jump(int slot)
     return rc;
 }
 
+/* Open path through the slots: the one holding it, else the first free one. */
+int nanox_slot_open(const char *path)
+{
+    int max_slots = nanox_slot_capacity();
+    int free_slot = -1;
+    char fname[PATH_MAX];
+    char canon[PATH_MAX];
+    int rc;
+
+    canonical_path(path, canon);
+    for (int i = 0; i < max_slots; ++i) {
+        if (slot_holds(i, path, canon))
+            return reserve_jump(i);
+        if (free_slot < 0 && !file_reserve[i][0])
+            free_slot = i;
+    }
+    if (free_slot < 0) {
+        mystrscpy(fname, path, sizeof(fname));
+        return getfile(fname, TRUE);
+    }
+    mystrscpy(file_reserve[free_slot], path, sizeof(file_reserve[free_slot]));
+    rc = reserve_jump(free_slot);
+    if (rc != TRUE)
+        file_reserve[free_slot][0] = '\0';
+    return rc;
+}
+
 int nanox_open_startup_slot(void)
 {
     seed_startup_slots();
@@ -1144,6 +1196,11 @@ static void detect_workspace_root(char *root_out, size_t sz)
     mystrscpy(file_tree_workspace_root, workspace, sizeof(file_tree_workspace_root));
 }
 
+void nanox_workspace_root(char *root_out, size_t sz)
+{
+    detect_workspace_root(root_out, sz);
+}
+
 static void file_tree_add_node(const char *name, const char *path, bool is_dir, int depth, FileNode *parent, int insert_pos)
 {
     if (file_tree_node_count >= MAX_TREE_NODES)
@@ -1306,14 +1363,8 @@ void file_tree_draw(void)
 
     for (int r = 0; r < visible_rows && r < term->t_nrow; r++) {
         struct video *vp = vscreen[r];
-        for (int c = 0; c < file_tree_width; c++) {
-            vp->v_text[c].ch = ' ';
-            vp->v_text[c].fg = normal.fg;
-            vp->v_text[c].bg = normal.bg;
-            vp->v_text[c].bold = false;
-            vp->v_text[c].underline = false;
-            vp->v_text[c].italic = false;
-        }
+        for (int c = 0; c < file_tree_width; c++)
+            vcell_set(&vp->v_text[c], ' ', normal.fg, normal.bg, false, false, false);
 
         int idx = file_tree_scroll + r;
         if (idx < count) {
@@ -1322,7 +1373,7 @@ void file_tree_draw(void)
             int col = 0;
 
             while (col < indent && col < file_tree_width - 2) {
-                vp->v_text[col].ch = ' ';
+                vcell_set(&vp->v_text[col], ' ', normal.fg, normal.bg, false, false, false);
                 col++;
             }
 
@@ -1338,12 +1389,8 @@ void file_tree_draw(void)
                 unicode_t uc;
                 int bytes = utf8_to_unicode((const unsigned char *)indicator, i, strlen(indicator), &uc);
                 if (bytes <= 0) break;
-                vp->v_text[col].ch = uc;
-                if (node->is_dir) {
-                    vp->v_text[col].fg = keyword.fg;
-                } else {
-                    vp->v_text[col].fg = comment.fg;
-                }
+                vcell_set(&vp->v_text[col], uc, node->is_dir ? keyword.fg : comment.fg,
+                          normal.bg, false, false, false);
                 col++;
                 i += bytes;
             }
@@ -1355,8 +1402,8 @@ void file_tree_draw(void)
                     unicode_t uc;
                     int bytes = utf8_to_unicode((const unsigned char *)ficon, fi, strlen(ficon), &uc);
                     if (bytes <= 0) break;
-                    vp->v_text[col].ch = uc;
-                    vp->v_text[col].fg = node->is_dir ? keyword.fg : comment.fg;
+                    vcell_set(&vp->v_text[col], uc, node->is_dir ? keyword.fg : comment.fg,
+                              normal.bg, false, false, false);
                     col++;
                     fi += bytes;
                 }
@@ -1368,22 +1415,19 @@ void file_tree_draw(void)
                 unicode_t uc;
                 int bytes = utf8_to_unicode((const unsigned char *)node->name, i, name_len, &uc);
                 if (bytes <= 0) break;
-                vp->v_text[col].ch = uc;
-                if (idx == file_tree_selected) {
-                    vp->v_text[col].bg = keyword.bg != -1 ? keyword.bg : normal.fg;
-                    vp->v_text[col].fg = keyword.bg != -1 ? keyword.fg : normal.bg;
-                    vp->v_text[col].bold = true;
-                } else {
-                    vp->v_text[col].fg = node->is_dir ? keyword.fg : normal.fg;
-                }
+                if (idx == file_tree_selected)
+                    vcell_set(&vp->v_text[col], uc, keyword.bg != -1 ? keyword.fg : normal.bg,
+                              keyword.bg != -1 ? keyword.bg : normal.fg, true, false, false);
+                else
+                    vcell_set(&vp->v_text[col], uc, node->is_dir ? keyword.fg : normal.fg,
+                              normal.bg, false, false, false);
                 col++;
                 i += bytes;
             }
         }
 
-        vp->v_text[file_tree_width - 1].ch = '|';
-        vp->v_text[file_tree_width - 1].fg = comment.fg;
-        vp->v_text[file_tree_width - 1].bg = normal.bg;
+        vcell_set(&vp->v_text[file_tree_width - 1], '|', comment.fg, normal.bg,
+                  false, false, false);
         vp->v_flag |= VFCHG;
     }
 }
@@ -1633,14 +1677,8 @@ void draw_interactive_help(void)
         struct video *vp = vscreen[r];
         if (!vp)
             return;
-        for (int c = 0; c < term->t_ncol; c++) {
-            vp->v_text[c].ch = ' ';
-            vp->v_text[c].fg = normal.fg;
-            vp->v_text[c].bg = normal.bg;
-            vp->v_text[c].bold = false;
-            vp->v_text[c].underline = false;
-            vp->v_text[c].italic = false;
-        }
+        for (int c = 0; c < term->t_ncol; c++)
+            vcell_set(&vp->v_text[c], ' ', normal.fg, normal.bg, false, false, false);
         vp->v_flag |= VFCHG;
     }
 
@@ -1650,9 +1688,8 @@ void draw_interactive_help(void)
     const char *header = " [ Nanox Interactive Help System ]";
     int col = 0;
     while (header[col] && col < term->t_ncol) {
-        hdr->v_text[col].ch = header[col];
-        hdr->v_text[col].bold = true;
-        hdr->v_text[col].fg = keyword.fg;
+        vcell_set(&hdr->v_text[col], (unsigned char)header[col], keyword.fg, normal.bg,
+                  true, false, false);
         col++;
     }
 
@@ -1667,8 +1704,8 @@ void draw_interactive_help(void)
     for (int r = 2; r < max_r && r < term->t_nrow; r++) {
         if (!vscreen[r])
             return;
-        vscreen[r]->v_text[separator_col].ch = 0x2502;
-        vscreen[r]->v_text[separator_col].fg = comment.fg;
+        vcell_set(&vscreen[r]->v_text[separator_col], 0x2502, comment.fg, normal.bg,
+                  false, false, false);
     }
 
     for (int i = 0; i < HELP_CAT_COUNT; i++) {
@@ -1680,14 +1717,13 @@ void draw_interactive_help(void)
         const char *name = help_categories[i].name;
         int c = 2;
         while (name[c - 2] && c < separator_col - 1) {
-            vp->v_text[c].ch = name[c - 2];
-            if (i == help_selected_cat) {
-                vp->v_text[c].bg = keyword.bg != -1 ? keyword.bg : normal.fg;
-                vp->v_text[c].fg = keyword.bg != -1 ? keyword.fg : normal.bg;
-                vp->v_text[c].bold = true;
-            } else {
-                vp->v_text[c].fg = normal.fg;
-            }
+            if (i == help_selected_cat)
+                vcell_set(&vp->v_text[c], (unsigned char)name[c - 2],
+                          keyword.bg != -1 ? keyword.fg : normal.bg,
+                          keyword.bg != -1 ? keyword.bg : normal.fg, true, false, false);
+            else
+                vcell_set(&vp->v_text[c], (unsigned char)name[c - 2], normal.fg, normal.bg,
+                          false, false, false);
             c++;
         }
     }
@@ -1711,9 +1747,8 @@ void draw_interactive_help(void)
                 uc = (unsigned char)line[idx];
                 bytes = 1;
             }
-            vp->v_text[c].ch = uc;
-            vp->v_text[c].fg = (l == 0) ? keyword.fg : normal.fg;
-            vp->v_text[c].bold = (l == 0);
+            vcell_set(&vp->v_text[c], uc, (l == 0) ? keyword.fg : normal.fg, normal.bg,
+                      l == 0, false, false);
             c++;
             idx += bytes;
         }
@@ -1722,16 +1757,13 @@ void draw_interactive_help(void)
     struct video *ftr = vscreen[max_r];
     if (!ftr)
         return;
-    for (int c = 0; c < term->t_ncol; c++) {
-        ftr->v_text[c].ch = '-';
-        ftr->v_text[c].fg = comment.fg;
-    }
+    for (int c = 0; c < term->t_ncol; c++)
+        vcell_set(&ftr->v_text[c], '-', comment.fg, normal.bg, false, false, false);
     const char *footer = " [ Up/Down: Navigate | Esc/F1: Exit Help ]";
     col = 2;
     while (footer[col - 2] && col < term->t_ncol - 2) {
-        ftr->v_text[col].ch = footer[col - 2];
-        ftr->v_text[col].bold = true;
-        ftr->v_text[col].fg = comment.fg;
+        vcell_set(&ftr->v_text[col], (unsigned char)footer[col - 2], comment.fg, normal.bg,
+                  true, false, false);
         col++;
     }
 }
@@ -128,7 +128,7 @@ int lowerregion(int f, int n)
         return rdonly();        /* we are in read only mode     */
     if ((s = getregion(&region)) != TRUE)
         return s;
-    lchange(WFHARD);
+    lchange_rest(region.r_linep);   /* rewrites lines other than dot */
     linep = region.r_linep;
     loffs = region.r_offset;
     while (region.r_size--) {
@@ -165,7 +165,7 @@ int upperregion(int f, int n)
         return rdonly();        /* we are in read only mode     */
     if ((s = getregion(&region)) != TRUE)
         return s;
-    lchange(WFHARD);
+    lchange_rest(region.r_linep);   /* rewrites lines other than dot */
     linep = region.r_linep;
     loffs = region.r_offset;
     while (region.r_size--) {
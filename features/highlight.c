@@ -4,7 +4,9 @@
 #include <ctype.h>
 #include <strings.h>
 #include <limits.h>
+#include <stdint.h>
 #include <regex.h>
+#include <pthread.h>
 
 #include "estruct.h"
 #include "edef.h"
@@ -13,6 +15,8 @@
 #include "colorscheme.h"
 #include "platform.h"
 #include "util.h"
+#include "hl_worker.h"
+#include "hl_cache.h"
 
 #ifdef USE_WINDOWS
 #include <windows.h>
@@ -20,25 +24,191 @@
 #include <dirent.h>
 #endif
 
-typedef struct {
-    bool enable_colorscheme;
-    char colorscheme_name[64];
-} HighlightGlobalConfig;
-
 static HighlightGlobalConfig global_config;
 static HighlightProfile profiles[MAX_PROFILES];
 static int profile_count = 0;
 static bool initialized = false;
 
-static inline int kw_match(const HighlightProfile *profile, const char *word1, const char *word2)
+/*
+ * Compiled keyword lookup.
+ *
+ * Every keyword list of a profile is folded into one open-addressing hash
+ * table that maps the word to its style, so classifying an identifier costs
+ * one hash of the word and (almost always) a single probe, regardless of how
+ * many keywords the language defines.  Lists are inserted in precedence
+ * order and the first insertion wins, which keeps the old
+ * Return > Flow > Preproc > Type > Keyword ordering.  Case-insensitive
+ * profiles hash and compare ASCII-folded bytes.  The table layout lives in
+ * hl_cache.h so the syntax cache can map it directly.
+ */
+
+static inline unsigned char kw_fold(unsigned char c, bool ci)
 {
-    if (profile && profile->case_insensitive) {
-        return strcasecmp(word1, word2) == 0;
-    } else {
-        return strcmp(word1, word2) == 0;
+    return (ci && c >= 'A' && c <= 'Z') ? (unsigned char)(c + 32) : c;
+}
+
+static inline uint32_t kw_hash(const char *word, int len, bool ci)
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++)
+        h = (h ^ kw_fold((unsigned char)word[i], ci)) * 16777619u;
+    return h;
+}
+
+static inline bool kw_equal(const char *a, const char *b, int len, bool ci)
+{
+    if (!ci)
+        return memcmp(a, b, (size_t)len) == 0;
+    for (int i = 0; i < len; i++) {
+        if (kw_fold((unsigned char)a[i], true) != kw_fold((unsigned char)b[i], true))
+            return false;
+    }
+    return true;
+}
+
+static void keyword_index_free(struct HlKeywordIndex *ix)
+{
+    if (!ix)
+        return;
+    free(ix->slots);
+    free(ix->pool);
+    free(ix);
+}
+
+/* Insert unless already present (earlier lists take precedence). */
+static void keyword_index_add(struct HlKeywordIndex *ix, const char *word, HighlightStyleID style)
+{
+    size_t len = strlen(word);
+    if (len == 0 || len >= MAX_TOKEN_LEN)
+        return;
+
+    uint32_t h = kw_hash(word, (int)len, ix->case_insensitive);
+    uint32_t i = h & ix->mask;
+    while (ix->slots[i].len != 0) {
+        const HlKeywordSlot *slot = &ix->slots[i];
+        if (slot->hash == h && slot->len == len &&
+            kw_equal(ix->pool + slot->name, word, (int)len, ix->case_insensitive))
+            return;
+        i = (i + 1) & ix->mask;
+    }
+
+    ix->slots[i].hash = h;
+    ix->slots[i].name = (uint32_t)ix->pool_len;
+    ix->slots[i].len = (uint8_t)len;
+    ix->slots[i].style = (uint8_t)style;
+    memcpy(ix->pool + ix->pool_len, word, len);
+    ix->pool_len += len;
+}
+
+typedef struct {
+    const HlStrList *words;
+    HighlightStyleID style;
+} KeywordList;
+
+static struct HlKeywordIndex *keyword_index_build(const HighlightProfile *p, const KeywordList *lists, int nlists)
+{
+    int total = 0;
+    for (int l = 0; l < nlists; l++)
+        total += lists[l].words->count;
+
+    uint32_t size = 16;
+    while (size < (uint32_t)total * 2)
+        size <<= 1;
+
+    struct HlKeywordIndex *ix = calloc(1, sizeof(*ix));
+    if (!ix)
+        return NULL;
+    ix->slots = calloc(size, sizeof(HlKeywordSlot));
+    ix->pool = malloc((size_t)total * MAX_TOKEN_LEN + 1);
+    if (!ix->slots || !ix->pool) {
+        keyword_index_free(ix);
+        return NULL;
+    }
+    ix->mask = size - 1;
+    ix->case_insensitive = p->case_insensitive;
+
+    for (int l = 0; l < nlists; l++) {
+        for (int i = 0; i < lists[l].words->count; i++)
+            keyword_index_add(ix, hl_str(p, lists[l].words->items[i]), lists[l].style);
+    }
+    return ix;
+}
+
+/* Style of word[0..len), or -1 when it is not a keyword. */
+static inline int keyword_index_lookup(const struct HlKeywordIndex *ix, const char *word, int len)
+{
+    if (!ix || len <= 0 || len >= MAX_TOKEN_LEN)
+        return -1;
+
+    uint32_t h = kw_hash(word, len, ix->case_insensitive);
+    for (uint32_t i = h & ix->mask; ix->slots[i].len != 0; i = (i + 1) & ix->mask) {
+        const HlKeywordSlot *slot = &ix->slots[i];
+        if (slot->hash == h && slot->len == len &&
+            kw_equal(ix->pool + slot->name, word, len, ix->case_insensitive))
+            return slot->style;
+    }
+    return -1;
+}
+
+static void profile_free_indexes(HighlightProfile *p)
+{
+    keyword_index_free(p->word_index);
+    keyword_index_free(p->directive_index);
+    p->word_index = NULL;
+    p->directive_index = NULL;
+}
+
+/*
+ * First-byte dispatch for highlight_line().  Comment tokens and string
+ * delimiters are only tried at bytes that can start one, and a byte that can
+ * only begin a word or a run of blanks skips the other checks altogether.
+ * 'r' and 'h' may start rgb()/hsl() colours and markdown uses '_' for
+ * emphasis, so those stay on the slow path.
+ */
+static void profile_build_dispatch(HighlightProfile *p)
+{
+    uint8_t *d = p->dispatch;
+
+    memset(p->dispatch, 0, sizeof(p->dispatch));
+    for (int i = 0; i < p->block_comment_count; i++)
+        d[(unsigned char)hl_str(p, p->block_comments[i].start)[0]] |= HL_BYTE_BLOCK_COMMENT;
+    for (int i = 0; i < p->line_comments.count; i++)
+        d[(unsigned char)hl_str(p, p->line_comments.items[i])[0]] |= HL_BYTE_LINE_COMMENT;
+    for (const char *s = p->string_delims; *s; s++)
+        d[(unsigned char)*s] |= HL_BYTE_STRING;
+
+    for (int c = 0; c < 256; c++) {
+        bool word = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+        if (c == 'r' || c == 'h' || (c == '_' && strcasecmp(p->name, "markdown") == 0))
+            word = false;
+        if (d[c] == 0 && word)
+            d[c] = HL_BYTE_WORD;
+        else if (d[c] == 0 && (c == ' ' || c == '\t'))
+            d[c] = HL_BYTE_BLANK;
     }
 }
 
+static void profile_compile(HighlightProfile *p)
+{
+    const KeywordList words[] = {
+        { &p->return_keywords, HL_RETURN },
+        { &p->flow_keywords, HL_FLOW },
+        { &p->preproc_keywords, HL_PREPROC },
+        { &p->type_keywords, HL_TYPE },
+        { &p->keywords, HL_KEYWORD },
+    };
+    const KeywordList directives[] = {
+        { &p->preproc_include_keywords, HL_PREPROC_INCLUDE },
+        { &p->preproc_define_keywords, HL_PREPROC_DEFINE },
+        { &p->preproc_flow_keywords, HL_PREPROC_FLOW },
+    };
+
+    profile_free_indexes(p);
+    p->word_index = keyword_index_build(p, words, (int)(sizeof(words) / sizeof(words[0])));
+    p->directive_index = keyword_index_build(p, directives, (int)(sizeof(directives) / sizeof(directives[0])));
+    profile_build_dispatch(p);
+}
+
 typedef struct {
     bool compiled;
     regex_t regex;
@@ -48,11 +218,6 @@ static CompiledFileMatch profile_file_matches[MAX_PROFILES][MAX_FILE_MATCHES];
 
 #define MAX_MD_LANG_ALIASES 256
 
-typedef struct {
-    char standard[MAX_TOKEN_LEN];
-    char nanox[MAX_TOKEN_LEN];
-} MarkdownLangAlias;
-
 static MarkdownLangAlias markdown_lang_aliases[MAX_MD_LANG_ALIASES];
 static int markdown_lang_alias_count = 0;
 
@@ -114,12 +279,35 @@ static bool compile_profile_file_match(int profile_index, int slot, const char *
     return true;
 }
 
+/* Compile the file_matches patterns of p; invalid ones are dropped (or, for
+ * a read-only cached profile, left uncompiled). */
+static void compile_file_matches(HighlightProfile *p)
+{
+    int profile_index = profile_index_from_ptr(p);
+    int kept = 0;
+
+    if (profile_index < 0)
+        return;
+    clear_profile_file_matches(profile_index);
+    for (int i = 0; i < p->file_matches.count; i++) {
+        const char *pattern = hl_str(p, p->file_matches.items[i]);
+        int slot = p->mapped ? i : kept;
+        if (*pattern && compile_profile_file_match(profile_index, slot, pattern, p->name)) {
+            if (!p->mapped)
+                p->file_matches.items[kept] = p->file_matches.items[i];
+            kept++;
+        }
+    }
+    if (!p->mapped)
+        p->file_matches.count = kept;
+}
+
 static bool profile_matches_filename(int profile_index, const char *basename)
 {
     if (profile_index < 0 || profile_index >= profile_count || !basename || !*basename)
         return false;
 
-    for (int i = 0; i < profiles[profile_index].file_match_count; i++) {
+    for (int i = 0; i < profiles[profile_index].file_matches.count; i++) {
         if (!profile_file_matches[profile_index][i].compiled)
             continue;
         if (regexec(&profile_file_matches[profile_index][i].regex, basename, 0, NULL, 0) == 0)
@@ -128,12 +316,103 @@ static bool profile_matches_filename(int profile_index, const char *basename)
     return false;
 }
 
+/* Helper to trim whitespace */
+static char *trim(char *s)
+{
+    char *p = s;
+    while (isspace(*p))
+        p++;
+    if (*p == 0)
+        return p;
+    char *end = p + strlen(p) - 1;
+    while (end > p && isspace(*end))
+        *end-- = 0;
+    return p;
+}
+
+/* Append str, truncated to maxlen - 1 bytes, to the profile's string pool. */
+static bool pool_add(HighlightProfile *p, const char *str, size_t maxlen, HlStr *out)
+{
+    size_t len = strnlen(str, maxlen - 1);
+
+    if (p->pool_len + len + 1 > p->pool_cap) {
+        size_t cap = p->pool_cap ? p->pool_cap * 2 : 256;
+        while (cap < p->pool_len + len + 1)
+            cap *= 2;
+        char *pool = realloc(p->pool, cap);
+        if (!pool)
+            return false;
+        p->pool = pool;
+        p->pool_cap = cap;
+    }
+    memcpy(p->pool + p->pool_len, str, len);
+    p->pool[p->pool_len + len] = '\0';
+    *out = (HlStr)p->pool_len;
+    p->pool_len += len + 1;
+    return true;
+}
+
+static void list_free(HlStrList *list)
+{
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+}
+
+/* Replace list with the comma separated, trimmed tokens of val. */
+static void parse_list(HighlightProfile *p, HlStrList *list, char *val, int max, size_t maxlen)
+{
+    int n = 1;
+    for (const char *c = val; *c; c++)
+        n += (*c == ',');
+    if (n > max)
+        n = max;
+
+    list_free(list);
+    list->items = malloc((size_t)n * sizeof(HlStr));
+    if (!list->items)
+        return;
+
+    char *save = NULL;
+    for (char *tok = strtok_r(val, ",", &save); tok && list->count < n; tok = strtok_r(NULL, ",", &save)) {
+        HlStr str;
+        if (pool_add(p, trim(tok), maxlen, &str))
+            list->items[list->count++] = str;
+    }
+}
+
+static void profile_free(HighlightProfile *p)
+{
+    if (p->mapped) {
+        /* only the index headers are ours, the rest is in the cache mapping */
+        free(p->word_index);
+        free(p->directive_index);
+        return;
+    }
+    profile_free_indexes(p);
+    free(p->source);
+    free(p->pool);
+    free(p->block_comments);
+    list_free(&p->extensions);
+    list_free(&p->file_matches);
+    list_free(&p->line_comments);
+    list_free(&p->keywords);
+    list_free(&p->type_keywords);
+    list_free(&p->flow_keywords);
+    list_free(&p->preproc_keywords);
+    list_free(&p->preproc_include_keywords);
+    list_free(&p->preproc_define_keywords);
+    list_free(&p->preproc_flow_keywords);
+    list_free(&p->return_keywords);
+}
+
 static void profile_init(HighlightProfile *p, const char *name)
 {
     int profile_index = profile_index_from_ptr(p);
     if (profile_index >= 0)
         clear_profile_file_matches(profile_index);
 
+    profile_free(p);
     memset(p, 0, sizeof(*p));
     mystrscpy(p->name, name, sizeof(p->name));
     p->enable_number_highlight = true;
@@ -144,7 +423,9 @@ static void profile_init(HighlightProfile *p, const char *name)
     /* Defaults could be more extensive, but usually config overrides */
 }
 
-static HighlightProfile *prepare_profile(const char *name)
+/* Start (or restart) the definition of a profile; a later section with the
+ * same name replaces the earlier one entirely. */
+static HighlightProfile *prepare_profile(const char *name, const char *source, long offset)
 {
     HighlightProfile *p = NULL;
     for (int i = 0; i < profile_count; i++) {
@@ -160,6 +441,8 @@ static HighlightProfile *prepare_profile(const char *name)
         p = slot;
     }
     if (p) {
+        p->source = strdup(source);
+        p->source_offset = offset;
         if (strcasecmp(name, "fortran") == 0 || strcasecmp(name, "sql") == 0 ||
             strcasecmp(name, "ini") == 0 || strcasecmp(name, "cmake") == 0 ||
             strcasecmp(name, "powershell") == 0 || strcasecmp(name, "makefile") == 0 ||
@@ -173,25 +456,81 @@ static HighlightProfile *prepare_profile(const char *name)
     return p;
 }
 
-/* Helper to trim whitespace */
-static char *trim(char *s)
+/* Keys of a profile section other than the indexed extensions/file_matches. */
+static void profile_set_key(HighlightProfile *p, const char *key, char *val)
 {
-    char *p = s;
-    while (isspace(*p))
-        p++;
-    if (*p == 0)
-        return p;
-    char *end = p + strlen(p) - 1;
-    while (end > p && isspace(*end))
-        *end-- = 0;
-    return p;
+    if (strcmp(key, "line_comment_tokens") == 0) {
+        parse_list(p, &p->line_comments, val, MAX_TOKENS, MAX_TOKEN_LEN);
+    } else if (strcmp(key, "block_comment_pairs") == 0) {
+        free(p->block_comments);
+        p->block_comment_count = 0;
+        p->block_comments = malloc(MAX_TOKENS * sizeof(BlockCommentPair));
+        if (!p->block_comments)
+            return;
+        char *save = NULL;
+        char *tok = strtok_r(val, ",", &save);
+        while (tok && p->block_comment_count < MAX_TOKENS) {
+            tok = trim(tok);
+            char *sp = strchr(tok, ' ');
+            if (sp) {
+                *sp = 0;
+                BlockCommentPair *pair = &p->block_comments[p->block_comment_count];
+                if (pool_add(p, tok, MAX_TOKEN_LEN, &pair->start) &&
+                    pool_add(p, trim(sp + 1), MAX_TOKEN_LEN, &pair->end))
+                    p->block_comment_count++;
+            }
+            tok = strtok_r(NULL, ",", &save);
+        }
+    } else if (strcmp(key, "string_delims") == 0) {
+        int j = 0;
+        for (int i = 0; val[i]; i++) {
+            if (val[i] != ',' && !isspace((unsigned char)val[i]) && j < MAX_TOKENS - 1)
+                p->string_delims[j++] = val[i];
+        }
+        p->string_delims[j] = 0;
+    } else if (strcmp(key, "keywords") == 0) {
+        parse_list(p, &p->keywords, val, MAX_TOKENS * 8, MAX_TOKEN_LEN);
+    } else if (strcmp(key, "types") == 0) {
+        parse_list(p, &p->type_keywords, val, MAX_TOKENS * 8, MAX_TOKEN_LEN);
+    } else if (strcmp(key, "flow") == 0) {
+        parse_list(p, &p->flow_keywords, val, MAX_TOKENS * 8, MAX_TOKEN_LEN);
+    } else if (strcmp(key, "preproc") == 0) {
+        parse_list(p, &p->preproc_keywords, val, MAX_TOKENS * 4, MAX_TOKEN_LEN);
+    } else if (strcmp(key, "preproc_include") == 0) {
+        parse_list(p, &p->preproc_include_keywords, val, MAX_TOKENS * 4, MAX_TOKEN_LEN);
+    } else if (strcmp(key, "preproc_define") == 0) {
+        parse_list(p, &p->preproc_define_keywords, val, MAX_TOKENS * 4, MAX_TOKEN_LEN);
+    } else if (strcmp(key, "preproc_flow") == 0) {
+        parse_list(p, &p->preproc_flow_keywords, val, MAX_TOKENS * 4, MAX_TOKEN_LEN);
+    } else if (strcmp(key, "return_keywords") == 0) {
+        parse_list(p, &p->return_keywords, val, MAX_TOKENS, MAX_TOKEN_LEN);
+    } else if (strcmp(key, "completion_end_line_char") == 0) {
+        char *trimmed = trim(val);
+        p->completion_end_line_char = (trimmed && *trimmed) ? *trimmed : '\0';
+    } else if (strcmp(key, "enable_triple_quotes") == 0) {
+        p->enable_triple_quotes = (strcasecmp(val, "true") == 0);
+    } else if (strcmp(key, "enable_number_highlight") == 0) {
+        p->enable_number_highlight = (strcasecmp(val, "true") == 0);
+    } else if (strcmp(key, "enable_bracket_highlight") == 0) {
+        p->enable_bracket_highlight = (strcasecmp(val, "true") == 0);
+    } else if (strcmp(key, "suppress_comment_autocomplete") == 0) {
+        p->suppress_comment_autocomplete = (strcasecmp(val, "true") == 0);
+    } else if (strcmp(key, "case_insensitive") == 0) {
+        p->case_insensitive = (strcasecmp(val, "true") == 0);
+    }
 }
 
+/*
+ * Read the index of a rules file: the [highlight] globals, every profile
+ * section header, and each profile's extensions and file_matches.  The rest
+ * of a section is left for profile_load().
+ */
 static bool load_config_file(const char *path, bool allow_global)
 {
     if (!path || !*path)
         return false;
 
+    hl_cache_depend(path);
     FILE *f = fopen(path, "r");
     if (!f)
         return false;
@@ -214,14 +553,10 @@ static bool load_config_file(const char *path, bool allow_global)
             char *sect = p + 1;
 
             if (strcasecmp(sect, "highlight") == 0) {
-                if (allow_global) {
-                    curr = NULL;
-                    ignore_section = false;
-                } else {
-                    ignore_section = true;
-                }
+                curr = NULL;
+                ignore_section = !allow_global;
             } else {
-                curr = prepare_profile(sect);
+                curr = prepare_profile(sect, path, ftell(f));
                 if (curr) {
                     ignore_section = false;
                     added = true;
@@ -254,132 +589,10 @@ static bool load_config_file(const char *path, bool allow_global)
         }
 
         if (strcmp(key, "extensions") == 0) {
-            char *tok = strtok(val, ",");
-            curr->ext_count = 0;
-            while (tok && curr->ext_count < MAX_EXTS) {
-                mystrscpy(curr->extensions[curr->ext_count++], trim(tok), MAX_EXT_LEN);
-                tok = strtok(NULL, ",");
-            }
+            parse_list(curr, &curr->extensions, val, MAX_EXTS, MAX_EXT_LEN);
         } else if (strcmp(key, "file_matches") == 0) {
-            int profile_index = profile_index_from_ptr(curr);
-            if (profile_index >= 0)
-                clear_profile_file_matches(profile_index);
-            curr->file_match_count = 0;
-            char *tok = strtok(val, ",");
-            while (tok && curr->file_match_count < MAX_FILE_MATCHES) {
-                char *pattern = trim(tok);
-                if (!*pattern) {
-                    tok = strtok(NULL, ",");
-                    continue;
-                }
-                char pattern_buf[MAX_FILE_MATCH_PATTERN];
-                mystrscpy(pattern_buf, pattern, sizeof(pattern_buf));
-                bool compiled = true;
-                if (profile_index >= 0)
-                    compiled = compile_profile_file_match(profile_index, curr->file_match_count, pattern_buf, curr->name);
-                if (compiled) {
-                    mystrscpy(curr->file_match_patterns[curr->file_match_count], pattern_buf, MAX_FILE_MATCH_PATTERN);
-                    curr->file_match_count++;
-                }
-                tok = strtok(NULL, ",");
-            }
-        } else if (strcmp(key, "line_comment_tokens") == 0) {
-            char *tok = strtok(val, ",");
-            curr->line_comment_count = 0;
-            while (tok && curr->line_comment_count < MAX_TOKENS) {
-                mystrscpy(curr->line_comments[curr->line_comment_count++], trim(tok), MAX_TOKEN_LEN);
-                tok = strtok(NULL, ",");
-            }
-        } else if (strcmp(key, "block_comment_pairs") == 0) {
-            char *tok = strtok(val, ",");
-            curr->block_comment_count = 0;
-            while (tok && curr->block_comment_count < MAX_TOKENS) {
-                tok = trim(tok);
-                char *sp = strchr(tok, ' ');
-                if (sp) {
-                    *sp = 0;
-                    mystrscpy(curr->block_comments[curr->block_comment_count].start, tok, MAX_TOKEN_LEN);
-                    mystrscpy(curr->block_comments[curr->block_comment_count].end, trim(sp + 1), MAX_TOKEN_LEN);
-                    curr->block_comment_count++;
-                }
-                tok = strtok(NULL, ",");
-            }
-        } else if (strcmp(key, "string_delims") == 0) {
-            int j = 0;
-            for (int i = 0; val[i]; i++) {
-                if (val[i] != ',' && !isspace((unsigned char)val[i]) && j < MAX_TOKENS - 1)
-                    curr->string_delims[j++] = val[i];
-            }
-            curr->string_delims[j] = 0;
-        } else if (strcmp(key, "keywords") == 0) {
-            char *tok = strtok(val, ",");
-            curr->keyword_count = 0;
-            while (tok && curr->keyword_count < MAX_TOKENS * 8) {
-                mystrscpy(curr->keywords[curr->keyword_count++], trim(tok), MAX_TOKEN_LEN);
-                tok = strtok(NULL, ",");
-            }
-        } else if (strcmp(key, "types") == 0) {
-            char *tok = strtok(val, ",");
-            curr->type_keyword_count = 0;
-            while (tok && curr->type_keyword_count < MAX_TOKENS * 8) {
-                mystrscpy(curr->type_keywords[curr->type_keyword_count++], trim(tok), MAX_TOKEN_LEN);
-                tok = strtok(NULL, ",");
-            }
-        } else if (strcmp(key, "flow") == 0) {
-            char *tok = strtok(val, ",");
-            curr->flow_keyword_count = 0;
-            while (tok && curr->flow_keyword_count < MAX_TOKENS * 8) {
-                mystrscpy(curr->flow_keywords[curr->flow_keyword_count++], trim(tok), MAX_TOKEN_LEN);
-                tok = strtok(NULL, ",");
-            }
-        } else if (strcmp(key, "preproc") == 0) {
-            char *tok = strtok(val, ",");
-            curr->preproc_keyword_count = 0;
-            while (tok && curr->preproc_keyword_count < MAX_TOKENS * 4) {
-                mystrscpy(curr->preproc_keywords[curr->preproc_keyword_count++], trim(tok), MAX_TOKEN_LEN);
-                tok = strtok(NULL, ",");
-            }
-        } else if (strcmp(key, "preproc_include") == 0) {
-            char *tok = strtok(val, ",");
-            curr->preproc_include_keyword_count = 0;
-            while (tok && curr->preproc_include_keyword_count < MAX_TOKENS * 4) {
-                mystrscpy(curr->preproc_include_keywords[curr->preproc_include_keyword_count++], trim(tok), MAX_TOKEN_LEN);
-                tok = strtok(NULL, ",");
-            }
-        } else if (strcmp(key, "preproc_define") == 0) {
-            char *tok = strtok(val, ",");
-            curr->preproc_define_keyword_count = 0;
-            while (tok && curr->preproc_define_keyword_count < MAX_TOKENS * 4) {
-                mystrscpy(curr->preproc_define_keywords[curr->preproc_define_keyword_count++], trim(tok), MAX_TOKEN_LEN);
-                tok = strtok(NULL, ",");
-            }
-        } else if (strcmp(key, "preproc_flow") == 0) {
-            char *tok = strtok(val, ",");
-            curr->preproc_flow_keyword_count = 0;
-            while (tok && curr->preproc_flow_keyword_count < MAX_TOKENS * 4) {
-                mystrscpy(curr->preproc_flow_keywords[curr->preproc_flow_keyword_count++], trim(tok), MAX_TOKEN_LEN);
-                tok = strtok(NULL, ",");
-            }
-        } else if (strcmp(key, "return_keywords") == 0) {
-            char *tok = strtok(val, ",");
-            curr->return_keyword_count = 0;
-            while (tok && curr->return_keyword_count < MAX_TOKENS) {
-                mystrscpy(curr->return_keywords[curr->return_keyword_count++], trim(tok), MAX_TOKEN_LEN);
-                tok = strtok(NULL, ",");
-            }
-        } else if (strcmp(key, "completion_end_line_char") == 0) {
-            char *trimmed = trim(val);
-            curr->completion_end_line_char = (trimmed && *trimmed) ? *trimmed : '\0';
-        } else if (strcmp(key, "enable_triple_quotes") == 0) {
-            curr->enable_triple_quotes = (strcasecmp(val, "true") == 0);
-        } else if (strcmp(key, "enable_number_highlight") == 0) {
-            curr->enable_number_highlight = (strcasecmp(val, "true") == 0);
-        } else if (strcmp(key, "enable_bracket_highlight") == 0) {
-            curr->enable_bracket_highlight = (strcasecmp(val, "true") == 0);
-        } else if (strcmp(key, "suppress_comment_autocomplete") == 0) {
-            curr->suppress_comment_autocomplete = (strcasecmp(val, "true") == 0);
-        } else if (strcmp(key, "case_insensitive") == 0) {
-            curr->case_insensitive = (strcasecmp(val, "true") == 0);
+            parse_list(curr, &curr->file_matches, val, MAX_FILE_MATCHES, MAX_FILE_MATCH_PATTERN);
+            compile_file_matches(curr);
         }
     }
 
@@ -387,11 +600,62 @@ static bool load_config_file(const char *path, bool allow_global)
     return added;
 }
 
+/* Parse the full definition of a profile from its source section. */
+static void profile_load(HighlightProfile *p)
+{
+    FILE *f = p->source ? fopen(p->source, "r") : NULL;
+
+    if (f && fseek(f, p->source_offset, SEEK_SET) == 0) {
+        char line[512];
+        while (fgets(line, sizeof(line), f)) {
+            char *s = trim(line);
+            if (*s == 0 || *s == ';' || *s == '#')
+                continue;
+            if (*s == '[') {
+                if (strchr(s, ']'))
+                    break;      /* next section */
+                continue;
+            }
+            char *eq = strchr(s, '=');
+            if (!eq)
+                continue;
+            *eq = 0;
+            profile_set_key(p, trim(s), trim(eq + 1));
+        }
+    }
+    if (f)
+        fclose(f);
+
+    free(p->source);
+    p->source = NULL;
+    profile_compile(p);
+    __atomic_store_n(&p->loaded, true, __ATOMIC_RELEASE);
+}
+
+/*
+ * Make sure a profile is fully loaded before it is used.  Besides the UI
+ * thread this runs on the highlight worker, which can reach a not yet
+ * loaded profile through a markdown code fence, hence the lock.
+ */
+static HighlightProfile *profile_ready(HighlightProfile *p)
+{
+    static pthread_mutex_t load_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    if (p && !__atomic_load_n(&p->loaded, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&load_mutex);
+        if (!p->loaded)
+            profile_load(p);
+        pthread_mutex_unlock(&load_mutex);
+    }
+    return p;
+}
+
 static bool load_lang_dir(const char *dir)
 {
     if (!dir || !*dir)
         return false;
 
+    hl_cache_depend(dir);      /* its mtime changes when files come and go */
     bool loaded = false;
 #ifdef USE_WINDOWS
     char pattern[PATH_MAX];
@@ -464,6 +728,7 @@ static bool load_markdown_lang_alias_file(const char *path)
     if (!path || !*path)
         return false;
 
+    hl_cache_depend(path);
     FILE *f = fopen(path, "r");
     if (!f)
         return false;
@@ -597,20 +862,128 @@ static bool load_external_langs(const char *rule_config_path)
     return loaded;
 }
 
+/*
+ * Extension -> profile table, rebuilt by highlight_init().  The keys are
+ * copied into ext_pool, so lookups never touch a profile's own pool (which
+ * grows when the profile is loaded).  Insertion follows profile order so the
+ * first profile that claims an extension keeps it.
+ */
+typedef struct {
+    uint32_t ext;           /* offset into ext_pool */
+    int profile;            /* -1 = empty slot */
+} ExtSlot;
+
+static ExtSlot *ext_table = NULL;
+static char *ext_pool = NULL;
+static uint32_t ext_mask = 0;
+static unsigned profile_generation = 0;    /* bumped by highlight_init() */
+
+static void build_ext_table(void)
+{
+    int total = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < profile_count; i++) {
+        total += profiles[i].extensions.count;
+        for (int j = 0; j < profiles[i].extensions.count; j++)
+            bytes += strlen(hl_str(&profiles[i], profiles[i].extensions.items[j])) + 1;
+    }
+
+    uint32_t size = 16;
+    while (size < (uint32_t)total * 2)
+        size <<= 1;
+
+    free(ext_table);
+    free(ext_pool);
+    ext_mask = 0;
+    ext_table = malloc(size * sizeof(ExtSlot));
+    ext_pool = malloc(bytes + 1);
+    if (!ext_table || !ext_pool) {
+        free(ext_table);
+        ext_table = NULL;
+        return;
+    }
+    ext_mask = size - 1;
+    for (uint32_t i = 0; i < size; i++)
+        ext_table[i].profile = -1;
+
+    size_t used = 0;
+    for (int i = 0; i < profile_count; i++) {
+        for (int j = 0; j < profiles[i].extensions.count; j++) {
+            const char *ext = hl_str(&profiles[i], profiles[i].extensions.items[j]);
+            uint32_t h = kw_hash(ext, (int)strlen(ext), true) & ext_mask;
+            while (ext_table[h].profile >= 0 && strcasecmp(ext_pool + ext_table[h].ext, ext) != 0)
+                h = (h + 1) & ext_mask;
+            if (ext_table[h].profile < 0) {
+                size_t len = strlen(ext) + 1;
+                memcpy(ext_pool + used, ext, len);
+                ext_table[h].ext = (uint32_t)used;
+                ext_table[h].profile = i;
+                used += len;
+            }
+        }
+    }
+}
+
+static HighlightProfile *profile_for_ext(const char *ext)
+{
+    if (!ext_table)
+        return NULL;
+
+    uint32_t h = kw_hash(ext, (int)strlen(ext), true) & ext_mask;
+    for (; ext_table[h].profile >= 0; h = (h + 1) & ext_mask) {
+        if (strcasecmp(ext_pool + ext_table[h].ext, ext) == 0)
+            return &profiles[ext_table[h].profile];
+    }
+    return NULL;
+}
+
 void highlight_init(const char *rule_config_path)
 {
+    hl_worker_drain();
+    /* drop the old rule set before its cache mapping goes away */
+    for (int i = 0; i < profile_count; i++)
+        profile_init(&profiles[i], "");
+    hl_cache_release();
     clear_all_profile_file_matches();
     profile_count = 0;
     global_config.enable_colorscheme = true;
     mystrscpy(global_config.colorscheme_name, "nanox-dark", sizeof(global_config.colorscheme_name));
 
     bool loaded_any = false;
+    HlRuleSet rules = {
+        &global_config, profiles, 0, MAX_PROFILES,
+        markdown_lang_aliases, 0, MAX_MD_LANG_ALIASES
+    };
+
+    hl_cache_begin(rule_config_path);
+    if (hl_cache_load(&rules)) {
+        profile_count = rules.profile_count;
+        markdown_lang_alias_count = rules.alias_count;
+        for (int i = 0; i < profile_count; i++) {
+            compile_file_matches(&profiles[i]);
+            profile_build_dispatch(&profiles[i]);
+        }
+        loaded_any = profile_count > 0;
+    } else {
+        if (rule_config_path && *rule_config_path)
+            loaded_any |= load_config_file(rule_config_path, true);
+
+        loaded_any |= load_external_langs(rule_config_path);
+        load_markdown_lang_aliases(rule_config_path);
+
+        if (loaded_any && hl_cache_writable()) {
+            /* the cache holds complete profiles, so pay for all of them once,
+             * but only when it can be written; otherwise they load lazily */
+            for (int i = 0; i < profile_count; i++)
+                profile_ready(&profiles[i]);
+            rules.profile_count = profile_count;
+            rules.alias_count = markdown_lang_alias_count;
+            hl_cache_store(&rules);
+        }
+    }
 
-    if (rule_config_path && *rule_config_path)
-        loaded_any |= load_config_file(rule_config_path, true);
-
-    loaded_any |= load_external_langs(rule_config_path);
-    load_markdown_lang_aliases(rule_config_path);
+    build_ext_table();
+    profile_generation++;
 
     if (global_config.enable_colorscheme) {
         colorscheme_init(global_config.colorscheme_name);
@@ -623,14 +996,43 @@ bool highlight_is_enabled(void)
     return initialized && global_config.enable_colorscheme;
 }
 
+/*
+ * Dynamic keywords for files without a profile.
+ *
+ * The most frequent words in the first DYN_SAMPLE_BYTES of the buffer are
+ * highlighted as keywords.  Words are counted in an open-addressing hash
+ * table, DYN_STEP_BYTES at a time: the first slice when the buffer is shown,
+ * the rest from the idle loop (highlight_dynamic_step()), so even a huge
+ * file opens without a pause.  The keyword set is published when the sample
+ * is complete, or early with what was counted so far if the buffer is
+ * edited in the meantime.
+ */
+#define DYN_SAMPLE_BYTES (4 * 1024 * 1024)
+#define DYN_STEP_BYTES (256 * 1024)
+#define DYN_MAX_WORDS 4096
+#define DYN_TABLE_SIZE (DYN_MAX_WORDS * 2)      /* power of two */
+
 static HighlightProfile dynamic_profile;
 static bool dynamic_profile_active = false;
 
 typedef struct {
     char word[MAX_TOKEN_LEN];
-    int count;
+    uint32_t hash;
+    int len;
+    int count;                  /* 0 = empty slot */
 } WordFreq;
 
+static struct {
+    struct buffer *owner;       /* buffer the profile was built for */
+    struct buffer *bp;          /* buffer being sampled, NULL when done */
+    struct line *lp;            /* next line to count */
+    int version;
+    unsigned epoch;
+    size_t scanned;
+    int nwords;
+    WordFreq *table;
+} dyn;
+
 static int word_freq_compare(const void *a, const void *b)
 {
     const WordFreq *wa = a;
@@ -639,74 +1041,165 @@ static int word_freq_compare(const void *a, const void *b)
         return 1;
     if (wb->count < wa->count)
         return -1;
-    return 0;
+    return strcmp(wa->word, wb->word);
 }
 
-static void extract_dynamic_profile(struct buffer *bp)
+static inline bool is_word_byte(unsigned char c)
 {
-    if (!bp) return;
-    
-    profile_init(&dynamic_profile, "dynamic");
-    WordFreq *freqs = calloc(MAX_TOKENS * 8, sizeof(WordFreq));
-    int word_count = 0;
-    
-    struct line *lp = lforw(bp->b_linep);
-    while (lp != bp->b_linep) {
-        int i = 0;
+    return isalnum(c) || c == '_';
+}
+
+static void dynamic_count_word(const char *word, int len)
+{
+    uint32_t h = kw_hash(word, len, false);
+    uint32_t i = h & (DYN_TABLE_SIZE - 1);
+
+    while (dyn.table[i].count != 0) {
+        WordFreq *wf = &dyn.table[i];
+        if (wf->hash == h && wf->len == len && memcmp(wf->word, word, (size_t)len) == 0) {
+            wf->count++;
+            return;
+        }
+        i = (i + 1) & (DYN_TABLE_SIZE - 1);
+    }
+    if (dyn.nwords >= DYN_MAX_WORDS)
+        return;
+    memcpy(dyn.table[i].word, word, (size_t)len);
+    dyn.table[i].word[len] = '\0';
+    dyn.table[i].hash = h;
+    dyn.table[i].len = len;
+    dyn.table[i].count = 1;
+    dyn.nwords++;
+}
+
+/* Count words on up to budget more bytes; true once the sample is complete. */
+static bool dynamic_scan(size_t budget)
+{
+    size_t done = 0;
+    struct line *lp = dyn.lp;
+
+    while (lp != dyn.bp->b_linep && done < budget && dyn.scanned < DYN_SAMPLE_BYTES) {
+        const char *text = (const char *)ltext(lp);
         int len = llength(lp);
+        int i = 0;
         while (i < len) {
-            if (isalnum((unsigned char)ltext(lp)[i]) || ltext(lp)[i] == '_') {
-                int start = i;
-                while (i < len && (isalnum((unsigned char)ltext(lp)[i]) || ltext(lp)[i] == '_'))
-                    i++;
-                
-                int word_len = i - start;
-                if (word_len >= 3 && word_len < MAX_TOKEN_LEN) {
-                    char tmp[MAX_TOKEN_LEN];
-                    memcpy(tmp, &ltext(lp)[start], word_len);
-                    tmp[word_len] = '\0';
-                    
-                    int found = -1;
-                    for (int j = 0; j < word_count; j++) {
-                        if (strcmp(freqs[j].word, tmp) == 0) {
-                            found = j;
-                            break;
-                        }
-                    }
-                    if (found >= 0) {
-                        freqs[found].count++;
-                    } else if (word_count < MAX_TOKENS * 8) {
-                        strcpy(freqs[word_count].word, tmp);
-                        freqs[word_count].count = 1;
-                        word_count++;
-                    }
-                }
-            } else {
+            if (!is_word_byte((unsigned char)text[i])) {
                 i++;
+                continue;
             }
+            int start = i;
+            while (i < len && is_word_byte((unsigned char)text[i]))
+                i++;
+            int word_len = i - start;
+            if (word_len >= 3 && word_len < MAX_TOKEN_LEN)
+                dynamic_count_word(text + start, word_len);
         }
+        done += (size_t)len + 1;
+        dyn.scanned += (size_t)len + 1;
         lp = lforw(lp);
     }
-    
+    dyn.lp = lp;
+    return lp == dyn.bp->b_linep || dyn.scanned >= DYN_SAMPLE_BYTES;
+}
+
+/* Turn the counted words into the keyword list of dynamic_profile. */
+static void dynamic_publish(void)
+{
+    struct buffer *bp = dyn.bp;
+    int word_count = 0;
+
+    hl_worker_drain();      /* the worker may be reading dynamic_profile */
+    profile_init(&dynamic_profile, "dynamic");
+
+    for (int i = 0; i < DYN_TABLE_SIZE; i++) {
+        if (dyn.table[i].count != 0)
+            dyn.table[word_count++] = dyn.table[i];
+    }
+
     if (word_count > 0) {
-        qsort(freqs, word_count, sizeof(WordFreq), word_freq_compare);
-        
+        qsort(dyn.table, (size_t)word_count, sizeof(WordFreq), word_freq_compare);
+
         /* Frequent words -> mild highlighting (KeyWords) */
         /* We take top 10% or at most 50 words */
         int top_limit = word_count / 10;
         if (top_limit > 50) top_limit = 50;
         if (top_limit < 5 && word_count > 5) top_limit = 5;
-        
-        dynamic_profile.keyword_count = 0;
-        for (int i = 0; i < top_limit && i < word_count; i++) {
-            if (freqs[i].count > 1) { /* Only if repeated */
-                strcpy(dynamic_profile.keywords[dynamic_profile.keyword_count++], freqs[i].word);
+
+        HlStrList *kw = &dynamic_profile.keywords;
+        kw->items = malloc((size_t)top_limit * sizeof(HlStr));
+        for (int i = 0; kw->items && i < top_limit && i < word_count; i++) {
+            if (dyn.table[i].count > 1) { /* Only if repeated */
+                if (pool_add(&dynamic_profile, dyn.table[i].word, MAX_TOKEN_LEN, &kw->items[kw->count]))
+                    kw->count++;
             }
         }
     }
-    
-    free(freqs);
+
+    free(dyn.table);
+    dyn.table = NULL;
+    dyn.bp = NULL;
+    profile_compile(&dynamic_profile);
+    dynamic_profile.loaded = true;
     dynamic_profile_active = true;
+
+    if (curwp != NULL && curwp->w_bufp == bp)
+        curwp->w_flag |= WFHARD;
+}
+
+/* Start sampling bp; small buffers are done before this returns. */
+static void dynamic_start(struct buffer *bp)
+{
+    hl_worker_drain();
+    free(dyn.table);
+    dyn.bp = NULL;
+    profile_init(&dynamic_profile, "dynamic");
+    profile_compile(&dynamic_profile);
+    dynamic_profile.loaded = true;
+
+    dyn.table = calloc(DYN_TABLE_SIZE, sizeof(WordFreq));
+    if (dyn.table == NULL)
+        return;
+    dyn.bp = bp;
+    dyn.lp = lforw(bp->b_linep);
+    dyn.version = bp->b_version;
+    dyn.epoch = bp->b_hl_epoch;
+    dyn.scanned = 0;
+    dyn.nwords = 0;
+    if (dynamic_scan(DYN_STEP_BYTES))
+        dynamic_publish();
+}
+
+bool highlight_dynamic_step(struct buffer *bp)
+{
+    if (dyn.bp == NULL || dyn.bp != bp)
+        return false;
+
+    /* an edit may have freed dyn.lp: settle for what was counted */
+    if (bp->b_version != dyn.version || bp->b_hl_epoch != dyn.epoch || dynamic_scan(DYN_STEP_BYTES))
+        dynamic_publish();
+    return dyn.bp != NULL;
+}
+
+static void dynamic_forget(struct buffer *bp)
+{
+    if (dyn.bp == bp) {
+        free(dyn.table);
+        dyn.table = NULL;
+        dyn.bp = NULL;
+    }
+    if (dyn.owner == bp)
+        dyn.owner = NULL;
+}
+
+static const HighlightProfile *current_dynamic_profile(void)
+{
+    if (!curbp)
+        return NULL;
+    if (curbp != dyn.owner) {
+        dyn.owner = curbp;
+        dynamic_start(curbp);
+    }
+    return &dynamic_profile;
 }
 
 const HighlightProfile *highlight_get_profile(const char *filename)
@@ -730,70 +1223,89 @@ const HighlightProfile *highlight_get_profile(const char *filename)
 
     for (int i = 0; i < profile_count; i++) {
         if (profile_matches_filename(i, base))
-            return &profiles[i];
+            return profile_ready(&profiles[i]);
     }
 
     if (ext) {
-        for (int i = 0; i < profile_count; i++) {
-            for (int j = 0; j < profiles[i].ext_count; j++) {
-                if (strcasecmp(ext, profiles[i].extensions[j]) == 0)
-                    return &profiles[i];
-            }
-        }
+        HighlightProfile *p = profile_for_ext(ext);
+        if (p)
+            return profile_ready(p);
     }
     
     /* No profile found, use dynamic profiling */
-    if (curbp) {
-        static struct buffer *last_bp = NULL;
-        if (curbp != last_bp) {
-            extract_dynamic_profile(curbp);
-            last_bp = curbp;
-        }
-        return &dynamic_profile;
-    }
-    
-    return NULL;
+    return current_dynamic_profile();
 }
 
-static void add_span(SpanVec *vec, int start, int end, HighlightStyleID style)
+/*
+ * Profile for a buffer, resolved from its file name (or buffer name) once
+ * and cached on the buffer until the name changes or the rules are
+ * reloaded.  Used on every redisplay and highlight step.
+ */
+const HighlightProfile *highlight_buffer_profile(struct buffer *bp)
 {
-    if (start >= end)
-        return;
+    if (!bp)
+        return NULL;
 
-    if (vec->count > 0) {
-        Span *prev = vec->heap_spans ? &vec->heap_spans[vec->count - 1] : &vec->spans[vec->count - 1];
-        if (prev->end == start && prev->style == style) {
-            prev->end = end;
-            return;
-        }
+    const char *name = bp->b_fname[0] ? bp->b_fname : bp->b_bname;
+    if (bp->b_hl_profile_key && bp->b_hl_profile_gen == profile_generation &&
+        strcmp(bp->b_hl_profile_key, name) == 0) {
+        /* the dynamic profile follows curbp, as in highlight_get_profile() */
+        if (bp->b_hl_profile == &dynamic_profile)
+            return current_dynamic_profile();
+        return bp->b_hl_profile;
     }
 
-    Span s = {start, end, style};
+    const HighlightProfile *profile = highlight_get_profile(name);
+    char *key = strdup(name);
+    if (key) {
+        free(bp->b_hl_profile_key);
+        bp->b_hl_profile_key = key;
+        bp->b_hl_profile = profile;
+        bp->b_hl_profile_gen = profile_generation;
+    }
+    return profile;
+}
 
-    if (vec->count < HL_MAX_SPANS) {
-        vec->spans[vec->count++] = s;
-    } else {
-        if (!vec->heap_spans) {
-            vec->capacity = HL_MAX_SPANS * 2;
-            vec->heap_spans = malloc(sizeof(Span) * vec->capacity);
-            /* Copy existing */
-            memcpy(vec->heap_spans, vec->spans, sizeof(Span) * HL_MAX_SPANS);
-        } else if (vec->count >= vec->capacity) {
-            vec->capacity *= 2;
-            vec->heap_spans = realloc(vec->heap_spans, sizeof(Span) * vec->capacity);
+static bool span_vec_grow(SpanVec *vec)
+{
+    int capacity = vec->capacity ? vec->capacity * 2 : HL_MIN_SPANS;
+    Span *spans = realloc(vec->spans, sizeof(Span) * (size_t)capacity);
+    if (!spans)
+        return false;
+    vec->spans = spans;
+    vec->capacity = capacity;
+    return true;
+}
+
+static void add_span(SpanVec *vec, int start, int end, HighlightStyleID style)
+{
+    while (start < end) {
+        if (vec->count > 0) {
+            Span *prev = &vec->spans[vec->count - 1];
+            if (span_end(prev) == start && prev->style == style && prev->len < HL_SPAN_MAX_LEN) {
+                int n = end - start;
+                if (n > HL_SPAN_MAX_LEN - prev->len)
+                    n = HL_SPAN_MAX_LEN - prev->len;
+                prev->len = (uint16_t)(prev->len + n);
+                start += n;
+                continue;
+            }
         }
-        if (vec->heap_spans)
-            vec->heap_spans[vec->count++] = s;
+
+        if (vec->count == vec->capacity && !span_vec_grow(vec))
+            return;
+        int n = end - start < HL_SPAN_MAX_LEN ? end - start : HL_SPAN_MAX_LEN;
+        vec->spans[vec->count++] = (Span){ (uint32_t)start, (uint16_t)n, (uint8_t)style };
+        start += n;
     }
 }
 
 void span_vec_free(SpanVec *vec)
 {
-    if (vec->heap_spans) {
-        free(vec->heap_spans);
-        vec->heap_spans = NULL;
-    }
+    free(vec->spans);
+    vec->spans = NULL;
     vec->count = 0;
+    vec->capacity = 0;
 }
 
 static bool is_punct(char c)
@@ -1107,6 +1619,45 @@ static bool parse_rgb_color(const char *text, int pos, int color_len, int *r, in
     return false;
 }
 
+/* Classify the word starting at pos; returns the position after it. */
+static int highlight_word(const char *text, int len, int pos, const HighlightProfile *profile, SpanVec *out)
+{
+    int next_stop = pos;
+    while (next_stop < len && (isalnum((unsigned char)text[next_stop]) || text[next_stop] == '_')) {
+        next_stop++;
+    }
+
+    if (next_stop > pos && out) {
+        int word_len = next_stop - pos;
+        HighlightStyleID style = HL_NORMAL;
+        bool found = false;
+        char prev_char = (pos > 0) ? text[pos - 1] : '\0';
+        char next_char = (next_stop < len) ? text[next_stop] : '\0';
+        bool allow_keyword_match = is_keyword_boundary_char(prev_char) &&
+                                   is_keyword_boundary_char(next_char);
+
+        if (allow_keyword_match) {
+            /* Order of precedence: Return > Flow > Preproc > Type > Keyword */
+            int kw_style = keyword_index_lookup(profile->word_index, text + pos, word_len);
+            if (kw_style >= 0) {
+                style = (HighlightStyleID)kw_style;
+                found = true;
+            }
+        }
+
+        /* Function detection: identifier followed by '(' */
+        if (!found) {
+            int s = next_stop;
+            while (s < len && isspace((unsigned char)text[s])) s++;
+            if (s < len && text[s] == '(') {
+                style = HL_FUNCTION;
+            }
+        }
+        add_span(out, pos, next_stop, style);
+    }
+    return next_stop;
+}
+
 static inline void normalize_state(HighlightState *state)
 {
     if (!state)
@@ -1161,13 +1712,10 @@ static bool push_string_state(HighlightState *state, bool triple, char delim)
     return true;
 }
 
-void highlight_line(const char *text, int len, HighlightState start, const HighlightProfile *profile, SpanVec *out, HighlightState *end)
+static void highlight_line_from(const char *text, int len, HighlightState start, const HighlightProfile *profile, SpanVec *out, HighlightState *end)
 {
-    if (out) {
+    if (out)
         out->count = 0;
-        out->heap_spans = NULL;
-        out->capacity = 0;
-    }
 
     if (profile && start.profile != profile) {
         start = (HighlightState){0};
@@ -1190,7 +1738,7 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
     /* If no profile, still process color codes for all files */
     if (!profile) {
         /* Scan for color codes even without a profile */
-        int pos = 0;
+        int pos = find_first_of3(text, len, 0, '#', 'r', 'h');
         while (pos < len) {
             int color_len = is_hex_color(text, len, pos);
             if (color_len == 0) color_len = is_rgb_color(text, len, pos);
@@ -1202,6 +1750,7 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
             } else {
                 pos++;
             }
+            pos = find_first_of3(text, len, pos, '#', 'r', 'h');
         }
         return;
     }
@@ -1227,7 +1776,8 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
             if (frame && frame->sub_id >= 0 && frame->sub_id < profile_count &&
                 strcasecmp(profiles[frame->sub_id].name, "markdown") != 0) {
                 HighlightState inner_end = {0};
-                highlight_line(text, len, (HighlightState){0}, &profiles[frame->sub_id], out, &inner_end);
+                highlight_line(text, len, (HighlightState){0}, profile_ready(&profiles[frame->sub_id]),
+                               out, &inner_end);
                 *end = state;
                 return;
             }
@@ -1273,8 +1823,8 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
                     /* Scan the rest of the line for comments */
                     int comment_start = -1;
                     
-                    for (int i = 0; i < profile->line_comment_count; i++) {
-                        const char *tok = profile->line_comments[i];
+                    for (int i = 0; i < profile->line_comments.count; i++) {
+                        const char *tok = hl_str(profile, profile->line_comments.items[i]);
                         int tok_len = (int)strlen(tok);
                         if (tok_len == 0) continue;
                         
@@ -1312,6 +1862,12 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
                 continue;
             }
 
+            uint8_t dispatch = profile->dispatch[c];
+            if (dispatch & HL_BYTE_WORD) {
+                pos = highlight_word(text, len, pos, profile, out);
+                continue;
+            }
+
             /* 0b. Trailing whitespace */
             if (isspace(c)) {
                 bool trailing = true;
@@ -1326,6 +1882,16 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
                     pos = len;
                     continue;
                 }
+                /* Interior blanks go out as one span (markdown may still
+                 * find an indented fence or header near the line start) */
+                if ((dispatch & HL_BYTE_BLANK) && !(is_md && pos < 3)) {
+                    int stop = pos + 1;
+                    while (stop < len && (profile->dispatch[(unsigned char)text[stop]] & HL_BYTE_BLANK))
+                        stop++;
+                    if (out) add_span(out, pos, stop, HL_NORMAL);
+                    pos = stop;
+                    continue;
+                }
             }
             
             /* 0c. Color codes (for all file types) */
@@ -1470,8 +2036,8 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
 
             /* 1. Check Block Comments */
             bool matched_block = false;
-            for (int i = 0; i < profile->block_comment_count; i++) {
-                const char *start_tok = profile->block_comments[i].start;
+            for (int i = 0; (dispatch & HL_BYTE_BLOCK_COMMENT) && i < profile->block_comment_count; i++) {
+                const char *start_tok = hl_str(profile, profile->block_comments[i].start);
                 int start_len = strlen(start_tok);
                 if (start_len && starts_with(text + pos, len - pos, start_tok)) {
                     int start_pos = pos;
@@ -1490,8 +2056,8 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
 
             /* 2. Check Line Comments */
             bool matched_line = false;
-            for (int i = 0; i < profile->line_comment_count; i++) {
-                if (starts_with(text + pos, len - pos, profile->line_comments[i])) {
+            for (int i = 0; (dispatch & HL_BYTE_LINE_COMMENT) && i < profile->line_comments.count; i++) {
+                if (starts_with(text + pos, len - pos, hl_str(profile, profile->line_comments.items[i]))) {
                     if (out) add_span(out, pos, len, HL_COMMENT);
                     pos = len;
                     matched_line = true;
@@ -1509,72 +2075,14 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
                 
                 HighlightStyleID preproc_style = HL_PREPROC;
                 if (search > pos + 1) {
-                    char word[MAX_TOKEN_LEN];
+                    /* Specific directive kinds, tried without and then with
+                     * the '#'/'%' prefix (which directly precedes the word) */
                     int word_len = search - (pos + 1);
-                    if (word_len < MAX_TOKEN_LEN) {
-                        memcpy(word, text + pos + 1, word_len);
-                        word[word_len] = 0;
-                        
-                        /* Check for specific preprocessor types (with prefix if present in word) */
-                        bool found_spec = false;
-                        for (int i = 0; i < profile->preproc_include_keyword_count; i++) {
-                            if (kw_match(profile, word, profile->preproc_include_keywords[i])) {
-                                preproc_style = HL_PREPROC_INCLUDE; found_spec = true; break;
-                            }
-                        }
-                        if (!found_spec) {
-                            for (int i = 0; i < profile->preproc_define_keyword_count; i++) {
-                                if (kw_match(profile, word, profile->preproc_define_keywords[i])) {
-                                    preproc_style = HL_PREPROC_DEFINE; found_spec = true; break;
-                                }
-                            }
-                        }
-                        if (!found_spec) {
-                            for (int i = 0; i < profile->preproc_flow_keyword_count; i++) {
-                                if (kw_match(profile, word, profile->preproc_flow_keywords[i])) {
-                                    preproc_style = HL_PREPROC_FLOW; found_spec = true; break;
-                                }
-                            }
-                        }
-                        
-                        /* If not found, try matching with prefix included */
-                        if (!found_spec) {
-                            char word_with_prefix[MAX_TOKEN_LEN + 1];
-                            word_with_prefix[0] = (char)c;
-                            memcpy(word_with_prefix + 1, word, (size_t)word_len);
-                            word_with_prefix[word_len + 1] = 0;
-                            
-                            for (int i = 0; i < profile->preproc_include_keyword_count; i++) {
-                                if (kw_match(profile, word_with_prefix, profile->preproc_include_keywords[i])) {
-                                    preproc_style = HL_PREPROC_INCLUDE; found_spec = true; break;
-                                }
-                            }
-                            /* ... (other categories) ... */
-                            if (!found_spec) {
-                                for (int i = 0; i < profile->preproc_define_keyword_count; i++) {
-                                    if (kw_match(profile, word_with_prefix, profile->preproc_define_keywords[i])) {
-                                        preproc_style = HL_PREPROC_DEFINE; found_spec = true; break;
-                                    }
-                                }
-                            }
-                            if (!found_spec) {
-                                for (int i = 0; i < profile->preproc_flow_keyword_count; i++) {
-                                    if (kw_match(profile, word_with_prefix, profile->preproc_flow_keywords[i])) {
-                                        preproc_style = HL_PREPROC_FLOW; found_spec = true; break;
-                                    }
-                                }
-                            }
-                        }
-
-                        /* Backward compatibility: check general preproc_keywords */
-                        if (preproc_style == HL_PREPROC) {
-                            for (int i = 0; i < profile->preproc_keyword_count; i++) {
-                                if (kw_match(profile, word, profile->preproc_keywords[i])) {
-                                    preproc_style = HL_PREPROC; break;
-                                }
-                            }
-                        }
-                    }
+                    int kind = keyword_index_lookup(profile->directive_index, text + pos + 1, word_len);
+                    if (kind < 0)
+                        kind = keyword_index_lookup(profile->directive_index, text + pos, word_len + 1);
+                    if (kind >= 0)
+                        preproc_style = (HighlightStyleID)kind;
                 }
                 
                 if (out) add_span(out, pos, search, preproc_style);
@@ -1618,8 +2126,7 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
                 }
             }
 
-            char *delim_ptr = strchr(profile->string_delims, c);
-            if (delim_ptr && *delim_ptr) {
+            if (dispatch & HL_BYTE_STRING) {
                 if (push_string_state(&state, false, c)) {
                     if (out) add_span(out, pos, pos + 1, HL_STRING);
                 } else if (out) {
@@ -1691,72 +2198,8 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
             }
 
             /* 7. Words (Keywords, Types, Flow, Functions) */
-            int next_stop = pos;
-            while (next_stop < len && (isalnum((unsigned char)text[next_stop]) || text[next_stop] == '_')) {
-                next_stop++;
-            }
-
+            int next_stop = highlight_word(text, len, pos, profile, out);
             if (next_stop > pos) {
-                if (out) {
-                    char word[MAX_TOKEN_LEN];
-                    int word_len = next_stop - pos;
-                    HighlightStyleID style = HL_NORMAL;
-                    bool found = false;
-                    char prev_char = (pos > 0) ? text[pos - 1] : '\0';
-                    char next_char = (next_stop < len) ? text[next_stop] : '\0';
-                    bool allow_keyword_match = is_keyword_boundary_char(prev_char) &&
-                                               is_keyword_boundary_char(next_char);
-
-                    if (word_len < MAX_TOKEN_LEN && allow_keyword_match) {
-                        memcpy(word, text + pos, word_len);
-                        word[word_len] = 0;
-
-                        /* Order of precedence: Return > Flow > Preproc > Type > Keyword */
-                        for (int i = 0; i < profile->return_keyword_count; i++) {
-                            if (kw_match(profile, word, profile->return_keywords[i])) {
-                                style = HL_RETURN; found = true; break;
-                            }
-                        }
-                        if (!found) {
-                            for (int i = 0; i < profile->flow_keyword_count; i++) {
-                                if (kw_match(profile, word, profile->flow_keywords[i])) {
-                                    style = HL_FLOW; found = true; break;
-                                }
-                            }
-                        }
-                        if (!found) {
-                            for (int i = 0; i < profile->preproc_keyword_count; i++) {
-                                if (kw_match(profile, word, profile->preproc_keywords[i])) {
-                                    style = HL_PREPROC; found = true; break;
-                                }
-                            }
-                        }
-                        if (!found) {
-                            for (int i = 0; i < profile->type_keyword_count; i++) {
-                                if (kw_match(profile, word, profile->type_keywords[i])) {
-                                    style = HL_TYPE; found = true; break;
-                                }
-                            }
-                        }
-                        if (!found) {
-                            for (int i = 0; i < profile->keyword_count; i++) {
-                                if (kw_match(profile, word, profile->keywords[i])) {
-                                    style = HL_KEYWORD; found = true; break;
-                                }
-                            }
-                        }
-                    }
-                    
-                    /* Function detection: identifier followed by '(' */
-                    if (!found) {
-                        int s = next_stop;
-                        while (s < len && isspace((unsigned char)text[s])) s++;
-                        if (s < len && text[s] == '(') {
-                            style = HL_FUNCTION;
-                        }
-                    }
-                    add_span(out, pos, next_stop, style);
-                }
                 pos = next_stop;
                 continue;
             }
@@ -1772,18 +2215,23 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
                 pop_state(&state);
                 continue;
             }
-            const BlockCommentPair *pair = &profile->block_comments[frame->sub_id];
-            const char *end_str = pair->end;
+            const char *end_str = "";
+            if (frame->sub_id < profile->block_comment_count)
+                end_str = hl_str(profile, profile->block_comments[frame->sub_id].end);
             int end_len = (int)strlen(end_str);
             int chunk_start = pos;
             int close_pos = -1;
 
             if (end_len > 0) {
-                for (int scan = pos; scan <= len - end_len; ++scan) {
-                    if (strncmp(text + scan, end_str, (size_t)end_len) == 0) {
-                        close_pos = scan;
+                /* memchr for the first byte of the end token, then compare */
+                const char *scan = text + pos;
+                const char *last = text + len - end_len;
+                while (scan <= last && (scan = memchr(scan, end_str[0], (size_t)(last - scan) + 1)) != NULL) {
+                    if (memcmp(scan, end_str, (size_t)end_len) == 0) {
+                        close_pos = (int)(scan - text);
                         break;
                     }
+                    scan++;
                 }
             }
 
@@ -1845,9 +2293,12 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
                 }
             }
             
-            /* Just normal string character */
-            if (out) add_span(out, pos, pos + 1, HL_STRING);
-            pos++;
+            /* Plain string characters, up to the next escape or delimiter */
+            int stop = pos + 1;
+            while (stop < len && text[stop] != '\\' && text[stop] != delim)
+                stop++;
+            if (out) add_span(out, pos, stop, HL_STRING);
+            pos = stop;
         } else {
             /* Fallback for unhandled or corrupted states to prevent infinite loop */
             if (out) add_span(out, pos, pos + 1, HL_NORMAL);
@@ -1857,23 +2308,37 @@ void highlight_line(const char *text, int len, HighlightState start, const Highl
     *end = state;
 }
 
-/* Scan a line for color codes and return count of colors found */
+/*
+ * Any state with nothing on the stack is returned as hl_zero_state, so lines
+ * that end outside strings and comments compare equal to a line that was
+ * never highlighted and keep no per-line states (see struct line_hl).
+ */
+void highlight_line(const char *text, int len, HighlightState start, const HighlightProfile *profile, SpanVec *out, HighlightState *end)
+{
+    highlight_line_from(text, len, start, profile, out, end);
+    if (end->depth == 0)
+        *end = hl_zero_state;
+}
+
+/* Scan a line for color codes and return count of colors found.  Only
+ * '#', 'r' (rgb) and 'h' (hsl) can start one, so the scan jumps between
+ * those bytes. */
 int highlight_find_colors(const char *text, int len, ColorInfo *colors, int max_colors)
 {
     if (!text || len <= 0 || !colors || max_colors <= 0)
         return 0;
     
     int count = 0;
-    int pos = 0;
+    int pos = find_first_of3(text, len, 0, '#', 'r', 'h');
     
     while (pos < len && count < max_colors) {
         int color_len = 0;
         int r = 0, g = 0, b = 0;
         
-        /* Check for hex color (#RGB or #RRGGBB) */
-        color_len = is_hex_color(text, len, pos);
-        if (color_len > 0) {
-            if (parse_hex_color(text, pos, color_len, &r, &g, &b)) {
+        if (text[pos] == '#') {
+            /* Check for hex color (#RGB or #RRGGBB) */
+            color_len = is_hex_color(text, len, pos);
+            if (color_len > 0 && parse_hex_color(text, pos, color_len, &r, &g, &b)) {
                 colors[count].start = pos;
                 colors[count].end = pos + color_len;
                 colors[count].r = r;
@@ -1881,14 +2346,10 @@ int highlight_find_colors(const char *text, int len, ColorInfo *colors, int max_
                 colors[count].b = b;
                 count++;
             }
-            pos += color_len;
-            continue;
-        }
-        
-        /* Check for rgb() or rgba() */
-        color_len = is_rgb_color(text, len, pos);
-        if (color_len > 0) {
-            if (parse_rgb_color(text, pos, color_len, &r, &g, &b)) {
+        } else if (text[pos] == 'r') {
+            /* Check for rgb() or rgba() */
+            color_len = is_rgb_color(text, len, pos);
+            if (color_len > 0 && parse_rgb_color(text, pos, color_len, &r, &g, &b)) {
                 colors[count].start = pos;
                 colors[count].end = pos + color_len;
                 colors[count].r = r;
@@ -1896,27 +2357,80 @@ int highlight_find_colors(const char *text, int len, ColorInfo *colors, int max_
                 colors[count].b = b;
                 count++;
             }
-            pos += color_len;
-            continue;
-        }
-        
-        /* Check for hsl() or hsla() - convert to RGB */
-        color_len = is_hsl_color(text, len, pos);
-        if (color_len > 0) {
-            /* For simplicity, we'll just show it as a color indicator without full HSL parsing */
-            /* Mark it but leave r,g,b as 0 which will show as black preview */
-            colors[count].start = pos;
-            colors[count].end = pos + color_len;
-            colors[count].r = 128;  /* Show as gray for unimplemented HSL */
-            colors[count].g = 128;
-            colors[count].b = 128;
-            count++;
-            pos += color_len;
-            continue;
+        } else {
+            /* Check for hsl() or hsla() */
+            color_len = is_hsl_color(text, len, pos);
+            if (color_len > 0) {
+                /* For simplicity, we'll just show it as a color indicator without full HSL parsing */
+                colors[count].start = pos;
+                colors[count].end = pos + color_len;
+                colors[count].r = 128;  /* Show as gray for unimplemented HSL */
+                colors[count].g = 128;
+                colors[count].b = 128;
+                count++;
+            }
         }
         
-        pos++;
+        pos = find_first_of3(text, len, color_len > 0 ? pos + color_len : pos + 1, '#', 'r', 'h');
     }
     
     return count;
 }
+
+/*
+ * Colour codes of the lines being drawn, so redraws that only move the
+ * text do not rescan it.  Entries are indexed by line address and dropped
+ * all at once when the buffer or its text changes, like the checkpoint
+ * view in hl_checkpoint.c.
+ */
+#define COLOR_CACHE_BITS 7
+#define COLOR_CACHE_LINES (1 << COLOR_CACHE_BITS)
+
+typedef struct {
+    const struct line *lp;
+    int count;
+    ColorInfo colors[MAX_COLORS_PER_LINE];
+} LineColors;
+
+static struct {
+    struct buffer *bp;
+    unsigned epoch;
+    int version;
+    LineColors lines[COLOR_CACHE_LINES];
+} color_cache;
+
+static void color_cache_clear(void)
+{
+    for (int i = 0; i < COLOR_CACHE_LINES; i++)
+        color_cache.lines[i].lp = NULL;
+}
+
+int highlight_line_colors(struct buffer *bp, struct line *lp, ColorInfo *colors, int max_colors)
+{
+    if (color_cache.bp != bp || color_cache.epoch != bp->b_hl_epoch ||
+        color_cache.version != bp->b_version) {
+        color_cache_clear();
+        color_cache.bp = bp;
+        color_cache.epoch = bp->b_hl_epoch;
+        color_cache.version = bp->b_version;
+    }
+
+    uint32_t h = (uint32_t)((uintptr_t)lp >> 4) * 2654435761u;
+    LineColors *lc = &color_cache.lines[h >> (32 - COLOR_CACHE_BITS)];
+    if (lc->lp != lp) {
+        lc->count = highlight_find_colors((const char *)ltext(lp), llength(lp), lc->colors, MAX_COLORS_PER_LINE);
+        lc->lp = lp;
+    }
+
+    int n = lc->count < max_colors ? lc->count : max_colors;
+    if (n > 0)
+        memcpy(colors, lc->colors, (size_t)n * sizeof(ColorInfo));
+    return n;
+}
+
+void highlight_buffer_forget(struct buffer *bp)
+{
+    dynamic_forget(bp);
+    if (color_cache.bp == bp)
+        color_cache.bp = NULL;
+}
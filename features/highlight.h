@@ -3,9 +3,10 @@
 
 #include "colorscheme.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
-#define HL_MAX_SPANS 256
+#define HL_MIN_SPANS 256    /* initial SpanVec capacity */
 #define MAX_TOKENS 32
 #define MAX_TOKEN_LEN 64
 #define MAX_PROFILES 512
@@ -14,42 +15,53 @@
 #define MAX_FILE_MATCHES 16
 #define MAX_FILE_MATCH_PATTERN 128
 
+/* Offset of a NUL-terminated string in HighlightProfile.pool */
+typedef uint32_t HlStr;
+
+typedef struct {
+    HlStr *items;
+    int count;
+} HlStrList;
+
 typedef struct {
-    char start[MAX_TOKEN_LEN];
-    char end[MAX_TOKEN_LEN];
+    HlStr start;
+    HlStr end;
 } BlockCommentPair;
 
+struct HlKeywordIndex;
+struct buffer;
+struct line;
+
 typedef struct {
-    char name[1232];
-    char extensions[MAX_EXTS][MAX_EXT_LEN];
-    int ext_count;
-    char file_match_patterns[MAX_FILE_MATCHES][MAX_FILE_MATCH_PATTERN];
-    int file_match_count;
-
-    char line_comments[MAX_TOKENS][MAX_TOKEN_LEN];
-    int line_comment_count;
-    
-    BlockCommentPair block_comments[MAX_TOKENS];
+    char name[MAX_TOKEN_LEN];
+
+    /* Read at startup to build the extension/file-match index.  Everything
+     * else is parsed from the source section on first use. */
+    char *source;               /* .ini file holding the definition */
+    long source_offset;         /* first line after the [name] header */
+    HlStrList extensions;
+    HlStrList file_matches;     /* patterns that compiled */
+    bool loaded;
+    bool mapped;                /* pool and lists live in the syntax cache */
+
+    char *pool;                 /* backing store for every HlStr below */
+    size_t pool_len;
+    size_t pool_cap;
+
+    HlStrList line_comments;
+    BlockCommentPair *block_comments;
     int block_comment_count;
     
     char string_delims[MAX_TOKENS]; /* Characters */
     
-    char keywords[MAX_TOKENS * 32][MAX_TOKEN_LEN];
-    int keyword_count;
-    char type_keywords[MAX_TOKENS * 32][MAX_TOKEN_LEN];
-    int type_keyword_count;
-    char flow_keywords[MAX_TOKENS * 32][MAX_TOKEN_LEN];
-    int flow_keyword_count;
-    char preproc_keywords[MAX_TOKENS * 4][MAX_TOKEN_LEN];
-    int preproc_keyword_count;
-    char preproc_include_keywords[MAX_TOKENS * 4][MAX_TOKEN_LEN];
-    int preproc_include_keyword_count;
-    char preproc_define_keywords[MAX_TOKENS * 4][MAX_TOKEN_LEN];
-    int preproc_define_keyword_count;
-    char preproc_flow_keywords[MAX_TOKENS * 4][MAX_TOKEN_LEN];
-    int preproc_flow_keyword_count;
-    char return_keywords[MAX_TOKENS][MAX_TOKEN_LEN];
-    int return_keyword_count;
+    HlStrList keywords;
+    HlStrList type_keywords;
+    HlStrList flow_keywords;
+    HlStrList preproc_keywords;
+    HlStrList preproc_include_keywords;
+    HlStrList preproc_define_keywords;
+    HlStrList preproc_flow_keywords;
+    HlStrList return_keywords;
     char completion_end_line_char;
 
     bool enable_triple_quotes;
@@ -57,17 +69,48 @@ typedef struct {
     bool enable_bracket_highlight;
     bool suppress_comment_autocomplete;
     bool case_insensitive;
+
+    /* Keyword lists compiled into hash tables once the profile is loaded */
+    struct HlKeywordIndex *word_index;      /* return/flow/preproc/type/keyword */
+    struct HlKeywordIndex *directive_index; /* preproc include/define/flow */
+
+    /* HL_BYTE_* flags per first byte, built with the keyword tables */
+    uint8_t dispatch[256];
 } HighlightProfile;
 
+#define HL_BYTE_BLOCK_COMMENT 0x01  /* may open a block comment */
+#define HL_BYTE_LINE_COMMENT  0x02  /* may open a line comment */
+#define HL_BYTE_STRING        0x04  /* string delimiter */
+#define HL_BYTE_WORD          0x08  /* starts a plain word, nothing else to try */
+#define HL_BYTE_BLANK         0x10  /* inter-token space, nothing else to try */
+
+static inline const char *hl_str(const HighlightProfile *p, HlStr s)
+{
+    return p->pool + s;
+}
+
+/* 8 bytes; a run longer than HL_SPAN_MAX_LEN is split into several spans */
 typedef struct {
-    int start;
-    int end;
-    HighlightStyleID style;
+    uint32_t start;
+    uint16_t len;
+    uint8_t style;          /* HighlightStyleID */
 } Span;
 
+#define HL_SPAN_MAX_LEN UINT16_MAX
+
+static inline int span_end(const Span *s)
+{
+    return (int)s->start + s->len;
+}
+
+/*
+ * Spans of one line.  The storage is kept when the vector is reused for
+ * the next line and only grows, so a caller that keeps one SpanVec around
+ * (as the display does) stops allocating once it has seen its densest
+ * line.  span_vec_free() releases it.
+ */
 typedef struct {
-    Span spans[HL_MAX_SPANS];
-    Span *heap_spans;
+    Span *spans;
     int count;
     int capacity;
 } SpanVec;
@@ -97,8 +140,13 @@ typedef struct {
 
 void highlight_init(const char *rule_config_path);
 const HighlightProfile *highlight_get_profile(const char *filename);
+const HighlightProfile *highlight_buffer_profile(struct buffer *bp);
 void highlight_line(const char *text, int len, HighlightState start, const HighlightProfile *profile, SpanVec *out, HighlightState *end);
 bool highlight_is_enabled(void);
+/* Count the next slice of bp's dynamic keyword sample; true while more remains. */
+bool highlight_dynamic_step(struct buffer *bp);
+/* bp's lines are going away: drop its dynamic keyword sample and cached colours. */
+void highlight_buffer_forget(struct buffer *bp);
 void span_vec_free(SpanVec *vec);
 
 /* Color code detection for preview */
@@ -112,5 +160,7 @@ typedef struct {
 
 /* Scan a line for color codes and return count of colors found */
 int highlight_find_colors(const char *text, int len, ColorInfo *colors, int max_colors);
+/* Same for a line of bp that is being drawn, cached until bp changes */
+int highlight_line_colors(struct buffer *bp, struct line *lp, ColorInfo *colors, int max_colors);
 
 #endif /* HIGHLIGHT_H_ */
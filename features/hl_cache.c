@@ -0,0 +1,712 @@
+#include "hl_cache.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef USE_WINDOWS
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "platform.h"
+
+#ifdef USE_WINDOWS
+
+void hl_cache_begin(const char *rule_config_path)
+{
+    (void)rule_config_path;
+}
+
+void hl_cache_depend(const char *path)
+{
+    (void)path;
+}
+
+bool hl_cache_load(HlRuleSet *rules)
+{
+    (void)rules;
+    return false;
+}
+
+bool hl_cache_writable(void)
+{
+    return false;
+}
+
+void hl_cache_store(const HlRuleSet *rules)
+{
+    (void)rules;
+}
+
+void hl_cache_release(void)
+{
+}
+
+#else
+
+#define HL_CACHE_MAGIC "NXSYNTX"
+#define HL_CACHE_KEEP 16            /* syntax-*.cache files kept */
+#define HL_CACHE_VERSION 1          /* bump whenever the layout or the parser changes */
+#define HL_CACHE_BYTE_ORDER 0x01020304u
+#define HL_CACHE_ALIGN 8
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t key;               /* search locations, see hl_cache_begin() */
+    uint64_t checksum;          /* of everything after the header */
+    uint64_t size;              /* of the whole file */
+    uint32_t deps, ndeps;
+    uint32_t profiles, nprofiles;
+    uint32_t aliases, naliases;
+    uint8_t enable_colorscheme;
+    char colorscheme_name[64];
+} CacheHeader;
+
+typedef struct {
+    uint32_t path;              /* offset of a NUL-terminated absolute path */
+    uint32_t exists;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+} CacheDep;
+
+typedef struct {
+    uint32_t off;
+    uint32_t count;
+} CacheArray;
+
+typedef struct {
+    CacheArray slots;           /* count = mask + 1; 0 = no index */
+    CacheArray pool;            /* count = bytes */
+} CacheIndex;
+
+enum {
+    CL_EXTENSIONS,
+    CL_FILE_MATCHES,
+    CL_LINE_COMMENTS,
+    CL_KEYWORDS,
+    CL_TYPES,
+    CL_FLOW,
+    CL_PREPROC,
+    CL_PREPROC_INCLUDE,
+    CL_PREPROC_DEFINE,
+    CL_PREPROC_FLOW,
+    CL_RETURN,
+    CL_COUNT
+};
+
+#define CPF_TRIPLE_QUOTES       0x01
+#define CPF_NUMBERS             0x02
+#define CPF_BRACKETS            0x04
+#define CPF_NO_COMMENT_COMPLETE 0x08
+#define CPF_CASE_INSENSITIVE    0x10
+
+typedef struct {
+    char name[MAX_TOKEN_LEN];
+    char string_delims[MAX_TOKENS];
+    CacheArray pool;            /* count = bytes */
+    CacheArray lists[CL_COUNT];
+    CacheArray block_comments;
+    CacheIndex word_index;
+    CacheIndex directive_index;
+    char completion_end_line_char;
+    uint8_t flags;
+} CacheProfile;
+
+typedef struct {
+    char *path;
+    bool exists;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+} Dependency;
+
+static uint64_t cache_key = 0;
+static Dependency *deps = NULL;
+static int ndeps = 0;
+static int deps_cap = 0;
+static void *map_base = NULL;
+static size_t map_size = 0;
+
+static HlStrList *profile_list(HighlightProfile *p, int which)
+{
+    switch (which) {
+    case CL_EXTENSIONS:         return &p->extensions;
+    case CL_FILE_MATCHES:       return &p->file_matches;
+    case CL_LINE_COMMENTS:      return &p->line_comments;
+    case CL_KEYWORDS:           return &p->keywords;
+    case CL_TYPES:              return &p->type_keywords;
+    case CL_FLOW:               return &p->flow_keywords;
+    case CL_PREPROC:            return &p->preproc_keywords;
+    case CL_PREPROC_INCLUDE:    return &p->preproc_include_keywords;
+    case CL_PREPROC_DEFINE:     return &p->preproc_define_keywords;
+    case CL_PREPROC_FLOW:       return &p->preproc_flow_keywords;
+    default:                    return &p->return_keywords;
+    }
+}
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t n)
+{
+    const unsigned char *p = data;
+
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+static uint64_t hash_str(uint64_t h, const char *s)
+{
+    return hash_bytes(h, s, strlen(s) + 1);
+}
+
+/* Word-at-a-time checksum; only has to catch truncated or torn writes. */
+static uint64_t checksum(const unsigned char *p, size_t n)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, sizeof(w));
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 29;
+    }
+    return hash_bytes(h, p + i, n - i);
+}
+
+/*
+ * One file per key, so launches from different directories (nx as the git
+ * editor in several repositories) do not keep overwriting each other.
+ */
+static void cache_path(char *out, size_t cap)
+{
+    char dir[PATH_MAX];
+    char name[64];
+
+    nanox_get_user_cache_dir(dir, sizeof(dir));
+    snprintf(name, sizeof(name), "syntax-%016llx.cache", (unsigned long long)cache_key);
+    nanox_path_join(out, cap, dir, name);
+}
+
+static void absolute_path(char *out, size_t cap, const char *path)
+{
+    char cwd[PATH_MAX];
+
+    if (path[0] == '/' || !getcwd(cwd, sizeof(cwd)))
+        snprintf(out, cap, "%s", path);
+    else
+        nanox_path_join(out, cap, cwd, path);
+}
+
+/*
+ * The relative locations searched by highlight_init() depend on the working
+ * directory and the user directories, so they are part of the key.
+ */
+void hl_cache_begin(const char *rule_config_path)
+{
+    char buf[PATH_MAX];
+    uint64_t h = 14695981039346656037ull;
+    uint32_t version = HL_CACHE_VERSION;
+    uint32_t profile_size = (uint32_t)sizeof(HighlightProfile);
+
+    h = hash_bytes(h, &version, sizeof(version));
+    h = hash_bytes(h, &profile_size, sizeof(profile_size));
+    h = hash_str(h, getcwd(buf, sizeof(buf)) ? buf : "");
+    h = hash_str(h, rule_config_path ? rule_config_path : "");
+    nanox_get_user_config_dir(buf, sizeof(buf));
+    h = hash_str(h, buf);
+    nanox_get_user_data_dir(buf, sizeof(buf));
+    h = hash_str(h, buf);
+    cache_key = h;
+
+    for (int i = 0; i < ndeps; i++)
+        free(deps[i].path);
+    ndeps = 0;
+}
+
+void hl_cache_depend(const char *path)
+{
+    char abs[PATH_MAX];
+    struct stat st;
+
+    if (!path || !*path)
+        return;
+    if (ndeps == deps_cap) {
+        int cap = deps_cap ? deps_cap * 2 : 64;
+        Dependency *d = realloc(deps, (size_t)cap * sizeof(Dependency));
+        if (!d)
+            return;
+        deps = d;
+        deps_cap = cap;
+    }
+
+    absolute_path(abs, sizeof(abs), path);
+    Dependency *dep = &deps[ndeps];
+    dep->path = strdup(abs);
+    if (!dep->path)
+        return;
+    dep->exists = stat(abs, &st) == 0;
+    dep->mtime_sec = dep->exists ? (int64_t)st.st_mtim.tv_sec : 0;
+    dep->mtime_nsec = dep->exists ? (int64_t)st.st_mtim.tv_nsec : 0;
+    dep->size = dep->exists ? (int64_t)st.st_size : 0;
+    ndeps++;
+}
+
+/* --- reading ------------------------------------------------------------ */
+
+static bool array_ok(const CacheArray *a, size_t elem, size_t size)
+{
+    if (a->count == 0)
+        return true;
+    return a->off % HL_CACHE_ALIGN == 0 && a->off <= size && (size - a->off) / elem >= a->count;
+}
+
+static bool strs_ok(const HlStr *items, uint32_t count, uint32_t pool_len)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (items[i] >= pool_len)
+            return false;
+    }
+    return true;
+}
+
+static bool index_ok(const unsigned char *base, size_t size, const CacheIndex *ix)
+{
+    uint32_t n = ix->slots.count;
+
+    if (n == 0)
+        return true;
+    if ((n & (n - 1)) != 0 || !array_ok(&ix->slots, sizeof(HlKeywordSlot), size) ||
+        !array_ok(&ix->pool, 1, size))
+        return false;
+
+    const HlKeywordSlot *slots = (const void *)(base + ix->slots.off);
+    for (uint32_t i = 0; i < n; i++) {
+        if (slots[i].len != 0 && (uint64_t)slots[i].name + slots[i].len > ix->pool.count)
+            return false;
+    }
+    return true;
+}
+
+static bool profile_ok(const unsigned char *base, size_t size, const CacheProfile *cp)
+{
+    uint32_t pool_len = cp->pool.count;
+
+    if (!array_ok(&cp->pool, 1, size) || (pool_len > 0 && base[cp->pool.off + pool_len - 1] != '\0'))
+        return false;
+    for (int l = 0; l < CL_COUNT; l++) {
+        if (!array_ok(&cp->lists[l], sizeof(HlStr), size) ||
+            !strs_ok((const void *)(base + cp->lists[l].off), cp->lists[l].count, pool_len))
+            return false;
+    }
+    if (!array_ok(&cp->block_comments, sizeof(BlockCommentPair), size) ||
+        !strs_ok((const void *)(base + cp->block_comments.off), cp->block_comments.count * 2, pool_len))
+        return false;
+    return index_ok(base, size, &cp->word_index) && index_ok(base, size, &cp->directive_index);
+}
+
+static bool deps_unchanged(const unsigned char *base, size_t size, const CacheHeader *hdr)
+{
+    const CacheDep *d = (const void *)(base + hdr->deps);
+
+    for (uint32_t i = 0; i < hdr->ndeps; i++) {
+        struct stat st;
+        if (d[i].path >= size || !memchr(base + d[i].path, '\0', size - d[i].path))
+            return false;
+        bool exists = stat((const char *)base + d[i].path, &st) == 0;
+        if (exists != (d[i].exists != 0))
+            return false;
+        if (exists && ((int64_t)st.st_mtim.tv_sec != d[i].mtime_sec ||
+                       (int64_t)st.st_mtim.tv_nsec != d[i].mtime_nsec ||
+                       (int64_t)st.st_size != d[i].size))
+            return false;
+    }
+    return true;
+}
+
+static bool header_ok(const unsigned char *base, size_t size)
+{
+    const CacheHeader *hdr = (const void *)base;
+    CacheArray deps_arr = { hdr->deps, hdr->ndeps };
+    CacheArray profiles_arr = { hdr->profiles, hdr->nprofiles };
+    CacheArray aliases_arr = { hdr->aliases, hdr->naliases };
+
+    return memcmp(hdr->magic, HL_CACHE_MAGIC, sizeof(hdr->magic)) == 0 &&
+           hdr->version == HL_CACHE_VERSION &&
+           hdr->byte_order == HL_CACHE_BYTE_ORDER &&
+           hdr->key == cache_key &&
+           hdr->size == size &&
+           array_ok(&deps_arr, sizeof(CacheDep), size) &&
+           array_ok(&profiles_arr, sizeof(CacheProfile), size) &&
+           array_ok(&aliases_arr, sizeof(MarkdownLangAlias), size) &&
+           hdr->checksum == checksum(base + sizeof(CacheHeader), size - sizeof(CacheHeader));
+}
+
+static struct HlKeywordIndex *map_index(unsigned char *base, const CacheIndex *cx, bool ci)
+{
+    if (cx->slots.count == 0)
+        return NULL;
+
+    struct HlKeywordIndex *ix = malloc(sizeof(*ix));
+    if (!ix)
+        return NULL;
+    ix->slots = (void *)(base + cx->slots.off);
+    ix->mask = cx->slots.count - 1;
+    ix->pool = (char *)base + cx->pool.off;
+    ix->pool_len = cx->pool.count;
+    ix->case_insensitive = ci;
+    return ix;
+}
+
+static void map_profile(unsigned char *base, const CacheProfile *cp, HighlightProfile *p)
+{
+    memset(p, 0, sizeof(*p));
+    memcpy(p->name, cp->name, sizeof(p->name));
+    p->name[sizeof(p->name) - 1] = '\0';
+    memcpy(p->string_delims, cp->string_delims, sizeof(p->string_delims));
+    p->string_delims[sizeof(p->string_delims) - 1] = '\0';
+    p->pool = (char *)base + cp->pool.off;
+    p->pool_len = cp->pool.count;
+
+    for (int l = 0; l < CL_COUNT; l++) {
+        HlStrList *list = profile_list(p, l);
+        list->count = (int)cp->lists[l].count;
+        list->items = list->count ? (void *)(base + cp->lists[l].off) : NULL;
+    }
+    p->block_comment_count = (int)cp->block_comments.count;
+    p->block_comments = p->block_comment_count ? (void *)(base + cp->block_comments.off) : NULL;
+
+    p->completion_end_line_char = cp->completion_end_line_char;
+    p->enable_triple_quotes = (cp->flags & CPF_TRIPLE_QUOTES) != 0;
+    p->enable_number_highlight = (cp->flags & CPF_NUMBERS) != 0;
+    p->enable_bracket_highlight = (cp->flags & CPF_BRACKETS) != 0;
+    p->suppress_comment_autocomplete = (cp->flags & CPF_NO_COMMENT_COMPLETE) != 0;
+    p->case_insensitive = (cp->flags & CPF_CASE_INSENSITIVE) != 0;
+    p->word_index = map_index(base, &cp->word_index, p->case_insensitive);
+    p->directive_index = map_index(base, &cp->directive_index, p->case_insensitive);
+    p->mapped = true;
+    p->loaded = true;
+}
+
+bool hl_cache_load(HlRuleSet *rules)
+{
+    char path[PATH_MAX];
+    struct stat st;
+
+    cache_path(path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader) || (uint64_t)st.st_size > UINT32_MAX) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    unsigned char *base = map;
+    const CacheHeader *hdr = map;
+    bool ok = header_ok(base, size) &&
+              (int)hdr->nprofiles <= rules->profile_max &&
+              (int)hdr->naliases <= rules->alias_max &&
+              deps_unchanged(base, size, hdr);
+
+    const CacheProfile *cp = (const void *)(base + hdr->profiles);
+    for (uint32_t i = 0; ok && i < hdr->nprofiles; i++)
+        ok = profile_ok(base, size, &cp[i]);
+    if (!ok) {
+        munmap(map, size);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < hdr->nprofiles; i++)
+        map_profile(base, &cp[i], &rules->profiles[i]);
+    rules->profile_count = (int)hdr->nprofiles;
+
+    memcpy(rules->aliases, base + hdr->aliases, hdr->naliases * sizeof(MarkdownLangAlias));
+    for (uint32_t i = 0; i < hdr->naliases; i++) {
+        rules->aliases[i].standard[MAX_TOKEN_LEN - 1] = '\0';
+        rules->aliases[i].nanox[MAX_TOKEN_LEN - 1] = '\0';
+    }
+    rules->alias_count = (int)hdr->naliases;
+
+    rules->global->enable_colorscheme = hdr->enable_colorscheme != 0;
+    memcpy(rules->global->colorscheme_name, hdr->colorscheme_name, sizeof(rules->global->colorscheme_name));
+    rules->global->colorscheme_name[sizeof(rules->global->colorscheme_name) - 1] = '\0';
+
+    map_base = map;
+    map_size = size;
+    return true;
+}
+
+void hl_cache_release(void)
+{
+    if (map_base) {
+        munmap(map_base, map_size);
+        map_base = NULL;
+        map_size = 0;
+    }
+}
+
+/* --- writing ------------------------------------------------------------ */
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} CacheBuf;
+
+/* Append n bytes (zeroes when src is NULL) at the next aligned offset. */
+static uint32_t buf_put(CacheBuf *b, const void *src, size_t n)
+{
+    size_t off = (b->len + HL_CACHE_ALIGN - 1) & ~(size_t)(HL_CACHE_ALIGN - 1);
+
+    if (b->failed || off + n > UINT32_MAX) {
+        b->failed = true;
+        return 0;
+    }
+    if (off + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 64 * 1024;
+        while (cap < off + n)
+            cap *= 2;
+        unsigned char *data = realloc(b->data, cap);
+        if (!data) {
+            b->failed = true;
+            return 0;
+        }
+        b->data = data;
+        b->cap = cap;
+    }
+    memset(b->data + b->len, 0, off - b->len);
+    if (src)
+        memcpy(b->data + off, src, n);
+    else
+        memset(b->data + off, 0, n);
+    b->len = off + n;
+    return (uint32_t)off;
+}
+
+static CacheArray put_array(CacheBuf *b, const void *items, size_t elem, int count)
+{
+    CacheArray a = { 0, 0 };
+
+    if (count > 0 && items) {
+        a.off = buf_put(b, items, elem * (size_t)count);
+        a.count = (uint32_t)count;
+    }
+    return a;
+}
+
+static CacheIndex put_index(CacheBuf *b, const struct HlKeywordIndex *ix)
+{
+    CacheIndex cx = { { 0, 0 }, { 0, 0 } };
+
+    if (ix) {
+        cx.slots = put_array(b, ix->slots, sizeof(HlKeywordSlot), (int)ix->mask + 1);
+        cx.pool = put_array(b, ix->pool, 1, (int)ix->pool_len);
+    }
+    return cx;
+}
+
+static void put_profile(CacheBuf *b, HighlightProfile *p, CacheProfile *cp)
+{
+    memset(cp, 0, sizeof(*cp));
+    memcpy(cp->name, p->name, sizeof(cp->name));
+    memcpy(cp->string_delims, p->string_delims, sizeof(cp->string_delims));
+    cp->pool = put_array(b, p->pool, 1, (int)p->pool_len);
+    for (int l = 0; l < CL_COUNT; l++) {
+        const HlStrList *list = profile_list(p, l);
+        cp->lists[l] = put_array(b, list->items, sizeof(HlStr), list->count);
+    }
+    cp->block_comments = put_array(b, p->block_comments, sizeof(BlockCommentPair), p->block_comment_count);
+    cp->word_index = put_index(b, p->word_index);
+    cp->directive_index = put_index(b, p->directive_index);
+    cp->completion_end_line_char = p->completion_end_line_char;
+    cp->flags = (uint8_t)((p->enable_triple_quotes ? CPF_TRIPLE_QUOTES : 0) |
+                          (p->enable_number_highlight ? CPF_NUMBERS : 0) |
+                          (p->enable_bracket_highlight ? CPF_BRACKETS : 0) |
+                          (p->suppress_comment_autocomplete ? CPF_NO_COMMENT_COMPLETE : 0) |
+                          (p->case_insensitive ? CPF_CASE_INSENSITIVE : 0));
+}
+
+static bool make_dirs(const char *dir)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s", dir);
+    for (char *s = path + 1; *s; s++) {
+        if (*s != '/')
+            continue;
+        *s = '\0';
+        if (mkdir(path, 0777) != 0 && errno != EEXIST)
+            return false;
+        *s = '/';
+    }
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+}
+
+typedef struct {
+    time_t mtime;
+    char name[64];
+} CacheFile;
+
+static int newer_first(const void *a, const void *b)
+{
+    time_t ta = ((const CacheFile *)a)->mtime;
+    time_t tb = ((const CacheFile *)b)->mtime;
+
+    return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+/* Keep the HL_CACHE_KEEP newest cache files of dir; drop the single
+ * syntax.cache of older versions. */
+static void prune_cache_dir(const char *dir)
+{
+    char path[PATH_MAX];
+    CacheFile *files = NULL;
+    int nfiles = 0;
+    int cap = 0;
+    struct dirent *de;
+    struct stat st;
+    DIR *d = opendir(dir);
+
+    if (!d)
+        return;
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+
+        if (strcmp(de->d_name, "syntax.cache") == 0) {
+            nanox_path_join(path, sizeof(path), dir, de->d_name);
+            unlink(path);
+            continue;
+        }
+        if (strncmp(de->d_name, "syntax-", 7) != 0 || len < 6 || len >= sizeof(files->name) ||
+            strcmp(de->d_name + len - 6, ".cache") != 0)
+            continue;
+        nanox_path_join(path, sizeof(path), dir, de->d_name);
+        if (stat(path, &st) != 0)
+            continue;
+        if (nfiles == cap) {
+            int ncap = cap ? cap * 2 : 32;
+            CacheFile *f = realloc(files, (size_t)ncap * sizeof(CacheFile));
+            if (!f)
+                break;
+            files = f;
+            cap = ncap;
+        }
+        files[nfiles].mtime = st.st_mtime;
+        memcpy(files[nfiles].name, de->d_name, len + 1);
+        nfiles++;
+    }
+    closedir(d);
+
+    if (nfiles > HL_CACHE_KEEP) {
+        qsort(files, (size_t)nfiles, sizeof(CacheFile), newer_first);
+        for (int i = HL_CACHE_KEEP; i < nfiles; i++) {
+            nanox_path_join(path, sizeof(path), dir, files[i].name);
+            unlink(path);
+        }
+    }
+    free(files);
+}
+
+bool hl_cache_writable(void)
+{
+    char dir[PATH_MAX];
+
+    nanox_get_user_cache_dir(dir, sizeof(dir));
+    return make_dirs(dir) && access(dir, W_OK) == 0;
+}
+
+void hl_cache_store(const HlRuleSet *rules)
+{
+    CacheBuf b = { NULL, 0, 0, false };
+    CacheHeader hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    buf_put(&b, NULL, sizeof(CacheHeader));
+
+    CacheDep *dep_recs = calloc((size_t)ndeps + 1, sizeof(CacheDep));
+    CacheProfile *prof_recs = calloc((size_t)rules->profile_count + 1, sizeof(CacheProfile));
+    if (!dep_recs || !prof_recs)
+        goto out;
+
+    for (int i = 0; i < ndeps; i++) {
+        dep_recs[i].path = buf_put(&b, deps[i].path, strlen(deps[i].path) + 1);
+        dep_recs[i].exists = deps[i].exists;
+        dep_recs[i].mtime_sec = deps[i].mtime_sec;
+        dep_recs[i].mtime_nsec = deps[i].mtime_nsec;
+        dep_recs[i].size = deps[i].size;
+    }
+    for (int i = 0; i < rules->profile_count; i++)
+        put_profile(&b, &rules->profiles[i], &prof_recs[i]);
+
+    memcpy(hdr.magic, HL_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = HL_CACHE_VERSION;
+    hdr.byte_order = HL_CACHE_BYTE_ORDER;
+    hdr.key = cache_key;
+    hdr.ndeps = (uint32_t)ndeps;
+    hdr.deps = buf_put(&b, dep_recs, (size_t)ndeps * sizeof(CacheDep));
+    hdr.nprofiles = (uint32_t)rules->profile_count;
+    hdr.profiles = buf_put(&b, prof_recs, (size_t)rules->profile_count * sizeof(CacheProfile));
+    hdr.naliases = (uint32_t)rules->alias_count;
+    hdr.aliases = buf_put(&b, rules->aliases, (size_t)rules->alias_count * sizeof(MarkdownLangAlias));
+    hdr.enable_colorscheme = rules->global->enable_colorscheme;
+    memcpy(hdr.colorscheme_name, rules->global->colorscheme_name, sizeof(hdr.colorscheme_name));
+    if (b.failed)
+        goto out;
+
+    hdr.size = b.len;
+    hdr.checksum = checksum(b.data + sizeof(CacheHeader), b.len - sizeof(CacheHeader));
+    memcpy(b.data, &hdr, sizeof(hdr));
+
+    /* write a private temporary and rename it into place, so concurrent
+     * launches only ever see a complete file */
+    char dir[PATH_MAX];
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 16];
+    nanox_get_user_cache_dir(dir, sizeof(dir));
+    cache_path(path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    if (!make_dirs(dir))
+        goto out;
+
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+        goto out;
+    size_t done = 0;
+    while (done < b.len) {
+        ssize_t n = write(fd, b.data + done, b.len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += (size_t)n;
+    }
+    if (close(fd) != 0 || done != b.len || rename(tmp, path) != 0)
+        unlink(tmp);
+    else
+        prune_cache_dir(dir);
+
+out:
+    free(dep_recs);
+    free(prof_recs);
+    free(b.data);
+}
+
+#endif /* USE_WINDOWS */
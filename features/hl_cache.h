@@ -0,0 +1,77 @@
+#ifndef HL_CACHE_H_
+#define HL_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "highlight.h"
+
+/*
+ * Binary syntax cache.
+ *
+ * The complete rule set (every profile with its string pool, lists and
+ * compiled keyword tables, the markdown fence aliases and the [highlight]
+ * globals) is written to $XDG_CACHE_HOME/nanox/syntax-<key>.cache, the key
+ * hashing the search locations (working directory included), after it has
+ * been read from source once.  Later launches map the file read-only and
+ * point the profiles straight into it, so no INI text is parsed.
+ *
+ * The cache is rejected when its format version, checksum or search
+ * locations differ, or when the mtime or size of any file or directory
+ * read to build it (including ones that did not exist) has changed.
+ */
+
+typedef struct {
+    bool enable_colorscheme;
+    char colorscheme_name[64];
+} HighlightGlobalConfig;
+
+typedef struct {
+    char standard[MAX_TOKEN_LEN];
+    char nanox[MAX_TOKEN_LEN];
+} MarkdownLangAlias;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t name;          /* offset into pool */
+    uint8_t len;            /* 0 = empty slot */
+    uint8_t style;
+} HlKeywordSlot;
+
+struct HlKeywordIndex {
+    HlKeywordSlot *slots;
+    uint32_t mask;
+    char *pool;
+    size_t pool_len;
+    bool case_insensitive;
+};
+
+typedef struct {
+    HighlightGlobalConfig *global;
+    HighlightProfile *profiles;
+    int profile_count;
+    int profile_max;
+    MarkdownLangAlias *aliases;
+    int alias_count;
+    int alias_max;
+} HlRuleSet;
+
+/* Start recording the sources of a fresh rule set read from source. */
+void hl_cache_begin(const char *rule_config_path);
+
+/* Record a file or directory the rule set depends on, before reading it. */
+void hl_cache_depend(const char *path);
+
+/* Fill rules from a valid cache; profiles come back loaded and mapped. */
+bool hl_cache_load(HlRuleSet *rules);
+
+/* Can the cache directory be created and written to? */
+bool hl_cache_writable(void);
+
+/* Write fully loaded rules and the recorded dependencies to the cache. */
+void hl_cache_store(const HlRuleSet *rules);
+
+/* Drop the current mapping; no mapped profile may be used afterwards. */
+void hl_cache_release(void);
+
+#endif /* HL_CACHE_H_ */
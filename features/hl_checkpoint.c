@@ -0,0 +1,125 @@
+#include "hl_checkpoint.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "estruct.h"
+#include "line.h"
+
+#define VIEW_LINES 256
+
+/*
+ * Start states of the lines that are being drawn, recomputed when the
+ * buffer, its profile or its text changes, or a line outside the range is
+ * asked for.
+ */
+static struct {
+    struct buffer *bp;
+    const HighlightProfile *profile;
+    unsigned epoch;
+    int version;
+    int count;
+    int next;                           /* where the next lookup starts */
+    struct line *lines[VIEW_LINES];
+    HighlightState states[VIEW_LINES];
+} view;
+
+void hl_checkpoint_setup(struct buffer *bp, long nlines)
+{
+    bp->b_hl_sparse = nlines >= HL_SPARSE_MIN_LINES;
+    if (bp->b_hl_sparse)
+        hl_dirty_clear(bp);
+    if (view.bp == bp)
+        view.bp = NULL;
+}
+
+static bool checkpoint_valid(struct buffer *bp, struct line *lp, const HighlightProfile *profile)
+{
+    return lp->l_hl != NULL && lp->l_hl->epoch == bp->b_hl_epoch &&
+           (lp->l_hl->start.depth == 0 || lp->l_hl->start.profile == profile);
+}
+
+static void checkpoint_store(struct buffer *bp, struct line *lp, const HighlightState *state)
+{
+    if (lp->l_hl == NULL && (lp->l_hl = calloc(1, sizeof(struct line_hl))) == NULL)
+        return;
+    lp->l_hl->start = *state;
+    lp->l_hl->epoch = bp->b_hl_epoch;
+}
+
+void hl_checkpoint_edit(struct buffer *bp, struct line *lp, unsigned old_epoch)
+{
+    int back = 0;
+
+    /* nothing above lp changed, so its checkpoints stay good */
+    for (struct line *l = lback(lp); l != bp->b_linep && back < HL_SYNC_LINES; l = lback(l), back++) {
+        if (l->l_hl != NULL && l->l_hl->epoch == old_epoch)
+            l->l_hl->epoch = bp->b_hl_epoch;
+    }
+}
+
+static void view_compute(struct buffer *bp, struct line *lp, const HighlightProfile *profile)
+{
+    struct line *first = lforw(bp->b_linep);
+    struct line *origin = lp;
+    HighlightState state = hl_zero_state;
+
+    for (int back = 0; origin != first && back < HL_SYNC_LINES; back++) {
+        if (checkpoint_valid(bp, origin, profile)) {
+            state = origin->l_hl->start;
+            break;
+        }
+        origin = lback(origin);
+    }
+
+    /* Walk down to lp and on through the view, refreshing the checkpoints
+     * passed and adding one wherever the last is HL_CHECKPOINT_LINES back. */
+    int since = 0;
+    view.count = 0;
+    for (struct line *l = origin; l != bp->b_linep && view.count < VIEW_LINES; l = lforw(l)) {
+        if (l != origin && (l->l_hl != NULL || since >= HL_CHECKPOINT_LINES)) {
+            checkpoint_store(bp, l, &state);
+            since = 0;
+        }
+        if (l == lp || view.count > 0) {
+            view.lines[view.count] = l;
+            view.states[view.count] = state;
+            view.count++;
+        }
+
+        HighlightState end;
+        highlight_line((const char *)ltext(l), llength(l), state, profile, NULL, &end);
+        state = end;
+        since++;
+    }
+
+    view.bp = bp;
+    view.profile = profile;
+    view.epoch = bp->b_hl_epoch;
+    view.version = bp->b_version;
+    view.next = 0;
+}
+
+HighlightState hl_checkpoint_state(struct buffer *bp, struct line *lp, const HighlightProfile *profile)
+{
+    if (profile == NULL)
+        return hl_zero_state;
+
+    if (view.bp == bp && view.profile == profile && view.epoch == bp->b_hl_epoch &&
+        view.version == bp->b_version) {
+        /* lines are usually drawn top to bottom */
+        for (int n = 0; n < view.count; n++) {
+            int i = (view.next + n) % view.count;
+            if (view.lines[i] == lp) {
+                view.next = i + 1;
+                return view.states[i];
+            }
+        }
+    }
+
+    view_compute(bp, lp, profile);
+    if (view.count == 0)
+        return hl_zero_state;
+    view.next = 1;
+    return view.states[0];
+}
@@ -0,0 +1,39 @@
+#ifndef HL_CHECKPOINT_H_
+#define HL_CHECKPOINT_H_
+
+#include "highlight.h"
+
+struct buffer;
+struct line;
+
+/*
+ * Checkpoint mode for very large buffers.
+ *
+ * A buffer read with at least HL_SPARSE_MIN_LINES lines (b_hl_sparse) does
+ * not propagate highlight states through its text.  Instead a start state is
+ * kept on about one line in HL_CHECKPOINT_LINES, and only in regions that
+ * have been displayed, so highlighting memory is O(lines / N) and nothing is
+ * computed for text that is never looked at.  The start state of a line
+ * being drawn is recomputed from the nearest valid checkpoint above it.  If
+ * there is none within HL_SYNC_LINES, the recomputation starts from the zero
+ * state that many lines up, which is only wrong for a comment or string that
+ * is longer than that.
+ *
+ * A checkpoint is valid while its epoch equals b_hl_epoch.  An edit re-stamps
+ * the checkpoints (up to HL_SYNC_LINES) above the edited line, so only those
+ * below it have to be recomputed.
+ */
+#define HL_SPARSE_MIN_LINES 1000000
+#define HL_CHECKPOINT_LINES 128
+#define HL_SYNC_LINES 4096
+
+/* Choose the mode of bp after it was (re)filled with nlines lines. */
+void hl_checkpoint_setup(struct buffer *bp, long nlines);
+
+/* lp was edited and b_hl_epoch moved on from old_epoch. */
+void hl_checkpoint_edit(struct buffer *bp, struct line *lp, unsigned old_epoch);
+
+/* Start state of lp in a checkpointed buffer. */
+HighlightState hl_checkpoint_state(struct buffer *bp, struct line *lp, const HighlightProfile *profile);
+
+#endif /* HL_CHECKPOINT_H_ */
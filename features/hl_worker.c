@@ -0,0 +1,291 @@
+#include "hl_worker.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+#include "highlight.h"
+#include "perf.h"
+
+#define HL_CHUNK_LINES 2048
+#define HL_CHUNK_BYTES (4 * 1024 * 1024)
+
+typedef enum {
+    HL_JOB_IDLE = 0,
+    HL_JOB_QUEUED,
+    HL_JOB_DONE
+} hl_job_state_t;
+
+typedef struct {
+    /* identity of the snapshot, checked again before publishing */
+    struct buffer *bp;
+    struct line *first;
+    int version;
+    unsigned epoch;
+    HighlightState start;
+    const HighlightProfile *profile;
+
+    /* immutable line snapshot: nlines texts packed back to back */
+    int nlines;
+    char *text;
+    size_t text_cap;
+    size_t *offsets;            /* nlines + 1 entries */
+    HighlightState *ends;       /* worker output, one per line */
+    int line_cap;
+} hl_job_t;
+
+static pthread_mutex_t hl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond;
+static pthread_cond_t done_cond;
+static pthread_t worker_thread;
+static int worker_started = 0;
+static int worker_failed = 0;
+static hl_job_state_t job_state = HL_JOB_IDLE;
+static hl_job_t job;
+
+static void *hl_worker_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&hl_mutex);
+        while (job_state != HL_JOB_QUEUED)
+            pthread_cond_wait(&work_cond, &hl_mutex);
+        pthread_mutex_unlock(&hl_mutex);
+
+        /* The UI thread leaves the job alone while it is queued. */
+        HighlightState state = job.start;
+        for (int i = 0; i < job.nlines; i++) {
+            int len = (int)(job.offsets[i + 1] - job.offsets[i]);
+            highlight_line(job.text + job.offsets[i], len, state, job.profile, NULL, &job.ends[i]);
+            state = job.ends[i];
+        }
+
+        pthread_mutex_lock(&hl_mutex);
+        job_state = HL_JOB_DONE;
+        pthread_cond_broadcast(&done_cond);
+        pthread_mutex_unlock(&hl_mutex);
+    }
+    return NULL;
+}
+
+static int start_worker(void)
+{
+    pthread_condattr_t attr;
+
+    if (worker_started)
+        return 1;
+    if (worker_failed)
+        return 0;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&done_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&work_cond, NULL);
+
+    if (pthread_create(&worker_thread, NULL, hl_worker_main, NULL) != 0) {
+        worker_failed = 1;
+        return 0;
+    }
+    pthread_detach(worker_thread);
+    worker_started = 1;
+    return 1;
+}
+
+static int reserve_lines(int n)
+{
+    if (n <= job.line_cap)
+        return 1;
+
+    size_t *offsets = realloc(job.offsets, (size_t)(n + 1) * sizeof(size_t));
+    if (offsets == NULL)
+        return 0;
+    job.offsets = offsets;
+
+    HighlightState *ends = realloc(job.ends, (size_t)n * sizeof(HighlightState));
+    if (ends == NULL)
+        return 0;
+    job.ends = ends;
+    job.line_cap = n;
+    return 1;
+}
+
+static int reserve_text(size_t n)
+{
+    if (n <= job.text_cap)
+        return 1;
+
+    size_t cap = job.text_cap ? job.text_cap : 64 * 1024;
+    while (cap < n)
+        cap *= 2;
+    char *text = realloc(job.text, cap);
+    if (text == NULL)
+        return 0;
+    job.text = text;
+    job.text_cap = cap;
+    return 1;
+}
+
+/* Snapshot up to one chunk of lines from the dirty line.  Caller holds
+ * hl_mutex and the worker is idle. */
+static int fill_job(struct buffer *bp, const HighlightProfile *profile)
+{
+    struct line *lp = bp->b_hl_dirty[0];
+    size_t used = 0;
+    int n = 0;
+
+    if (!reserve_lines(HL_CHUNK_LINES))
+        return 0;
+
+    job.bp = bp;
+    job.first = lp;
+    job.version = bp->b_version;
+    job.epoch = bp->b_hl_epoch;
+    job.start = *lhl_start(lp);
+    job.profile = profile;
+
+    while (lp != bp->b_linep && n < HL_CHUNK_LINES && used < HL_CHUNK_BYTES) {
+        size_t len = (size_t)llength(lp);
+        if (!reserve_text(used + len + 1))
+            return 0;
+        job.offsets[n] = used;
+        if (len > 0)
+            memcpy(job.text + used, ltext(lp), len);
+        used += len;
+        n++;
+        lp = lforw(lp);
+    }
+    job.offsets[n] = used;
+    job.nlines = n;
+    return n > 0;
+}
+
+/* Publish a finished chunk onto the lines if the snapshot is still current.
+ * Mirrors highlight_incremental_run() in display.c. */
+static void apply_job(struct buffer *bp)
+{
+    if (job.bp != bp || !hl_dirty_contains(bp, job.first) ||
+        bp->b_version != job.version || bp->b_hl_epoch != job.epoch ||
+        memcmp(lhl_start(job.first), &job.start, sizeof(HighlightState)) != 0)
+        return;
+
+    struct line *lp = job.first;
+    HighlightState current = job.start;
+    bool full = bp->b_hl_full;
+    bool any_changed = false;
+
+    for (int i = 0; i < job.nlines && lp != bp->b_linep; i++) {
+        bool changed = lhl_set_start(lp, &current);
+        changed |= lhl_set_end(lp, &job.ends[i]);
+        current = job.ends[i];
+        lp = lforw(lp);
+        any_changed |= changed;
+
+        if (lp != bp->b_linep && lp != job.first && hl_dirty_contains(bp, lp)) {
+            hl_dirty_remove(bp, lp);
+            continue;
+        }
+        if (!changed && !full) {
+            if (lp == bp->b_linep || memcmp(lhl_start(lp), &current, sizeof(HighlightState)) == 0) {
+                hl_dirty_remove(bp, job.first);
+                goto out;
+            }
+        }
+    }
+
+    if (lp == bp->b_linep) {
+        hl_dirty_remove(bp, job.first);
+    } else {
+        lhl_set_start(lp, &current);
+        hl_dirty_replace(bp, job.first, lp);
+    }
+out:
+    if (any_changed && curwp != NULL && curwp->w_bufp == bp)
+        curwp->w_flag |= WFHARD;
+}
+
+bool hl_worker_pump(struct buffer *bp, int wait_ms)
+{
+    bool sampling = highlight_dynamic_step(bp);
+
+    if (!highlight_is_enabled() || bp->b_hl_ndirty == 0)
+        return sampling;
+
+    if (!start_worker()) {
+        highlight_incremental_step(bp);
+        return sampling || bp->b_hl_ndirty > 0;
+    }
+
+    uint64_t t0 = perf_begin();
+    /* resolved outside the lock: it may need to drain the worker */
+    const HighlightProfile *profile = highlight_buffer_profile(bp);
+
+    pthread_mutex_lock(&hl_mutex);
+
+    if (job_state == HL_JOB_DONE) {
+        apply_job(bp);
+        job.bp = NULL;
+        job_state = HL_JOB_IDLE;
+    }
+
+    if (job_state == HL_JOB_IDLE && bp->b_hl_ndirty > 0) {
+        if (profile == NULL) {
+            hl_dirty_clear(bp);
+        } else if (fill_job(bp, profile)) {
+            job_state = HL_JOB_QUEUED;
+            pthread_cond_signal(&work_cond);
+        } else {
+            /* out of memory: fall back to the synchronous path */
+            pthread_mutex_unlock(&hl_mutex);
+            highlight_incremental_step(bp);
+            return sampling || bp->b_hl_ndirty > 0;
+        }
+    }
+    perf_end(PERF_HIGHLIGHT, t0);
+
+    if (job_state == HL_JOB_QUEUED && wait_ms > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += (long)wait_ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (job_state == HL_JOB_QUEUED) {
+            if (pthread_cond_timedwait(&done_cond, &hl_mutex, &deadline) != 0)
+                break;
+        }
+    }
+
+    pthread_mutex_unlock(&hl_mutex);
+    return sampling || bp->b_hl_ndirty > 0;
+}
+
+void hl_worker_drain(void)
+{
+    if (!worker_started)
+        return;
+
+    pthread_mutex_lock(&hl_mutex);
+    while (job_state == HL_JOB_QUEUED)
+        pthread_cond_wait(&done_cond, &hl_mutex);
+    pthread_mutex_unlock(&hl_mutex);
+}
+
+void hl_worker_forget(struct buffer *bp)
+{
+    if (!worker_started)
+        return;
+
+    pthread_mutex_lock(&hl_mutex);
+    while (job_state == HL_JOB_QUEUED)
+        pthread_cond_wait(&done_cond, &hl_mutex);
+    if (job.bp == bp) {
+        job.bp = NULL;
+        job_state = HL_JOB_IDLE;
+    }
+    pthread_mutex_unlock(&hl_mutex);
+}
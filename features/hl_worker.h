@@ -0,0 +1,31 @@
+#ifndef HL_WORKER_H_
+#define HL_WORKER_H_
+
+#include <stdbool.h>
+
+struct buffer;
+
+/*
+ * Background highlight-state propagation.
+ *
+ * The UI thread copies a chunk of lines starting at the first dirty interval
+ * (b_hl_dirty[0], see hl_dirty_add() in line.c) into a private snapshot and
+ * hands it to a worker thread, which runs highlight_line() over it and
+ * records the end state of every line.  The
+ * next hl_worker_pump() publishes those states back onto the lines, unless
+ * the buffer was edited in the meantime, in which case the result is
+ * dropped and the chunk is resubmitted from the new dirty line.
+ */
+
+/* Apply a finished chunk, queue the next one, and wait at most wait_ms for
+ * the worker.  Also advances bp's dynamic keyword sample.  Returns true
+ * while bp still needs propagation or sampling. */
+bool hl_worker_pump(struct buffer *bp, int wait_ms);
+
+/* Block until the worker is idle; used before shared profile data changes. */
+void hl_worker_drain(void);
+
+/* Discard any work queued for bp (the buffer is going away). */
+void hl_worker_forget(struct buffer *bp);
+
+#endif /* HL_WORKER_H_ */
@@ -0,0 +1,431 @@
+#include "lit_search.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "line.h"
+
+#if defined(__AVX2__)
+#define VEC_BYTES 32
+typedef __m256i vec_t;
+
+static inline vec_t vec_set1(unsigned char c)
+{
+    return _mm256_set1_epi8((char)c);
+}
+
+/* Bit i set where p[i] | lower == c. */
+static inline unsigned vec_hits(const unsigned char *p, vec_t c, vec_t lower)
+{
+    __m256i v = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)p), lower);
+    return (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, c));
+}
+#elif defined(__SSE2__)
+#define VEC_BYTES 16
+typedef __m128i vec_t;
+
+static inline vec_t vec_set1(unsigned char c)
+{
+    return _mm_set1_epi8((char)c);
+}
+
+static inline unsigned vec_hits(const unsigned char *p, vec_t c, vec_t lower)
+{
+    __m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i *)p), lower);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, c));
+}
+#endif
+
+/* Byte maps for exact and case-folded comparison, as eq() folds. */
+static unsigned char same_tab[256];
+static unsigned char fold_tab[256];
+
+static void init_tables(void)
+{
+    static bool ready;
+
+    if (ready)
+        return;
+    for (int c = 0; c < 256; c++) {
+        same_tab[c] = (unsigned char)c;
+        fold_tab[c] = (unsigned char)(c >= 'a' && c <= 'z' ? c ^ DIFCASE : c);
+    }
+    ready = true;
+}
+
+static inline const unsigned char *byte_map(const struct lsearch *ls)
+{
+    return ls->fold ? fold_tab : same_tab;
+}
+
+void lsearch_compile(struct lsearch *ls, const char *pat, int len, bool fold)
+{
+    const unsigned char *map;
+    const char *nl;
+
+    init_tables();
+    if (len > NPAT - 1)
+        len = NPAT - 1;
+    if (len < 0)
+        len = 0;
+
+    ls->len = len;
+    ls->fold = fold;
+    map = byte_map(ls);
+    for (int i = 0; i < len; i++)
+        ls->pat[i] = map[(unsigned char)pat[i]];
+
+    nl = memchr(pat, '\n', (size_t)len);
+    ls->nl_first = nl ? (int)(nl - pat) : -1;
+    nl = memrchr(pat, '\n', (size_t)len);
+    ls->nl_last = nl ? (int)(nl - pat) : -1;
+
+    /*
+     * fskip[c]: how far the window may move right when its last byte is c,
+     * rskip[c]: how far it may move left when its first byte is c.
+     */
+    for (int c = 0; c < 256; c++) {
+        ls->fskip[c] = (uint16_t)(len > 0 ? len : 1);
+        ls->rskip[c] = (uint16_t)(len > 0 ? len : 1);
+    }
+    for (int i = 0; i < len - 1; i++)
+        ls->fskip[ls->pat[i]] = (uint16_t)(len - 1 - i);
+    for (int i = len - 1; i > 0; i--)
+        ls->rskip[ls->pat[i]] = (uint16_t)i;
+}
+
+/* Do the n bytes at text equal the pattern from pat_off on? */
+static inline bool equal_at(const struct lsearch *ls, const unsigned char *text, int pat_off, int n)
+{
+    const unsigned char *p = ls->pat + pat_off;
+
+    if (!ls->fold)
+        return memcmp(text, p, (size_t)n) == 0;
+    for (int i = 0; i < n; i++) {
+        if (fold_tab[text[i]] != p[i])
+            return false;
+    }
+    return true;
+}
+
+#ifdef VEC_BYTES
+/*
+ * What a SIMD probe compares pattern byte i with.  A folded letter is
+ * upper case, so text bytes are or'ed with 0x20 and compared with the
+ * lower case letter; the few non-letters that also match are weeded out
+ * by equal_at().
+ */
+static inline void probe(const struct lsearch *ls, int i, vec_t *c, vec_t *lower)
+{
+    unsigned char b = ls->pat[i];
+    unsigned char m = ls->fold && b >= 'A' && b <= 'Z' ? DIFCASE : 0;
+
+    *c = vec_set1((unsigned char)(b | m));
+    *lower = vec_set1(m);
+}
+#endif
+
+int lsearch_find(const struct lsearch *ls, const unsigned char *text, int len, int from)
+{
+    const unsigned char *map = byte_map(ls);
+    int n = ls->len;
+    int last = len - n;                 /* last start that fits */
+    int s = from < 0 ? 0 : from;
+
+    if (n == 0 || s > last)
+        return -1;
+
+#ifdef VEC_BYTES
+    vec_t first, first_lower, end, end_lower;
+
+    probe(ls, 0, &first, &first_lower);
+    probe(ls, n - 1, &end, &end_lower);
+    for (; s + VEC_BYTES - 1 <= last; s += VEC_BYTES) {
+        unsigned mask = vec_hits(text + s, first, first_lower) &
+                        vec_hits(text + s + n - 1, end, end_lower);
+
+        while (mask != 0) {
+            int i = s + __builtin_ctz(mask);
+
+            if (equal_at(ls, text + i, 0, n))
+                return i;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    while (s <= last) {
+        unsigned char c = map[text[s + n - 1]];
+
+        if (c == ls->pat[n - 1] && equal_at(ls, text + s, 0, n))
+            return s;
+        s += ls->fskip[c];
+    }
+    return -1;
+}
+
+int lsearch_rfind(const struct lsearch *ls, const unsigned char *text, int end)
+{
+    const unsigned char *map = byte_map(ls);
+    int n = ls->len;
+    int s = end - n;                    /* last start that fits */
+
+    if (n == 0 || s < 0)
+        return -1;
+
+#ifdef VEC_BYTES
+    vec_t first, first_lower, last, last_lower;
+
+    probe(ls, 0, &first, &first_lower);
+    probe(ls, n - 1, &last, &last_lower);
+    for (; s - (VEC_BYTES - 1) >= 0; s -= VEC_BYTES) {
+        int base = s - (VEC_BYTES - 1);
+        unsigned mask = vec_hits(text + base, first, first_lower) &
+                        vec_hits(text + base + n - 1, last, last_lower);
+
+        while (mask != 0) {
+            int bit = 31 - __builtin_clz(mask);
+
+            if (equal_at(ls, text + base + bit, 0, n))
+                return base + bit;
+            mask &= ~(1u << bit);
+        }
+    }
+#endif
+
+    while (s >= 0) {
+        unsigned char c = map[text[s]];
+
+        if (c == ls->pat[0] && equal_at(ls, text + s, 0, n))
+            return s;
+        s -= ls->rskip[c];
+    }
+    return -1;
+}
+
+static const unsigned char *peek_chunk(struct lsearch_peek *pk, MemoryHandle h)
+{
+    if (pk->base == NULL || h != pk->handle) {
+        pk->handle = h;
+        pk->base = handle_peek(h, &pk->scratch, &pk->cap);
+    }
+    return pk->base;
+}
+
+bool lsearch_rscan(const struct lsearch *ls, struct line *lp, int off, struct line *stop,
+                   struct lsearch_peek *pk, struct lsearch_match *m)
+{
+    int n = ls->len;
+
+    if (off > llength(lp))
+        off = llength(lp);
+    while (lp != stop) {
+        struct line *top = lp;
+        struct line *hit = lp;
+        int lo, hi, limit, end;
+        const unsigned char *base;
+
+        /* the lines above lp that lie in its chunk before it */
+        while (lback(top) != stop && lback(top)->l_handle == top->l_handle &&
+               lback(top)->l_offset + (uint32_t)llength(lback(top)) <= top->l_offset)
+            top = lback(top);
+        lo = (int)top->l_offset;
+        hi = (int)lp->l_offset + off;
+        limit = hi;
+        base = hi - lo >= n ? peek_chunk(pk, lp->l_handle) : NULL;
+
+        /* a match across the end of a line is no match; look further left */
+        for (end = hi - lo; base != NULL; ) {
+            int pos = lsearch_rfind(ls, base + lo, end);
+
+            if (pos < 0)
+                break;
+            while ((int)hit->l_offset > lo + pos) {
+                hit = lback(hit);
+                limit = (int)hit->l_offset + llength(hit);
+            }
+            if (lo + pos + n <= limit) {
+                m->start_lp = m->end_lp = hit;
+                m->start_off = lo + pos - (int)hit->l_offset;
+                m->end_off = m->start_off + n;
+                return true;
+            }
+            end = pos + n - 1;
+        }
+        lp = lback(top);
+        off = llength(lp);
+    }
+    return false;
+}
+
+/*
+ * Line text for a walk over many lines.  Lines read from a file share a
+ * chunk, so the handle is only dereferenced when it changes; nothing can
+ * move or freeze a chunk while a search runs.
+ */
+struct text_cursor {
+    MemoryHandle handle;
+    unsigned char *base;
+};
+
+static const unsigned char *line_text(struct text_cursor *tc, struct line *lp)
+{
+    if (llength(lp) == 0)
+        return NULL;
+    if (tc->base == NULL || lp->l_handle != tc->handle) {
+        tc->handle = lp->l_handle;
+        tc->base = handle_deref(lp->l_handle);
+        if (tc->base == NULL)
+            return NULL;
+    }
+    return tc->base + lp->l_offset;
+}
+
+/* Does the pattern segment [from, to) equal the text of lp at off? */
+static bool segment_at(const struct lsearch *ls, struct text_cursor *tc, struct line *lp,
+                       int off, int from, int to)
+{
+    const unsigned char *text;
+
+    if (to == from)
+        return true;
+    text = line_text(tc, lp);
+    return text != NULL && equal_at(ls, text + off, from, to - from);
+}
+
+/*
+ * Multi-line pattern whose first line ends lp.  Check it and the lines
+ * after it; the match ends on *elp at *eoff.
+ */
+static bool lines_forward(const struct lsearch *ls, struct text_cursor *tc, struct line *lp,
+                          struct line **elp, int *eoff)
+{
+    int seg = ls->nl_first;
+
+    if (!segment_at(ls, tc, lp, llength(lp) - seg, 0, seg))
+        return false;
+    while (seg < ls->len) {
+        int from = seg + 1;
+        const unsigned char *nl = memchr(ls->pat + from, '\n', (size_t)(ls->len - from));
+        int to = nl ? (int)(nl - ls->pat) : ls->len;
+
+        lp = lforw(lp);
+        if (nl ? llength(lp) != to - from : llength(lp) < to - from)
+            return false;
+        if (!segment_at(ls, tc, lp, 0, from, to))
+            return false;
+        seg = to;
+        *eoff = to - from;
+    }
+    *elp = lp;
+    return true;
+}
+
+/* The same, for a match whose last line starts lp, checked upwards. */
+static bool lines_reverse(const struct lsearch *ls, struct text_cursor *tc, struct line *lp,
+                          struct line **slp, int *soff)
+{
+    int seg = ls->nl_last;
+
+    if (!segment_at(ls, tc, lp, 0, seg + 1, ls->len))
+        return false;
+    while (seg >= 0) {
+        int to = seg;
+        const unsigned char *nl = to > 0 ? memrchr(ls->pat, '\n', (size_t)to) : NULL;
+        int from = nl ? (int)(nl - ls->pat) + 1 : 0;
+
+        lp = lback(lp);
+        if (nl ? llength(lp) != to - from : llength(lp) < to - from)
+            return false;
+        if (!segment_at(ls, tc, lp, llength(lp) - (to - from), from, to))
+            return false;
+        seg = from - 1;
+        *soff = llength(lp) - (to - from);
+    }
+    *slp = lp;
+    return true;
+}
+
+static bool buffer_forward(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                           struct lsearch_match *m)
+{
+    struct text_cursor tc = { 0 };
+
+    for (;;) {
+        bool last = lforw(lp) == bp->b_linep;
+
+        if (ls->nl_first < 0) {
+            const unsigned char *text = line_text(&tc, lp);
+            int pos = text ? lsearch_find(ls, text, llength(lp), off) : -1;
+
+            if (pos >= 0) {
+                m->start_lp = m->end_lp = lp;
+                m->start_off = pos;
+                m->end_off = pos + ls->len;
+                return true;
+            }
+        } else {
+            int start = llength(lp) - ls->nl_first;
+
+            if (start >= off && !(last && start == llength(lp)) &&
+                lines_forward(ls, &tc, lp, &m->end_lp, &m->end_off)) {
+                m->start_lp = lp;
+                m->start_off = start;
+                return true;
+            }
+        }
+        if (last)
+            return false;
+        lp = lforw(lp);
+        off = 0;
+    }
+}
+
+static bool buffer_reverse(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                           struct lsearch_match *m)
+{
+    struct text_cursor tc = { 0 };
+
+    if (ls->nl_last < 0) {
+        struct lsearch_peek pk = { 0 };
+        bool found;
+
+        if (lp == bp->b_linep) {
+            lp = lback(lp);
+            off = llength(lp);
+        }
+        found = lsearch_rscan(ls, lp, off, bp->b_linep, &pk, m);
+        free(pk.scratch);
+        return found;
+    }
+    for (;;) {
+        bool first = lback(lp) == bp->b_linep;
+
+        int end = ls->len - ls->nl_last - 1;
+
+        if (end <= off && end <= llength(lp) && !(first && end == 0) &&
+            lines_reverse(ls, &tc, lp, &m->start_lp, &m->start_off)) {
+            m->end_lp = lp;
+            m->end_off = end;
+            return true;
+        }
+        if (first)
+            return false;
+        lp = lback(lp);
+        off = llength(lp);
+    }
+}
+
+bool lsearch_buffer(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                    int dir, struct lsearch_match *m)
+{
+    if (ls->len == 0)
+        return false;
+    if (dir == FORWARD)
+        return buffer_forward(ls, bp, lp, off, m);
+    return buffer_reverse(ls, bp, lp, off, m);
+}
@@ -0,0 +1,85 @@
+#ifndef LIT_SEARCH_H_
+#define LIT_SEARCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "estruct.h"
+#include "mymemory.h"
+
+struct buffer;
+struct line;
+
+/*
+ * Literal (non-MAGIC) search.
+ *
+ * A pattern is compiled once into a struct lsearch: the pattern bytes,
+ * case-folded through a table when the search ignores case, and the
+ * Horspool shift tables for both directions.  Text is then scanned a block
+ * at a time: SSE2/AVX2 compares the first and last byte of the pattern at
+ * every position at once, and only the positions where both match are
+ * compared in full.  Without SIMD, and for the last few bytes of a block,
+ * Horspool is used instead.
+ *
+ * A pattern containing newlines can only match at the end of one line and
+ * the start of the next ones, so lsearch_buffer() checks one position per
+ * line for it instead of scanning the text.
+ *
+ * A reverse search reads the lines of a chunk (lines read from a file share
+ * one MemoryHandle) as a single block through handle_peek(), so COLD chunks
+ * stay COLD, and scans it right to left with the same prefilter.
+ */
+struct lsearch {
+    int len;
+    bool fold;                          /* ignore ASCII case */
+    int nl_first;                       /* offset of the first '\n', or -1 */
+    int nl_last;                        /* offset of the last '\n', or -1 */
+    unsigned char pat[NPAT];            /* folded when fold is set */
+    uint16_t fskip[256];                /* Horspool shifts, forward */
+    uint16_t rskip[256];                /* Horspool shifts, reverse */
+};
+
+/* A match, from its first byte up to the position just after it. */
+struct lsearch_match {
+    struct line *start_lp;
+    int start_off;
+    struct line *end_lp;
+    int end_off;
+};
+
+/* Read access to the chunk of a line that leaves COLD chunks COLD. */
+struct lsearch_peek {
+    MemoryHandle handle;
+    const unsigned char *base;
+    char *scratch;                      /* a COLD chunk, decompressed */
+    size_t cap;
+};
+
+/* Compile the len bytes of pat; len is cut to NPAT - 1. */
+void lsearch_compile(struct lsearch *ls, const char *pat, int len, bool fold);
+
+/* Start of the first match in text[from..len), or -1. */
+int lsearch_find(const struct lsearch *ls, const unsigned char *text, int len, int from);
+
+/* Start of the last match that ends at or before text[end], or -1. */
+int lsearch_rfind(const struct lsearch *ls, const unsigned char *text, int end);
+
+/*
+ * Last match of a pattern without newlines that lies within one line,
+ * searching the text of lp before off and then the lines above it, up to
+ * but not including stop.  The caller frees pk->scratch.
+ */
+bool lsearch_rscan(const struct lsearch *ls, struct line *lp, int off, struct line *stop,
+                   struct lsearch_peek *pk, struct lsearch_match *m);
+
+/*
+ * Search bp from (lp, off).  FORWARD finds the first match starting at or
+ * after it, REVERSE the last one ending at or before it.  Like the old
+ * character scanner, the search does not start a match at the very end of
+ * the buffer, or end one at its very beginning.
+ */
+bool lsearch_buffer(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                    int dir, struct lsearch_match *m);
+
+#endif /* LIT_SEARCH_H_ */
@@ -0,0 +1,679 @@
+#include "match_index.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+
+#define MI_BLOCK_LINES 512              /* a block ends at a chunk boundary after this... */
+#define MI_BLOCK_MAX 2048               /* ...and never holds more lines than this */
+#define MI_WALK_MAX (8 * MI_BLOCK_MAX)  /* a block longer than this is lost; start over */
+#define MI_SLICE_NS (20 * 1000000L)
+
+struct mi_hits {
+    int ordinal;                        /* line number within the block */
+    int count;
+};
+
+struct mi_block {
+    struct line *first;                 /* NULL once all its lines are gone */
+    int nlines;
+    long count;                         /* -1 while stale */
+    struct mi_hits *hits;               /* the lines with matches, in order */
+    int nhits;
+    int hit_cap;
+};
+
+static struct {
+    struct buffer *bp;                  /* NULL: no index */
+    char pat[NPAT];                     /* what it counts */
+    bool fold;
+    struct lsearch ls;
+
+    struct mi_block *blocks;
+    int nblocks;
+    int block_cap;
+    long *fen;                          /* Fenwick tree over the block counts, from 1 */
+    long total;                         /* matches in the counted blocks */
+
+    struct line *next_lp;               /* first line in no block; b_linep when all are */
+    int *stale;
+    int nstale;
+    int stale_cap;
+
+    struct line **hash_lp;              /* block first line -> block number */
+    int *hash_block;
+    int hash_cap;
+    int hash_used;
+
+    struct line *touched;               /* last match_index_touch() line... */
+    int touched_block;                  /* ...and its block */
+
+    char *scratch;                      /* handle_peek() of a COLD chunk */
+    size_t scratch_cap;
+} mi;
+
+/* Fenwick tree */
+
+/* Matches in blocks [0, n). */
+static long fen_prefix(int n)
+{
+    long sum = 0;
+
+    for (int i = n; i > 0; i -= i & -i)
+        sum += mi.fen[i];
+    return sum;
+}
+
+static void fen_add(int b, long v)
+{
+    for (int i = b + 1; i <= mi.nblocks; i += i & -i)
+        mi.fen[i] += v;
+}
+
+/* The block holding match number k, counted from 1. */
+static int fen_find(long k)
+{
+    int pos = 0;
+    int step = 1;
+
+    while (step * 2 <= mi.nblocks)
+        step *= 2;
+    for (; step > 0; step /= 2) {
+        if (pos + step <= mi.nblocks && mi.fen[pos + step] < k) {
+            pos += step;
+            k -= mi.fen[pos];
+        }
+    }
+    return pos;
+}
+
+/* First lines of blocks, open addressing on the line address */
+
+static unsigned hash_slot(const struct line *lp)
+{
+    uint64_t h = (uint64_t)(uintptr_t)lp * 0x9E3779B97F4A7C15ull;
+
+    return (unsigned)(h >> 32) & (unsigned)(mi.hash_cap - 1);
+}
+
+static int hash_find(const struct line *lp)
+{
+    if (mi.hash_cap == 0)
+        return -1;
+    for (unsigned i = hash_slot(lp);; i = (i + 1) & (unsigned)(mi.hash_cap - 1)) {
+        if (mi.hash_lp[i] == lp)
+            return mi.hash_block[i];
+        if (mi.hash_lp[i] == NULL)
+            return -1;
+    }
+}
+
+static void hash_put(struct line *lp, int b)
+{
+    unsigned i = hash_slot(lp);
+
+    while (mi.hash_lp[i] != NULL)
+        i = (i + 1) & (unsigned)(mi.hash_cap - 1);
+    mi.hash_lp[i] = lp;
+    mi.hash_block[i] = b;
+    mi.hash_used++;
+}
+
+static bool hash_insert(struct line *lp, int b)
+{
+    if ((mi.hash_used + 1) * 2 > mi.hash_cap) {
+        struct line **old_lp = mi.hash_lp;
+        int *old_block = mi.hash_block;
+        int old_cap = mi.hash_cap;
+        int cap = old_cap ? old_cap * 2 : 256;
+
+        mi.hash_lp = calloc((size_t)cap, sizeof(*mi.hash_lp));
+        mi.hash_block = malloc((size_t)cap * sizeof(*mi.hash_block));
+        if (mi.hash_lp == NULL || mi.hash_block == NULL) {
+            free(mi.hash_lp);
+            free(mi.hash_block);
+            mi.hash_lp = old_lp;
+            mi.hash_block = old_block;
+            return false;
+        }
+        mi.hash_cap = cap;
+        mi.hash_used = 0;
+        for (int i = 0; i < old_cap; i++)
+            if (old_lp[i] != NULL)
+                hash_put(old_lp[i], old_block[i]);
+        free(old_lp);
+        free(old_block);
+    }
+    hash_put(lp, b);
+    return true;
+}
+
+static void hash_remove(const struct line *lp)
+{
+    unsigned mask = (unsigned)(mi.hash_cap - 1);
+    unsigned i = hash_slot(lp);
+
+    while (mi.hash_lp[i] != lp) {
+        if (mi.hash_lp[i] == NULL)
+            return;
+        i = (i + 1) & mask;
+    }
+    /* shift the rest of the run back over the hole */
+    for (unsigned j = (i + 1) & mask; mi.hash_lp[j] != NULL; j = (j + 1) & mask) {
+        unsigned home = hash_slot(mi.hash_lp[j]);
+
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            mi.hash_lp[i] = mi.hash_lp[j];
+            mi.hash_block[i] = mi.hash_block[j];
+            i = j;
+        }
+    }
+    mi.hash_lp[i] = NULL;
+    mi.hash_used--;
+}
+
+/* The index itself */
+
+static void drop(void)
+{
+    for (int b = 0; b < mi.nblocks; b++)
+        free(mi.blocks[b].hits);
+    free(mi.blocks);
+    free(mi.fen);
+    free(mi.stale);
+    free(mi.hash_lp);
+    free(mi.hash_block);
+    mi.blocks = NULL;
+    mi.fen = NULL;
+    mi.stale = NULL;
+    mi.hash_lp = NULL;
+    mi.hash_block = NULL;
+    mi.nblocks = mi.block_cap = 0;
+    mi.nstale = mi.stale_cap = 0;
+    mi.hash_cap = mi.hash_used = 0;
+    mi.total = 0;
+    mi.touched = NULL;
+    if (mi.bp != NULL && mi.bp == curwp->w_bufp)
+        curwp->w_flag |= WFMODE;
+    mi.bp = NULL;
+}
+
+void match_index_forget(struct buffer *bp)
+{
+    if (bp != NULL && bp == mi.bp)
+        drop();
+}
+
+/* Does the current search pattern want an index of bp? */
+static bool wanted(struct buffer *bp)
+{
+    if (pat[0] == '\0' || (bp->b_flag & BFINVS) || strchr(pat, '\n') != NULL)
+        return false;
+    return !magic_search(bp);
+}
+
+static void start(struct buffer *bp)
+{
+    bool fold = (bp->b_mode & MDEXACT) == 0;
+
+    if (mi.bp == bp && mi.fold == fold && strcmp(mi.pat, pat) == 0)
+        return;
+    drop();
+    if (!wanted(bp))
+        return;
+    mi.bp = bp;
+    mi.fold = fold;
+    strcpy(mi.pat, pat);
+    lsearch_compile(&mi.ls, pat, (int)strlen(pat), fold);
+    mi.next_lp = lforw(bp->b_linep);
+}
+
+/* Where the lines of block b stop. */
+static struct line *block_end(int b)
+{
+    for (int i = b + 1; i < mi.nblocks; i++)
+        if (mi.blocks[i].first != NULL)
+            return mi.blocks[i].first;
+    return mi.next_lp;
+}
+
+/*
+ * Find the block of lp by walking back to a first line: the block number
+ * and lp's ordinal in it, -1 when lp is past the counted lines, or -2 when
+ * the walk gets nowhere and the index is no good.
+ */
+static int locate(struct line *lp, int *ordinal)
+{
+    struct line *l = lp;
+
+    for (int d = 0; d <= MI_WALK_MAX; d++, l = lback(l)) {
+        int b;
+
+        if (l == mi.next_lp)
+            return -1;
+        if ((b = hash_find(l)) >= 0) {
+            *ordinal = d;
+            return b;
+        }
+        if (l == mi.bp->b_linep)
+            return -2;
+    }
+    return -2;
+}
+
+static void mark_stale(int b)
+{
+    struct mi_block *blk = &mi.blocks[b];
+
+    if (blk->count < 0)
+        return;
+    if (mi.nstale == mi.stale_cap) {
+        int cap = mi.stale_cap ? mi.stale_cap * 2 : 64;
+        int *stale = realloc(mi.stale, (size_t)cap * sizeof(*stale));
+
+        if (stale == NULL) {
+            drop();
+            return;
+        }
+        mi.stale = stale;
+        mi.stale_cap = cap;
+    }
+    mi.stale[mi.nstale++] = b;
+    fen_add(b, -blk->count);
+    mi.total -= blk->count;
+    blk->count = -1;
+}
+
+void match_index_touch(struct buffer *bp, struct line *lp)
+{
+    int b, d;
+
+    if (bp != mi.bp || lp == NULL)
+        return;
+    if (lp == bp->b_linep) {            /* the end of the buffer: the last line */
+        lp = lback(lp);
+        if (lp == bp->b_linep)
+            return;
+    }
+    if (lp == mi.touched) {
+        b = mi.touched_block;
+    } else {
+        b = locate(lp, &d);
+        if (b == -1)
+            return;
+        if (b < 0) {
+            drop();
+            return;
+        }
+        mi.touched = lp;
+        mi.touched_block = b;
+    }
+    mark_stale(b);
+}
+
+void match_index_replace(struct buffer *bp, struct line *lp, struct line *repl)
+{
+    int b, d;
+
+    if (bp != mi.bp)
+        return;
+    mi.touched = NULL;
+    b = locate(lp, &d);
+    if (b == -2) {
+        drop();
+        return;
+    }
+    if (b >= 0)
+        mark_stale(b);
+    if (mi.bp == NULL)
+        return;
+    if (lp == mi.next_lp)
+        mi.next_lp = repl;
+    if ((b = hash_find(lp)) >= 0) {
+        struct mi_block *blk = &mi.blocks[b];
+
+        hash_remove(lp);
+        if (repl == block_end(b) || hash_find(repl) >= 0) {
+            blk->first = NULL;          /* lp was all there was */
+            blk->nlines = 0;
+        } else {
+            blk->first = repl;
+            if (!hash_insert(repl, b)) {
+                drop();
+                return;
+            }
+        }
+    }
+    if ((b = hash_find(mi.next_lp)) >= 0) {  /* the last block lost its lines */
+        mark_stale(b);
+        hash_remove(mi.next_lp);
+        mi.blocks[b].first = NULL;
+        mi.blocks[b].nlines = 0;
+    }
+}
+
+static bool add_hits(struct mi_block *blk, int ordinal, int count)
+{
+    if (blk->nhits == blk->hit_cap) {
+        int cap = blk->hit_cap ? blk->hit_cap * 2 : 16;
+        struct mi_hits *hits = realloc(blk->hits, (size_t)cap * sizeof(*hits));
+
+        if (hits == NULL)
+            return false;
+        blk->hits = hits;
+        blk->hit_cap = cap;
+    }
+    blk->hits[blk->nhits].ordinal = ordinal;
+    blk->hits[blk->nhits].count = count;
+    blk->nhits++;
+    return true;
+}
+
+/* The text of lp without thawing its chunk; peek caches the chunk. */
+struct peek {
+    MemoryHandle handle;
+    const unsigned char *base;
+};
+
+static const unsigned char *line_peek(struct peek *pk, struct line *lp)
+{
+    if (pk->base == NULL || lp->l_handle != pk->handle) {
+        pk->handle = lp->l_handle;
+        pk->base = handle_peek(lp->l_handle, &mi.scratch, &mi.scratch_cap);
+        if (pk->base == NULL)
+            return NULL;
+    }
+    return pk->base + lp->l_offset;
+}
+
+/* Non-overlapping matches on lp, the way the search steps through them. */
+static int count_line(struct peek *pk, struct line *lp)
+{
+    const unsigned char *text;
+    int len = llength(lp);
+    int n = 0;
+
+    if (len < mi.ls.len || (text = line_peek(pk, lp)) == NULL)
+        return 0;
+    for (int pos = 0; (pos = lsearch_find(&mi.ls, text, len, pos)) >= 0; pos += mi.ls.len)
+        n++;
+    return n;
+}
+
+/*
+ * Count block b from its first line up to end, or, when end is NULL, cut
+ * it off the uncounted lines at a chunk boundary.  Returns false when the
+ * index had to be dropped.
+ */
+static bool count_block(int b, struct line *end)
+{
+    struct mi_block *blk = &mi.blocks[b];
+    struct peek pk = { 0 };
+    struct line *lp = blk->first;
+    long count = 0;
+
+    blk->nhits = 0;
+    blk->nlines = 0;
+    while (lp != NULL && lp != end) {
+        int n = count_line(&pk, lp);
+
+        if (n > 0 && !add_hits(blk, blk->nlines, n)) {
+            drop();
+            return false;
+        }
+        count += n;
+        blk->nlines++;
+        lp = lforw(lp);
+        if (end == NULL) {
+            if (lp == mi.bp->b_linep ||
+                blk->nlines >= MI_BLOCK_MAX ||
+                (blk->nlines >= MI_BLOCK_LINES && lp->l_handle != lback(lp)->l_handle)) {
+                mi.next_lp = lp;
+                break;
+            }
+        } else if (blk->nlines > MI_WALK_MAX || (lp != end && lp == mi.bp->b_linep)) {
+            drop();
+            return false;
+        }
+    }
+    blk->count = count;
+    fen_add(b, count);
+    mi.total += count;
+    return true;
+}
+
+/* Cut and count the next block; false when the index was dropped. */
+static bool append_block(void)
+{
+    struct mi_block *blk;
+    int b = mi.nblocks;
+
+    if (mi.nblocks == mi.block_cap) {
+        int cap = mi.block_cap ? mi.block_cap * 2 : 64;
+        struct mi_block *blocks = realloc(mi.blocks, (size_t)cap * sizeof(*blocks));
+        long *fen;
+
+        if (blocks == NULL) {
+            drop();
+            return false;
+        }
+        mi.blocks = blocks;
+        fen = realloc(mi.fen, (size_t)(cap + 1) * sizeof(*fen));
+        if (fen == NULL) {
+            drop();
+            return false;
+        }
+        mi.fen = fen;
+        if (mi.block_cap == 0)
+            mi.fen[0] = 0;
+        mi.block_cap = cap;
+    }
+    blk = &mi.blocks[b];
+    memset(blk, 0, sizeof(*blk));
+    blk->first = mi.next_lp;
+    if (!hash_insert(blk->first, b)) {
+        drop();
+        return false;
+    }
+    /* the new node covers blocks (b + 1 - lowbit, b]; all but b are counted */
+    mi.nblocks++;
+    mi.fen[b + 1] = fen_prefix(b) - fen_prefix(b + 1 - ((b + 1) & -(b + 1)));
+    return count_block(b, NULL);
+}
+
+static long elapsed_ns(const struct timespec *t0)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t0->tv_sec) * 1000000000L + (now.tv_nsec - t0->tv_nsec);
+}
+
+bool match_index_pump(struct buffer *bp)
+{
+    struct timespec t0;
+
+    if (bp == NULL)
+        return false;
+    start(bp);
+    if (mi.bp != bp)
+        return false;
+    if (mi.nstale == 0 && mi.next_lp == bp->b_linep)
+        return false;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+        if (mi.nstale > 0) {
+            int b = mi.stale[--mi.nstale];
+
+            if (mi.blocks[b].count >= 0)
+                continue;
+            if (mi.blocks[b].first == NULL) {
+                mi.blocks[b].count = 0;
+                continue;
+            }
+            mi.touched = NULL;
+            if (!count_block(b, block_end(b)))
+                return false;
+        } else if (mi.next_lp != bp->b_linep) {
+            if (!append_block())
+                return false;
+        } else {
+            break;
+        }
+    } while (elapsed_ns(&t0) < MI_SLICE_NS && !typahead());
+
+    if (mi.nstale == 0 && mi.next_lp == bp->b_linep && curwp->w_bufp == bp)
+        curwp->w_flag |= WFMODE;
+    return true;
+}
+
+bool match_index_ready(struct buffer *bp, const struct lsearch *ls)
+{
+    return bp == mi.bp && mi.nstale == 0 && mi.next_lp == bp->b_linep &&
+        ls->len == mi.ls.len && ls->fold == mi.ls.fold &&
+        memcmp(ls->pat, mi.ls.pat, (size_t)ls->len) == 0;
+}
+
+static struct line *nth_line(int b, int ordinal)
+{
+    struct line *lp = mi.blocks[b].first;
+
+    while (ordinal-- > 0)
+        lp = lforw(lp);
+    return lp;
+}
+
+/*
+ * The next line after lp (dir FORWARD) or before it (REVERSE) that has
+ * matches, NULL if none, or bp->b_linep when the index is found wrong.
+ * From the header line, FORWARD starts at the top and REVERSE at the end.
+ */
+static struct line *next_line(struct buffer *bp, struct line *lp, int dir)
+{
+    struct mi_block *blk;
+    int b, d;
+    long k;
+
+    if (mi.nblocks == 0)
+        return NULL;
+    if (lp == bp->b_linep) {
+        if (dir == FORWARD) {
+            b = 0;
+            d = -1;
+        } else {
+            b = mi.nblocks - 1;
+            d = mi.blocks[b].nlines;
+        }
+    } else if ((b = locate(lp, &d)) < 0) {
+        return bp->b_linep;
+    }
+
+    blk = &mi.blocks[b];
+    if (dir == FORWARD) {
+        for (int i = 0; i < blk->nhits; i++)
+            if (blk->hits[i].ordinal > d)
+                return nth_line(b, blk->hits[i].ordinal);
+        k = fen_prefix(b + 1);
+        if (k >= mi.total)
+            return NULL;
+        b = fen_find(k + 1);
+        blk = &mi.blocks[b];
+        return blk->nhits > 0 ? nth_line(b, blk->hits[0].ordinal) : bp->b_linep;
+    }
+    for (int i = blk->nhits - 1; i >= 0; i--)
+        if (blk->hits[i].ordinal < d)
+            return nth_line(b, blk->hits[i].ordinal);
+    k = fen_prefix(b);
+    if (k <= 0)
+        return NULL;
+    b = fen_find(k);
+    blk = &mi.blocks[b];
+    return blk->nhits > 0 ? nth_line(b, blk->hits[blk->nhits - 1].ordinal) : bp->b_linep;
+}
+
+static bool found(const struct lsearch *ls, struct line *lp, int pos, struct lsearch_match *m)
+{
+    m->start_lp = m->end_lp = lp;
+    m->start_off = pos;
+    m->end_off = pos + ls->len;
+    return true;
+}
+
+bool match_index_find(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                      int dir, struct lsearch_match *m)
+{
+    struct peek pk = { 0 };
+    const unsigned char *text;
+    struct line *nl;
+    int pos;
+
+    if (lp != bp->b_linep && (text = line_peek(&pk, lp)) != NULL) {
+        pos = dir == FORWARD ? lsearch_find(ls, text, llength(lp), off) : lsearch_rfind(ls, text, off);
+        if (pos >= 0)
+            return found(ls, lp, pos, m);
+    }
+
+    nl = next_line(bp, lp, dir);
+    if (nl == NULL)
+        return false;
+    if (nl != bp->b_linep && (text = line_peek(&pk, nl)) != NULL) {
+        pos = dir == FORWARD ? lsearch_find(ls, text, llength(nl), 0)
+            : lsearch_rfind(ls, text, llength(nl));
+        if (pos >= 0)
+            return found(ls, nl, pos, m);
+    }
+    /* the index is off: count again, and search the slow way */
+    drop();
+    return lsearch_buffer(ls, bp, lp, off, dir, m);
+}
+
+void match_index_status(struct window *wp, char *buf, size_t size)
+{
+    struct buffer *bp = wp->w_bufp;
+    struct line *dot = wp->w_dotp;
+    struct peek pk = { 0 };
+    const unsigned char *text;
+    bool done;
+    long k;
+    int b, d;
+
+    buf[0] = '\0';
+    if (bp != mi.bp || !wanted(bp) || strcmp(mi.pat, pat) != 0)
+        return;
+    done = mi.nstale == 0 && mi.next_lp == bp->b_linep;
+    if (!done) {
+        snprintf(buf, size, "%ld+ matches", mi.total);
+        return;
+    }
+    if (mi.total == 0) {
+        snprintf(buf, size, "no matches");
+        return;
+    }
+
+    /* dot on a match, or just after it as a forward search leaves it */
+    if (dot != bp->b_linep && (b = locate(dot, &d)) >= 0 && (text = line_peek(&pk, dot)) != NULL) {
+        int len = llength(dot);
+
+        k = fen_prefix(b);
+        for (int i = 0; i < mi.blocks[b].nhits && mi.blocks[b].hits[i].ordinal < d; i++)
+            k += mi.blocks[b].hits[i].count;
+        for (int pos = 0; (pos = lsearch_find(&mi.ls, text, len, pos)) >= 0; pos += mi.ls.len) {
+            k++;
+            if (pos > wp->w_doto)
+                break;
+            if (pos == wp->w_doto || pos + mi.ls.len == wp->w_doto) {
+                snprintf(buf, size, "match %ld/%ld", k, mi.total);
+                return;
+            }
+        }
+    }
+    snprintf(buf, size, "%ld match%s", mi.total, mi.total == 1 ? "" : "es");
+}
@@ -0,0 +1,53 @@
+#ifndef MATCH_INDEX_H_
+#define MATCH_INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lit_search.h"
+
+struct buffer;
+struct line;
+struct window;
+
+/*
+ * Index of the matches of the search pattern in the current buffer.
+ *
+ * While the editor waits for a key, match_index_pump() cuts the buffer into
+ * blocks of lines and counts the non-overlapping matches of pat[] in each,
+ * a slice at a time, reading COLD chunks through handle_peek() so they stay
+ * COLD.  A Fenwick tree over the block counts answers "which match is this"
+ * and "where is the next line with a match" in O(log n) plus one block.
+ *
+ * Edits keep it current: lchange() reports the changed line and lines that
+ * go away are reported before they are freed, so only the blocks touched
+ * are counted again.  Only literal patterns without a newline are indexed;
+ * MAGIC patterns with metacharacters are not.
+ */
+
+/* Count for a few ms; true if there was anything to count. */
+bool match_index_pump(struct buffer *bp);
+
+/* lp (or, for the header line, the end of the buffer) was changed. */
+void match_index_touch(struct buffer *bp, struct line *lp);
+
+/* lp, still linked, is about to go away; repl takes its place. */
+void match_index_replace(struct buffer *bp, struct line *lp, struct line *repl);
+
+/* Drop the index of bp, if it has one. */
+void match_index_forget(struct buffer *bp);
+
+/* Is the index of bp complete and built for the pattern in ls? */
+bool match_index_ready(struct buffer *bp, const struct lsearch *ls);
+
+/*
+ * lsearch_buffer() through the index; requires match_index_ready().  Only
+ * the start line is scanned, the index says which line to try next.
+ */
+bool match_index_find(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                      int dir, struct lsearch_match *m);
+
+/* "match 37/1204", "1204 matches" or "" for wp's mode line. */
+void match_index_status(struct window *wp, char *buf, size_t size);
+
+#endif /* MATCH_INDEX_H_ */
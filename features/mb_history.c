@@ -0,0 +1,694 @@
+#include "mb_history.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#ifndef USE_WINDOWS
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "estruct.h"
+#include "lit_search.h"
+#include "platform.h"
+#include "rx_cache.h"
+
+#define MBH_KINDS 64
+#define MBH_FILE "history"
+
+struct mbh_entry {
+    char *text;
+    int len;
+    int kind;
+    bool dead;                          /* entered again since */
+    uint64_t bytes;                     /* byte_mask() of the text */
+};
+
+/* The entries whose text contains one trigram, or bigram. */
+struct mbh_gram {
+    uint32_t key;                       /* the folded bytes + 1; 0: free */
+    int n;
+    int cap;
+    int *ids;                           /* ascending */
+};
+
+static struct {
+    bool loaded;
+    int file_lines;                     /* entries in the history file */
+    char *kinds[MBH_KINDS];
+    int nkinds;
+    struct mbh_entry *e;                /* oldest first */
+    int n;
+    int cap;
+    int live;
+    int *by_text;                       /* live ids by kind and text; -1: free */
+    int by_text_cap;
+    struct mbh_gram *grams;
+    int grams_cap;
+    int ngrams;
+} mbh;
+
+/* The last query. */
+static struct {
+    bool valid;
+    bool regex;                         /* a regex that compiles */
+    char text[NPAT];
+    struct lsearch ls;
+    char lit[NPAT];                     /* in every match */
+    int litlen;
+    uint64_t need;                      /* byte_mask() of lit */
+} q;
+
+static inline unsigned char fold(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c | 0x20) : c;
+}
+
+/* A bit for each folded byte value, mod 64, in text. */
+static uint64_t byte_mask(const char *text, int len)
+{
+    uint64_t mask = 0;
+
+    for (int i = 0; i < len; i++)
+        mask |= 1ull << (fold((unsigned char)text[i]) & 63);
+    return mask;
+}
+
+/* Trigrams and bigrams share the table; bigram keys have bit 24 set. */
+static inline uint32_t gram_key(const char *s, int n)
+{
+    if (n == 2)
+        return (1u << 24 | (uint32_t)fold((unsigned char)s[0]) << 8 | fold((unsigned char)s[1])) + 1;
+    return ((uint32_t)fold((unsigned char)s[0]) << 16 | (uint32_t)fold((unsigned char)s[1]) << 8 |
+            fold((unsigned char)s[2])) + 1;
+}
+
+static inline uint32_t mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x45d9f3bu;
+    h ^= h >> 16;
+    return h;
+}
+
+static struct mbh_gram *gram_find(uint32_t key)
+{
+    if (mbh.grams_cap == 0)
+        return NULL;
+    for (uint32_t i = mix(key);; i++) {
+        struct mbh_gram *g = &mbh.grams[i & (uint32_t)(mbh.grams_cap - 1)];
+
+        if (g->key == key)
+            return g;
+        if (g->key == 0)
+            return NULL;
+    }
+}
+
+static bool grams_grow(void)
+{
+    int cap = mbh.grams_cap ? mbh.grams_cap * 2 : 4096;
+    struct mbh_gram *grams = calloc((size_t)cap, sizeof(*grams));
+
+    if (grams == NULL)
+        return false;
+    for (int j = 0; j < mbh.grams_cap; j++) {
+        struct mbh_gram *g = &mbh.grams[j];
+
+        if (g->key == 0)
+            continue;
+        for (uint32_t i = mix(g->key);; i++) {
+            struct mbh_gram *slot = &grams[i & (uint32_t)(cap - 1)];
+
+            if (slot->key == 0) {
+                *slot = *g;
+                break;
+            }
+        }
+    }
+    free(mbh.grams);
+    mbh.grams = grams;
+    mbh.grams_cap = cap;
+    return true;
+}
+
+static struct mbh_gram *gram_get(uint32_t key)
+{
+    if (mbh.ngrams * 2 >= mbh.grams_cap && !grams_grow())
+        return NULL;
+    for (uint32_t i = mix(key);; i++) {
+        struct mbh_gram *g = &mbh.grams[i & (uint32_t)(mbh.grams_cap - 1)];
+
+        if (g->key == key)
+            return g;
+        if (g->key == 0) {
+            g->key = key;
+            mbh.ngrams++;
+            return g;
+        }
+    }
+}
+
+static void index_gram(uint32_t key, int id)
+{
+    struct mbh_gram *g = gram_get(key);
+
+    if (g == NULL || (g->n > 0 && g->ids[g->n - 1] == id))
+        return;
+    if (g->n == g->cap) {
+        int cap = g->cap ? g->cap * 2 : 4;
+        int *ids = realloc(g->ids, (size_t)cap * sizeof(*ids));
+
+        if (ids == NULL)
+            return;
+        g->ids = ids;
+        g->cap = cap;
+    }
+    g->ids[g->n++] = id;
+}
+
+static void index_entry(int id)
+{
+    const struct mbh_entry *e = &mbh.e[id];
+
+    for (int i = 0; i + 2 <= e->len; i++) {
+        for (int n = 2; n <= 3 && i + n <= e->len; n++)
+            index_gram(gram_key(e->text + i, n), id);
+    }
+}
+
+static uint32_t text_hash(int kind, const char *text, int len)
+{
+    uint32_t h = 2166136261u ^ (uint32_t)kind;
+
+    for (int i = 0; i < len; i++)
+        h = (h ^ (unsigned char)text[i]) * 16777619u;
+    return h;
+}
+
+/* The by_text slot of kind and text: holding its id, or free. */
+static int *text_slot(int kind, const char *text, int len)
+{
+    for (uint32_t i = text_hash(kind, text, len);; i++) {
+        int *slot = &mbh.by_text[i & (uint32_t)(mbh.by_text_cap - 1)];
+        const struct mbh_entry *e;
+
+        if (*slot < 0)
+            return slot;
+        e = &mbh.e[*slot];
+        if (e->kind == kind && e->len == len && memcmp(e->text, text, (size_t)len) == 0)
+            return slot;
+    }
+}
+
+static bool by_text_rebuild(int cap)
+{
+    int *by_text = malloc((size_t)cap * sizeof(*by_text));
+
+    if (by_text == NULL)
+        return false;
+    memset(by_text, 0xff, (size_t)cap * sizeof(*by_text));
+    free(mbh.by_text);
+    mbh.by_text = by_text;
+    mbh.by_text_cap = cap;
+    for (int id = 0; id < mbh.n; id++) {
+        const struct mbh_entry *e = &mbh.e[id];
+
+        if (!e->dead)
+            *text_slot(e->kind, e->text, e->len) = id;
+    }
+    return true;
+}
+
+/* Make text the newest entry of kind; false if it already was. */
+static bool add(int kind, const char *text, int len)
+{
+    struct mbh_entry *e;
+    int *slot;
+
+    if ((mbh.live + 1) * 2 > mbh.by_text_cap &&
+        !by_text_rebuild(mbh.by_text_cap ? mbh.by_text_cap * 2 : 1024))
+        return false;
+    if (mbh.n == mbh.cap) {
+        int cap = mbh.cap ? mbh.cap * 2 : 1024;
+        struct mbh_entry *grown = realloc(mbh.e, (size_t)cap * sizeof(*grown));
+
+        if (grown == NULL)
+            return false;
+        mbh.e = grown;
+        mbh.cap = cap;
+    }
+    slot = text_slot(kind, text, len);
+    if (*slot == mbh.n - 1 && *slot >= 0)
+        return false;
+    e = &mbh.e[mbh.n];
+    e->text = malloc((size_t)len + 1);
+    if (e->text == NULL)
+        return false;
+    memcpy(e->text, text, (size_t)len);
+    e->text[len] = '\0';
+    e->len = len;
+    e->kind = kind;
+    e->dead = false;
+    e->bytes = byte_mask(text, len);
+    if (*slot >= 0)
+        mbh.e[*slot].dead = true;
+    else
+        mbh.live++;
+    *slot = mbh.n++;
+    index_entry(*slot);
+    q.valid = false;
+    return true;
+}
+
+static void file_path(char *out, size_t cap)
+{
+    char dir[PATH_MAX];
+
+    nanox_get_user_data_dir(dir, sizeof(dir));
+    nanox_path_join(out, cap, dir, MBH_FILE);
+}
+
+static bool make_dirs(const char *dir)
+{
+#ifndef USE_WINDOWS
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s", dir);
+    for (char *s = path + 1; *s; s++) {
+        if (*s != '/')
+            continue;
+        *s = '\0';
+        if (mkdir(path, 0777) != 0 && errno != EEXIST)
+            return false;
+        *s = '/';
+    }
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+#else
+    (void)dir;
+    return true;
+#endif
+}
+
+/* One "kind<TAB>text" line, with backslash, tab and newline escaped. */
+static void put_entry(FILE *fp, const struct mbh_entry *e)
+{
+    fputs(mbh.kinds[e->kind], fp);
+    fputc('\t', fp);
+    for (int i = 0; i < e->len; i++) {
+        char c = e->text[i];
+
+        if (c == '\\' || c == '\t' || c == '\n' || c == '\r') {
+            fputc('\\', fp);
+            c = c == '\t' ? 't' : c == '\n' ? 'n' : c == '\r' ? 'r' : c;
+        }
+        fputc(c, fp);
+    }
+    fputc('\n', fp);
+}
+
+static void append_entry(const struct mbh_entry *e)
+{
+    char path[PATH_MAX];
+    char dir[PATH_MAX];
+    FILE *fp;
+
+    nanox_get_user_data_dir(dir, sizeof(dir));
+    file_path(path, sizeof(path));
+    if (!make_dirs(dir) || (fp = fopen(path, "a")) == NULL)
+        return;
+    put_entry(fp, e);
+    fclose(fp);
+    mbh.file_lines++;
+}
+
+static void rewrite_file(void)
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + 8];
+    FILE *fp;
+    bool ok;
+
+    file_path(path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((fp = fopen(tmp, "w")) == NULL)
+        return;
+    for (int id = 0; id < mbh.n; id++)
+        put_entry(fp, &mbh.e[id]);
+    ok = fflush(fp) == 0 && !ferror(fp);
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return;
+    }
+    mbh.file_lines = mbh.n;
+}
+
+static void drop_grams(void)
+{
+    for (int i = 0; i < mbh.grams_cap; i++)
+        free(mbh.grams[i].ids);
+    free(mbh.grams);
+    mbh.grams = NULL;
+    mbh.grams_cap = 0;
+    mbh.ngrams = 0;
+}
+
+/* Forget every entry, keeping the kinds. */
+static void drop_entries(void)
+{
+    for (int id = 0; id < mbh.n; id++)
+        free(mbh.e[id].text);
+    mbh.n = 0;
+    mbh.live = 0;
+    mbh.file_lines = 0;
+    drop_grams();
+    if (mbh.by_text != NULL)
+        memset(mbh.by_text, 0xff, (size_t)mbh.by_text_cap * sizeof(*mbh.by_text));
+    q.valid = false;
+}
+
+static int intern_kind(const char *name, int len);
+
+/* Add the entries of the history file, oldest first. */
+static void read_file(void)
+{
+    char path[PATH_MAX];
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t got;
+    FILE *fp;
+
+    file_path(path, sizeof(path));
+    if ((fp = fopen(path, "r")) == NULL)
+        return;
+    while ((got = getline(&line, &cap, fp)) > 0) {
+        char *tab = memchr(line, '\t', (size_t)got);
+        int n = 0;
+        int kind;
+
+        mbh.file_lines++;
+        if (tab == NULL || (kind = intern_kind(line, (int)(tab - line))) < 0)
+            continue;
+        for (char *s = tab + 1; s < line + got && *s != '\n'; s++) {
+            char c = *s;
+
+            if (c == '\\' && s + 1 < line + got) {
+                c = *++s;
+                c = c == 't' ? '\t' : c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+            }
+            line[n++] = c;              /* never ahead of s */
+        }
+        if (n > 0 && n < NPAT)
+            add(kind, line, n);
+    }
+    free(line);
+    fclose(fp);
+}
+
+/*
+ * Drop the dead entries and all but the newest MB_HISTORY_MAX live ones,
+ * and rewrite the file with the rest.  Other editors may have appended to
+ * the file since it was read, so unless it was just read it is read again
+ * first; every entry made here was appended to it too.
+ */
+static void compact(bool reread)
+{
+    int skip;
+    int n = 0;
+
+    if (reread) {
+        drop_entries();
+        read_file();
+    }
+    skip = mbh.live > MB_HISTORY_MAX ? mbh.live - MB_HISTORY_MAX : 0;
+    for (int id = 0; id < mbh.n; id++) {
+        struct mbh_entry *e = &mbh.e[id];
+
+        if (e->dead || skip > 0) {
+            skip -= !e->dead;
+            free(e->text);
+            continue;
+        }
+        mbh.e[n++] = *e;
+    }
+    mbh.n = n;
+    mbh.live = n;
+    drop_grams();
+    for (int id = 0; id < n; id++)
+        index_entry(id);
+    by_text_rebuild(mbh.by_text_cap);
+    q.valid = false;
+    rewrite_file();
+}
+
+static int intern_kind(const char *name, int len)
+{
+    char *copy;
+
+    for (int k = 0; k < mbh.nkinds; k++) {
+        if ((int)strlen(mbh.kinds[k]) == len && memcmp(mbh.kinds[k], name, (size_t)len) == 0)
+            return k;
+    }
+    if (mbh.nkinds == MBH_KINDS || (copy = malloc((size_t)len + 1)) == NULL)
+        return -1;
+    memcpy(copy, name, (size_t)len);
+    copy[len] = '\0';
+    mbh.kinds[mbh.nkinds] = copy;
+    return mbh.nkinds++;
+}
+
+static void load(void)
+{
+    if (mbh.loaded)
+        return;
+    mbh.loaded = true;
+    read_file();
+    if (mbh.live > MB_HISTORY_MAX || mbh.file_lines > mbh.live * 2 + 1024)
+        compact(false);
+}
+
+int mb_history_kind(const char *prompt)
+{
+    int len = (int)strlen(prompt);
+
+    load();
+    while (len > 0 && (prompt[len - 1] == ' ' || prompt[len - 1] == ':'))
+        len--;
+    if (len == 0 || memchr(prompt, '\t', (size_t)len) != NULL)
+        return -1;
+    return intern_kind(prompt, len);
+}
+
+void mb_history_add(int kind, const char *text)
+{
+    int len = (int)strlen(text);
+
+    load();
+    if (kind < 0 || len == 0 || len >= NPAT || !add(kind, text, len))
+        return;
+    append_entry(&mbh.e[mbh.n - 1]);
+    if (mbh.n >= MB_HISTORY_MAX + MB_HISTORY_MAX / 2)
+        compact(true);
+}
+
+const char *mb_history_text(int id)
+{
+    return id >= 0 && id < mbh.n ? mbh.e[id].text : "";
+}
+
+static void keep_run(const char *run, int n, char *out, int *best)
+{
+    if (n > *best) {
+        memcpy(out, run, (size_t)n);
+        *best = n;
+    }
+}
+
+/*
+ * The longest run of bytes that every match of re contains.  Only runs
+ * outside groups count, and alternation or inline options give up.  Bytes
+ * past ASCII end a run, as a caseless UTF match may use another case.
+ */
+static int required_literal(const char *re, char *out)
+{
+    char run[NPAT];
+    int n = 0;
+    int best = 0;
+    int depth = 0;
+
+    if (strchr(re, '|') != NULL || strstr(re, "(?") != NULL)
+        return 0;
+    for (const char *s = re; *s != '\0'; s++) {
+        char c = *s;
+
+        if (c == '\\') {
+            c = *++s;
+            if (c == '\0')
+                break;
+            if ((c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')) {
+                keep_run(run, n, out, &best);   /* a class or a back reference */
+                n = 0;
+                continue;
+            }
+        } else if (c == '*' || c == '?' || c == '{') {
+            n -= n > 0;                         /* the atom before may be missing */
+            while (c == '{' && s[1] != '\0' && s[1] != '}')
+                s++;
+            s += c == '{' && s[1] == '}';
+            keep_run(run, n, out, &best);
+            n = 0;
+            continue;
+        } else if (c == '[') {
+            s += s[1] == '^';
+            s += s[1] == ']';
+            while (s[1] != '\0' && s[1] != ']')
+                s += s[1] == '\\' && s[2] != '\0' ? 2 : 1;
+            s += s[1] == ']';
+            keep_run(run, n, out, &best);
+            n = 0;
+            continue;
+        } else if (strchr("().^$+", c) != NULL) {
+            depth += c == '(' ? 1 : c == ')' ? -1 : 0;
+            keep_run(run, n, out, &best);
+            n = 0;
+            continue;
+        }
+        if ((unsigned char)c >= 0x80) {
+            keep_run(run, n, out, &best);
+            n = 0;
+            continue;
+        }
+        if (depth == 0 && n < NPAT - 1)
+            run[n++] = c;
+    }
+    keep_run(run, n, out, &best);
+    return best;
+}
+
+/* Compile query unless it is the last one; an invalid regex is a literal. */
+static void prepare(const char *query, bool regex, struct rx **rx)
+{
+    char err[128];
+
+    *rx = regex ? rx_get(query, PCRE2_UTF | PCRE2_UCP | PCRE2_CASELESS, err, sizeof(err)) : NULL;
+    regex = *rx != NULL;
+    if (q.valid && q.regex == regex && strcmp(q.text, query) == 0)
+        return;
+    q.valid = true;
+    q.regex = regex;
+    snprintf(q.text, sizeof(q.text), "%s", query);
+    if (regex) {
+        q.litlen = required_literal(q.text, q.lit);
+    } else {
+        q.litlen = (int)strlen(q.text);
+        memcpy(q.lit, q.text, (size_t)q.litlen);
+        lsearch_compile(&q.ls, q.text, q.litlen, true);
+    }
+    q.need = byte_mask(q.lit, q.litlen);
+}
+
+static bool matches(int id, int kind, struct rx *rx)
+{
+    const struct mbh_entry *e = &mbh.e[id];
+
+    if (e->dead || e->kind != kind || (q.need & ~e->bytes) != 0)
+        return false;
+    if (rx != NULL)
+        return rx_match(rx, e->text, (size_t)e->len, 0) >= 0;
+    return q.litlen == 0 ||
+           (e->len >= q.litlen && lsearch_find(&q.ls, (const unsigned char *)e->text, e->len, 0) >= 0);
+}
+
+/*
+ * The ids that can match the query: those under its rarest trigram (its
+ * bigram if it is that short), or all of them.  False when some trigram of
+ * the query is in no entry.
+ */
+static bool candidates(const int **ids, int *n)
+{
+    const struct mbh_gram *best = NULL;
+    int len = q.litlen < 3 ? q.litlen : 3;
+
+    *ids = NULL;
+    *n = mbh.n;
+    for (int i = 0; len >= 2 && i + len <= q.litlen; i++) {
+        const struct mbh_gram *g = gram_find(gram_key(q.lit + i, len));
+
+        if (g == NULL)
+            return false;
+        if (best == NULL || g->n < best->n)
+            best = g;
+    }
+    if (best != NULL) {
+        *ids = best->ids;
+        *n = best->n;
+    }
+    return true;
+}
+
+/* Index of the first of ids[0..n) at or above id. */
+static int lower_bound(const int *ids, int n, int id)
+{
+    int lo = 0;
+    int hi = n;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (ids[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int mb_history_prev(int kind, const char *query, bool regex, int before)
+{
+    struct rx *rx;
+    const int *ids;
+    int n;
+    int i;
+
+    load();
+    if (before < 0 || before > mbh.n)
+        before = mbh.n;
+    if (kind < 0)
+        return -1;
+    prepare(query, regex, &rx);
+    if (!candidates(&ids, &n))
+        return -1;
+    i = ids != NULL ? lower_bound(ids, n, before) : before;
+    while (--i >= 0) {
+        int id = ids != NULL ? ids[i] : i;
+
+        if (matches(id, kind, rx))
+            return id;
+    }
+    return -1;
+}
+
+int mb_history_next(int kind, const char *query, bool regex, int after)
+{
+    struct rx *rx;
+    const int *ids;
+    int n;
+
+    load();
+    if (kind < 0)
+        return -1;
+    prepare(query, regex, &rx);
+    if (!candidates(&ids, &n))
+        return -1;
+    for (int i = ids != NULL ? lower_bound(ids, n, after + 1) : after + 1; i < n; i++) {
+        int id = ids != NULL ? ids[i] : i;
+
+        if (matches(id, kind, rx))
+            return id;
+    }
+    return -1;
+}
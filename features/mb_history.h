@@ -0,0 +1,47 @@
+#ifndef MB_HISTORY_H_
+#define MB_HISTORY_H_
+
+#include <stdbool.h>
+
+/*
+ * History of what was entered in the minibuffer, shared by all prompts.
+ *
+ * Each prompt ("Search", "Command Mode", "sed replace", ...) is a kind, and
+ * recalling only walks the entries of one kind.  Entries are appended to
+ * the "history" file in the user data directory as they are made, so
+ * several editors can share it.  Once it has grown well past what is kept
+ * it is read again, so that what other editors appended is kept too, and
+ * rewritten without the duplicates.
+ *
+ * Every entry is indexed by the case-folded trigrams and bigrams of its
+ * text.  A query only looks at the entries listed under its rarest trigram
+ * (its bigram if it is that short), newest first, and checks those with
+ * lsearch_find(), or with PCRE2 for a regex, whose grams come from the
+ * longest literal every match must contain.  A 64-bit mask of the bytes
+ * of each entry rules out most of the rest before they are searched.
+ * Recall therefore stays well under a millisecond with tens of thousands
+ * of entries.  Matching ignores case: ASCII case for a literal, Unicode
+ * case for a regex, which is compiled as UTF-8.
+ */
+#define MB_HISTORY_MAX 65536            /* entries kept */
+
+/* The kind of the entries made at prompt; loads the history file. */
+int mb_history_kind(const char *prompt);
+
+/* text was entered at a prompt of kind; it becomes the newest entry. */
+void mb_history_add(int kind, const char *text);
+
+/*
+ * The newest entry of kind older than entry before (any entry when before
+ * is negative) that contains query, or matches it as a regex; -1 if none.
+ * An invalid regex is looked for as a literal.
+ */
+int mb_history_prev(int kind, const char *query, bool regex, int before);
+
+/* The oldest matching entry newer than entry after, or -1. */
+int mb_history_next(int kind, const char *query, bool regex, int after);
+
+/* The text of entry id, valid until the next mb_history_add(). */
+const char *mb_history_text(int id);
+
+#endif /* MB_HISTORY_H_ */
@@ -0,0 +1,384 @@
+#include "par_search.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+
+#define PS_RING 64                      /* jobs in flight */
+#define PS_JOB_LINES 512                /* a job ends at a chunk boundary after this... */
+#define PS_JOB_BYTES (64 * 1024)        /* ...or this much text */
+#define PS_JOB_MAX_LINES 4096           /* and never runs longer than this */
+#define PS_PROGRESS_MS 100
+
+struct ps_hit {
+    struct line *lp;
+    int off;
+};
+
+struct ps_job {
+    long seq;
+    struct line *first;
+    int first_off;                      /* hits on the first line start here */
+    struct line *stop;                  /* reverse: the line above the job */
+    int nlines;
+    long bytes;
+    bool done;
+    struct ps_hit *hits;
+    int nhits;
+    int hit_cap;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;           /* a job finished */
+    pthread_cond_t free_cond;           /* a ring slot was handed back */
+
+    const struct lsearch *ls;
+    struct buffer *bp;
+    bool first_only;
+    bool reverse;                       /* jobs go up from next_lp */
+
+    struct line *next_lp;               /* where the next job starts */
+    int next_off;
+    bool at_end;                        /* no more jobs to claim */
+    long next_seq;
+    long delivered;                     /* jobs before this were handed over */
+    long stop_seq;                      /* don't claim jobs from here on */
+
+    struct ps_job ring[PS_RING];
+} ps = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .done_cond = PTHREAD_COND_INITIALIZER,
+    .free_cond = PTHREAD_COND_INITIALIZER,
+};
+
+bool psearch_worthwhile(struct buffer *bp, struct line *lp, int dir)
+{
+    for (int n = 0; n < PS_MIN_LINES; n++) {
+        lp = dir == FORWARD ? lforw(lp) : lback(lp);
+        if (lp == bp->b_linep)
+            return false;
+    }
+    return true;
+}
+
+/* The same as claim(), upwards: the job ends above at job->stop. */
+static void claim_up(struct ps_job *job)
+{
+    struct line *lp = ps.next_lp;
+
+    for (;;) {
+        job->nlines++;
+        job->bytes += llength(lp) + 1;
+        if (lback(lp) == ps.bp->b_linep) {
+            job->stop = ps.bp->b_linep;
+            ps.at_end = true;
+            return;
+        }
+        struct line *prev = lback(lp);
+        bool boundary = prev->l_handle != lp->l_handle;
+
+        lp = prev;
+        if (job->nlines >= PS_JOB_MAX_LINES ||
+            (boundary && (job->nlines >= PS_JOB_LINES || job->bytes >= PS_JOB_BYTES)))
+            break;
+    }
+    job->stop = lp;
+    ps.next_lp = lp;
+    ps.next_off = llength(lp);
+}
+
+/* Cut the next job off the remaining lines.  Caller holds ps.lock. */
+static void claim(struct ps_job *job)
+{
+    struct line *lp = ps.next_lp;
+
+    job->seq = ps.next_seq++;
+    job->first = lp;
+    job->first_off = ps.next_off;
+    job->nlines = 0;
+    job->bytes = 0;
+    job->nhits = 0;
+    job->done = false;
+    if (ps.reverse) {
+        claim_up(job);
+        return;
+    }
+
+    for (;;) {
+        job->nlines++;
+        job->bytes += llength(lp) + 1;
+        if (lforw(lp) == ps.bp->b_linep) {
+            ps.at_end = true;
+            return;
+        }
+        struct line *next = lforw(lp);
+        bool boundary = next->l_handle != lp->l_handle;
+
+        lp = next;
+        if (job->nlines >= PS_JOB_MAX_LINES ||
+            (boundary && (job->nlines >= PS_JOB_LINES || job->bytes >= PS_JOB_BYTES)))
+            break;
+    }
+    ps.next_lp = lp;
+    ps.next_off = 0;
+}
+
+static bool add_hit(struct ps_job *job, struct line *lp, int off)
+{
+    if (job->nhits == job->hit_cap) {
+        int cap = job->hit_cap ? job->hit_cap * 2 : 64;
+        struct ps_hit *hits = realloc(job->hits, (size_t)cap * sizeof(*hits));
+
+        if (hits == NULL)
+            return false;
+        job->hits = hits;
+        job->hit_cap = cap;
+    }
+    job->hits[job->nhits].lp = lp;
+    job->hits[job->nhits].off = off;
+    job->nhits++;
+    return true;
+}
+
+static void scan_job(struct ps_job *job, struct lsearch_peek *pk)
+{
+    const struct lsearch *ls = ps.ls;
+    struct line *lp = job->first;
+    int off = job->first_off;
+
+    if (ps.reverse) {                   /* only the last hit is wanted */
+        struct lsearch_match m;
+
+        if (lsearch_rscan(ls, lp, off, job->stop, pk, &m))
+            add_hit(job, m.start_lp, m.start_off);
+        return;
+    }
+
+    for (int i = 0; i < job->nlines; i++, lp = lforw(lp), off = 0) {
+        int len = llength(lp);
+
+        if (len == 0)
+            continue;
+        if (pk->base == NULL || lp->l_handle != pk->handle) {
+            pk->handle = lp->l_handle;
+            pk->base = handle_peek(lp->l_handle, &pk->scratch, &pk->cap);
+            if (pk->base == NULL)
+                continue;
+        }
+
+        const unsigned char *text = pk->base + lp->l_offset;
+        for (int pos = off; (pos = lsearch_find(ls, text, len, pos)) >= 0; pos += ls->len) {
+            if (!add_hit(job, lp, pos) || ps.first_only)
+                return;
+        }
+    }
+}
+
+static void *ps_worker_main(void *arg)
+{
+    struct lsearch_peek pk = { 0 };
+
+    (void)arg;
+    pthread_mutex_lock(&ps.lock);
+    for (;;) {
+        while (!ps.at_end && ps.next_seq < ps.stop_seq && ps.next_seq >= ps.delivered + PS_RING)
+            pthread_cond_wait(&ps.free_cond, &ps.lock);
+        if (ps.at_end || ps.next_seq >= ps.stop_seq)
+            break;
+
+        struct ps_job *job = &ps.ring[ps.next_seq % PS_RING];
+        claim(job);
+        pthread_mutex_unlock(&ps.lock);
+
+        scan_job(job, &pk);
+
+        pthread_mutex_lock(&ps.lock);
+        job->done = true;
+        if (ps.first_only && job->nhits > 0 && job->seq + 1 < ps.stop_seq)
+            ps.stop_seq = job->seq + 1;
+        pthread_cond_broadcast(&ps.done_cond);
+    }
+    pthread_mutex_unlock(&ps.lock);
+    free(pk.scratch);
+    return NULL;
+}
+
+static int thread_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n < 1)
+        n = 1;
+    return n > PS_THREADS_MAX ? PS_THREADS_MAX : (int)n;
+}
+
+/* Key typed?  Keep it for the caller unless it is the abort key. */
+static bool cancelled(void)
+{
+    int c;
+
+    if (kbdmode == PLAY || !typahead())
+        return false;
+    c = tgetc();
+    if (c != abortc && c != (CONTROL | 'G'))
+        reeat(c);
+    return true;
+}
+
+static int run(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+               bool reverse, bool first_only, psearch_hit_fn fn, void *arg)
+{
+    pthread_t threads[PS_THREADS_MAX];
+    int nthreads = thread_count();
+    int started = 0;
+    int status = TRUE;
+    bool shown = false;                 /* progress is on the message line */
+    long searched = 0;
+    struct timespec last, now;
+
+    if (ls->len == 0 || ls->nl_first >= 0)
+        return FALSE;
+
+    pthread_mutex_lock(&ps.lock);
+    ps.ls = ls;
+    ps.bp = bp;
+    ps.first_only = first_only;
+    ps.reverse = reverse;
+    ps.next_lp = lp;
+    ps.next_off = off;
+    ps.at_end = false;
+    ps.next_seq = 0;
+    ps.delivered = 0;
+    ps.stop_seq = LONG_MAX;
+    pthread_mutex_unlock(&ps.lock);
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, ps_worker_main, NULL) != 0)
+            break;
+        started++;
+    }
+    if (started == 0)
+        return FALSE;
+
+    clock_gettime(CLOCK_MONOTONIC, &last);
+    pthread_mutex_lock(&ps.lock);
+    for (;;) {
+        struct ps_job *job = &ps.ring[ps.delivered % PS_RING];
+
+        /* hand over finished jobs, in order */
+        while (ps.delivered < ps.next_seq && job->done && ps.delivered < ps.stop_seq) {
+            bool more = true;
+
+            for (int i = 0; i < job->nhits && more; i++)
+                more = fn(job->hits[i].lp, job->hits[i].off, arg);
+            if (!more || (first_only && job->nhits > 0))
+                ps.stop_seq = ps.delivered + 1;
+            searched += job->bytes;
+            ps.delivered++;
+            pthread_cond_broadcast(&ps.free_cond);
+            job = &ps.ring[ps.delivered % PS_RING];
+        }
+        if (ps.delivered >= ps.stop_seq || (ps.delivered == ps.next_seq && ps.at_end))
+            break;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - last.tv_sec) * 1000L + (now.tv_nsec - last.tv_nsec) / 1000000L >= PS_PROGRESS_MS) {
+            last = now;
+            pthread_mutex_unlock(&ps.lock);
+            mlwrite("Searching... %D MB (any key stops)", searched >> 20);
+            shown = true;
+            bool stop = cancelled();
+            pthread_mutex_lock(&ps.lock);
+            if (stop) {
+                status = ABORT;
+                break;
+            }
+            continue;
+        }
+
+        if (ps.delivered == ps.next_seq || !job->done) {
+            struct timespec deadline;
+
+            clock_gettime(CLOCK_REALTIME, &deadline);   /* the clock of done_cond */
+            deadline.tv_nsec += PS_PROGRESS_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&ps.done_cond, &ps.lock, &deadline);
+        }
+    }
+    ps.stop_seq = ps.next_seq;          /* the workers finish what they hold */
+    pthread_cond_broadcast(&ps.free_cond);
+    pthread_mutex_unlock(&ps.lock);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    if (status == ABORT)
+        mlwrite("Search stopped");
+    else if (shown)
+        mlwrite("");
+    return status;
+}
+
+int psearch_run(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                bool first_only, psearch_hit_fn fn, void *arg)
+{
+    return run(ls, bp, lp, off, false, first_only, fn, arg);
+}
+
+static bool first_hit(struct line *lp, int off, void *arg)
+{
+    struct lsearch_match *m = arg;
+
+    m->start_lp = lp;
+    m->start_off = off;
+    return false;
+}
+
+int psearch_forward(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                    struct lsearch_match *m)
+{
+    int status;
+
+    m->start_lp = NULL;
+    status = psearch_run(ls, bp, lp, off, true, first_hit, m);
+    if (status == FALSE)
+        return lsearch_buffer(ls, bp, lp, off, FORWARD, m);
+    if (status == ABORT)
+        return ABORT;
+    if (m->start_lp == NULL)
+        return FALSE;
+    m->end_lp = m->start_lp;
+    m->end_off = m->start_off + ls->len;
+    return TRUE;
+}
+
+int psearch_reverse(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                    struct lsearch_match *m)
+{
+    int status;
+
+    if (lp == bp->b_linep) {
+        lp = lback(lp);
+        off = llength(lp);
+    }
+    m->start_lp = NULL;
+    status = run(ls, bp, lp, off, true, true, first_hit, m);
+    if (status == FALSE)
+        return lsearch_buffer(ls, bp, lp, off, REVERSE, m);
+    if (status == ABORT)
+        return ABORT;
+    if (m->start_lp == NULL)
+        return FALSE;
+    m->end_lp = m->start_lp;
+    m->end_off = m->start_off + ls->len;
+    return TRUE;
+}
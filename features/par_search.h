@@ -0,0 +1,58 @@
+#ifndef PAR_SEARCH_H_
+#define PAR_SEARCH_H_
+
+#include <stdbool.h>
+
+#include "lit_search.h"
+
+struct buffer;
+struct line;
+
+/*
+ * Multi-threaded literal search over a whole buffer.
+ *
+ * The lines from the start position to the end of the buffer are cut into
+ * jobs of whole read chunks (lines sharing one MemoryHandle) that worker
+ * threads claim in order.  A worker reads a chunk through handle_peek(), so
+ * a COLD chunk is decompressed into the worker's scratch buffer and stays
+ * COLD; searching a huge file no longer thaws all of it.  Results are handed
+ * back to the UI thread job by job in buffer order, which shows the amount
+ * searched on the message line and stops when a key is typed.
+ *
+ * A reverse search cuts the jobs going up from the start position; each
+ * worker looks for the last hit of its job with lsearch_rscan().
+ *
+ * The UI thread does nothing else meanwhile, so the buffer cannot change
+ * under the workers.  Patterns containing a newline are not supported here;
+ * lsearch_buffer() handles them.
+ */
+#define PS_THREADS_MAX 8
+#define PS_MIN_LINES 65536              /* smaller buffers are searched inline */
+
+/* Called for each hit in buffer order; return false to stop. */
+typedef bool (*psearch_hit_fn)(struct line *lp, int off, void *arg);
+
+/* Is the rest of bp from lp, going dir, long enough to be worth the threads? */
+bool psearch_worthwhile(struct buffer *bp, struct line *lp, int dir);
+
+/*
+ * Call fn for the hits of ls from (lp, off) to the end of bp, or only for
+ * the first one when first_only is set.  Returns TRUE when done, ABORT when
+ * a typed key cancelled the search (the key is kept for the caller) and
+ * FALSE when the threads could not be started.
+ */
+int psearch_run(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                bool first_only, psearch_hit_fn fn, void *arg);
+
+/*
+ * First match from (lp, off) forward: TRUE, FALSE or ABORT.  Falls back to
+ * lsearch_buffer() when the threads cannot be started.
+ */
+int psearch_forward(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                    struct lsearch_match *m);
+
+/* The same, for the last match before (lp, off). */
+int psearch_reverse(const struct lsearch *ls, struct buffer *bp, struct line *lp, int off,
+                    struct lsearch_match *m);
+
+#endif /* PAR_SEARCH_H_ */
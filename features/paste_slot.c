@@ -49,12 +49,8 @@ static int paste_slot_decode(const char *content, int byte_pos, int content_len,
 static void paste_slot_set_cell(struct video *vp, int col, unicode_t ch,
                                 HighlightStyle style)
 {
-    vp->v_text[col].ch = ch;
-    vp->v_text[col].fg = style.fg;
-    vp->v_text[col].bg = style.bg;
-    vp->v_text[col].bold = style.bold;
-    vp->v_text[col].underline = style.underline;
-    vp->v_text[col].italic = style.italic;
+    vcell_set(&vp->v_text[col], ch, style.fg, style.bg, style.bold, style.underline,
+              style.italic);
 }
 
 static void paste_slot_puts(struct video *vp, int *col, int max_col,
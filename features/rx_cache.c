@@ -0,0 +1,97 @@
+#include "rx_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RX_JIT_STACK_MIN (32 * 1024)
+#define RX_JIT_STACK_MAX (1024 * 1024)
+
+static struct rx cache[RX_CACHE_SIZE];
+static unsigned long clock_hand;
+
+/* Match context with this thread's JIT stack; NULL uses PCRE2's default. */
+static pcre2_match_context *thread_context(void)
+{
+    static _Thread_local pcre2_match_context *mctx;
+    static _Thread_local bool tried;
+    pcre2_jit_stack *stack;
+
+    if (tried)
+        return mctx;
+    tried = true;
+    mctx = pcre2_match_context_create(NULL);
+    if (mctx == NULL)
+        return NULL;
+    stack = pcre2_jit_stack_create(RX_JIT_STACK_MIN, RX_JIT_STACK_MAX, NULL);
+    if (stack != NULL)
+        pcre2_jit_stack_assign(mctx, NULL, stack);
+    return mctx;
+}
+
+static void drop(struct rx *rx)
+{
+    if (rx->md != NULL)
+        pcre2_match_data_free(rx->md);
+    if (rx->code != NULL)
+        pcre2_code_free(rx->code);
+    free(rx->pattern);
+    memset(rx, 0, sizeof(*rx));
+}
+
+struct rx *rx_get(const char *pattern, uint32_t options, char *err, size_t errsz)
+{
+    struct rx *rx = &cache[0];
+    int errornumber;
+    PCRE2_SIZE erroffset;
+
+    if (options & PCRE2_UTF)
+        options |= PCRE2_MATCH_INVALID_UTF;
+
+    for (int i = 0; i < RX_CACHE_SIZE; i++) {
+        struct rx *e = &cache[i];
+
+        if (e->code != NULL && e->options == options && strcmp(e->pattern, pattern) == 0) {
+            e->used = ++clock_hand;
+            return e;
+        }
+        if (e->used < rx->used)
+            rx = e;                     /* least recently used, or free */
+    }
+
+    drop(rx);
+    rx->pattern = strdup(pattern);
+    if (rx->pattern == NULL) {
+        snprintf(err, errsz, "Out of memory");
+        return NULL;
+    }
+    rx->code = pcre2_compile((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED, options,
+                             &errornumber, &erroffset, NULL);
+    if (rx->code == NULL) {
+        char msg[128];
+
+        pcre2_get_error_message(errornumber, (PCRE2_UCHAR *)msg, sizeof(msg));
+        snprintf(err, errsz, "Regex error at %d: %s", (int)erroffset, msg);
+        drop(rx);
+        return NULL;
+    }
+    rx->md = pcre2_match_data_create_from_pattern(rx->code, NULL);
+    if (rx->md == NULL) {
+        snprintf(err, errsz, "Out of memory");
+        drop(rx);
+        return NULL;
+    }
+    rx->jit = pcre2_jit_compile(rx->code, PCRE2_JIT_COMPLETE) == 0;
+    rx->options = options;
+    rx->used = ++clock_hand;
+    return rx;
+}
+
+int rx_match(struct rx *rx, const char *subject, size_t len, size_t start)
+{
+    pcre2_match_context *mctx = thread_context();
+
+    if (rx->jit)
+        return pcre2_jit_match(rx->code, (PCRE2_SPTR)subject, len, start, 0, rx->md, mctx);
+    return pcre2_match(rx->code, (PCRE2_SPTR)subject, len, start, 0, rx->md, mctx);
+}
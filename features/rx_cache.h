@@ -0,0 +1,48 @@
+#ifndef RX_CACHE_H_
+#define RX_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+
+/*
+ * Compiled regular expressions, shared by sed replace and the MAGIC search.
+ *
+ * rx_get() keeps the last RX_CACHE_SIZE patterns, keyed by pattern text and
+ * compile options, each compiled and then JIT-compiled once; repeating a
+ * search or an s/// does not compile anything.  rx_match() runs the JIT
+ * code directly with a per-thread JIT stack, or falls back to pcre2_match()
+ * where the JIT is not available.  A pattern compiled with PCRE2_UTF also
+ * gets PCRE2_MATCH_INVALID_UTF, because JIT matching skips the UTF check
+ * and buffers may hold any bytes.
+ */
+#define RX_CACHE_SIZE 16
+
+struct rx {
+    char *pattern;
+    uint32_t options;
+    pcre2_code *code;
+    pcre2_match_data *md;               /* for the UI thread */
+    bool jit;
+    unsigned long used;                 /* LRU stamp */
+};
+
+/*
+ * The compiled pattern, or NULL with the PCRE2 message in err.  It stays
+ * valid until RX_CACHE_SIZE other patterns have been asked for.
+ */
+struct rx *rx_get(const char *pattern, uint32_t options, char *err, size_t errsz);
+
+/* pcre2_match() rc of pattern rx on subject[0..len) from start; the match
+ * is in rx_ovector(rx). */
+int rx_match(struct rx *rx, const char *subject, size_t len, size_t start);
+
+static inline PCRE2_SIZE *rx_ovector(struct rx *rx)
+{
+    return pcre2_get_ovector_pointer(rx->md);
+}
+
+#endif /* RX_CACHE_H_ */
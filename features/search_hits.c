@@ -0,0 +1,140 @@
+#include "search_hits.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+#include "lit_search.h"
+#include "render_plugin.h"
+
+#define SH_SLOTS 1024                   /* power of two; several screenfuls */
+
+struct sh_entry {
+    struct line *lp;                    /* NULL: free */
+    unsigned gen;
+    MemoryHandle handle;                /* the text the hits were found in */
+    uint32_t offset;
+    int used;
+    int n;
+    int cap;
+    render_range_t *hits;
+};
+
+static struct {
+    bool shown;
+    unsigned gen;                       /* entries of older ones are stale */
+    bool fold;
+    char pat[NPAT];                     /* ls was compiled from this */
+    struct lsearch ls;
+    struct sh_entry slots[SH_SLOTS];
+} sh = { .shown = true, .gen = 1 };
+
+static struct sh_entry *slot_of(struct line *lp)
+{
+    uintptr_t h = (uintptr_t)lp;
+
+    h ^= h >> 17;
+    h *= 0x9E3779B97F4A7C15u;
+    return &sh.slots[(h >> 32) & (SH_SLOTS - 1)];
+}
+
+void search_hits_touch(struct line *lp)
+{
+    struct sh_entry *e = slot_of(lp);
+
+    if (e->lp == lp)
+        e->lp = NULL;
+}
+
+void search_hits_forget(void)
+{
+    sh.gen++;
+}
+
+void search_hits_show(bool on)
+{
+    sh.shown = on;
+}
+
+/* Is there a pattern to mark in bp?  Compiles it when it changed. */
+static bool current(struct buffer *bp)
+{
+    bool fold = (bp->b_mode & MDEXACT) == 0;
+
+    if (!sh.shown || pat[0] == '\0' || strchr(pat, '\n') != NULL || magic_search(bp))
+        return false;
+    if (sh.fold != fold || strcmp(sh.pat, pat) != 0) {
+        lsearch_compile(&sh.ls, pat, (int)strnlen(pat, NPAT - 1), fold);
+        memcpy(sh.pat, pat, (size_t)sh.ls.len);
+        sh.pat[sh.ls.len] = '\0';
+        sh.fold = fold;
+        sh.gen++;
+    }
+    return true;
+}
+
+static bool add_hit(struct sh_entry *e, int start, int end)
+{
+    if (e->n == e->cap) {
+        int cap = e->cap ? e->cap * 2 : 8;
+        render_range_t *grown = realloc(e->hits, (size_t)cap * sizeof(*grown));
+
+        if (grown == NULL)
+            return false;
+        e->hits = grown;
+        e->cap = cap;
+    }
+    e->hits[e->n].start = start;
+    e->hits[e->n].end = end;
+    e->n++;
+    return true;
+}
+
+static struct sh_entry *hits_of(struct line *lp)
+{
+    struct sh_entry *e = slot_of(lp);
+    int len = llength(lp);
+
+    if (e->lp == lp && e->gen == sh.gen && e->handle == lp->l_handle &&
+        e->offset == lp->l_offset && e->used == len)
+        return e;
+
+    const unsigned char *text = ltext(lp);
+
+    e->lp = lp;
+    e->gen = sh.gen;
+    e->handle = lp->l_handle;
+    e->offset = lp->l_offset;
+    e->used = len;
+    e->n = 0;
+    if (len < sh.ls.len)
+        return e;
+    for (int pos = 0; (pos = lsearch_find(&sh.ls, text, len, pos)) >= 0; pos += sh.ls.len) {
+        if (!add_hit(e, pos, pos + sh.ls.len))
+            break;
+    }
+    return e;
+}
+
+static void search_hits_plugin_fn(render_ctx_t *ctx)
+{
+    struct sh_entry *e;
+
+    if (ctx->wp == NULL || ctx->lp == ctx->wp->w_bufp->b_linep || !current(ctx->wp->w_bufp))
+        return;
+    e = hits_of(ctx->lp);
+    if (e->n == 0)
+        return;
+    ctx->ranges = e->hits;
+    ctx->nranges = e->n;
+    ctx->current_style = HL_SEARCH_HIT;
+}
+
+void search_hits_init(void)
+{
+    render_plugin_register((render_plugin_t){ RENDER_HOOK_PRE_LINE, search_hits_plugin_fn, NULL });
+}
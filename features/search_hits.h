@@ -0,0 +1,34 @@
+#ifndef SEARCH_HITS_H_
+#define SEARCH_HITS_H_
+
+#include <stdbool.h>
+
+struct line;
+
+/*
+ * Marks every occurrence of the search pattern on screen.
+ *
+ * A RENDER_HOOK_PRE_LINE plugin hands show_line() the byte ranges of the
+ * hits on each line it draws.  The ranges come from a small direct-mapped
+ * cache keyed by line, so a redraw only searches the lines that changed:
+ * lchange() drops the entry of the line it reports, lines that go away are
+ * dropped before they are freed, and a new pattern or case mode starts a
+ * new generation.  Each entry also records which text it was built from,
+ * so a line given new text without going through lchange() is searched
+ * again.  Only literal patterns without a newline are marked, like the
+ * match counts of match_index.c.
+ */
+
+/* Register the render plugin. */
+void search_hits_init(void);
+
+/* lp changed, or is about to be freed. */
+void search_hits_touch(struct line *lp);
+
+/* Any line may have changed. */
+void search_hits_forget(void);
+
+/* Show the hits (a search was made) or hide them until the next one. */
+void search_hits_show(bool on);
+
+#endif /* SEARCH_HITS_H_ */
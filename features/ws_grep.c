@@ -0,0 +1,797 @@
+#include "ws_grep.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+#include "lit_search.h"
+#include "match_index.h"
+#include "nanox.h"
+#include "util.h"
+
+#define WG_QUEUE 256                    /* files walked but not searched yet */
+#define WG_BINARY_PROBE 8192            /* a NUL in this much means binary */
+#define WG_TEXT_MAX 400                 /* text shown for a hit, in bytes */
+#define WG_JIT_STACK_MIN (32 * 1024)
+#define WG_JIT_STACK_MAX (1024 * 1024)
+
+/* One line of a .gitignore; the last rule that matches a path decides. */
+struct wg_rule {
+    char *pat;
+    int base_len;                       /* length of "dir/" it was read in */
+    bool negate;                        /* "!pat" */
+    bool dir_only;                      /* "pat/" */
+    bool has_slash;                     /* matched against the path, not the name */
+};
+
+struct wg_walk {
+    struct wg_rule *rules;
+    int nrules;
+    int cap;
+    size_t root_len;
+    char path[PATH_MAX];
+};
+
+/* Result lines of one file, "file:line: text\n" each. */
+struct wg_chunk {
+    struct wg_chunk *next;
+    size_t len;
+    size_t cap;
+    char text[];
+};
+
+struct wg_worker {
+    pthread_t thread;
+    pcre2_match_data *md;
+    pcre2_match_context *mctx;
+    pcre2_jit_stack *stack;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t queue_cond;          /* a file was queued, or the walk ended */
+    pthread_cond_t space_cond;          /* a queue slot was freed */
+    pthread_cond_t result_cond;         /* results arrived, or a worker is done */
+
+    bool running;
+    atomic_bool stop;
+    atomic_long hits;
+    bool walk_done;
+    int busy;                           /* workers in the middle of a file */
+    char *queue[WG_QUEUE];
+    int qhead;
+    int qlen;
+    struct wg_chunk *first;             /* not in the buffer yet */
+    struct wg_chunk *last;
+    long files;
+    long hit_files;
+
+    char root[PATH_MAX];
+    struct lsearch ls;
+    pcre2_code *code;                   /* -E, else the literal ls */
+
+    pthread_t walker;
+    struct wg_worker workers[WS_GREP_THREADS_MAX];
+    int nworkers;
+
+    struct buffer *bp;                  /* the results buffer */
+    char shown_root[PATH_MAX];          /* results in bp are relative to this */
+} wg = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .queue_cond = PTHREAD_COND_INITIALIZER,
+    .space_cond = PTHREAD_COND_INITIALIZER,
+    .result_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static bool halted(void)
+{
+    return atomic_load(&wg.stop) || atomic_load(&wg.hits) >= WS_GREP_MAX_HITS;
+}
+
+/* ----------------------------------------------------------------- walk */
+
+static void add_rule(struct wg_walk *w, const char *glob, int base_len, bool negate,
+                     bool dir_only, bool has_slash)
+{
+    struct wg_rule *r;
+
+    if (w->nrules == w->cap) {
+        int cap = w->cap ? w->cap * 2 : 32;
+        struct wg_rule *grown = realloc(w->rules, (size_t)cap * sizeof(*grown));
+        if (grown == NULL)
+            return;
+        w->rules = grown;
+        w->cap = cap;
+    }
+    r = &w->rules[w->nrules];
+    if ((r->pat = strdup(glob)) == NULL)
+        return;
+    r->base_len = base_len;
+    r->negate = negate;
+    r->dir_only = dir_only;
+    r->has_slash = has_slash;
+    w->nrules++;
+}
+
+/* Read the .gitignore of the directory in w->path[0..len). */
+static void load_ignore(struct wg_walk *w, size_t len)
+{
+    char file[PATH_MAX + 16];
+    char line[PATH_MAX];
+    int base_len = len > w->root_len ? (int)(len - w->root_len) : 0;
+    FILE *fp;
+
+    snprintf(file, sizeof(file), "%.*s/.gitignore", (int)len, w->path);
+    if ((fp = fopen(file, "r")) == NULL)
+        return;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *p = line;
+        size_t n = strcspn(line, "\r\n");
+        bool negate = false;
+        bool dir_only = false;
+        bool has_slash;
+
+        while (n > 0 && line[n - 1] == ' ' && (n < 2 || line[n - 2] != '\\'))
+            n--;
+        line[n] = '\0';
+        if (*p == '\0' || *p == '#')
+            continue;
+        if (*p == '!') {
+            negate = true;
+            p++;
+        } else if (*p == '\\' && (p[1] == '#' || p[1] == '!')) {
+            p++;
+        }
+        n = strlen(p);
+        if (n > 0 && p[n - 1] == '/') {
+            dir_only = true;
+            p[--n] = '\0';
+        }
+        if (n == 0)
+            continue;
+        has_slash = strchr(p, '/') != NULL;
+        if (strncmp(p, "**/", 3) == 0 && strchr(p + 3, '/') == NULL) {
+            p += 3;                     /* same as the bare name */
+            has_slash = false;
+        }
+        if (*p == '/')
+            p++;
+        add_rule(w, p, base_len, negate, dir_only, has_slash);
+    }
+    fclose(fp);
+}
+
+static bool ignored(const struct wg_walk *w, const char *rel, bool is_dir)
+{
+    const char *name = strrchr(rel, '/');
+    bool ign = false;
+
+    name = name ? name + 1 : rel;
+    for (int i = 0; i < w->nrules; i++) {
+        const struct wg_rule *r = &w->rules[i];
+        int hit;
+
+        if (r->dir_only && !is_dir)
+            continue;
+        if (r->has_slash)
+            hit = fnmatch(r->pat, rel + r->base_len,
+                          strstr(r->pat, "**") ? 0 : FNM_PATHNAME) == 0;
+        else
+            hit = fnmatch(r->pat, name, 0) == 0;
+        if (hit)
+            ign = !r->negate;
+    }
+    return ign;
+}
+
+/* Hand a file to the workers; false once the search is over. */
+static bool enqueue(char *rel)
+{
+    pthread_mutex_lock(&wg.lock);
+    while (wg.qlen == WG_QUEUE && !halted())
+        pthread_cond_wait(&wg.space_cond, &wg.lock);
+    if (halted()) {
+        pthread_mutex_unlock(&wg.lock);
+        free(rel);
+        return false;
+    }
+    wg.queue[(wg.qhead + wg.qlen) % WG_QUEUE] = rel;
+    wg.qlen++;
+    pthread_cond_signal(&wg.queue_cond);
+    pthread_mutex_unlock(&wg.lock);
+    return true;
+}
+
+/* Walk the directory in w->path[0..len). */
+static void walk(struct wg_walk *w, size_t len)
+{
+    int saved = w->nrules;
+    struct dirent *de;
+    DIR *dir;
+
+    if ((dir = opendir(w->path)) == NULL)
+        return;
+    load_ignore(w, len);
+    while (!halted() && (de = readdir(dir)) != NULL) {
+        const char *name = de->d_name;
+        size_t nlen = strlen(name);
+        bool is_dir;
+        bool is_reg;
+        char *rel;
+
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strcmp(name, ".git") == 0)
+            continue;
+        if (len + 1 + nlen >= sizeof(w->path))
+            continue;
+        w->path[len] = '/';
+        memcpy(w->path + len + 1, name, nlen + 1);
+        if (de->d_type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(w->path, &st) != 0)
+                continue;
+            is_dir = S_ISDIR(st.st_mode);
+            is_reg = S_ISREG(st.st_mode);
+        } else {
+            is_dir = de->d_type == DT_DIR;
+            is_reg = de->d_type == DT_REG;
+        }
+        if (!is_dir && !is_reg)         /* symlinks could loop */
+            continue;
+        rel = w->path + w->root_len + 1;
+        if (ignored(w, rel, is_dir))
+            continue;
+        if (is_dir)
+            walk(w, len + 1 + nlen);
+        else if ((rel = strdup(rel)) == NULL || !enqueue(rel))
+            break;
+    }
+    w->path[len] = '\0';
+    closedir(dir);
+    while (w->nrules > saved)
+        free(w->rules[--w->nrules].pat);
+}
+
+static void *walker_main(void *arg)
+{
+    struct wg_walk *w = arg;
+
+    walk(w, w->root_len);
+    free(w->rules);
+    free(w);
+
+    pthread_mutex_lock(&wg.lock);
+    wg.walk_done = true;
+    pthread_cond_broadcast(&wg.queue_cond);
+    pthread_cond_signal(&wg.result_cond);
+    pthread_mutex_unlock(&wg.lock);
+    return NULL;
+}
+
+/* --------------------------------------------------------------- search */
+
+static bool emit(struct wg_chunk **cp, const char *rel, long lineno,
+                 const unsigned char *text, size_t n)
+{
+    struct wg_chunk *c = *cp;
+    size_t need;
+    int head;
+
+    if (n > WG_TEXT_MAX)
+        n = WG_TEXT_MAX;
+    while (n > 0 && text[n - 1] == '\r')
+        n--;
+    need = strlen(rel) + 32 + n;
+    if (c == NULL || c->len + need > c->cap) {
+        size_t cap = c ? c->cap * 2 : 4096;
+        while (cap < (c ? c->len : 0) + need)
+            cap *= 2;
+        struct wg_chunk *grown = realloc(c, sizeof(*c) + cap);
+        if (grown == NULL)
+            return false;
+        if (c == NULL) {
+            grown->next = NULL;
+            grown->len = 0;
+        }
+        grown->cap = cap;
+        *cp = c = grown;
+    }
+    head = snprintf(c->text + c->len, c->cap - c->len, "%s:%ld: ", rel, lineno);
+    c->len += (size_t)head;
+    memcpy(c->text + c->len, text, n);
+    c->len += n;
+    c->text[c->len++] = '\n';
+    return true;
+}
+
+/* Start of the first match in map[from..len), or -1. */
+static long find(struct wg_worker *me, const unsigned char *map, size_t len, size_t from)
+{
+    if (wg.code == NULL)
+        return lsearch_find(&wg.ls, map, (int)len, (int)from);
+    if (pcre2_match(wg.code, map, len, from, 0, me->md, me->mctx) < 0)
+        return -1;
+    return (long)pcre2_get_ovector_pointer(me->md)[0];
+}
+
+/*
+ * A regex match found in the whole map may run on into the next lines, as
+ * \s matches a newline; like grep, only count it if the line alone matches.
+ */
+static bool line_only(struct wg_worker *me, const unsigned char *map, size_t bol, size_t eol)
+{
+    if (wg.code == NULL || pcre2_get_ovector_pointer(me->md)[1] <= eol)
+        return true;
+    return pcre2_match(wg.code, map, eol, bol, 0, me->md, me->mctx) >= 0;
+}
+
+/* The hits of one file, one per line, or NULL. */
+static struct wg_chunk *search_file(struct wg_worker *me, const char *rel)
+{
+    char path[PATH_MAX * 2];
+    struct wg_chunk *c = NULL;
+    unsigned char *map;
+    size_t len, pos = 0, counted = 0;
+    long lineno = 1;
+    struct stat st;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", wg.root, rel);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || st.st_size > INT_MAX) {
+        close(fd);
+        return NULL;
+    }
+    len = (size_t)st.st_size;
+    map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    if (memchr(map, '\0', len < WG_BINARY_PROBE ? len : WG_BINARY_PROBE) != NULL)
+        pos = len;
+    while (pos < len && !halted()) {
+        long at = find(me, map, len, pos);
+        const unsigned char *nl, *bol;
+        size_t eol;
+
+        if (at < 0 || ((size_t)at == len && map[len - 1] == '\n'))
+            break;
+        nl = memchr(map + at, '\n', len - (size_t)at);
+        eol = nl ? (size_t)(nl - map) : len;
+        bol = memrchr(map + pos, '\n', (size_t)at - pos);
+        bol = bol ? bol + 1 : map + pos;
+        if (!line_only(me, map, (size_t)(bol - map), eol)) {
+            pos = eol + 1;
+            continue;
+        }
+        while (counted < (size_t)(bol - map)) {
+            const unsigned char *p = memchr(map + counted, '\n', (size_t)(bol - map) - counted);
+            if (p == NULL)
+                break;
+            lineno++;
+            counted = (size_t)(p - map) + 1;
+        }
+        counted = (size_t)(bol - map);
+        if (!emit(&c, rel, lineno, bol, (size_t)((map + eol) - bol)))
+            break;
+        atomic_fetch_add(&wg.hits, 1);
+        pos = eol + 1;
+    }
+    munmap(map, len);
+    return c;
+}
+
+static void *worker_main(void *arg)
+{
+    struct wg_worker *me = arg;
+
+    for (;;) {
+        struct wg_chunk *c;
+        char *rel;
+
+        pthread_mutex_lock(&wg.lock);
+        while (wg.qlen == 0 && !wg.walk_done && !halted())
+            pthread_cond_wait(&wg.queue_cond, &wg.lock);
+        if (wg.qlen == 0 || halted()) {
+            /* The walker may be waiting for room that will not come. */
+            pthread_cond_broadcast(&wg.space_cond);
+            pthread_cond_broadcast(&wg.queue_cond);
+            pthread_cond_signal(&wg.result_cond);
+            pthread_mutex_unlock(&wg.lock);
+            return NULL;
+        }
+        rel = wg.queue[wg.qhead];
+        wg.qhead = (wg.qhead + 1) % WG_QUEUE;
+        wg.qlen--;
+        wg.busy++;
+        pthread_cond_signal(&wg.space_cond);
+        pthread_mutex_unlock(&wg.lock);
+
+        c = search_file(me, rel);
+        free(rel);
+
+        pthread_mutex_lock(&wg.lock);
+        wg.busy--;
+        wg.files++;
+        if (c != NULL) {
+            if (wg.last != NULL)
+                wg.last->next = c;
+            else
+                wg.first = c;
+            wg.last = c;
+            wg.hit_files++;
+        }
+        pthread_cond_signal(&wg.result_cond);
+        pthread_mutex_unlock(&wg.lock);
+    }
+}
+
+/* Nothing left to search?  Caller holds wg.lock. */
+static bool done_locked(void)
+{
+    return wg.walk_done && wg.busy == 0 && (wg.qlen == 0 || halted());
+}
+
+/* --------------------------------------------------------------- the UI */
+
+static int thread_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n < 1)
+        n = 1;
+    return n > WS_GREP_THREADS_MAX ? WS_GREP_THREADS_MAX : (int)n;
+}
+
+static void free_chunks(struct wg_chunk *c)
+{
+    while (c != NULL) {
+        struct wg_chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+}
+
+/* Free what a worker was given; its thread, if any, has been joined. */
+static void free_worker(struct wg_worker *me)
+{
+    if (me->md != NULL)
+        pcre2_match_data_free(me->md);
+    if (me->mctx != NULL)
+        pcre2_match_context_free(me->mctx);
+    if (me->stack != NULL)
+        pcre2_jit_stack_free(me->stack);
+    memset(me, 0, sizeof(*me));
+}
+
+/* Join the threads and free what the search used. */
+static void finish(void)
+{
+    pthread_join(wg.walker, NULL);
+    for (int i = 0; i < wg.nworkers; i++) {
+        pthread_join(wg.workers[i].thread, NULL);
+        free_worker(&wg.workers[i]);
+    }
+    wg.nworkers = 0;
+    while (wg.qlen > 0) {
+        free(wg.queue[wg.qhead]);
+        wg.qhead = (wg.qhead + 1) % WG_QUEUE;
+        wg.qlen--;
+    }
+    free_chunks(wg.first);
+    wg.first = wg.last = NULL;
+    if (wg.code != NULL)
+        pcre2_code_free(wg.code);
+    wg.code = NULL;
+    wg.running = false;
+}
+
+static void stop(void)
+{
+    if (!wg.running)
+        return;
+    pthread_mutex_lock(&wg.lock);
+    atomic_store(&wg.stop, true);
+    pthread_cond_broadcast(&wg.queue_cond);
+    pthread_cond_broadcast(&wg.space_cond);
+    pthread_mutex_unlock(&wg.lock);
+    finish();
+}
+
+/* Point the window, if it shows the results, at their first line. */
+static void reset_window(struct buffer *bp)
+{
+    if (curwp->w_bufp != bp)
+        return;
+    curwp->w_dotp = curwp->w_linep = lforw(bp->b_linep);
+    curwp->w_doto = 0;
+    curwp->w_markp = NULL;
+    curwp->w_marko = 0;
+    curwp->w_flag |= WFHARD | WFMODE;
+}
+
+/*
+ * Append the lines of list to the results buffer.  They share one handle,
+ * as the lines of a read chunk do, so a long search does not use a handle
+ * per hit.
+ */
+static void append(struct wg_chunk *list)
+{
+    struct buffer *bp = wg.bp;
+    bool was_empty = lforw(bp->b_linep) == bp->b_linep;
+    size_t total = 0, pos = 0;
+    MemoryHandle h;
+    char *text;
+
+    for (struct wg_chunk *c = list; c != NULL; c = c->next)
+        total += c->len;
+    if (total == 0 || total > INT_MAX || (h = my_handle_alloc(total)) == NULL)
+        return;
+    text = handle_deref(h);
+    for (struct wg_chunk *c = list; c != NULL; c = c->next) {
+        memcpy(text + pos, c->text, c->len);
+        pos += c->len;
+    }
+    for (pos = 0; pos < total; ) {
+        const char *eol = memchr(text + pos, '\n', total - pos);
+        size_t n = eol ? (size_t)(eol - (text + pos)) : total - pos;
+        struct line *lp;
+
+        if ((lp = malloc(sizeof(struct line))) == NULL)
+            break;
+        lp->l_handle = h;
+        my_handle_ref(h);
+        lp->l_offset = (uint32_t)pos;
+        lp->used = (int)n;
+        lp->size = (int)n;
+        lp->l_hl = NULL;
+        lp->l_diag = 0;
+        lp->prev = bp->b_linep->prev;
+        lp->next = bp->b_linep;
+        bp->b_linep->prev->next = lp;
+        bp->b_linep->prev = lp;
+        pos += n + 1;
+    }
+    my_handle_free(h);                  /* the lines hold it now */
+    bp->b_version++;
+    match_index_touch(bp, bp->b_linep);
+    if (bp->b_dotp == bp->b_linep)
+        bp->b_dotp = lforw(bp->b_linep);
+    if (was_empty)
+        reset_window(bp);
+    if (curwp->w_bufp == bp)
+        curwp->w_flag |= WFHARD | WFMODE;
+}
+
+bool ws_grep_pump(int wait_ms)
+{
+    struct wg_chunk *list;
+    bool finished;
+    long files, hit_files;
+
+    if (!wg.running)
+        return false;
+    pthread_mutex_lock(&wg.lock);
+    if (wg.first == NULL && !done_locked() && wait_ms > 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (long)wait_ms * 1000000L;
+        ts.tv_sec += ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&wg.result_cond, &wg.lock, &ts);
+    }
+    list = wg.first;
+    wg.first = wg.last = NULL;
+    finished = done_locked();
+    files = wg.files;
+    hit_files = wg.hit_files;
+    pthread_mutex_unlock(&wg.lock);
+
+    if (list != NULL && wg.bp != NULL)
+        append(list);
+    free_chunks(list);
+    if (finished) {
+        long hits = atomic_load(&wg.hits);
+        finish();
+        mlwrite("grep: %ld match%s in %ld of %ld files%s", hits, hits == 1 ? "" : "es",
+                hit_files, files, hits >= WS_GREP_MAX_HITS ? " (stopped at the limit)" : "");
+    }
+    return true;
+}
+
+int ws_grep_command(const char *args)
+{
+    bool fold = false;
+    bool regex = false;
+    struct wg_walk *w;
+    struct buffer *bp;
+    size_t len;
+
+    while (args[0] == '-' && args[1] != '\0' && (args[2] == ' ' || args[2] == '\0')) {
+        char opt = args[1];
+
+        if (opt == 'i')
+            fold = true;
+        else if (opt == 'E')
+            regex = true;
+        else if (opt != '-')            /* "--" ends the options */
+            break;
+        args += 2;
+        while (*args == ' ')
+            args++;
+        if (opt == '-')
+            break;
+    }
+    if (*args == '\0') {
+        if (wg.running) {
+            stop();
+            mlwrite("grep: stopped");
+            return TRUE;
+        }
+        mlwrite("Usage: grep [-i] [-E] pattern");
+        return FALSE;
+    }
+    stop();
+
+    len = strlen(args);
+    if (regex) {
+        int err;
+        PCRE2_SIZE erroff;
+        uint32_t opts = PCRE2_MULTILINE | (fold ? PCRE2_CASELESS : 0);
+
+        wg.code = pcre2_compile((PCRE2_SPTR)args, len, opts, &err, &erroff, NULL);
+        if (wg.code == NULL) {
+            PCRE2_UCHAR msg[128];
+            pcre2_get_error_message(err, msg, sizeof(msg));
+            mlwrite("grep: %s at %d", (char *)msg, (int)erroff);
+            return FALSE;
+        }
+        pcre2_jit_compile(wg.code, PCRE2_JIT_COMPLETE);
+    } else {
+        if (len >= NPAT) {
+            mlwrite("grep: pattern too long");
+            return FALSE;
+        }
+        lsearch_compile(&wg.ls, args, (int)len, fold);
+    }
+
+    nanox_workspace_root(wg.root, sizeof(wg.root));
+    if (wg.root[0] == '\0' && getcwd(wg.root, sizeof(wg.root)) == NULL) {
+        mlwrite("grep: no workspace root");
+        goto fail;
+    }
+    if ((bp = bfind("*grep*", TRUE, 0)) == NULL)
+        goto fail;
+    bp->b_flag &= ~BFCHG;
+    if (bclear(bp) != TRUE)
+        goto fail;
+    bp->b_mode |= MDVIEW;
+    wg.bp = bp;
+    mystrscpy(wg.shown_root, wg.root, sizeof(wg.shown_root));
+    reset_window(bp);
+    if (curbp != bp)
+        swbuffer(bp);
+
+    atomic_store(&wg.stop, false);
+    atomic_store(&wg.hits, 0);
+    wg.walk_done = false;
+    wg.busy = 0;
+    wg.files = wg.hit_files = 0;
+    if ((w = calloc(1, sizeof(*w))) == NULL)
+        goto fail;
+    w->root_len = strlen(wg.root);
+    while (w->root_len > 1 && wg.root[w->root_len - 1] == '/')
+        w->root_len--;
+    memcpy(w->path, wg.root, w->root_len);
+    w->path[w->root_len] = '\0';
+
+    wg.nworkers = thread_count();
+    for (int i = 0; i < wg.nworkers; i++) {
+        struct wg_worker *me = &wg.workers[i];
+        if (wg.code == NULL)
+            continue;
+        me->md = pcre2_match_data_create_from_pattern(wg.code, NULL);
+        me->mctx = pcre2_match_context_create(NULL);
+        me->stack = pcre2_jit_stack_create(WG_JIT_STACK_MIN, WG_JIT_STACK_MAX, NULL);
+        if (me->mctx != NULL && me->stack != NULL)
+            pcre2_jit_stack_assign(me->mctx, NULL, me->stack);
+        if (me->md == NULL) {
+            wg.nworkers = i;
+            break;
+        }
+    }
+    if (wg.nworkers == 0 || pthread_create(&wg.walker, NULL, walker_main, w) != 0) {
+        free(w);
+        mlwrite("grep: cannot start the search");
+        for (int i = 0; i < wg.nworkers; i++)
+            free_worker(&wg.workers[i]);
+        wg.nworkers = 0;
+        goto fail;
+    }
+    wg.running = true;
+    for (int i = 0; i < wg.nworkers; i++) {
+        if (pthread_create(&wg.workers[i].thread, NULL, worker_main, &wg.workers[i]) != 0) {
+            /* Only the first i threads exist for finish() to join. */
+            for (int j = i; j < wg.nworkers; j++)
+                free_worker(&wg.workers[j]);
+            wg.nworkers = i;
+            stop();
+            mlwrite("grep: cannot start the search");
+            return FALSE;
+        }
+    }
+    mlwrite("grep: searching %s ...", wg.root);
+    return TRUE;
+
+fail:
+    if (wg.code != NULL)
+        pcre2_code_free(wg.code);
+    wg.code = NULL;
+    return FALSE;
+}
+
+bool ws_grep_owns(struct buffer *bp)
+{
+    return bp != NULL && bp == wg.bp;
+}
+
+int ws_grep_visit(void)
+{
+    struct line *lp = curwp->w_dotp;
+    char path[PATH_MAX * 2];
+    const char *text;
+    long lineno = 0;
+    int n, i, j;
+
+    if (lp == curbp->b_linep)
+        return FALSE;
+    text = (const char *)ltext(lp);
+    n = llength(lp);
+    for (i = 0; i < n; i++) {
+        if (text[i] != ':')
+            continue;
+        lineno = 0;
+        for (j = i + 1; j < n && text[j] >= '0' && text[j] <= '9'; j++)
+            lineno = lineno * 10 + (text[j] - '0');
+        if (j > i + 1 && j < n && text[j] == ':')
+            break;
+    }
+    if (i == n || lineno <= 0) {
+        mlwrite("Not a grep hit");
+        return FALSE;
+    }
+    snprintf(path, sizeof(path), "%s/%.*s", wg.shown_root, i, text);
+    if (strlen(path) >= PATH_MAX) {
+        mlwrite("grep: path too long");
+        return FALSE;
+    }
+    if (nanox_slot_open(path) != TRUE)
+        return FALSE;
+    return gotoline(TRUE, (int)lineno);
+}
+
+void ws_grep_forget(struct buffer *bp)
+{
+    if (bp == NULL || bp != wg.bp)
+        return;
+    stop();
+    wg.bp = NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef WS_GREP_H_
+#define WS_GREP_H_
+
+#include <stdbool.h>
+
+struct buffer;
+
+/*
+ * Project-wide grep into the "*grep*" buffer.
+ *
+ * A walker thread goes through the workspace root, skipping .git and what
+ * the .gitignore files along the way exclude, and queues the files for a
+ * few worker threads.  A worker maps a file, skips it if it looks binary,
+ * and looks for the pattern in the whole map at once, with lsearch_find()
+ * for a literal pattern or a JIT-compiled PCRE2 pattern for -E.  Each hit
+ * becomes a "file:line: text" line; ws_grep_pump() appends them to the
+ * buffer while the editor waits for a key, so results show up as they are
+ * found.  Enter on a result line opens the file through the slots.
+ */
+#define WS_GREP_THREADS_MAX 8
+#define WS_GREP_MAX_HITS 50000
+
+/* "grep [-i] [-E] pattern": start a search, or stop the running one. */
+int ws_grep_command(const char *args);
+
+/* Move finished results into the buffer; true while a search runs. */
+bool ws_grep_pump(int wait_ms);
+
+/* Is bp the results buffer? */
+bool ws_grep_owns(struct buffer *bp);
+
+/* Open the hit on the current line of the results buffer. */
+int ws_grep_visit(void);
+
+/* bp is going away; stop feeding it. */
+void ws_grep_forget(struct buffer *bp);
+
+#endif /* WS_GREP_H_ */
@@ -129,6 +129,7 @@ extern void updpos(void);
 extern void upddex(void);
 extern void updgar(void);
 extern int updupd(int force);
+extern void vtshadow_touch(int row);
 extern void upmode(void);
 extern void movecursor(int row, int col);
 extern void mlerase(void);
@@ -408,6 +409,7 @@ extern int backhunt(int f, int n);
 extern int nanox_search_engine(int f, int n);
 extern int mcscanner(struct magic *mcpatrn, int direct, int beg_or_end);
 extern int scanner(const char *patrn, int direct, int beg_or_end);
+extern int magic_search(struct buffer *bp);
 extern int eq(unsigned char bc, unsigned char pc);
 extern void savematch(void);
 extern void rvstrscpy(char *rvstr, char *str, int size);
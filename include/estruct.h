@@ -36,6 +36,7 @@
 #define NLOCKS  1000                /* max # of file locks active   */
 #define NCOLORS 8               /* number of supported colors   */
 #define KBLOCK  8192            /* sizeof kill buffer chunks (increased for large pastes) */
+#define HL_DIRTY_MAX 32             /* dirty highlight intervals per buffer */
 
 #define CONTROL 0x10000000          /* Control flag, or'ed in       */
 #define META    0x20000000          /* Meta flag, or'ed in          */
@@ -215,7 +216,14 @@ struct buffer {
     char b_fname[NFILEN];           /* File name                    */
     char b_bname[NBUFN];            /* Buffer name                  */
     int b_tabsize;                  /* Tab size (0: use real tabs)  */
-    struct line *b_hl_dirty_line;   /* First line needing HL propagation */
+    struct line *b_hl_dirty[HL_DIRTY_MAX]; /* Starts of dirty HL intervals */
+    int b_hl_ndirty;                /* Entries used in b_hl_dirty   */
+    char b_hl_full;                 /* Propagate to EOF, no early stop */
+    unsigned b_hl_epoch;            /* Bumped whenever a line is marked dirty */
+    char b_hl_sparse;               /* States at checkpoints only, see hl_checkpoint.h */
+    const void *b_hl_profile;       /* Cached HighlightProfile, see highlight_buffer_profile() */
+    char *b_hl_profile_key;         /* Name b_hl_profile was resolved for */
+    unsigned b_hl_profile_gen;      /* Rule generation of b_hl_profile */
     int b_version;                  /* Incremented on line insert/delete */
     int b_line_cache_version;
     int b_line_cache_no;
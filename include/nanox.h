@@ -85,6 +85,8 @@ void nanox_queue_startup_file(const char *path);
 size_t nanox_startup_file_count(void);
 const char *nanox_startup_file_at(size_t index);
 int nanox_open_startup_slot(void);
+int nanox_slot_open(const char *path);
+void nanox_workspace_root(char *root_out, size_t sz);
 void nanox_handle_closed_file(const char *path);
 void nanox_request_underbar_redraw(void);
 
@@ -10,6 +10,9 @@
 
 typedef struct pcre2_real_code_8 pcre2_code;
 typedef struct pcre2_real_match_data_8 pcre2_match_data;
+typedef struct pcre2_real_match_context_8 pcre2_match_context;
+typedef struct pcre2_real_jit_stack_8 pcre2_jit_stack;
+typedef pcre2_jit_stack *(*pcre2_jit_callback_8)(void *);
 typedef const unsigned char *PCRE2_SPTR;
 typedef unsigned char PCRE2_UCHAR;
 typedef size_t PCRE2_SIZE;
@@ -19,6 +22,9 @@ typedef size_t PCRE2_SIZE;
 #define PCRE2_UCP       0x00020000u
 #define PCRE2_MULTILINE 0x00000400u
 #define PCRE2_CASELESS  0x00000008u
+#define PCRE2_MATCH_INVALID_UTF 0x04000000u
+#define PCRE2_JIT_COMPLETE 0x00000001u
+#define PCRE2_ERROR_NOMATCH (-1)
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +37,13 @@ extern "C" {
 #define pcre2_get_error_message pcre2_get_error_message_8
 #define pcre2_code_free pcre2_code_free_8
 #define pcre2_match_data_free pcre2_match_data_free_8
+#define pcre2_jit_compile pcre2_jit_compile_8
+#define pcre2_jit_match pcre2_jit_match_8
+#define pcre2_jit_stack_create pcre2_jit_stack_create_8
+#define pcre2_jit_stack_assign pcre2_jit_stack_assign_8
+#define pcre2_match_context_create pcre2_match_context_create_8
+#define pcre2_match_context_free pcre2_match_context_free_8
+#define pcre2_jit_stack_free pcre2_jit_stack_free_8
 
 pcre2_code *pcre2_compile_8(const PCRE2_SPTR pattern,
                             PCRE2_SIZE length,
@@ -57,6 +70,27 @@ int pcre2_get_error_message_8(int errorcode, PCRE2_UCHAR *buffer, PCRE2_SIZE buf
 void pcre2_code_free_8(pcre2_code *code);
 void pcre2_match_data_free_8(pcre2_match_data *match_data);
 
+int pcre2_jit_compile_8(pcre2_code *code, uint32_t options);
+
+int pcre2_jit_match_8(const pcre2_code *code,
+                      PCRE2_SPTR subject,
+                      PCRE2_SIZE length,
+                      PCRE2_SIZE startoffset,
+                      uint32_t options,
+                      pcre2_match_data *match_data,
+                      pcre2_match_context *match_context);
+
+pcre2_jit_stack *pcre2_jit_stack_create_8(PCRE2_SIZE startsize, PCRE2_SIZE maxsize,
+                                          void *general_context);
+
+void pcre2_jit_stack_assign_8(pcre2_match_context *match_context,
+                              pcre2_jit_callback_8 callback,
+                              void *callback_data);
+
+pcre2_match_context *pcre2_match_context_create_8(void *general_context);
+void pcre2_match_context_free_8(pcre2_match_context *match_context);
+void pcre2_jit_stack_free_8(pcre2_jit_stack *jit_stack);
+
 #ifdef __cplusplus
 }
 #endif
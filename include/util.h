@@ -1,6 +1,10 @@
 #ifndef UTIL_H_
 #define UTIL_H_
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "utf8.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
@@ -64,4 +68,43 @@ static inline int utf8_display_width(const char *str, int byte_len)
     return width;
 }
 
+/*
+ * Index of the first of the bytes a, b or c in text[pos..len), or len.
+ * Used to jump between candidate positions when most bytes cannot start
+ * a match.
+ */
+static inline int find_first_of3(const char *text, int len, int pos, char a, char b, char c)
+{
+#if defined(__AVX2__)
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    const __m256i vc = _mm256_set1_epi8(c);
+    for (; pos + 32 <= len; pos += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(text + pos));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)),
+                                      _mm256_cmpeq_epi8(v, vc));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask != 0)
+            return pos + __builtin_ctz(mask);
+    }
+#elif defined(__SSE2__)
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    const __m128i vc = _mm_set1_epi8(c);
+    for (; pos + 16 <= len; pos += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(text + pos));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+                                   _mm_cmpeq_epi8(v, vc));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask != 0)
+            return pos + __builtin_ctz(mask);
+    }
+#endif
+    for (; pos < len; pos++) {
+        if (text[pos] == a || text[pos] == b || text[pos] == c)
+            return pos;
+    }
+    return len;
+}
+
 #endif              /* UTIL_H_ */
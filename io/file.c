@@ -18,6 +18,8 @@
 #include "efunc.h"
 #include "line.h"
 #include "util.h"
+#include "hl_checkpoint.h"
+#include "match_index.h"
 
 /* Max number of lines from one file. */
 #define MAXNLINE 10000000
@@ -305,8 +307,7 @@ int readin(char *fname, int lockfl)
                         lp1->l_offset = (uint32_t)line_offsets[i];
                         lp1->used = (uint16_t)line_lengths[i];
                         lp1->size = (uint16_t)line_lengths[i];
-                        lp1->hl_start_state = (HighlightState){0};
-                        lp1->hl_end_state = (HighlightState){0};
+                        lp1->l_hl = NULL;
                         lp1->l_diag = 0;
 
                         lp2 = lback(curbp->b_linep);
@@ -353,8 +354,7 @@ int readin(char *fname, int lockfl)
                     lp1->l_offset = (uint32_t)line_offsets[i];
                     lp1->used = (uint16_t)line_lengths[i];
                     lp1->size = (uint16_t)line_lengths[i];
-                    lp1->hl_start_state = (HighlightState){0};
-                    lp1->hl_end_state = (HighlightState){0};
+                    lp1->l_hl = NULL;
                     lp1->l_diag = 0;
 
                     lp2 = lback(curbp->b_linep);
@@ -381,6 +381,7 @@ int readin(char *fname, int lockfl)
     s = FIOSUC;
 
  msg_out:
+    hl_checkpoint_setup(bp, nline);
     strcpy(mesg, "(");
     if (s == FIOERR) {
         strcat(mesg, "I/O ERROR, ");
@@ -771,6 +772,7 @@ int ifile(char *fname)
         return FALSE;
     }
     mlwrite("(Inserting file)");
+    match_index_forget(bp);
 
     /* back up a line and save the mark here */
     curwp->w_dotp = lback(curwp->w_dotp);
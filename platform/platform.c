@@ -116,6 +116,30 @@ void nanox_get_user_config_dir(char *out, size_t cap) {
 #endif
 }
 
+void nanox_get_user_cache_dir(char *out, size_t cap) {
+#ifdef USE_WINDOWS
+    char data[1024];
+    nanox_get_user_data_dir(data, sizeof(data));
+    snprintf(out, cap, "%s\\cache", data);
+#else
+    const char *xdg_cache = getenv("XDG_CACHE_HOME");
+    if (xdg_cache && *xdg_cache) {
+        snprintf(out, cap, "%s/nanox", xdg_cache);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home) {
+            struct passwd *pw = getpwuid(getuid());
+            if (pw) home = pw->pw_dir;
+        }
+        if (home) {
+            snprintf(out, cap, "%s/.cache/nanox", home);
+        } else {
+            snprintf(out, cap, "/tmp/nanox");
+        }
+    }
+#endif
+}
+
 void nanox_path_join(char *out, size_t cap, const char *a, const char *b) {
     if (cap == 0) return; // Cannot write to a zero-sized buffer
     
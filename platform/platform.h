@@ -6,6 +6,7 @@
 
 void nanox_get_user_data_dir(char *out, size_t cap);
 void nanox_get_user_config_dir(char *out, size_t cap);
+void nanox_get_user_cache_dir(char *out, size_t cap);
 void nanox_path_join(char *out, size_t cap, const char *a, const char *b);
 bool nanox_file_exists(const char *path);
 void nanox_normalize_path(char *path);
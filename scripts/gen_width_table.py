@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Generate utils/width_table.h, the display width table used by unicode_width().
+
+The table is derived from the Unicode character database shipped with the
+Python interpreter (unicodedata), so the widths are identical on every host
+regardless of the C library or the current locale:
+
+    width 0  combining marks (Mn, Me), format characters (Cf, except U+00AD
+             and the prepended concatenation marks)
+             and Hangul medial vowels / final consonants (U+1160-U+11FF)
+    width 2  East Asian Wide and Fullwidth characters (this covers the
+             emoji with default emoji presentation), plus the unassigned
+             code points of planes 2 and 3
+    width 1  everything else
+
+Control characters are handled by unicode_width() itself and never reach the
+table.  Re-run after a Python upgrade to pick up a newer Unicode version:
+
+    python3 scripts/gen_width_table.py > utils/width_table.h
+"""
+
+import sys
+import unicodedata
+
+BLOCK = 256
+MAX_CP = 0x110000
+
+# Prepended_Concatenation_Mark: format characters that do render a glyph
+PREPENDED_MARKS = set(range(0x0600, 0x0606)) | {0x06DD, 0x070F, 0x0890, 0x0891,
+                                                 0x08E2, 0x110BD, 0x110CD}
+
+
+def width(cp):
+    ch = chr(cp)
+    cat = unicodedata.category(ch)
+    if cat in ("Mn", "Me") or (cat == "Cf" and cp != 0x00AD and cp not in PREPENDED_MARKS):
+        return 0
+    if 0x1160 <= cp <= 0x11FF:
+        return 0
+    if cat == "Cn":
+        # unicodedata reports arbitrary widths for unassigned code points
+        return 2 if 0x20000 <= cp <= 0x3FFFD else 1
+    if unicodedata.east_asian_width(ch) in ("W", "F"):
+        return 2
+    return 1
+
+
+def main():
+    blocks = []
+    index = {}
+    stage1 = []
+    for base in range(0, MAX_CP, BLOCK):
+        packed = bytearray(BLOCK // 4)
+        for off in range(BLOCK):
+            packed[off >> 2] |= width(base + off) << ((off & 3) * 2)
+        key = bytes(packed)
+        if key not in index:
+            index[key] = len(blocks)
+            blocks.append(key)
+        stage1.append(index[key])
+
+    if len(blocks) > 256:
+        sys.exit("too many distinct blocks for a uint8_t index")
+
+    out = sys.stdout
+    out.write("/* Generated by scripts/gen_width_table.py from Unicode %s -- do not edit. */\n"
+              % unicodedata.unidata_version)
+    out.write("#ifndef WIDTH_TABLE_H\n#define WIDTH_TABLE_H\n\n#include <stdint.h>\n\n")
+    out.write("#define WIDTH_TABLE_UNICODE \"%s\"\n\n" % unicodedata.unidata_version)
+    out.write("/* Block index for each 256 code point page. */\n")
+    out.write("static const uint8_t width_stage1[%d] = {\n" % len(stage1))
+    for i in range(0, len(stage1), 16):
+        out.write("    " + ", ".join("%d" % v for v in stage1[i:i + 16]) + ",\n")
+    out.write("};\n\n")
+    out.write("/* Two bits per code point, four code points per byte. */\n")
+    out.write("static const uint8_t width_stage2[%d][%d] = {\n" % (len(blocks), BLOCK // 4))
+    for blk in blocks:
+        out.write("    {\n")
+        for i in range(0, len(blk), 16):
+            out.write("        " + ", ".join("0x%02x" % v for v in blk[i:i + 16]) + ",\n")
+        out.write("    },\n")
+    out.write("};\n\n#endif\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,446 @@
+/*
+ * bench_highlight - highlighter throughput and regression harness
+ *
+ * Runs highlight_line() over a corpus twice per language: once producing
+ * spans as the display does ("spans"), and once computing only the end
+ * states as full-buffer propagation does ("states").  Each run prints one
+ * JSON object per line, so results can be diffed or gated by a script:
+ *
+ *   {"corpus":"c","profile":"c","mode":"spans","bytes":...,"lines":...,
+ *    "passes":...,"seconds":...,"mb_per_s":...,"ns_per_line":...,
+ *    "spans":...,"allocs":...,"alloc_bytes":...,"span_growths":...}
+ *
+ * "allocs" and "alloc_bytes" count malloc/calloc/realloc calls made by the
+ * editor objects during the timed loop (the binary is linked with
+ * -Wl,--wrap for them); "span_growths" counts lines that had to grow the
+ * SpanVec, which is reused from line to line as the display reuses it.
+ *
+ *   make bench-highlight
+ *   ./build/bench_highlight [-p passes] [-s kbytes] [file...]
+ *
+ * Without file arguments a deterministic corpus of C, Python, Markdown
+ * (with fenced code blocks), HTML and minified JavaScript is generated,
+ * -s kbytes of each (default 2048).  Files are highlighted with the
+ * profile their name selects.  Run from the repository root so
+ * configs/nanox/syntax.ini is found.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "highlight.h"
+
+/* Allocation counters, fed by the --wrap'ed allocator entry points. */
+static int counting;
+static unsigned long long alloc_count;
+static unsigned long long alloc_bytes;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    if (counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    if (counting) {
+        alloc_count++;
+        alloc_bytes += n * size;
+    }
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    if (counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __real_realloc(p, size);
+}
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} corpus_t;
+
+static int corpus_reserve(corpus_t *c, size_t n)
+{
+    if (c->len + n <= c->cap)
+        return 1;
+
+    size_t cap = c->cap ? c->cap * 2 : 1 << 20;
+    while (cap < c->len + n)
+        cap *= 2;
+    char *p = realloc(c->data, cap);
+    if (!p)
+        return 0;
+    c->data = p;
+    c->cap = cap;
+    return 1;
+}
+
+static void corpus_printf(corpus_t *c, const char *fmt, ...)
+{
+    char buf[1024];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return;
+    if ((size_t)n >= sizeof(buf))
+        n = (int)sizeof(buf) - 1;
+    if (!corpus_reserve(c, (size_t)n))
+        return;
+    memcpy(c->data + c->len, buf, (size_t)n);
+    c->len += (size_t)n;
+}
+
+static int corpus_append_file(corpus_t *c, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return 0;
+
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        if (!corpus_reserve(c, n)) {
+            fclose(fp);
+            return 0;
+        }
+        memcpy(c->data + c->len, buf, n);
+        c->len += n;
+    }
+    fclose(fp);
+    return 1;
+}
+
+/* Deterministic xorshift so every run sees the same corpus. */
+static uint32_t rng_state = 2463534242u;
+
+static uint32_t rng(uint32_t n)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state % n;
+}
+
+static const char *const idents[] = {
+    "buffer", "count", "index", "result", "value", "node", "item", "offset",
+    "length", "state", "profile", "cursor", "window", "handle", "entry", "key",
+};
+#define IDENT() idents[rng((uint32_t)(sizeof(idents) / sizeof(idents[0])))]
+
+static void gen_c(corpus_t *c, size_t size)
+{
+    for (int f = 0; c->len < size; f++) {
+        if (rng(4) == 0)
+            corpus_printf(c, "/*\n * %s_%d - update the %s of a %s.\n *\n * Returns the new %s.\n */\n",
+                          IDENT(), f, IDENT(), IDENT(), IDENT());
+        if (rng(6) == 0)
+            corpus_printf(c, "#define %s_MAX_%d (%u * sizeof(struct %s))\n", IDENT(), f, rng(4096), IDENT());
+        corpus_printf(c, "static int %s_%d(struct %s *%s, const char *%s, int %s)\n{\n",
+                      IDENT(), f, IDENT(), IDENT(), IDENT(), IDENT());
+        int body = 3 + (int)rng(12);
+        for (int i = 0; i < body; i++) {
+            switch (rng(6)) {
+            case 0:
+                corpus_printf(c, "    if (%s->%s > %u && %s != NULL)\n        return -%u;\n",
+                              IDENT(), IDENT(), rng(100), IDENT(), rng(10));
+                break;
+            case 1:
+                corpus_printf(c, "    for (int i = 0; i < %s; i++)\n        %s[i] = %s[i] ^ 0x%x;\n",
+                              IDENT(), IDENT(), IDENT(), rng(0xffff));
+                break;
+            case 2:
+                corpus_printf(c, "    snprintf(%s, sizeof(%s), \"%%s: %%d (%s)\\n\", %s, %s);\n",
+                              IDENT(), IDENT(), IDENT(), IDENT(), IDENT());
+                break;
+            case 3:
+                corpus_printf(c, "    %s += %s(%s, '%c'); /* %s */\n",
+                              IDENT(), IDENT(), IDENT(), 'a' + (int)rng(26), IDENT());
+                break;
+            case 4:
+                corpus_printf(c, "#ifdef USE_%s\n    %s = %s->%s;\n#endif\n", IDENT(), IDENT(), IDENT(), IDENT());
+                break;
+            default:
+                corpus_printf(c, "    while (%s-- > 0) { %s = %s + %u.%us; }\n",
+                              IDENT(), IDENT(), IDENT(), rng(10), rng(100));
+                break;
+            }
+        }
+        corpus_printf(c, "    return %s;\n}\n\n", IDENT());
+    }
+}
+
+static void gen_python(corpus_t *c, size_t size)
+{
+    for (int f = 0; c->len < size; f++) {
+        if (rng(3) == 0)
+            corpus_printf(c, "class %s%d(%s):\n    \"\"\"Holds the %s of a %s.\n\n    Used by %s.\n    \"\"\"\n\n",
+                          IDENT(), f, IDENT(), IDENT(), IDENT(), IDENT());
+        corpus_printf(c, "    def %s_%d(self, %s, %s=None, *args, **kwargs):\n", IDENT(), f, IDENT(), IDENT());
+        int body = 2 + (int)rng(10);
+        for (int i = 0; i < body; i++) {
+            switch (rng(5)) {
+            case 0:
+                corpus_printf(c, "        if %s is not None and %s > %u:\n            return [%s for %s in %s]\n",
+                              IDENT(), IDENT(), rng(100), IDENT(), IDENT(), IDENT());
+                break;
+            case 1:
+                corpus_printf(c, "        %s = f\"{%s}: {self.%s!r}\"  # %s\n", IDENT(), IDENT(), IDENT(), IDENT());
+                break;
+            case 2:
+                corpus_printf(c, "        for %s, %s in enumerate(self.%s):\n            yield %s, '%s'\n",
+                              IDENT(), IDENT(), IDENT(), IDENT(), IDENT());
+                break;
+            case 3:
+                corpus_printf(c, "        %s = '''%s\n        %s'''\n", IDENT(), IDENT(), IDENT());
+                break;
+            default:
+                corpus_printf(c, "        self.%s = %s.get('%s', %u) * %u.%u\n",
+                              IDENT(), IDENT(), IDENT(), rng(1000), rng(10), rng(10));
+                break;
+            }
+        }
+        corpus_printf(c, "        return self.%s\n\n", IDENT());
+    }
+}
+
+static void gen_markdown(corpus_t *c, size_t size)
+{
+    static const char *const fences[] = { "c", "python", "js", "sh", "" };
+
+    for (int f = 0; c->len < size; f++) {
+        corpus_printf(c, "## %s %s %d\n\n", IDENT(), IDENT(), f);
+        corpus_printf(c, "The `%s` of a **%s** is kept in _%s_, see [%s](#%s-%d).\n",
+                      IDENT(), IDENT(), IDENT(), IDENT(), IDENT(), f);
+        corpus_printf(c, "It is \"%s\" until the %s's %s changes.\n\n", IDENT(), IDENT(), IDENT());
+        int items = (int)rng(5);
+        for (int i = 0; i < items; i++)
+            corpus_printf(c, "- %s: `%s(%s)` returns %u\n", IDENT(), IDENT(), IDENT(), rng(100));
+        if (items)
+            corpus_printf(c, "\n");
+        const char *lang = fences[rng((uint32_t)(sizeof(fences) / sizeof(fences[0])))];
+        corpus_printf(c, "```%s\n", lang);
+        int lines = 2 + (int)rng(8);
+        for (int i = 0; i < lines; i++)
+            corpus_printf(c, "%s = %s(\"%s\", %u) /* %s */\n", IDENT(), IDENT(), IDENT(), rng(100), IDENT());
+        corpus_printf(c, "```\n\n");
+        if (rng(4) == 0)
+            corpus_printf(c, "> %s %s %s\n\n", IDENT(), IDENT(), IDENT());
+    }
+}
+
+static void gen_html(corpus_t *c, size_t size)
+{
+    corpus_printf(c, "<!DOCTYPE html>\n<html>\n<head>\n<style>\n");
+    for (int i = 0; i < 20; i++)
+        corpus_printf(c, ".%s-%d { color: #%06x; margin: %upx %upx; }\n", IDENT(), i, rng(0xffffff), rng(20), rng(20));
+    corpus_printf(c, "</style>\n</head>\n<body>\n");
+    for (int f = 0; c->len < size; f++) {
+        if (rng(5) == 0)
+            corpus_printf(c, "<!-- %s %s\n     %s -->\n", IDENT(), IDENT(), IDENT());
+        corpus_printf(c, "<div class=\"%s-%d\" id='%s%d' data-%s=\"%u\">\n",
+                      IDENT(), f % 20, IDENT(), f, IDENT(), rng(1000));
+        corpus_printf(c, "  <a href=\"/%s/%s?%s=%u\">%s &amp; %s</a>\n",
+                      IDENT(), IDENT(), IDENT(), rng(100), IDENT(), IDENT());
+        corpus_printf(c, "  <p>The <b>%s</b> of the <code>%s</code> is %u.</p>\n", IDENT(), IDENT(), rng(100));
+        if (rng(4) == 0)
+            corpus_printf(c, "  <input type=\"text\" name=\"%s\" value=\"%s\" disabled>\n", IDENT(), IDENT());
+        corpus_printf(c, "</div>\n");
+    }
+    corpus_printf(c, "</body>\n</html>\n");
+}
+
+/* Minified bundles: statements run together on very long lines. */
+static void gen_minjs(corpus_t *c, size_t size)
+{
+    while (c->len < size) {
+        size_t line_end = c->len + 16384 + rng(49152);
+        corpus_printf(c, "!function(e,t){\"use strict\";");
+        while (c->len < line_end) {
+            switch (rng(4)) {
+            case 0:
+                corpus_printf(c, "var %s=function(n,r){return n.%s(r)||\"%s\"};", IDENT(), IDENT(), IDENT());
+                break;
+            case 1:
+                corpus_printf(c, "for(var i=0;i<%s.length;i++)%s[i]=%u;", IDENT(), IDENT(), rng(100));
+                break;
+            case 2:
+                corpus_printf(c, "if(%s!==null&&typeof %s==='%s')throw new Error('%s');",
+                              IDENT(), IDENT(), IDENT(), IDENT());
+                break;
+            default:
+                corpus_printf(c, "e.%s={%s:%u,%s:[%u,%u],%s:/%s+/g};",
+                              IDENT(), IDENT(), rng(100), IDENT(), rng(10), rng(10), IDENT(), IDENT());
+                break;
+            }
+        }
+        corpus_printf(c, "}(window,document);\n");
+    }
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void json_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            putchar('\\');
+        putchar(*s);
+    }
+    putchar('"');
+}
+
+/* Highlight the corpus `passes` times and print one result line. */
+static void run(const char *name, const corpus_t *corpus, const HighlightProfile *profile,
+                int passes, int with_spans)
+{
+    SpanVec spans = { 0 };
+    unsigned long long nspans = 0;
+    unsigned long long growths = 0;
+    size_t nlines = 0;
+
+    alloc_count = 0;
+    alloc_bytes = 0;
+    counting = 1;
+    double t0 = now_sec();
+
+    for (int p = 0; p < passes; p++) {
+        HighlightState state;
+        memset(&state, 0, sizeof(state));
+        const char *s = corpus->data;
+        const char *end = corpus->data + corpus->len;
+        while (s < end) {
+            const char *nl = memchr(s, '\n', (size_t)(end - s));
+            const char *eol = nl ? nl : end;
+            HighlightState next;
+
+            if (with_spans) {
+                int capacity = spans.capacity;
+                highlight_line(s, (int)(eol - s), state, profile, &spans, &next);
+                nspans += (unsigned long long)spans.count;
+                if (spans.capacity != capacity)
+                    growths++;
+            } else {
+                highlight_line(s, (int)(eol - s), state, profile, NULL, &next);
+            }
+            state = next;
+            nlines++;
+            s = nl ? nl + 1 : end;
+        }
+    }
+
+    double secs = now_sec() - t0;
+    counting = 0;
+
+    double mb = (double)corpus->len * passes / (1024.0 * 1024.0);
+    printf("{\"corpus\":");
+    json_string(name);
+    printf(",\"profile\":");
+    json_string(profile->name);
+    printf(",\"mode\":\"%s\",\"bytes\":%zu,\"lines\":%zu,\"passes\":%d,"
+           "\"seconds\":%.4f,\"mb_per_s\":%.1f,\"ns_per_line\":%.1f,"
+           "\"spans\":%llu,\"allocs\":%llu,\"alloc_bytes\":%llu,\"span_growths\":%llu}\n",
+           with_spans ? "spans" : "states", corpus->len, nlines / (size_t)passes, passes,
+           secs, mb / secs, secs * 1e9 / (double)nlines,
+           nspans, alloc_count, alloc_bytes, growths);
+    fflush(stdout);
+    span_vec_free(&spans);
+}
+
+static int bench(const char *name, const corpus_t *corpus, const char *filename, int passes)
+{
+    const HighlightProfile *profile = highlight_get_profile(filename);
+    if (!profile) {
+        fprintf(stderr, "bench_highlight: no syntax profile for %s (run from the repository root)\n", filename);
+        return 0;
+    }
+    run(name, corpus, profile, passes, 1);
+    run(name, corpus, profile, passes, 0);
+    return 1;
+}
+
+static const struct {
+    const char *name;
+    const char *filename;           /* selects the profile */
+    void (*generate)(corpus_t *c, size_t size);
+} generated[] = {
+    { "c", "bench.c", gen_c },
+    { "python", "bench.py", gen_python },
+    { "markdown", "bench.md", gen_markdown },
+    { "html", "bench.html", gen_html },
+    { "minified-js", "bench.min.js", gen_minjs },
+};
+
+int main(int argc, char **argv)
+{
+    int passes = 5;
+    size_t size = 2048 * 1024;
+    int opt;
+    int ok = 1;
+
+    while ((opt = getopt(argc, argv, "p:s:")) != -1) {
+        switch (opt) {
+        case 'p':
+            passes = atoi(optarg);
+            break;
+        case 's':
+            size = (size_t)atol(optarg) * 1024;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p passes] [-s kbytes] [file...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (passes < 1)
+        passes = 1;
+
+    highlight_init("configs/nanox/syntax.ini");
+
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) {
+            corpus_t corpus = { 0 };
+            if (!corpus_append_file(&corpus, argv[i]) || corpus.len == 0) {
+                fprintf(stderr, "bench_highlight: cannot read %s\n", argv[i]);
+                ok = 0;
+                continue;
+            }
+            ok &= bench(argv[i], &corpus, argv[i], passes);
+            free(corpus.data);
+        }
+        return ok ? 0 : 1;
+    }
+
+    for (size_t i = 0; i < sizeof(generated) / sizeof(generated[0]); i++) {
+        corpus_t corpus = { 0 };
+        generated[i].generate(&corpus, size);
+        ok &= bench(generated[i].name, &corpus, generated[i].filename, passes);
+        free(corpus.data);
+    }
+    return ok ? 0 : 1;
+}
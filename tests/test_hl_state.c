@@ -0,0 +1,264 @@
+/*
+ * test_hl_state - regression tests for the per-line highlight states
+ *
+ * Fills a C buffer with random lines, some of which open or close block
+ * comments and strings, and checks the stored states against a straight
+ * highlight_line() run from the first line:
+ *
+ *   full     full-buffer propagation (highlight_incremental_step until
+ *            nothing is dirty): every line has the states of the straight
+ *            run, and a line that starts and ends outside any comment or
+ *            string keeps l_hl == NULL
+ *   edit     the same after random lines are rewritten and marked dirty
+ *   sparse   hl_checkpoint_state() of a checkpointed buffer, for lines
+ *            visited in random order, is the straight-run start state
+ *
+ *   make test-highlight
+ *   ./build/test_hl_state [-s seed] [-n iterations]
+ *
+ * Run from the repository root so configs/nanox/syntax.ini is found.  Each
+ * failure is printed; the exit status is non-zero if there was any.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+#include "highlight.h"
+#include "hl_checkpoint.h"
+
+#define NLINES 300
+
+static unsigned long checks;
+static unsigned long failures;
+
+static uint32_t rnd_state = 1;
+
+/* xorshift, so a seed gives the same run with any libc */
+static int rnd(int n)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return n > 0 ? (int)(rnd_state % (uint32_t)n) : 0;
+}
+
+static void fail(const char *test, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void fail(const char *test, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (++failures > 20)
+        return;
+    printf("FAIL %s: ", test);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+static struct window test_window;
+
+/* A fresh buffer named so that it gets the C profile. */
+static struct buffer *test_buffer(void)
+{
+    struct buffer *bp = bfind("test_hl_state.c", TRUE, BFINVS);
+
+    if (bp == NULL) {
+        fprintf(stderr, "test_hl_state: out of memory\n");
+        exit(2);
+    }
+    curbp = bp;
+    curwp = &test_window;
+    test_window.w_bufp = bp;
+    bclear(bp);
+    bp->b_hl_sparse = false;
+    hl_dirty_clear(bp);
+    return bp;
+}
+
+/* Mostly plain code, now and then a comment or string left open. */
+static int random_line(char *text, int cap)
+{
+    static const char *const parts[] = {
+        "int x = 1;", "return y;", "if (a < b) {", "}", "foo(bar, 42);",
+        "// line comment", "/* short */", "\"str\"", "'c'", "x /= 2;",
+        "/* open", "close */", "\"open\\", "#define N 3", "    ",
+    };
+    int len = 0;
+
+    for (int k = rnd(4); k > 0; k--) {
+        const char *p = parts[rnd((int)(sizeof(parts) / sizeof(parts[0])))];
+        int n = (int)strlen(p);
+
+        if (len + n + 1 >= cap)
+            break;
+        memcpy(text + len, p, (size_t)n);
+        len += n;
+        text[len++] = ' ';
+    }
+    return len;
+}
+
+static void set_line(struct line *lp, const char *text, int len)
+{
+    memcpy(ltext(lp), text, (size_t)len);
+    lp->used = len;
+}
+
+static struct line *lines[NLINES];
+
+static void fill(struct buffer *bp)
+{
+    char text[128];
+
+    for (int i = 0; i < NLINES; i++) {
+        int len = random_line(text, (int)sizeof(text));
+        struct line *lp = lalloc(len);
+
+        set_line(lp, text, len);
+        lp->prev = bp->b_linep->prev;
+        lp->next = bp->b_linep;
+        bp->b_linep->prev->next = lp;
+        bp->b_linep->prev = lp;
+        lines[i] = lp;
+    }
+}
+
+/* Start and end states of every line, from a straight run from the top. */
+static HighlightState want_start[NLINES], want_end[NLINES];
+
+static void reference(const HighlightProfile *profile)
+{
+    HighlightState state = hl_zero_state;
+
+    for (int i = 0; i < NLINES; i++) {
+        want_start[i] = state;
+        highlight_line((const char *)ltext(lines[i]), llength(lines[i]), state, profile, NULL, &state);
+        want_end[i] = state;
+    }
+}
+
+static bool same(const HighlightState *a, const HighlightState *b)
+{
+    return memcmp(a, b, sizeof(HighlightState)) == 0;
+}
+
+static void propagate(struct buffer *bp)
+{
+    for (int guard = 0; buffer_needs_hl_update(bp); guard++) {
+        if (guard > NLINES) {
+            fail("propagate", "still dirty after %d steps", guard);
+            hl_dirty_clear(bp);
+            return;
+        }
+        highlight_incremental_step(bp);
+    }
+}
+
+static void check_lines(const char *test)
+{
+    for (int i = 0; i < NLINES; i++) {
+        struct line *lp = lines[i];
+
+        checks++;
+        if (!same(lhl_start(lp), &want_start[i]) || !same(lhl_end(lp), &want_end[i]))
+            fail(test, "line %d: states differ from the straight run (depth %d/%d, want %d/%d)",
+                 i, lhl_start(lp)->depth, lhl_end(lp)->depth, want_start[i].depth, want_end[i].depth);
+        checks++;
+        if (want_start[i].depth == 0 && want_end[i].depth == 0 && lp->l_hl != NULL)
+            fail(test, "line %d: plain line \"%.*s\" keeps highlight states", i,
+                 llength(lp), (const char *)ltext(lp));
+    }
+}
+
+static void test_full(const HighlightProfile *profile)
+{
+    struct buffer *bp = test_buffer();
+
+    fill(bp);
+    reference(profile);
+    bp->b_hl_dirty[0] = lines[0];
+    bp->b_hl_ndirty = 1;
+    bp->b_hl_full = TRUE;
+    propagate(bp);
+    check_lines("full");
+
+    /* rewrite some lines in place and let propagation catch up */
+    char text[128];
+    for (int k = 0; k < 8; k++) {
+        int i = rnd(NLINES);
+        int len = random_line(text, (int)sizeof(text));
+
+        if (len > lines[i]->size)
+            len = lines[i]->size;
+        set_line(lines[i], text, len);
+        lmark_dirty(lines[i]);
+    }
+    reference(profile);
+    propagate(bp);
+    check_lines("edit");
+}
+
+static void test_sparse(const HighlightProfile *profile)
+{
+    struct buffer *bp = test_buffer();
+
+    fill(bp);
+    reference(profile);
+    bp->b_hl_sparse = true;
+    bp->b_hl_epoch++;
+    for (int k = 0; k < NLINES; k++) {
+        int i = rnd(NLINES);
+        HighlightState got = hl_checkpoint_state(bp, lines[i], profile);
+
+        checks++;
+        if (!same(&got, &want_start[i]))
+            fail("sparse", "line %d: checkpoint state depth %d, want %d", i, got.depth,
+                 want_start[i].depth);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+        switch (opt) {
+        case 's':
+            rnd_state = (uint32_t)strtoul(optarg, NULL, 0) | 1;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s seed] [-n iterations]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    highlight_init("configs/nanox/syntax.ini");
+    const HighlightProfile *profile = highlight_get_profile("test_hl_state.c");
+    if (!highlight_is_enabled() || profile == NULL) {
+        fprintf(stderr, "test_hl_state: no C profile (run from the repository root)\n");
+        return 2;
+    }
+
+    for (int it = 0; it < iterations; it++) {
+        test_full(profile);
+        test_sparse(profile);
+    }
+
+    printf("test_hl_state: %lu checks, %lu failures\n", checks, failures);
+    return failures != 0;
+}
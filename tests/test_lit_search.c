@@ -0,0 +1,601 @@
+/*
+ * test_lit_search - regression tests for the literal search engine
+ *
+ * Checks features/lit_search.c against byte-at-a-time references:
+ *
+ *   fold     every pair of bytes, folded and exact, through the byte map
+ *            and through the SIMD probe (only ASCII letters fold, so '@'
+ *            and '`' or '[' and '{' must stay apart)
+ *   probe    lsearch_find()/lsearch_rfind() from every start and end in
+ *            texts around the vector width, over a small alphabet so the
+ *            first/last-byte probe passes at many positions that are no
+ *            match
+ *   tails    patterns up to NPAT - 1 bytes in texts barely longer, which
+ *            leave only the Horspool loop to run
+ *   rscan    lsearch_rscan() over chunks shared by several lines, with
+ *            gaps left by deleted lines and chunks frozen COLD: a hit
+ *            across a line end or a gap is no match, and a COLD chunk is
+ *            still COLD afterwards
+ *   scanner  scanner() against the old character scanner, in both
+ *            directions, folded and exact, with patterns across lines
+ *
+ *   make test-search
+ *   ./build/test_lit_search [-s seed] [-n iterations]
+ *
+ * Each failure is printed; the exit status is non-zero if there was any.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+#include "lit_search.h"
+
+static unsigned long checks;
+static unsigned long failures;
+
+static uint32_t rnd_state = 1;
+
+/* xorshift, so a seed gives the same run with any libc */
+static int rnd(int n)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return n > 0 ? (int)(rnd_state % (uint32_t)n) : 0;
+}
+
+static void fail(const char *test, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void fail(const char *test, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (++failures > 20)
+        return;
+    printf("FAIL %s: ", test);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+/* eq() of the old scanner: only ASCII lower case letters fold. */
+static int ref_fold(int c)
+{
+    return c >= 'a' && c <= 'z' ? c ^ DIFCASE : c;
+}
+
+static bool ref_at(const unsigned char *needle, int n, bool fold, const unsigned char *text)
+{
+    for (int i = 0; i < n; i++) {
+        int a = text[i], b = needle[i];
+
+        if (fold ? ref_fold(a) != ref_fold(b) : a != b)
+            return false;
+    }
+    return true;
+}
+
+static int ref_find(const unsigned char *needle, int n, bool fold, const unsigned char *text,
+                    int len, int from)
+{
+    for (int s = from; s + n <= len; s++) {
+        if (ref_at(needle, n, fold, text + s))
+            return s;
+    }
+    return -1;
+}
+
+static int ref_rfind(const unsigned char *needle, int n, bool fold, const unsigned char *text,
+                     int end)
+{
+    for (int s = end - n; s >= 0; s--) {
+        if (ref_at(needle, n, fold, text + s))
+            return s;
+    }
+    return -1;
+}
+
+/* lsearch_find() from every start and lsearch_rfind() to every end of text. */
+static void check_text(const char *test, const unsigned char *needle, int n, bool fold,
+                       const unsigned char *text, int len)
+{
+    struct lsearch ls;
+
+    lsearch_compile(&ls, (const char *)needle, n, fold);
+    for (int i = 0; i <= len; i++) {
+        int want = ref_find(needle, n, fold, text, len, i);
+        int got = lsearch_find(&ls, text, len, i);
+
+        checks++;
+        if (got != want)
+            fail(test, "find len=%d n=%d fold=%d from=%d: %d, want %d", len, n, fold, i, got, want);
+        want = ref_rfind(needle, n, fold, text, i);
+        got = lsearch_rfind(&ls, text, i);
+        checks++;
+        if (got != want)
+            fail(test, "rfind len=%d n=%d fold=%d end=%d: %d, want %d", len, n, fold, i, got, want);
+    }
+}
+
+static void test_fold(void)
+{
+    unsigned char text[80];
+
+    for (int a = 0; a < 256; a++) {
+        for (int fold = 0; fold < 2; fold++) {
+            struct lsearch ls;
+            unsigned char needle = (unsigned char)a;
+
+            lsearch_compile(&ls, (const char *)&needle, 1, fold);
+            for (int b = 0; b < 256; b++) {
+                bool want = fold ? ref_fold(a) == ref_fold(b) : a == b;
+
+                /* one byte goes through the byte map, a long run through the probe */
+                memset(text, b, sizeof(text));
+                checks += 2;
+                if ((lsearch_find(&ls, text, 1, 0) == 0) != want)
+                    fail("fold", "%02x in %02x, fold=%d", a, b, fold);
+                if ((lsearch_rfind(&ls, text, (int)sizeof(text)) >= 0) != want)
+                    fail("fold", "%02x in a run of %02x, fold=%d", a, b, fold);
+            }
+        }
+    }
+}
+
+static const char alphabet[] = "aAbB@`[{zZ";
+
+static void random_text(unsigned char *text, int len)
+{
+    for (int i = 0; i < len; i++)
+        text[i] = (unsigned char)alphabet[rnd((int)sizeof(alphabet) - 1)];
+}
+
+/* Copy n bytes of text from s, flipping the case of some letters. */
+static void pick_pattern(unsigned char *needle, const unsigned char *text, int s, int n)
+{
+    memcpy(needle, text + s, (size_t)n);
+    for (int i = 0; i < n; i++) {
+        if (((needle[i] | DIFCASE) >= 'a' && (needle[i] | DIFCASE) <= 'z') && rnd(3) == 0)
+            needle[i] ^= DIFCASE;
+    }
+}
+
+static void test_probe(int iterations)
+{
+    unsigned char text[160], needle[NPAT];
+
+    for (int it = 0; it < iterations; it++) {
+        int len = rnd((int)sizeof(text) + 1);
+        int n = 1 + rnd(len < 40 ? 8 : 40);
+
+        random_text(text, len);
+        if (len >= n && rnd(4) != 0)
+            pick_pattern(needle, text, rnd(len - n + 1), n);
+        else
+            random_text(needle, n);
+        check_text("probe", needle, n, rnd(2), text, len);
+    }
+}
+
+static void test_tails(int iterations)
+{
+    unsigned char text[NPAT + 80], needle[NPAT];
+
+    for (int it = 0; it < iterations; it++) {
+        int n = NPAT - 1 - rnd(8);
+        int len = n + rnd(70);
+
+        random_text(text, len);
+        pick_pattern(needle, text, rnd(len - n + 1), n);
+        check_text("tails", needle, n, rnd(2), text, len);
+    }
+}
+
+static struct window test_window;
+
+/* A fresh buffer, current in a window of its own. */
+static struct buffer *test_buffer(void)
+{
+    struct buffer *bp = bfind("test_lit_search", TRUE, BFINVS);
+
+    if (bp == NULL) {
+        fprintf(stderr, "test_lit_search: out of memory\n");
+        exit(2);
+    }
+    curbp = bp;
+    curwp = &test_window;
+    test_window.w_bufp = bp;
+    bclear(bp);
+    return bp;
+}
+
+static void link_line(struct buffer *bp, struct line *lp)
+{
+    lp->l_hl = NULL;
+    lp->l_diag = 0;
+    lp->prev = bp->b_linep->prev;
+    lp->next = bp->b_linep;
+    bp->b_linep->prev->next = lp;
+    bp->b_linep->prev = lp;
+}
+
+/*
+ * Append nlines lines to bp, their text packed into one chunk as readin()
+ * packs it: no newlines, each line right after the one before.  Lines with
+ * keep[i] false are left out, which leaves a gap in the chunk as deleting
+ * them would.  Returns the chunk.
+ */
+static MemoryHandle append_chunk(struct buffer *bp, const unsigned char *text, const int *lens,
+                                 int nlines, const bool *keep)
+{
+    MemoryHandle h;
+    int pos = 0;
+
+    for (int i = 0; i < nlines; i++)
+        pos += lens[i];
+    h = my_handle_alloc((size_t)pos + 1);
+    memcpy(handle_deref(h), text, (size_t)pos);
+    pos = 0;
+    for (int i = 0; i < nlines; i++) {
+        if (keep[i]) {
+            struct line *lp = malloc(sizeof(struct line));
+
+            lp->l_handle = h;
+            my_handle_ref(h);
+            lp->l_offset = (uint32_t)pos;
+            lp->used = lp->size = lens[i];
+            link_line(bp, lp);
+        }
+        pos += lens[i];
+    }
+    my_handle_free(h);
+    return h;
+}
+
+/* Append a line with a handle of its own, as an edited line has. */
+static void append_line(struct buffer *bp, const unsigned char *text, int len)
+{
+    struct line *lp = lalloc(len);
+
+    memcpy(ltext(lp), text, (size_t)len);
+    link_line(bp, lp);
+}
+
+/* Words that compress, so that chunks can be frozen. */
+static int random_line(unsigned char *text)
+{
+    static const char *const words[] = { "abc", "AbC@", "b`[", "{zz", "aaaa", "Zab", " " };
+    int len = 0;
+
+    for (int k = rnd(12); k > 0; k--) {
+        const char *w = words[rnd((int)(sizeof(words) / sizeof(words[0])))];
+
+        memcpy(text + len, w, strlen(w));
+        len += (int)strlen(w);
+    }
+    return len;
+}
+
+/*
+ * The old answer: the last match within one line, from (lp, off) up.  The
+ * text is peeked at, like lsearch_rscan() does, so COLD chunks stay COLD.
+ */
+static bool ref_rscan(const unsigned char *needle, int n, bool fold, struct line *lp, int off,
+                      struct line *stop, struct lsearch_match *m)
+{
+    static char *scratch;
+    static size_t cap;
+
+    for (; lp != stop; lp = lback(lp), off = llength(lp)) {
+        const unsigned char *text = handle_peek(lp->l_handle, &scratch, &cap);
+        int s = ref_rfind(needle, n, fold, text + lp->l_offset, off);
+
+        if (s >= 0) {
+            m->start_lp = m->end_lp = lp;
+            m->start_off = s;
+            m->end_off = s + n;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void test_rscan(int iterations)
+{
+    enum { MAX_CHUNKS = 12, MAX_LINES = 40 };
+    unsigned char text[MAX_LINES * 48], needle[NPAT];
+    struct line *lines[MAX_CHUNKS * (MAX_LINES + 1)];
+    MemoryHandle cold[MAX_CHUNKS];
+    unsigned long traps = 0;
+
+    for (int it = 0; it < iterations; it++) {
+        struct buffer *bp = test_buffer();
+        int nlines = 0, ncold = 0;
+
+        for (int c = rnd(MAX_CHUNKS) + 1; c > 0; c--) {
+            int lens[MAX_LINES];
+            bool keep[MAX_LINES];
+            int len = 0, k = rnd(MAX_LINES) + 1;
+            MemoryHandle h;
+
+            for (int i = 0; i < k; i++) {
+                lens[i] = random_line(text + len);
+                len += lens[i];
+                keep[i] = rnd(5) != 0;
+            }
+            keep[k / 2] = true;         /* the lines hold the chunk */
+            h = append_chunk(bp, text, lens, k, keep);
+            if (rnd(2) == 0 && mymemory_freeze(h))
+                cold[ncold++] = h;
+            if (rnd(3) == 0) {
+                len = random_line(text);
+                append_line(bp, text, len);
+            }
+        }
+        for (struct line *lp = lforw(bp->b_linep); lp != bp->b_linep; lp = lforw(lp))
+            lines[nlines++] = lp;
+
+        for (int q = 0; q < 16 && nlines > 0; q++) {
+            struct lsearch ls;
+            struct lsearch_peek pk = { 0 };
+            struct lsearch_match want, got;
+            struct line *lp = lines[rnd(nlines)];
+            int off = rnd(llength(lp) + 1);
+            int end = (int)lp->l_offset + off;
+            bool fold = rnd(2);
+            int n = 1 + rnd(10);
+            char *scratch = NULL;
+            size_t cap = 0;
+            const unsigned char *chunk;
+            int block;
+            bool w, g;
+
+            /* Taken from the chunk, the pattern often spans a line end or a gap. */
+            chunk = handle_peek(lp->l_handle, &scratch, &cap);
+            if (end >= n && rnd(4) != 0)
+                pick_pattern(needle, chunk, rnd(end - n + 1), n);
+            else
+                random_text(needle, n);
+
+            lsearch_compile(&ls, (const char *)needle, n, fold);
+            g = lsearch_rscan(&ls, lp, off, bp->b_linep, &pk, &got);
+            free(pk.scratch);
+            for (int i = 0; i < ncold; i++) {
+                checks++;
+                if (mymemory_freeze(cold[i]))
+                    fail("rscan", "a COLD chunk was thawed");
+            }
+
+            w = ref_rscan(needle, n, fold, lp, off, bp->b_linep, &want);
+            checks++;
+            if (w != g || (w && (want.start_lp != got.start_lp || want.start_off != got.start_off ||
+                                 want.end_lp != got.end_lp || want.end_off != got.end_off)))
+                fail("rscan", "n=%d fold=%d off=%d: %s at %d, want %s at %d", n, fold, off,
+                     g ? "hit" : "none", g ? got.start_off : -1,
+                     w ? "hit" : "none", w ? want.start_off : -1);
+
+            /* Would scanning the chunk as one block have found another hit? */
+            block = ref_rfind(needle, n, fold, chunk, end);
+            if (block >= 0 && (!w || want.start_lp->l_handle != lp->l_handle ||
+                               (int)want.start_lp->l_offset + want.start_off != block))
+                traps++;
+            free(scratch);
+        }
+    }
+    if (traps == 0)
+        fail("rscan", "no pattern spanned a line end or a gap");
+}
+
+/* The old character scanner that scanner() replaced. */
+static int ref_eq(int bc, int pc)
+{
+    if ((curwp->w_bufp->b_mode & MDEXACT) == 0) {
+        bc = ref_fold(bc);
+        pc = ref_fold(pc);
+    }
+    return bc == pc;
+}
+
+static int ref_boundry(struct line *curline, int curoff, int dir)
+{
+    if (dir == FORWARD)
+        return curoff == llength(curline) && lforw(curline) == curbp->b_linep;
+    return curoff == 0 && lback(curline) == curbp->b_linep;
+}
+
+static int ref_nextch(struct line **pcurline, int *pcuroff, int dir)
+{
+    struct line *curline = *pcurline;
+    int curoff = *pcuroff;
+    int c;
+
+    if (dir == FORWARD) {
+        if (curoff == llength(curline)) {
+            curline = lforw(curline);
+            curoff = 0;
+            c = '\n';
+        } else {
+            c = lgetc(curline, curoff++);
+        }
+    } else {
+        if (curoff == 0) {
+            curline = lback(curline);
+            curoff = llength(curline);
+            c = '\n';
+        } else {
+            c = lgetc(curline, --curoff);
+        }
+    }
+    *pcurline = curline;
+    *pcuroff = curoff;
+    return c;
+}
+
+static int ref_scanner(const char *patrn, int direct, int beg_or_end)
+{
+    struct line *curline = curwp->w_dotp;
+    int curoff = curwp->w_doto;
+
+    beg_or_end ^= direct;
+    while (!ref_boundry(curline, curoff, direct)) {
+        struct line *startline = curline;
+        int startoff = curoff;
+        int c = ref_nextch(&curline, &curoff, direct);
+
+        if (ref_eq(c, (unsigned char)patrn[0])) {
+            struct line *scanline = curline;
+            int scanoff = curoff;
+            const char *patptr = patrn;
+
+            while (*++patptr != '\0') {
+                c = ref_nextch(&scanline, &scanoff, direct);
+                if (!ref_eq(c, (unsigned char)*patptr))
+                    break;
+            }
+            if (*patptr == '\0') {
+                if (beg_or_end == PTEND) {
+                    curwp->w_dotp = scanline;
+                    curwp->w_doto = scanoff;
+                } else {
+                    curwp->w_dotp = startline;
+                    curwp->w_doto = startoff;
+                }
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+static void test_scanner(int iterations)
+{
+    enum { MAX_LINES = 24 };
+    unsigned char text[MAX_LINES * 201];
+    struct line *lines[MAX_LINES];
+
+    for (int it = 0; it < iterations; it++) {
+        struct buffer *bp = test_buffer();
+        int lens[MAX_LINES];
+        bool keep[MAX_LINES];
+        int nlines = rnd(MAX_LINES) + (rnd(4) != 0);
+        int len = 0;
+
+        for (int i = 0; i < nlines; i++) {
+            lens[i] = rnd(rnd(3) != 0 ? 8 : 200);
+            random_text(text + len, lens[i]);
+            len += lens[i];
+            keep[i] = true;
+        }
+        /* runs of lines in a chunk, and edited lines in handles of their own */
+        for (int i = 0, pos = 0; i < nlines; ) {
+            int run = 1 + rnd(nlines - i);
+
+            if (rnd(3) == 0) {
+                append_line(bp, text + pos, lens[i]);
+                run = 1;
+            } else {
+                append_chunk(bp, text + pos, lens + i, run, keep);
+            }
+            for (; run > 0; run--)
+                pos += lens[i++];
+        }
+        nlines = 0;
+        for (struct line *lp = lforw(bp->b_linep); lp != bp->b_linep; lp = lforw(lp))
+            lines[nlines++] = lp;
+
+        /* the text as the old scanner reads it, with a newline after each line */
+        len = 0;
+        for (int i = 0; i < nlines; i++) {
+            memcpy(text + len, ltext(lines[i]), (size_t)llength(lines[i]));
+            len += llength(lines[i]);
+            text[len++] = '\n';
+        }
+        bp->b_mode = rnd(2) ? MDEXACT : 0;
+
+        for (int q = 0; q < 20; q++) {
+            char needle[NPAT], rneedle[NPAT];
+            int n, li, off, dir, beg_or_end;
+            int r1, r2, o1;
+            struct line *l1;
+
+            if (len > 0 && rnd(4) != 0) {
+                int s = rnd(len);
+
+                n = 1 + rnd(12);
+                if (s + n > len)
+                    n = len - s;
+                pick_pattern((unsigned char *)needle, text, s, n);
+            } else {
+                n = 1 + rnd(3);
+                for (int k = 0; k < n; k++)
+                    needle[k] = rnd(5) != 0 ? alphabet[rnd((int)sizeof(alphabet) - 1)] : '\n';
+            }
+            needle[n] = '\0';
+            rvstrscpy(rneedle, needle, NPAT);
+
+            li = rnd(nlines + 1);
+            curwp->w_dotp = li == nlines ? bp->b_linep : lines[li];
+            off = rnd(llength(curwp->w_dotp) + 1);
+            curwp->w_doto = off;
+            dir = rnd(2) ? REVERSE : FORWARD;
+            beg_or_end = rnd(2) ? PTEND : PTBEG;
+
+            r1 = ref_scanner(dir == REVERSE ? rneedle : needle, dir, beg_or_end);
+            l1 = curwp->w_dotp;
+            o1 = curwp->w_doto;
+            curwp->w_dotp = li == nlines ? bp->b_linep : lines[li];
+            curwp->w_doto = off;
+            r2 = scanner(dir == REVERSE ? rneedle : needle, dir, beg_or_end);
+            checks++;
+            if (r1 != r2 || (r1 == TRUE && (l1 != curwp->w_dotp || o1 != curwp->w_doto)))
+                fail("scanner", "n=%d dir=%d beg_or_end=%d exact=%d from line %d:%d: %d, want %d",
+                     n, dir, beg_or_end, (bp->b_mode & MDEXACT) != 0, li, off, r2, r1);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 2000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+        switch (opt) {
+        case 's':
+            rnd_state = (uint32_t)strtoul(optarg, NULL, 0) | 1;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s seed] [-n iterations]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    test_fold();
+    test_probe(iterations);
+    test_tails(iterations / 4);
+    test_rscan(iterations / 4);
+    test_scanner(iterations);
+
+#if defined(__AVX2__)
+    printf("test_lit_search: AVX2 probe, ");
+#elif defined(__SSE2__)
+    printf("test_lit_search: SSE2 probe, ");
+#else
+    printf("test_lit_search: no SIMD probe, ");
+#endif
+    printf("%lu checks, %lu failures\n", checks, failures);
+    return failures != 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * test_mb_history - regression tests for the minibuffer history search
+ *
+ * Adds random entries of a few kinds, some of them entered again, and
+ * checks mb_history_prev()/mb_history_next() from random positions
+ * against a scan of every entry:
+ *
+ *   literal  substrings of entries and random strings, with changed case,
+ *            against strcasestr()
+ *   regex    random patterns of literals, '.', classes ([abc], [^a],
+ *            [a-c]), escapes (\d, \w, \.), groups with and without '|',
+ *            anchors and the quantifiers *, +, ?, {m}, {m,}, {m,n}, against
+ *            rx_match() over every live entry; a pattern that does not
+ *            compile must be looked for as a literal, and a non-ASCII
+ *            letter must also find its other case
+ *
+ * The history file goes to a temporary XDG_DATA_HOME, which is removed
+ * afterwards.
+ *
+ *   make test-history
+ *   ./build/test_mb_history [-s seed] [-n iterations]
+ *
+ * Each failure is printed; the exit status is non-zero if there was any.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "estruct.h"
+#include "mb_history.h"
+#include "rx_cache.h"
+
+#define NKINDS 3
+#define ADDS 500                        /* entries added per iteration */
+#define QUERIES 200                     /* queries per iteration */
+/* as prepare() compiles a regex */
+#define RX_FLAGS (PCRE2_UTF | PCRE2_UCP | PCRE2_CASELESS)
+
+static unsigned long checks;
+static unsigned long failures;
+
+static uint32_t rnd_state = 1;
+
+/* xorshift, so a seed gives the same run with any libc */
+static int rnd(int n)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return n > 0 ? (int)(rnd_state % (uint32_t)n) : 0;
+}
+
+static void fail(const char *test, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void fail(const char *test, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (++failures > 20)
+        return;
+    printf("FAIL %s: ", test);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+/* What the history should hold: every id ever given out, oldest first. */
+static struct {
+    char text[NPAT];
+    int kind;
+    bool dead;                          /* entered again since */
+} ref[MB_HISTORY_MAX];
+static int nref;
+
+static int kinds[NKINDS];
+
+/* A small alphabet with regex metacharacters, so patterns hit often. */
+static void random_text(char *out, int maxlen)
+{
+    static const char *const parts[] = {
+        "a", "b", "c", "A", "B", "x", "ab", "abc", "1", "42", ".", "(", ")",
+        "-", " ", "_", "foo", "Bar", "s/a/b/", "\xc3\xa9", "\xc3\x89", "\xc3\xbc",
+    };
+    int len = 0;
+
+    for (int k = 1 + rnd(6); k > 0; k--) {
+        const char *p = parts[rnd((int)(sizeof(parts) / sizeof(parts[0])))];
+        int n = (int)strlen(p);
+
+        if (len + n >= maxlen)
+            break;
+        memcpy(out + len, p, (size_t)n);
+        len += n;
+    }
+    out[len] = '\0';
+}
+
+static void add_entry(void)
+{
+    char text[NPAT];
+    int kind = rnd(NKINDS);
+
+    /* re-enter an older entry now and then */
+    if (nref > 0 && rnd(4) == 0) {
+        int id = rnd(nref);
+
+        kind = ref[id].kind;
+        snprintf(text, sizeof(text), "%s", ref[id].text);
+    } else {
+        random_text(text, 24);
+    }
+    if (text[0] == '\0' || nref == MB_HISTORY_MAX)
+        return;
+    mb_history_add(kinds[kind], text);
+
+    /* the newest entry entered again is not added */
+    if (nref > 0 && ref[nref - 1].kind == kind && strcmp(ref[nref - 1].text, text) == 0)
+        return;
+    for (int id = 0; id < nref; id++) {
+        if (!ref[id].dead && ref[id].kind == kind && strcmp(ref[id].text, text) == 0)
+            ref[id].dead = true;
+    }
+    snprintf(ref[nref].text, sizeof(ref[nref].text), "%s", text);
+    ref[nref].kind = kind;
+    ref[nref].dead = false;
+    nref++;
+}
+
+/* Does entry id match query, as the brute force sees it? */
+static bool ref_matches(int id, int kind, const char *query, bool regex)
+{
+    char err[128];
+    struct rx *rx;
+
+    if (ref[id].dead || ref[id].kind != kind)
+        return false;
+    if (regex && (rx = rx_get(query, RX_FLAGS, err, sizeof(err))) != NULL)
+        return rx_match(rx, ref[id].text, strlen(ref[id].text), 0) >= 0;
+    return strcasestr(ref[id].text, query) != NULL;
+}
+
+static int ref_prev(int kind, const char *query, bool regex, int before)
+{
+    if (before < 0 || before > nref)
+        before = nref;
+    while (--before >= 0) {
+        if (ref_matches(before, kind, query, regex))
+            return before;
+    }
+    return -1;
+}
+
+static int ref_next(int kind, const char *query, bool regex, int after)
+{
+    while (++after < nref) {
+        if (ref_matches(after, kind, query, regex))
+            return after;
+    }
+    return -1;
+}
+
+/* A random atom, maybe quantified, appended to out. */
+static void random_atom(char *out, size_t cap)
+{
+    static const char *const atoms[] = {
+        "a", "b", "c", "x", "A", "ab", "foo", "42", ".", "[abc]", "[^a]", "[a-c]",
+        "[A-Z]", "\\d", "\\w", "\\s", "\\.", "\\(", "\\)", "(ab)", "(a|b)",
+        "(foo|bar)", "(a(b)c)", "^", "$", "s/", "_", "\xc3\xa9", "\xc3\x89" "b", "[a\xc3\xbc]",
+    };
+    static const char *const quants[] = {
+        "*", "+", "?", "{2}", "{1,}", "{0,2}", "{1,3}", "*?", "{2,2}",
+    };
+    size_t len = strlen(out);
+    const char *atom = atoms[rnd((int)(sizeof(atoms) / sizeof(atoms[0])))];
+    const char *quant = "";
+
+    if (atom[0] != '^' && atom[0] != '$' && rnd(3) == 0)
+        quant = quants[rnd((int)(sizeof(quants) / sizeof(quants[0])))];
+    snprintf(out + len, cap - len, "%s%s", atom, quant);
+}
+
+static void random_query(char *query, size_t cap, bool *regex)
+{
+    *regex = rnd(3) != 0;
+    query[0] = '\0';
+    if (*regex) {
+        for (int k = 1 + rnd(4); k > 0; k--)
+            random_atom(query, cap);
+        if (rnd(20) == 0)               /* does not compile: a literal */
+            snprintf(query + strlen(query), cap - strlen(query), "%s", rnd(2) ? "(" : "[a");
+        return;
+    }
+    if (nref > 0 && rnd(3) != 0) {
+        /* part of an entry, its case changed */
+        const char *text = ref[rnd(nref)].text;
+        int len = (int)strlen(text);
+        int start = rnd(len);
+        int n = 1 + rnd(len - start);
+
+        for (int i = 0; i < n; i++) {
+            char c = text[start + i];
+
+            query[i] = rnd(2) && c >= 'a' && c <= 'z' ? (char)(c - 'a' + 'A') : c;
+        }
+        query[n] = '\0';
+        return;
+    }
+    if (rnd(10) != 0)
+        random_text(query, 8);
+}
+
+static void check_query(int kind, const char *query, bool regex)
+{
+    const char *test = regex ? "regex" : "literal";
+    int from = rnd(nref + 2) - 1;
+    int got, want;
+
+    /* walk a few steps back from a random entry, then forward */
+    got = mb_history_prev(kinds[kind], query, regex, from);
+    want = ref_prev(kind, query, regex, from);
+    for (int step = 0; step < 4; step++) {
+        checks++;
+        if (got != want) {
+            fail(test, "prev \"%s\" kind %d before %d: %d, want %d", query, kind, from, got, want);
+            return;
+        }
+        if (got >= 0 && strcmp(mb_history_text(got), ref[got].text) != 0) {
+            fail(test, "entry %d is \"%s\", want \"%s\"", got, mb_history_text(got), ref[got].text);
+            return;
+        }
+        if (got < 0)
+            break;
+        from = got;
+        got = mb_history_prev(kinds[kind], query, regex, from);
+        want = ref_prev(kind, query, regex, from);
+    }
+
+    from = rnd(nref + 1) - 1;
+    got = mb_history_next(kinds[kind], query, regex, from);
+    want = ref_next(kind, query, regex, from);
+    for (int step = 0; step < 4; step++) {
+        checks++;
+        if (got != want) {
+            fail(test, "next \"%s\" kind %d after %d: %d, want %d", query, kind, from, got, want);
+            return;
+        }
+        if (got < 0)
+            break;
+        from = got;
+        got = mb_history_next(kinds[kind], query, regex, from);
+        want = ref_next(kind, query, regex, from);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char dir[] = "/tmp/test_mb_history.XXXXXX";
+    char cmd[64];
+    int iterations = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+        switch (opt) {
+        case 's':
+            rnd_state = (uint32_t)strtoul(optarg, NULL, 0) | 1;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s seed] [-n iterations]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (mkdtemp(dir) == NULL || setenv("XDG_DATA_HOME", dir, 1) != 0) {
+        perror("test_mb_history");
+        return 2;
+    }
+    kinds[0] = mb_history_kind("Search: ");
+    kinds[1] = mb_history_kind("Command Mode: ");
+    kinds[2] = mb_history_kind("sed replace: ");
+
+    for (int it = 0; it < iterations; it++) {
+        for (int i = 0; i < ADDS; i++)
+            add_entry();
+        for (int i = 0; i < QUERIES; i++) {
+            char query[NPAT];
+            bool regex;
+
+            random_query(query, 64, &regex);
+            check_query(rnd(NKINDS), query, regex);
+            if (rnd(8) == 0)
+                add_entry();
+        }
+    }
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0)
+        fprintf(stderr, "test_mb_history: could not remove %s\n", dir);
+
+    printf("test_mb_history: %lu checks, %lu failures\n", checks, failures);
+    return failures != 0;
+}
@@ -0,0 +1,361 @@
+/*
+ * test_sed_bulk - regression tests for the bulk global sed replace
+ *
+ * sed_replace_bulk() must leave a buffer exactly as the per-line path,
+ * apply_regex_to_line() with is_global set, run over every line does.
+ * Both are static, so this file includes commands/command_mode.c, and the
+ * make target links the other editor objects without command_mode.o.
+ *
+ *   fixed    hand-checked results for both paths: a replacement holding
+ *            \n, \r\n, \r or \n\r splits the line, and an empty match
+ *            replaced with text steps past what was inserted (x* replaced
+ *            with "-" in "abc" gives "-a-b-c-", and does terminate)
+ *   random   random buffers, patterns and replacements, with lines packed
+ *            in chunks as readin() packs them and some chunks COLD: both
+ *            paths give the same text and count, and a COLD chunk with no
+ *            match in it is still COLD afterwards
+ *
+ *   make test-sed
+ *   ./build/test_sed_bulk [-s seed] [-n iterations]
+ *
+ * Each failure is printed; the exit status is non-zero if there was any.
+ */
+
+#include "command_mode.c"
+
+#include <stdarg.h>
+#include <unistd.h>
+
+static unsigned long checks;
+static unsigned long failures;
+
+static uint32_t rnd_state = 1;
+
+/* xorshift, so a seed gives the same run with any libc */
+static int rnd(int n)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return n > 0 ? (int)(rnd_state % (uint32_t)n) : 0;
+}
+
+static void fail(const char *test, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void fail(const char *test, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (++failures > 20)
+        return;
+    printf("FAIL %s: ", test);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    putchar('\n');
+}
+
+static struct window test_window;
+
+/* Make bp current, in a window of its own. */
+static void use(struct buffer *bp)
+{
+    memset(&test_window, 0, sizeof(test_window));
+    test_window.w_bufp = bp;
+    test_window.w_dotp = test_window.w_linep = lforw(bp->b_linep);
+    curwp = &test_window;
+    curbp = bp;
+}
+
+/* An empty buffer called name. */
+static struct buffer *test_buffer(char *name)
+{
+    struct buffer *bp = bfind(name, TRUE, BFINVS);
+
+    if (bp == NULL) {
+        fprintf(stderr, "test_sed_bulk: out of memory\n");
+        exit(2);
+    }
+    use(bp);
+    bclear(bp);
+    bp->b_flag = BFINVS;
+    return bp;
+}
+
+/*
+ * Append nlines lines to bp, their text packed into one chunk as readin()
+ * packs it: no newlines, each line right after the one before.  Returns
+ * the chunk.
+ */
+static MemoryHandle append_chunk(struct buffer *bp, char **lines, int nlines)
+{
+    MemoryHandle h;
+    size_t pos = 0;
+
+    for (int i = 0; i < nlines; i++)
+        pos += strlen(lines[i]);
+    h = my_handle_alloc(pos + 1);
+    pos = 0;
+    for (int i = 0; i < nlines; i++) {
+        struct line *lp = malloc(sizeof(struct line));
+        size_t n = strlen(lines[i]);
+
+        memcpy((char *)handle_deref(h) + pos, lines[i], n);
+        lp->l_handle = h;
+        my_handle_ref(h);
+        lp->l_offset = (uint32_t)pos;
+        lp->used = lp->size = (int)n;
+        lp->l_hl = NULL;
+        lp->l_diag = 0;
+        lp->prev = bp->b_linep->prev;
+        lp->next = bp->b_linep;
+        bp->b_linep->prev->next = lp;
+        bp->b_linep->prev = lp;
+        pos += n;
+    }
+    my_handle_free(h);
+    return h;
+}
+
+/* The text of bp, a newline after each line; the caller frees it. */
+static char *dump(struct buffer *bp)
+{
+    size_t cap = 256, n = 0;
+    char *out = malloc(cap);
+
+    for (struct line *lp = lforw(bp->b_linep); lp != bp->b_linep; lp = lforw(lp)) {
+        size_t len = (size_t)llength(lp);
+
+        if (n + len + 2 > cap) {
+            cap = (n + len + 2) * 2;
+            out = realloc(out, cap);
+        }
+        if (len > 0)
+            memcpy(out + n, ltext(lp), len);
+        n += len;
+        out[n++] = '\n';
+    }
+    out[n] = '\0';
+    return out;
+}
+
+static int run_per_line(struct buffer *bp, struct rx *rx, const char *repl, int *count)
+{
+    use(bp);
+    for (struct line *lp = lforw(bp->b_linep), *next; lp != bp->b_linep; lp = next) {
+        next = lforw(lp);
+        if (!apply_regex_to_line(lp, rx, repl, strlen(repl), TRUE, count))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static int run_bulk(struct buffer *bp, struct rx *rx, const char *repl, int *count)
+{
+    use(bp);
+    return sed_replace_bulk(rx, repl, strlen(repl), count);
+}
+
+static struct rx *compile(const char *pattern)
+{
+    char err[160];
+    struct rx *rx = rx_get(pattern, PCRE2_UTF | PCRE2_UCP | PCRE2_MULTILINE, err, sizeof(err));
+
+    if (rx == NULL)
+        fail("compile", "%s: %s", pattern, err);
+    return rx;
+}
+
+/* Show line breaks and the like in a failure message. */
+static const char *shown(const char *s)
+{
+    static char out[4][256];
+    static int slot;
+    char *p = out[slot = (slot + 1) % 4];
+    size_t n = 0;
+
+    for (; *s != '\0' && n + 3 < sizeof(out[0]); s++) {
+        if (*s == '\n' || *s == '\r') {
+            p[n++] = '\\';
+            p[n++] = *s == '\n' ? 'n' : 'r';
+        } else {
+            p[n++] = *s;
+        }
+    }
+    p[n] = '\0';
+    return p;
+}
+
+static const struct {
+    const char *text;           /* lines, each ended by a newline */
+    const char *pattern;
+    const char *repl;
+    const char *want;
+    int count;
+} fixed_cases[] = {
+    { "a1b\n", "1", "\n", "a\nb\n", 1 },
+    { "a1b\n", "1", "\r\n", "a\nb\n", 1 },
+    { "a1b\n", "1", "\r", "a\nb\n", 1 },
+    { "a1b\n", "1", "\n\r", "a\n\nb\n", 1 },
+    { "aXbXc\n", "X", "q\nr", "aq\nrbq\nrc\n", 2 },
+    { "1\n", "1", "\n", "\n\n", 1 },
+    { "abc\n", "x*", "-", "-a-b-c-\n", 4 },
+    { "abc\n", "x*", "", "abc\n", 4 },
+    { "\n", "x*", "xx", "xx\n", 1 },
+    { "\xc3\xa9" "a\n", "", "-", "-\xc3\xa9-a-\n", 3 },
+    { "aa\nbb\n", "^", "+", "+aa\n+bb\n", 2 },
+    { "ab\n\n", "$", "!", "ab!\n!\n", 2 },
+    { "xaxx\n", "x*", "<\n>", "<\n><\n>a<\n><\n>\n", 4 },
+};
+
+static void test_fixed(void)
+{
+    for (size_t i = 0; i < sizeof(fixed_cases) / sizeof(fixed_cases[0]); i++) {
+        char *lines[8];
+        int nlines = 0;
+        char text[64];
+        struct rx *rx = compile(fixed_cases[i].pattern);
+
+        if (rx == NULL)
+            continue;
+        snprintf(text, sizeof(text), "%s", fixed_cases[i].text);
+        for (char *p = text, *nl; (nl = strchr(p, '\n')) != NULL; p = nl + 1) {
+            *nl = '\0';
+            lines[nlines++] = p;
+        }
+
+        for (int bulk = 0; bulk < 2; bulk++) {
+            struct buffer *bp = test_buffer(bulk ? "sed-bulk" : "sed-per-line");
+            int count = 0;
+            char *got;
+
+            append_chunk(bp, lines, nlines);
+            if (!(bulk ? run_bulk : run_per_line)(bp, rx, fixed_cases[i].repl, &count))
+                fail("fixed", "case %zu failed to run", i);
+            got = dump(bp);
+            checks++;
+            if (strcmp(got, fixed_cases[i].want) != 0 || count != fixed_cases[i].count)
+                fail("fixed", "%s: s/%s/%s/g on \"%s\" gave \"%s\" (%d), want \"%s\" (%d)",
+                     bulk ? "bulk" : "per-line", fixed_cases[i].pattern,
+                     shown(fixed_cases[i].repl), shown(fixed_cases[i].text), shown(got), count,
+                     shown(fixed_cases[i].want), fixed_cases[i].count);
+            free(got);
+        }
+    }
+}
+
+/* Does any line of the chunk lines[from, to) match? */
+static bool chunk_matches(struct rx *rx, char **lines, int from, int to)
+{
+    for (int i = from; i < to; i++) {
+        if (rx_match(rx, lines[i], strlen(lines[i]), 0) >= 0)
+            return true;
+    }
+    return false;
+}
+
+static void test_random(int iterations)
+{
+    static const char *const patterns[] = {
+        "a", "ab", "^", "$", "x*", "\\b", "(?<=a)b", "^a", "b$", "[ab]+", "\xc3\xa9",
+        ".", "a|", "(?i)A", "", "b*$",
+    };
+    static const char *const repls[] = {
+        "", "Z", "ZZZ", "a", "\n", "q\nr", "\r\n", "\r", "\n\r", "ab", "\xc3\xa9", "\n\n",
+    };
+    static const char *const words[] = { "a", "ab", "x", "\xc3\xa9", " ", "b", "aab", "xxxx" };
+    enum { MAX_LINES = 24 };
+    unsigned long cold_checked = 0;
+
+    for (int it = 0; it < iterations; it++) {
+        const char *pattern = patterns[rnd((int)(sizeof(patterns) / sizeof(patterns[0])))];
+        const char *repl = repls[rnd((int)(sizeof(repls) / sizeof(repls[0])))];
+        struct rx *rx = compile(pattern);
+        char *lines[MAX_LINES];
+        int nlines = rnd(MAX_LINES);
+        MemoryHandle cold[MAX_LINES];
+        int ncold = 0;
+        struct buffer *a, *b;
+        int ca = 0, cb = 0;
+        char *da, *db;
+
+        if (rx == NULL)
+            continue;
+        for (int i = 0; i < nlines; i++) {
+            char line[256];
+            size_t len = 0;
+
+            /* long lines now and then, so that chunks are big enough to freeze */
+            for (int k = rnd(rnd(4) != 0 ? 6 : 60); k > 0; k--) {
+                const char *w = words[rnd((int)(sizeof(words) / sizeof(words[0])))];
+
+                memcpy(line + len, w, strlen(w));
+                len += strlen(w);
+            }
+            line[len] = '\0';
+            lines[i] = strdup(line);
+        }
+
+        a = test_buffer("sed-per-line");
+        b = test_buffer("sed-bulk");
+        for (int i = 0; i < nlines; ) {
+            int run = 1 + rnd(nlines - i < 8 ? nlines - i : 8);
+            MemoryHandle h;
+
+            append_chunk(a, lines + i, run);
+            h = append_chunk(b, lines + i, run);
+            if (rnd(2) == 0 && !chunk_matches(rx, lines, i, i + run) && mymemory_freeze(h))
+                cold[ncold++] = h;
+            i += run;
+        }
+
+        if (!run_per_line(a, rx, repl, &ca) || !run_bulk(b, rx, repl, &cb))
+            fail("random", "s/%s/%s/g failed to run", pattern, shown(repl));
+        for (int i = 0; i < ncold; i++) {
+            checks++;
+            cold_checked++;
+            if (mymemory_freeze(cold[i]))
+                fail("random", "s/%s/%s/g thawed a COLD chunk with no match", pattern, shown(repl));
+        }
+
+        da = dump(a);
+        db = dump(b);
+        checks++;
+        if (ca != cb || strcmp(da, db) != 0)
+            fail("random", "s/%s/%s/g: bulk gave %d and \"%s\", per-line %d and \"%s\"",
+                 pattern, shown(repl), cb, shown(db), ca, shown(da));
+        free(da);
+        free(db);
+        for (int i = 0; i < nlines; i++)
+            free(lines[i]);
+    }
+    if (iterations > 0 && cold_checked == 0)
+        fail("random", "no chunk could be frozen");
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 5000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+        switch (opt) {
+        case 's':
+            rnd_state = (uint32_t)strtoul(optarg, NULL, 0) | 1;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s seed] [-n iterations]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    test_fixed();
+    test_random(iterations);
+
+    printf("test_sed_bulk: %lu checks, %lu failures\n", checks, failures);
+    return failures != 0;
+}
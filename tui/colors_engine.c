@@ -183,10 +183,12 @@ static int parse_hex(char ch) {
     return -1;
 }
 
+/* Only '#', '0' (0xRRGGBB) and 'r' (rgb) can start a match, so the scan
+ * jumps between those bytes. */
 static int match_colors(const char *text, int len, Match *matches, int max_matches) {
     int count = 0;
     int i = 0;
-    while (i < len && count < max_matches) {
+    while (count < max_matches && (i = find_first_of3(text, len, i, '#', '0', 'r')) < len) {
         if (text[i] == '#' && i + 3 <= len) {
             int h1 = parse_hex(text[i+1]);
             int h2 = parse_hex(text[i+2]);
@@ -286,6 +288,23 @@ int command_mode_handle_colors_command(const char *input) {
         remaining = llength(lp);
     }
 
+    /* The operation list is the same for every match: split it once. */
+    int max_ops = 1;
+    for (const char *s = input; *s; s++)
+        max_ops += *s == ';';
+    char *ops_buf = strdup(input);
+    char **ops = malloc((size_t)max_ops * sizeof(*ops));
+    if (!ops_buf || !ops) {
+        free(ops_buf);
+        free(ops);
+        return FALSE;
+    }
+    int nops = 0;
+    for (char *tok = strtok(ops_buf, ";"); tok; tok = strtok(NULL, ";"))
+        ops[nops++] = tok;
+
+    char *new_text = NULL;
+    int new_cap = 0;
     int match_count_total = 0;
 
     while (remaining > 0 && lp != curbp->b_linep) {
@@ -304,8 +323,12 @@ int command_mode_handle_colors_command(const char *input) {
 
         if (mcount > 0) {
             match_count_total += mcount;
-            char *new_text = malloc(line_len + 512); // generous padding
-            if (!new_text) break;
+            if (line_len + 512 > new_cap) { // generous padding
+                char *grown = realloc(new_text, line_len + 512);
+                if (!grown) break;
+                new_text = grown;
+                new_cap = line_len + 512;
+            }
             int out_idx = 0;
             int in_idx = 0;
             
@@ -325,13 +348,8 @@ int command_mode_handle_colors_command(const char *input) {
                 
                 // apply ops
                 ColorData c = matches[m].c;
-                char *cmd_dup = strdup(input);
-                char *tok = strtok(cmd_dup, ";");
-                while (tok) {
-                    execute_op(&c, tok);
-                    tok = strtok(NULL, ";");
-                }
-                free(cmd_dup);
+                for (int op = 0; op < nops; op++)
+                    execute_op(&c, ops[op]);
 
                 // format output
                 int ir = (int)round(c.r);
@@ -371,7 +389,6 @@ int command_mode_handle_colors_command(const char *input) {
             curwp->w_doto = 0;
             ldelete(line_len, FALSE);
             linsert_block(new_text, out_idx);
-            free(new_text);
             
             lp = curwp->w_dotp; 
         }
@@ -379,6 +396,9 @@ int command_mode_handle_colors_command(const char *input) {
         lp = lforw(lp);
         start_offset = 0; // next line starts at offset 0
     }
+    free(new_text);
+    free(ops);
+    free(ops_buf);
 
     if (match_count_total > 0) {
         mlwrite("Colors modified: %d", match_count_total);
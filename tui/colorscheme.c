@@ -71,6 +71,8 @@ static void set_default_scheme(void) {
     styles[HL_LSP_WARN] = (HighlightStyle){11, -1, true, false, false};
     /* Line Number Gutter: Bright Black (Gray) on Default */
     styles[HL_LINENUM] = (HighlightStyle){8, -1, false, false, false};
+    /* Search Hits: Black on Cyan */
+    styles[HL_SEARCH_HIT] = (HighlightStyle){0, 6, false, false, false};
 }
 
 static int parse_color(const char *val) {
@@ -189,6 +191,7 @@ static void load_scheme_file(const char *path) {
             else if (strcmp(key, "lsp_error") == 0) id = HL_LSP_ERROR;
             else if (strcmp(key, "lsp_warn") == 0) id = HL_LSP_WARN;
             else if (strcmp(key, "linenum") == 0) id = HL_LINENUM;
+            else if (strcmp(key, "search_hit") == 0) id = HL_SEARCH_HIT;
             
                     if (id != HL_COUNT) {                parse_attributes(val, &styles[id]);
             }
@@ -199,7 +202,7 @@ static void load_scheme_file(const char *path) {
     /* Propagate normal background to other styles if they are unset */
     if (styles[HL_NORMAL].bg != -1) {
         for (int i = 0; i < HL_COUNT; i++) {
-            if (i == HL_NORMAL || i == HL_SELECTION) continue;
+            if (i == HL_NORMAL || i == HL_SELECTION || i == HL_SEARCH_HIT) continue;
             if (styles[i].bg == -1) {
                 styles[i].bg = styles[HL_NORMAL].bg;
             }
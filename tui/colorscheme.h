@@ -35,6 +35,7 @@ typedef enum {
     HL_LSP_ERROR,      /* LSP error indicator in gutter */
     HL_LSP_WARN,       /* LSP warning indicator in gutter */
     HL_LINENUM,        /* Line number gutter */
+    HL_SEARCH_HIT,     /* Occurrences of the search pattern */
     HL_COUNT
 } HighlightStyleID;
 
@@ -27,12 +27,20 @@
 #include "utf8.h"
 #include "util.h"
 #include "highlight.h"
+#include "hl_checkpoint.h"
 #include "video.h"
 #include "render_plugin.h"
+#include "match_index.h"
+#include "search_hits.h"
+#include "perf.h"
 
 extern struct terminal *term;
 
 struct video **vscreen;          /* Virtual screen. */
+static struct video **pscreen;   /* Shadow of what the terminal shows. */
+static bool vt_painting = false; /* updupd() owns the terminal output */
+static int shadow_normal_fg = -1;
+static int shadow_normal_bg = -1;
 
 void vtputc(int c);
 void vteeol(void);
@@ -173,35 +181,19 @@ static void gutter_plugin_fn(render_ctx_t *ctx) {
     HighlightStyle warn_style = colorscheme_get(HL_LSP_WARN);
     
     video_cell *vcp = vscreen[row]->v_text;
-    for (int i = 0; i < 5; i++) {
-        vcp[i].ch = buf[i];
-        vcp[i].fg = num_style.fg;
-        vcp[i].bg = num_style.bg;
-        vcp[i].bold = num_style.bold;
-        vcp[i].underline = num_style.underline;
-        vcp[i].italic = num_style.italic;
-    }
+    for (int i = 0; i < 5; i++)
+        vcell_set(&vcp[i], (unsigned char)buf[i], num_style.fg, num_style.bg,
+                  num_style.bold, num_style.underline, num_style.italic);
 
     /* Indicators */
-    for (int i = 0; i < 2; i++) {
-        vcp[5+i].ch = indicator[i];
-        if (indicator[0] == '!') {
-            vcp[5+i].fg = err_style.fg;
-            vcp[5+i].bg = err_style.bg;
-            vcp[5+i].bold = err_style.bold;
-        } else if (indicator[0] == '?') {
-            vcp[5+i].fg = warn_style.fg;
-            vcp[5+i].bg = warn_style.bg;
-            vcp[5+i].bold = warn_style.bold;
-        } else {
-            vcp[5+i].fg = num_style.fg;
-            vcp[5+i].bg = num_style.bg;
-        }
-    }
-
-    vcp[7].ch = 0x2502; /* Unicode box-drawing vertical separator */
-    vcp[7].fg = num_style.fg;
-    vcp[7].bg = num_style.bg;
+    HighlightStyle ind_style = indicator[0] == '!' ? err_style :
+                               indicator[0] == '?' ? warn_style : num_style;
+    for (int i = 0; i < 2; i++)
+        vcell_set(&vcp[5+i], (unsigned char)indicator[i], ind_style.fg, ind_style.bg,
+                  ind_style.bold, false, false);
+
+    /* Unicode box-drawing vertical separator */
+    vcell_set(&vcp[7], 0x2502, num_style.fg, num_style.bg, false, false, false);
 }
 
 static void ghost_text_plugin_fn(render_ctx_t *ctx) {
@@ -248,7 +240,7 @@ static void ghost_text_plugin_fn(render_ctx_t *ctx) {
 
 static void render_gutter(int row, int lnum, struct line *lp)
 {
-    render_ctx_t ctx = { NULL, lp, row, 0, 0, 0, HL_NORMAL, lnum };
+    render_ctx_t ctx = { NULL, lp, row, 0, 0, 0, HL_NORMAL, lnum, NULL, 0 };
     render_plugin_execute(RENDER_HOOK_GUTTER, &ctx);
 }
 
@@ -264,7 +256,7 @@ int chg_width, chg_height;
 static int reframe(struct window *wp);
 static void updone(struct window *wp);
 static void updall(struct window *wp);
-static int updateline(int row, struct video *vp);
+static int updateline(int row, struct video *vp, int start, int end);
 static void modeline(struct window *wp);
 static void show_line_wrapped(struct window *wp, struct line *lp);
 
@@ -486,16 +478,25 @@ void vtinit(void)
     rendering_color_underline = false;
     rendering_color_italic = false;
 
+    pscreen = xmalloc(term->t_mrow * sizeof(struct video *));
+    memset(pscreen, 0, term->t_mrow * sizeof(struct video *));
+
     for (i = 0; i < term->t_mrow; ++i) {
         vp = xmalloc(sizeof(struct video) + term->t_mcol * sizeof(video_cell));
         memset(vp, 0, sizeof(struct video) + term->t_mcol * sizeof(video_cell));
         vp->v_flag = 0;
         vscreen[i] = vp;
+
+        vp = xmalloc(sizeof(struct video) + term->t_mcol * sizeof(video_cell));
+        memset(vp, 0, sizeof(struct video) + term->t_mcol * sizeof(video_cell));
+        vp->v_flag = VFINV;
+        pscreen[i] = vp;
     }
 
     /* Register built-in plugins */
     render_plugin_register((render_plugin_t){ RENDER_HOOK_GUTTER, gutter_plugin_fn, NULL });
     render_plugin_register((render_plugin_t){ RENDER_HOOK_POST_LINE, ghost_text_plugin_fn, NULL });
+    search_hits_init();
 }
 
 /*
@@ -520,6 +521,14 @@ void vttidy(void)
         free(vscreen);
         vscreen = NULL;
     }
+    if (pscreen != NULL) {
+        for (i = 0; i < term->t_mrow; ++i) {
+            if (pscreen[i] != NULL)
+                free(pscreen[i]);
+        }
+        free(pscreen);
+        pscreen = NULL;
+    }
     write(1, "\r", 1);
 }
 
@@ -576,14 +585,10 @@ void vtputc(int c)
     if (vtcol >= 0) {
         int i;
         for (i = 0; i < char_width; i++) {
-            if (vtcol + i < term->t_ncol) {
-                vp->v_text[vtcol + i].ch = (i == 0) ? c : 0;
-                vp->v_text[vtcol + i].fg = rendering_color_fg;
-                vp->v_text[vtcol + i].bg = rendering_color_bg;
-                vp->v_text[vtcol + i].bold = rendering_color_bold;
-                vp->v_text[vtcol + i].underline = rendering_color_underline;
-                vp->v_text[vtcol + i].italic = rendering_color_italic;
-            }
+            if (vtcol + i < term->t_ncol)
+                vcell_set(&vp->v_text[vtcol + i], (i == 0) ? (unicode_t)c : 0,
+                          rendering_color_fg, rendering_color_bg, rendering_color_bold,
+                          rendering_color_underline, rendering_color_italic);
         }
         vtcol += char_width;
     }
@@ -601,12 +606,8 @@ void vteeol(void)
     if (vtcol > term->t_ncol) vtcol = term->t_ncol;
 
     while (vtcol < term->t_ncol) {
-        vcp[vtcol].ch = ' ';
-        vcp[vtcol].fg = rendering_color_fg;
-        vcp[vtcol].bg = rendering_color_bg;
-        vcp[vtcol].bold = rendering_color_bold;
-        vcp[vtcol].underline = rendering_color_underline;
-        vcp[vtcol].italic = rendering_color_italic;
+        vcell_set(&vcp[vtcol], ' ', rendering_color_fg, rendering_color_bg, rendering_color_bold,
+                  rendering_color_underline, rendering_color_italic);
         vtcol++;
     }
 }
@@ -622,101 +623,115 @@ int upscreen(int f, int n)
     return TRUE;
 }
 
-static void update_syntax_highlighting(struct buffer *bp) {
-    if (!highlight_is_enabled()) return;
-    
-    struct line *lp = bp->b_hl_dirty_line;
-    if (lp == NULL) lp = lforw(bp->b_linep);
-    
-    const char *fname = bp->b_fname[0] ? bp->b_fname : bp->b_bname;
-    const HighlightProfile *profile = highlight_get_profile(fname);
-    if (!profile) return;
+bool buffer_needs_hl_update(struct buffer *bp)
+{
+    return highlight_is_enabled() && bp->b_hl_ndirty > 0;
+}
 
-    HighlightState current_state = lp->hl_start_state;
-    
-    while (lp != bp->b_linep) {
-        bool changed = false;
-        if (memcmp(&lp->hl_start_state, &current_state, sizeof(HighlightState)) != 0) {
-            lp->hl_start_state = current_state;
-            changed = true;
-        }
+/*
+ * Propagate highlight states from "start", which must be the first line of
+ * a dirty interval, for at most max_lines lines.  Other intervals walked
+ * over are absorbed.  Returns the first line that was not processed.
+ */
+static struct line *highlight_incremental_run(struct buffer *bp, struct line *start, int max_lines)
+{
+    const HighlightProfile *profile = highlight_buffer_profile(bp);
+    if (!profile) {
+        hl_dirty_clear(bp);
+        return bp->b_linep;
+    }
+
+    struct line *lp = start;
+    HighlightState current_state = *lhl_start(lp);
+    bool full = bp->b_hl_full;
+    int count = 0;
+
+    while (lp != bp->b_linep && count < max_lines) {
+        bool changed = lhl_set_start(lp, &current_state);
 
         HighlightState computed_end;
         highlight_line((const char *)ltext(lp), lp->used, current_state, profile, NULL, &computed_end);
         
-        if (memcmp(&lp->hl_end_state, &computed_end, sizeof(HighlightState)) != 0) {
-            lp->hl_end_state = computed_end;
-            changed = true;
-        }
+        changed |= lhl_set_end(lp, &computed_end);
         
         current_state = computed_end;
-        if (!changed) {
-            /* If state didn't change and matched previous end state, we might be able to stop.
-             * But we need to check if the NEXT line's hl_start_state also matches.
-             */
-            struct line *next = lforw(lp);
-            if (next == bp->b_linep || memcmp(&next->hl_start_state, &current_state, sizeof(HighlightState)) == 0) {
-                break;
+        lp = lforw(lp);
+        count++;
+
+        if (lp != bp->b_linep && lp != start && hl_dirty_contains(bp, lp)) {
+            hl_dirty_remove(bp, lp);
+            continue;
+        }
+        if (!changed && !full) {
+            if (lp == bp->b_linep || memcmp(lhl_start(lp), &current_state, sizeof(HighlightState)) == 0) {
+                hl_dirty_remove(bp, start);
+                return lp;
             }
         }
-        
-        lp = lforw(lp);
     }
-    bp->b_hl_dirty_line = NULL;
+
+    if (lp == bp->b_linep) {
+        hl_dirty_remove(bp, start);
+    } else {
+        lhl_set_start(lp, &current_state);
+        hl_dirty_replace(bp, start, lp);
+    }
+    return lp;
 }
 
-bool buffer_needs_hl_update(struct buffer *bp)
+void highlight_incremental_step(struct buffer *bp)
 {
-    return highlight_is_enabled() && bp->b_hl_dirty_line != NULL;
+    if (!buffer_needs_hl_update(bp))
+        return;
+
+    uint64_t t0 = perf_begin();
+    highlight_incremental_run(bp, bp->b_hl_dirty[0], 100);
+    perf_end(PERF_HIGHLIGHT, t0);
 }
 
-void highlight_incremental_step(struct buffer *bp)
+/*
+ * Viewport-first scheduling.  Every line keeps its own start state, so any
+ * line outside a dirty interval is a usable checkpoint.  Intervals that
+ * start inside the window, or at most HL_VIEWPORT_MARGIN lines above or
+ * below it, are propagated here on the UI thread, bounded by the window
+ * size plus the margins.  Intervals further away are left to the
+ * background worker (hl_worker.c); until it catches up the window is drawn
+ * from the states already stored on its lines.
+ */
+#define HL_VIEWPORT_MARGIN 256
+
+static void highlight_viewport_step(struct window *wp)
 {
-    if (!highlight_is_enabled() || bp->b_hl_dirty_line == NULL) return;
+    struct buffer *bp = wp->w_bufp;
+    struct line *lp = wp->w_linep;
+    int above = 0;
 
-    const char *fname = bp->b_fname[0] ? bp->b_fname : bp->b_bname;
-    const HighlightProfile *profile = highlight_get_profile(fname);
-    if (!profile) {
-        bp->b_hl_dirty_line = NULL;
+    if (!buffer_needs_hl_update(bp))
         return;
-    }
 
-    struct line *lp = bp->b_hl_dirty_line;
-    HighlightState current_state = lp->hl_start_state;
-    int count = 0;
-    const int MAX_INCREMENTAL_LINES = 100;
+    while (above < HL_VIEWPORT_MARGIN && lback(lp) != bp->b_linep) {
+        lp = lback(lp);
+        above++;
+    }
 
-    while (lp != bp->b_linep && count < MAX_INCREMENTAL_LINES) {
-        bool changed = false;
-        if (memcmp(&lp->hl_start_state, &current_state, sizeof(HighlightState)) != 0) {
-            lp->hl_start_state = current_state;
-            changed = true;
-        }
+    int budget = above + nanox_text_rows() + HL_VIEWPORT_MARGIN;
+    uint64_t t0 = perf_begin();
 
-        HighlightState computed_end;
-        highlight_line((const char *)ltext(lp), lp->used, current_state, profile, NULL, &computed_end);
-        
-        if (memcmp(&lp->hl_end_state, &computed_end, sizeof(HighlightState)) != 0) {
-            lp->hl_end_state = computed_end;
-            changed = true;
-        }
-        
-        current_state = computed_end;
-        lp = lforw(lp);
-        count++;
-
-        if (!changed) {
-            if (lp == bp->b_linep || memcmp(&lp->hl_start_state, &current_state, sizeof(HighlightState)) == 0) {
-                bp->b_hl_dirty_line = NULL;
-                return;
+    while (budget > 0 && lp != bp->b_linep && bp->b_hl_ndirty > 0) {
+        if (hl_dirty_contains(bp, lp)) {
+            struct line *stop = highlight_incremental_run(bp, lp, budget);
+            struct line *walk = lp;
+            while (walk != stop && budget > 0) {
+                walk = lforw(walk);
+                budget--;
             }
+            lp = stop;
+            continue;
         }
+        lp = lforw(lp);
+        budget--;
     }
-
-    if (lp == bp->b_linep)
-        bp->b_hl_dirty_line = NULL;
-    else
-        bp->b_hl_dirty_line = lp;
+    perf_end(PERF_HIGHLIGHT, t0);
 }
 
 /*
@@ -761,18 +776,21 @@ int update(int force)
     wp = curwp;
 
     if (wp->w_flag) {
-        /* Update syntax highlighting incrementally, not the whole buffer */
-        if (buffer_needs_hl_update(wp->w_bufp)) {
-            highlight_incremental_step(wp->w_bufp);
-        }
-
         /* if the window has changed, service it */
+        uint64_t t0 = perf_begin();
         reframe(wp);        /* check the framing */
+        perf_end(PERF_REFRAME, t0);
 
+        /* Only the visible part is highlighted here, from the new
+         * w_linep; see hl_worker.c */
+        highlight_viewport_step(wp);
+
+        t0 = perf_begin();
         if ((wp->w_flag & ~WFMODE) == WFEDIT)
             updone(wp); /* update EDITed line */
         else if (wp->w_flag & ~WFMOVE)
             updall(wp); /* update all lines */
+        perf_end(PERF_DRAW, t0);
         if (wp->w_flag & WFMODE) {
             /* Reset colors before drawing modeline to avoid color leakage from syntax highlighting */
             rendering_color_fg = normal.fg;
@@ -807,11 +825,16 @@ int update(int force)
                                        get_gutter_width());
 
     /* update the virtual screen to the physical screen */
+    uint64_t t_upd = perf_begin();
     updupd(force);
+    perf_end(PERF_UPDUPD, t_upd);
 
     /* update the cursor and flush the buffers */
     movecursor(currow, curcol + get_gutter_width() - lbound);
+    uint64_t t_flush = perf_begin();
     TTflush();
+    perf_end(PERF_FLUSH, t_flush);
+    perf_key_painted();
     displaying = FALSE;
     while (chg_width || chg_height)
         newscreensize(chg_height, chg_width);
@@ -869,31 +892,54 @@ static int reframe(struct window *wp)
     return TRUE;
 }
 
-static void show_line(struct window *wp, struct line *lp)
-{
-    int len = llength(lp);
-    current_rendering_lp = lp;
+/* Spans of the line being drawn.  The storage is reused for every line,
+ * so redisplay allocates nothing once the densest line has been seen. */
+static SpanVec line_spans;
 
-    /* Highlight logic */
-    SpanVec spans;
+/*
+ * Highlight lp for display.  If its end state turns out different from the
+ * stored one, the next line is re-seeded and marked dirty.  Checkpointed
+ * buffers compute the start state on demand and store nothing here.
+ */
+static void highlight_show_state(struct window *wp, struct line *lp, int len,
+                                 const HighlightProfile *profile, SpanVec *spans)
+{
+    struct buffer *bp = wp->w_bufp;
     HighlightState end_state;
 
-    const char *fname = wp->w_bufp->b_fname;
-    if (!fname || !*fname)
-        fname = wp->w_bufp->b_bname;
-    const HighlightProfile *profile = highlight_get_profile(fname);
+    if (bp->b_hl_sparse) {
+        HighlightState start = hl_checkpoint_state(bp, lp, profile);
+        highlight_line((const char *)ltext(lp), len, start, profile, spans, &end_state);
+        return;
+    }
 
-    highlight_line((const char *)ltext(lp), len, lp->hl_start_state, profile, &spans, &end_state);
+    highlight_line((const char *)ltext(lp), len, *lhl_start(lp), profile, spans, &end_state);
 
-    if (memcmp(&lp->hl_end_state, &end_state, sizeof(HighlightState)) != 0) {
-        lp->hl_end_state = end_state;
+    if (lhl_set_end(lp, &end_state)) {
         struct line *next = lforw(lp);
-        if (next != wp->w_bufp->b_linep) {
-            next->hl_start_state = end_state;
+        if (next != bp->b_linep) {
+            lhl_set_start(next, &end_state);
             lmark_dirty(next);
             lchange(WFHARD);
         }
     }
+}
+
+static void show_line(struct window *wp, struct line *lp)
+{
+    int len = llength(lp);
+    current_rendering_lp = lp;
+
+    /* Highlight logic */
+    SpanVec *spans = &line_spans;
+    const HighlightProfile *profile = highlight_buffer_profile(wp->w_bufp);
+
+    highlight_show_state(wp, lp, len, profile, spans);
+
+    /* Ranges a plugin wants marked, e.g. the search hits */
+    render_ctx_t pre = { wp, lp, vtrow, vtcol, 0, 0, HL_NORMAL, 0, NULL, 0 };
+    render_plugin_execute(RENDER_HOOK_PRE_LINE, &pre);
+    int range_idx = 0;
 
     int current_span_idx = 0;
     int char_idx = 0; /* byte index */
@@ -901,13 +947,13 @@ static void show_line(struct window *wp, struct line *lp)
 
     while (char_idx < len) {
         int style = HL_NORMAL;
-        while (current_span_idx < spans.count) {
-            Span *s = (spans.heap_spans) ? &spans.heap_spans[current_span_idx] : &spans.spans[current_span_idx];
-            if (char_idx >= s->end) {
+        while (current_span_idx < spans->count) {
+            const Span *s = &spans->spans[current_span_idx];
+            if (char_idx >= span_end(s)) {
                 current_span_idx++;
                 continue;
             }
-            if (char_idx >= s->start) {
+            if (char_idx >= (int)s->start) {
                 style = s->style;
             }
             break;
@@ -919,6 +965,11 @@ static void show_line(struct window *wp, struct line *lp)
             bytes = 1;
         int next_col = next_column(text_col, c, tab_width);
 
+        while (range_idx < pre.nranges && char_idx >= pre.ranges[range_idx].end)
+            range_idx++;
+        if (range_idx < pre.nranges && char_idx >= pre.ranges[range_idx].start)
+            style = pre.current_style;
+
         if (command_mode_block_selection_contains(lp, text_col, next_col))
             style = HL_SELECTION;
 
@@ -936,11 +987,9 @@ static void show_line(struct window *wp, struct line *lp)
         text_col = next_col;
     }
 
-    span_vec_free(&spans);
-
     /* Detect color codes in the line and show preview boxes */
     ColorInfo colors[MAX_COLORS_PER_LINE];
-    int color_count = highlight_find_colors((const char *)ltext(lp), len, colors, MAX_COLORS_PER_LINE);
+    int color_count = highlight_line_colors(wp->w_bufp, lp, colors, MAX_COLORS_PER_LINE);
     
     if (color_count > 0) {
         /* Add a space separator, then color preview boxes */
@@ -981,7 +1030,7 @@ static void show_line(struct window *wp, struct line *lp)
     }
 
     /* 6. Inline Plugins (e.g. Ghost Text, LSP) */
-    render_ctx_t ctx = { wp, lp, vtrow, vtcol, 0, 0, HL_NORMAL, 0 };
+    render_ctx_t ctx = { wp, lp, vtrow, vtcol, 0, 0, HL_NORMAL, 0, NULL, 0 };
     render_plugin_execute(RENDER_HOOK_POST_LINE, &ctx);
 }
 
@@ -1023,24 +1072,15 @@ static void show_line_wrapped(struct window *wp, struct line *lp)
     current_rendering_lp = lp;
     int indent = wrap_continuation_indent();
 
-    SpanVec spans;
-    HighlightState end_state;
-    const char *fname = wp->w_bufp->b_fname;
-    if (!fname || !*fname)
-        fname = wp->w_bufp->b_bname;
-    const HighlightProfile *profile = highlight_get_profile(fname);
+    SpanVec *spans = &line_spans;
+    const HighlightProfile *profile = highlight_buffer_profile(wp->w_bufp);
 
-    highlight_line((const char *)ltext(lp), len, lp->hl_start_state, profile, &spans, &end_state);
+    highlight_show_state(wp, lp, len, profile, spans);
 
-    if (memcmp(&lp->hl_end_state, &end_state, sizeof(HighlightState)) != 0) {
-        lp->hl_end_state = end_state;
-        struct line *next = lforw(lp);
-        if (next != wp->w_bufp->b_linep) {
-            next->hl_start_state = end_state;
-            lmark_dirty(next);
-            lchange(WFHARD);
-        }
-    }
+    /* Ranges a plugin wants marked, e.g. the search hits */
+    render_ctx_t pre = { wp, lp, vtrow, vtcol, 0, 0, HL_NORMAL, 0, NULL, 0 };
+    render_plugin_execute(RENDER_HOOK_PRE_LINE, &pre);
+    int range_idx = 0;
 
     int current_span_idx = 0;
     int char_idx = 0;
@@ -1062,13 +1102,13 @@ static void show_line_wrapped(struct window *wp, struct line *lp)
         }
 
         int style = HL_NORMAL;
-        while (current_span_idx < spans.count) {
-            Span *s = (spans.heap_spans) ? &spans.heap_spans[current_span_idx] : &spans.spans[current_span_idx];
-            if (char_idx >= s->end) {
+        while (current_span_idx < spans->count) {
+            const Span *s = &spans->spans[current_span_idx];
+            if (char_idx >= span_end(s)) {
                 current_span_idx++;
                 continue;
             }
-            if (char_idx >= s->start) {
+            if (char_idx >= (int)s->start) {
                 style = s->style;
             }
             break;
@@ -1081,6 +1121,11 @@ static void show_line_wrapped(struct window *wp, struct line *lp)
         int w = get_char_width_rel(c, text_col);
         int next_text_col = text_col + w;
 
+        while (range_idx < pre.nranges && char_idx >= pre.ranges[range_idx].end)
+            range_idx++;
+        if (range_idx < pre.nranges && char_idx >= pre.ranges[range_idx].start)
+            style = pre.current_style;
+
         if (command_mode_block_selection_contains(lp, text_col, next_text_col))
             style = HL_SELECTION;
 
@@ -1098,11 +1143,9 @@ static void show_line_wrapped(struct window *wp, struct line *lp)
         text_col = next_text_col;
     }
 
-    span_vec_free(&spans);
-
     /* Detect color codes in the line and show preview boxes */
     ColorInfo colors[MAX_COLORS_PER_LINE];
-    int color_count = highlight_find_colors((const char *)ltext(lp), len, colors, MAX_COLORS_PER_LINE);
+    int color_count = highlight_line_colors(wp->w_bufp, lp, colors, MAX_COLORS_PER_LINE);
     
     if (color_count > 0) {
         /* Add a space separator, then color preview boxes */
@@ -1143,7 +1186,7 @@ static void show_line_wrapped(struct window *wp, struct line *lp)
     }
 
     /* 6. Inline Plugins (e.g. Ghost Text, LSP) */
-    render_ctx_t ctx = { wp, lp, vtrow, vtcol, 0, 0, HL_NORMAL, 0 };
+    render_ctx_t ctx = { wp, lp, vtrow, vtcol, 0, 0, HL_NORMAL, 0, NULL, 0 };
     render_plugin_execute(RENDER_HOOK_POST_LINE, &ctx);
 }
 
@@ -1338,6 +1381,7 @@ void updgar(void)
     start_screen_reset_smoothing();
     movecursor(0, 0);           /* Erase the screen. */
     (*term->t_eeop) ();
+    vtshadow_touch(-1);         /* the shadow no longer matches */
     finish_screen_reset_smoothing();
     TTsetcolors(-1, -1);          /* Reset colors immediately after erase */
     TTflush();                  /* Force the clear to happen */
@@ -1346,25 +1390,83 @@ void updgar(void)
     mpresf = FALSE;             /* the message area. */
 }
 
+/*
+ * vtshadow_touch:
+ *  called by the terminal wrapper for output that bypasses updupd() (popups,
+ *  the message line, full clears).  The shadow row no longer describes the
+ *  terminal, so the next updupd() must repaint it in full.  A negative row
+ *  invalidates the whole screen.
+ */
+void vtshadow_touch(int row)
+{
+    if (vt_painting || pscreen == NULL)
+        return;
+    if (row < 0) {
+        for (int i = 0; i < term->t_mrow; ++i)
+            pscreen[i]->v_flag |= VFINV;
+    } else if (row < term->t_mrow) {
+        pscreen[row]->v_flag |= VFINV;
+    }
+}
+
 /*
  * updupd:
  *  update the physical screen from the virtual screen
  *
+ *  Rows flagged VFCHG are diffed against the shadow screen first; only the
+ *  span between the first and last differing cell is sent to the terminal,
+ *  and rows that came out identical are skipped entirely.
+ *
  * int force;       forced update flag
  */
 int updupd(int force)
 {
     struct video *vp1;
+    struct video *pp1;
     int i;
+    int col_limit = term->t_ncol;
+    HighlightStyle normal = colorscheme_get(HL_NORMAL);
+
+    if (col_limit > MAXCOL)
+        col_limit = MAXCOL;
+
+    /* the erase colour is not part of the cells; repaint if it changed */
+    if (normal.fg != shadow_normal_fg || normal.bg != shadow_normal_bg) {
+        vtshadow_touch(-1);
+        shadow_normal_fg = normal.fg;
+        shadow_normal_bg = normal.bg;
+    }
 
+    vt_painting = true;
     for (i = 0; i < term->t_nrow; ++i) {
         vp1 = vscreen[i];
 
         /* for each line that needs to be updated */
-        if ((vp1->v_flag & VFCHG) != 0) {
-            updateline(i, vp1);
+        if ((vp1->v_flag & VFCHG) == 0)
+            continue;
+
+        pp1 = pscreen[i];
+        int start = 0;
+        int end = col_limit;
+
+        if ((pp1->v_flag & VFINV) == 0 && ((pp1->v_flag ^ vp1->v_flag) & VFREQ) == 0 &&
+            (vp1->v_flag & VFREQ) == 0 && (curwp->w_bufp->b_mode & MDSPELL) == 0) {
+            start = vtrow_first_diff(vp1->v_text, pp1->v_text, col_limit);
+            if (start == col_limit) {
+                vp1->v_flag &= ~VFCHG;
+                continue;
+            }
+            end = vtrow_last_diff(vp1->v_text, pp1->v_text, col_limit);
+            /* never start on the trailing half of a wide character */
+            while (start > 0 && vp1->v_text[start].ch == 0)
+                start--;
         }
+
+        updateline(i, vp1, start, end);
+        memcpy(pp1->v_text, vp1->v_text, (size_t)col_limit * sizeof(video_cell));
+        pp1->v_flag = vp1->v_flag & VFREQ;
     }
+    vt_painting = false;
     return TRUE;
 }
 
@@ -1487,21 +1589,26 @@ static size_t findwords(unicode_t *line, size_t len, unsigned char *result, size
 /*
  * updateline()
  *
+ * Cells outside [start, end) are known to match the terminal already and are
+ * not resent; the erase to end of line is only issued when the changed span
+ * reaches past the last visible cell.
+ *
  * int row;         row of screen to update
  * struct video *vp;    virtual screen image
+ * int start, end;  span of cells that differ from the shadow
  */
-static int updateline(int row, struct video *vp)
+static int updateline(int row, struct video *vp, int start, int end)
 {
     int maxchar = 0, analyzed = 0;
     unsigned char array[256];
     unicode_t text_buf[MAXCOL];
     bool spellcheck = curwp->w_bufp->b_mode & MDSPELL;
 
-    movecursor(row, 0);             /* Go to start of line. */
+    movecursor(row, start);         /* Go to start of the changed span. */
     TTsetcolors(-1, -1);           /* Reset colors */
     TTsetattrs(0, 0, 0);           /* Reset attributes */
-    int phys_fg = -1;
-    int phys_bg = -1;
+    uint16_t phys_fg = VCOLOR_DEFAULT;
+    uint16_t phys_bg = VCOLOR_DEFAULT;
     bool phys_bold = false;
     bool phys_underline = false;
     bool phys_italic = false;
@@ -1515,7 +1622,7 @@ static int updateline(int row, struct video *vp)
     for (int i = 0; i < col_limit; i++) {
         text_buf[i] = vp->v_text[i].ch;
         /* Exclude dummy cells (ch == 0) from maxchar calculation */
-        if (text_buf[i] != 0 && (text_buf[i] != ' ' || vp->v_text[i].bg != -1 || vp->v_text[i].underline || vp->v_text[i].italic))
+        if (text_buf[i] != 0 && (text_buf[i] != ' ' || vp->v_text[i].bg != VCOLOR_DEFAULT || vp->v_text[i].underline || vp->v_text[i].italic))
             maxchar = i + 1;
     }
 
@@ -1529,8 +1636,9 @@ static int updateline(int row, struct video *vp)
     if (spellcheck)
         analyzed = findwords(text_buf, maxchar, array, sizeof(array));
 
+    int paint_end = end < maxchar ? end : maxchar;
     int started = 0;
-    for (int i = 0; i < maxchar; i++) {
+    for (int i = start; i < paint_end; i++) {
         video_cell *cell = &vp->v_text[i];
 
         /* Skip dummy cells used for wide characters */
@@ -1547,7 +1655,7 @@ static int updateline(int row, struct video *vp)
 
         /* Color Handling */
         if (cell->fg != phys_fg || cell->bg != phys_bg) {
-            TTsetcolors(cell->fg, cell->bg);
+            TTsetcolors(vcolor_unpack(cell->fg), vcolor_unpack(cell->bg));
             phys_fg = cell->fg;
             phys_bg = cell->bg;
         }
@@ -1569,19 +1677,24 @@ static int updateline(int row, struct video *vp)
         TTsetattrs(phys_bold, phys_underline, phys_italic);
 
     /* Move to actual end of visible content and clear remaining trash */
-    ttcol = maxchar;
+    ttcol = paint_end > start ? paint_end : start;
 
     TTsetcolors(-1, -1); /* Reset */
     TTsetattrs(0, 0, 0);
 
-    HighlightStyle normal = colorscheme_get(HL_NORMAL);
-    if (normal.bg != -1) {
-        TTsetcolors(normal.fg, normal.bg);
-    }
+    if (end > maxchar) {
+        HighlightStyle normal = colorscheme_get(HL_NORMAL);
+        if (ttcol != maxchar) {
+            movecursor(row, maxchar);
+        }
+        if (normal.bg != -1) {
+            TTsetcolors(normal.fg, normal.bg);
+        }
 
-    TTeeol();
-    TTsetcolors(-1, -1); /* Final Reset */
-    TTsetattrs(0, 0, 0);
+        TTeeol();
+        TTsetcolors(-1, -1); /* Final Reset */
+        TTsetattrs(0, 0, 0);
+    }
 
     /* turn rev video off */
     TTrev(FALSE);
@@ -1602,6 +1715,7 @@ static void modeline(struct window *wp)
     const char *row1 = nanox_cfg.hint_bar ? "F1/^H Help F2/^S Save F3/^O Open F4/^Q Quit F5/^F Search" : "";
     const char *row2 = "";
     char status[MAXCOL + 1];
+    char matches[64];
     const char *fname = bp->b_fname[0] ? bp->b_fname : bp->b_bname;
     const char *lamp = nanox_lamp_label();
     char mark = (bp->b_flag & BFCHG) ? '*' : '-';
@@ -1616,10 +1730,16 @@ static void modeline(struct window *wp)
             : "F6/^W Copy(S:End) F7/^X Cut(S:End) F8/^V Paste F9-12 Slot";
     }
 
-    snprintf(status, sizeof(status), "%s L%d C%d %c",
-         fname, line, col, mark);
+    match_index_status(wp, matches, sizeof(matches));
+    snprintf(status, sizeof(status), "%s L%d C%d %c%s%s",
+         fname, line, col, mark, matches[0] ? "  " : "", matches);
 
     if (top >= 0 && top < term->t_nrow) {
+        char hud[MAXCOL + 1];
+        if (perf_hud_active()) {
+            perf_hud_text(hud, sizeof(hud));
+            row1 = hud;
+        }
         vscreen[top]->v_flag |= VFCHG | VFCOL;
         draw_hint_row(top, row1, status);
     }
@@ -4,6 +4,12 @@
 #include "estruct.h"
 #include "highlight.h"
 
+/* Bytes [start, end) of the line being drawn. */
+typedef struct {
+    int start;
+    int end;
+} render_range_t;
+
 typedef struct {
     struct window *wp;
     struct line *lp;
@@ -13,6 +19,8 @@ typedef struct {
     int target_col_end;
     HighlightStyleID current_style;
     int line_num;
+    const render_range_t *ranges;   /* PRE_LINE: sorted spans drawn in current_style */
+    int nranges;
 } render_ctx_t;
 
 typedef enum {
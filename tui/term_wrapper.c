@@ -7,6 +7,7 @@
 #include <errno.h>
 #include "estruct.h"
 #include "edef.h"
+#include "efunc.h"
 
 extern struct terminal *term;
 extern struct terminal tcap_term;
@@ -15,6 +16,7 @@ extern struct terminal ncurses_term;
 #endif
 
 static int driver_failed = 0;
+static int cursor_row = 0;      /* last row passed to vttmove() */
 
 /* Helper to check if terminal is responding to ANSI queries */
 static int terminal_is_sane(void) {
@@ -88,6 +90,7 @@ int vttgetc(void) {
 }
 
 int vttputc(int c) {
+    vtshadow_touch(cursor_row);
     if (term->t_putchar) return term->t_putchar(c);
     return 0;
 }
@@ -97,14 +100,17 @@ void vttflush(void) {
 }
 
 void vttmove(int row, int col) {
+    cursor_row = row;
     if (term->t_move) term->t_move(row, col);
 }
 
 void vtteeol(void) {
+    vtshadow_touch(cursor_row);
     if (term->t_eeol) term->t_eeol();
 }
 
 void vtteeop(void) {
+    vtshadow_touch(-1);
     if (term->t_eeop) term->t_eeop();
 }
 
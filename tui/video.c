@@ -0,0 +1,144 @@
+/*  video.c
+ *
+ *      Packed screen cell support: the interned truecolor palette behind the
+ *      16-bit cell colour codes, and the vectorised row comparison used by
+ *      updupd() to diff the virtual screen against its physical shadow.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "video.h"
+
+#define VCOLOR_RGB_MAX  (VCOLOR_DEFAULT - VCOLOR_RGB_BASE)
+#define VCOLOR_HASH_SIZE 0x20000u   /* power of two, > 2 * VCOLOR_RGB_MAX */
+
+static int rgb_palette[VCOLOR_RGB_MAX];
+static uint16_t rgb_hash[VCOLOR_HASH_SIZE];    /* 0 = empty, else code */
+static unsigned rgb_count = 0;
+static int last_rgb = -1;
+static uint16_t last_code = VCOLOR_DEFAULT;
+
+/* Nearest xterm-256 cube entry, used once the palette is exhausted. */
+static uint16_t rgb_to_ansi256(int rgb)
+{
+    int r = (rgb >> 16) & 0xFF;
+    int g = (rgb >> 8) & 0xFF;
+    int b = rgb & 0xFF;
+    int ri = r < 48 ? 0 : (r < 115 ? 1 : (r - 35) / 40);
+    int gi = g < 48 ? 0 : (g < 115 ? 1 : (g - 35) / 40);
+    int bi = b < 48 ? 0 : (b < 115 ? 1 : (b - 35) / 40);
+
+    return (uint16_t)(16 + 36 * ri + 6 * gi + bi);
+}
+
+uint16_t vcolor_intern_rgb(int rgb)
+{
+    uint32_t h;
+
+    if (rgb == last_rgb)
+        return last_code;
+
+    h = ((uint32_t)rgb * 2654435761u) >> 15;
+    for (;;) {
+        uint16_t code;
+
+        h &= VCOLOR_HASH_SIZE - 1;
+        code = rgb_hash[h];
+        if (code == 0)
+            break;
+        if (rgb_palette[code - VCOLOR_RGB_BASE] == rgb) {
+            last_rgb = rgb;
+            last_code = code;
+            return code;
+        }
+        h++;
+    }
+
+    if (rgb_count >= VCOLOR_RGB_MAX)
+        return rgb_to_ansi256(rgb);
+
+    rgb_palette[rgb_count] = rgb;
+    rgb_hash[h] = (uint16_t)(VCOLOR_RGB_BASE + rgb_count);
+    rgb_count++;
+    last_rgb = rgb;
+    last_code = rgb_hash[h];
+    return last_code;
+}
+
+int vcolor_rgb_at(uint16_t code)
+{
+    unsigned idx = (unsigned)code - VCOLOR_RGB_BASE;
+
+    if (code < VCOLOR_RGB_BASE || idx >= rgb_count)
+        return -1;
+    return rgb_palette[idx];
+}
+
+static inline uint64_t cell_bits(const video_cell *c)
+{
+    uint64_t v;
+
+    memcpy(&v, c, sizeof(v));
+    return v;
+}
+
+int vtrow_first_diff(const video_cell *a, const video_cell *b, int n)
+{
+    int i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (mask != 0xFFFFFFFFu)
+            return i + __builtin_ctz(~mask) / 8;
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= n; i += 2) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        if (mask != 0xFFFFu)
+            return i + __builtin_ctz(~mask & 0xFFFFu) / 8;
+    }
+#endif
+    for (; i < n; i++) {
+        if (cell_bits(&a[i]) != cell_bits(&b[i]))
+            return i;
+    }
+    return n;
+}
+
+int vtrow_last_diff(const video_cell *a, const video_cell *b, int n)
+{
+    int i = n;
+
+#if defined(__AVX2__)
+    for (; i >= 4; i -= 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i - 4));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i - 4));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (mask != 0xFFFFFFFFu)
+            return i - 4 + (31 - __builtin_clz(~mask)) / 8 + 1;
+    }
+#elif defined(__SSE2__)
+    for (; i >= 2; i -= 2) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i - 2));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i - 2));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        if (mask != 0xFFFFu)
+            return i - 2 + (31 - __builtin_clz(~mask & 0xFFFFu)) / 8 + 1;
+    }
+#endif
+    for (; i > 0; i--) {
+        if (cell_bits(&a[i - 1]) != cell_bits(&b[i - 1]))
+            return i;
+    }
+    return 0;
+}
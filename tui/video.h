@@ -1,14 +1,30 @@
 #ifndef __VIDEO_H__
 #define __VIDEO_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utf8.h"
+
+/*
+ * One screen cell, packed into 8 bytes so that a whole row can be compared
+ * with a handful of vector loads.  The code point keeps 21 bits (the full
+ * Unicode range), the attribute bits sit above it, and the colours are
+ * 16-bit codes: VCOLOR_DEFAULT, an ANSI palette index (0-255), or an index
+ * into the interned truecolor palette (see vcolor_pack()).
+ */
 typedef struct {
-    unicode_t ch;
-    int fg;
-    int bg;
-    bool bold;
-    bool underline;
-    bool italic;
+    uint32_t ch : 21;
+    uint32_t bold : 1;
+    uint32_t underline : 1;
+    uint32_t italic : 1;
+    uint32_t _reserved : 8;         /* must stay zero, rows are memcmp'd */
+    uint16_t fg;
+    uint16_t bg;
 } video_cell;
 
+_Static_assert(sizeof(video_cell) == 8, "video_cell must pack into 8 bytes");
+
 struct video {
     int v_flag;             /* Flags */
     video_cell v_text[1];           /* Screen data. */
@@ -18,4 +34,53 @@ struct video {
 #define VFEXT   0x0002              /* extended (beyond column 80)  */
 #define VFREQ   0x0008              /* reverse video request        */
 #define VFCOL   0x0010              /* color change requested       */
+#define VFINV   0x0020              /* physical row unknown (shadow) */
+
+#define VCELL_CH_MASK   0x1FFFFFu
+#define VCOLOR_DEFAULT  0xFFFFu     /* terminal default colour (-1) */
+#define VCOLOR_RGB_BASE 0x0100u     /* first interned truecolor code */
+
+uint16_t vcolor_intern_rgb(int rgb);
+int vcolor_rgb_at(uint16_t code);
+
+/* Map a colorscheme colour (-1, 0-255 or 0x01RRGGBB) to a cell code. */
+static inline uint16_t vcolor_pack(int color)
+{
+    if (color < 0)
+        return VCOLOR_DEFAULT;
+    if (color < 256)
+        return (uint16_t)color;
+    return vcolor_intern_rgb(color);
+}
+
+/* Inverse of vcolor_pack(), suitable for TTsetcolors(). */
+static inline int vcolor_unpack(uint16_t code)
+{
+    if (code == VCOLOR_DEFAULT)
+        return -1;
+    if (code < VCOLOR_RGB_BASE)
+        return code;
+    return vcolor_rgb_at(code);
+}
+
+static inline void vcell_set(video_cell *cell, unicode_t ch, int fg, int bg,
+                             bool bold, bool underline, bool italic)
+{
+    cell->ch = ch & VCELL_CH_MASK;
+    cell->bold = bold;
+    cell->underline = underline;
+    cell->italic = italic;
+    cell->_reserved = 0;
+    cell->fg = vcolor_pack(fg);
+    cell->bg = vcolor_pack(bg);
+}
+
+/*
+ * Row comparison helpers.  vtrow_first_diff() returns the index of the first
+ * cell that differs (or n when the rows are equal); vtrow_last_diff() returns
+ * one past the last differing cell (or 0).
+ */
+int vtrow_first_diff(const video_cell *a, const video_cell *b, int n);
+int vtrow_last_diff(const video_cell *a, const video_cell *b, int n);
+
 #endif
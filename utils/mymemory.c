@@ -223,6 +223,35 @@ void *handle_deref(MemoryHandle h)
     return slot->actual_ptr;
 }
 
+const void *handle_peek(MemoryHandle h, char **scratch, size_t *cap)
+{
+    struct HandleSlot *slot = h;
+    int rc;
+
+    if (slot == NULL || !slot->is_active)
+        return NULL;
+    if (slot->state == STATE_HOT)
+        return slot->actual_ptr;
+    if (slot->comp_size > INT_MAX || slot->raw_size > INT_MAX)
+        return NULL;
+
+    if (*scratch == NULL || *cap < slot->raw_size) {
+        size_t want = slot->raw_size == 0 ? 1u : (size_t)slot->raw_size;
+        char *grown = realloc(*scratch, want);
+
+        if (grown == NULL)
+            return NULL;
+        *scratch = grown;
+        *cap = want;
+    }
+
+    rc = LZ4_decompress_safe((const char *)slot->actual_ptr, *scratch,
+                             (int)slot->comp_size, (int)slot->raw_size);
+    if (rc < 0 || (uint32_t)rc != slot->raw_size)
+        return NULL;
+    return *scratch;
+}
+
 int mymemory_freeze(void *p)
 {
     struct HandleSlot *slot = (struct HandleSlot *)p;
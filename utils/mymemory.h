@@ -29,6 +29,14 @@ int my_handle_ref_count(MemoryHandle h);
  */
 void *handle_deref(MemoryHandle h);
 
+/*
+ * Read-only access that leaves a COLD block COLD: returns the block itself
+ * when it is HOT, or decompresses it into *scratch, which is grown to *cap
+ * as needed.  Several threads may peek at once as long as nothing thaws,
+ * frees or freezes blocks meanwhile.
+ */
+const void *handle_peek(MemoryHandle h, char **scratch, size_t *cap);
+
 /* 
  * Serialize a HOT memory block into a COLD (LZ4 compressed) state.
  * Returns 1 on success, 0 on failure (e.g., no compression benefit).
@@ -0,0 +1,210 @@
+#include "perf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+
+#define PERF_RING_SIZE 512
+
+typedef struct {
+    uint64_t samples[PERF_RING_SIZE];
+    unsigned head;          /* next slot to write */
+    unsigned count;         /* valid samples, <= PERF_RING_SIZE */
+    uint64_t max;
+} perf_ring_t;
+
+typedef struct {
+    unsigned count;
+    uint64_t p50, p95, p99, max;
+} perf_stats_t;
+
+static const char *const stage_names[PERF_STAGE_COUNT] = {
+    "key", "getcmd", "execute", "highlight", "reframe", "draw", "updupd", "flush"
+};
+
+bool perf_enabled = false;
+static bool perf_hud = false;
+static perf_ring_t rings[PERF_STAGE_COUNT];
+static uint64_t key_start_ns = 0;
+static uint64_t last_key_ns = 0;
+
+uint64_t perf_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void perf_record(perf_stage_t stage, uint64_t ns)
+{
+    perf_ring_t *r = &rings[stage];
+
+    r->samples[r->head] = ns;
+    r->head = (r->head + 1) % PERF_RING_SIZE;
+    if (r->count < PERF_RING_SIZE)
+        r->count++;
+    if (ns > r->max)
+        r->max = ns;
+}
+
+/* Called for every byte read from the terminal; only the first one of a
+ * key sequence starts the keystroke clock. */
+void perf_key_arrived(void)
+{
+    if (perf_enabled && key_start_ns == 0)
+        key_start_ns = perf_now_ns();
+}
+
+uint64_t perf_key_start(void)
+{
+    return key_start_ns;
+}
+
+/* Called once the terminal has been flushed at the end of update(). */
+void perf_key_painted(void)
+{
+    if (!perf_enabled || key_start_ns == 0)
+        return;
+    last_key_ns = perf_now_ns() - key_start_ns;
+    perf_record(PERF_KEY_TO_PAINT, last_key_ns);
+    key_start_ns = 0;
+    if (perf_hud && curwp != NULL)
+        curwp->w_flag |= WFMODE;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void perf_stats(perf_stage_t stage, perf_stats_t *st)
+{
+    static uint64_t sorted[PERF_RING_SIZE];
+    const perf_ring_t *r = &rings[stage];
+
+    memset(st, 0, sizeof(*st));
+    if (r->count == 0)
+        return;
+    memcpy(sorted, r->samples, r->count * sizeof(uint64_t));
+    qsort(sorted, r->count, sizeof(uint64_t), cmp_u64);
+    st->count = r->count;
+    st->p50 = sorted[(r->count - 1) * 50 / 100];
+    st->p95 = sorted[(r->count - 1) * 95 / 100];
+    st->p99 = sorted[(r->count - 1) * 99 / 100];
+    st->max = r->max;
+}
+
+static double ms(uint64_t ns)
+{
+    return (double)ns / 1e6;
+}
+
+bool perf_hud_active(void)
+{
+    return perf_enabled && perf_hud;
+}
+
+void perf_hud_text(char *buf, size_t size)
+{
+    perf_stats_t st;
+
+    perf_stats(PERF_KEY_TO_PAINT, &st);
+    snprintf(buf, size, "perf key->paint last %.2fms p50 %.2f p95 %.2f p99 %.2f (n=%u)",
+             ms(last_key_ns), ms(st.p50), ms(st.p95), ms(st.p99), st.count);
+}
+
+static void perf_reset(void)
+{
+    memset(rings, 0, sizeof(rings));
+    key_start_ns = 0;
+    last_key_ns = 0;
+}
+
+static void perf_summary(void)
+{
+    char msg[NSTRING];
+    size_t len;
+    perf_stats_t st;
+
+    perf_stats(PERF_KEY_TO_PAINT, &st);
+    len = (size_t)snprintf(msg, sizeof(msg), "key->paint %.2f/%.2f/%.2fms p99:",
+                           ms(st.p50), ms(st.p95), ms(st.p99));
+    for (int i = PERF_GETCMD; i < PERF_STAGE_COUNT && len < sizeof(msg); i++) {
+        perf_stats((perf_stage_t)i, &st);
+        len += (size_t)snprintf(msg + len, sizeof(msg) - len, " %s %.2f",
+                                stage_names[i], ms(st.p99));
+    }
+    mlwrite("%s", msg);
+}
+
+/*
+ * perf                 summary: key->paint p50/p95/p99 and per-stage p99
+ * perf <stage>         count, p50, p95, p99 and max for one stage
+ * perf on|off          start / stop collecting samples
+ * perf hud             toggle the live key->paint readout in the hint row
+ * perf reset           drop all samples
+ */
+void perf_command(const char *args)
+{
+    while (*args && isspace((unsigned char)*args))
+        args++;
+
+    if (strcasecmp(args, "on") == 0) {
+        perf_enabled = true;
+        mlwrite("perf: collecting");
+        return;
+    }
+    if (strcasecmp(args, "off") == 0) {
+        perf_enabled = false;
+        perf_hud = false;
+        key_start_ns = 0;
+        mlwrite("perf: stopped");
+        return;
+    }
+    if (strcasecmp(args, "hud") == 0) {
+        perf_hud = !perf_hud;
+        if (perf_hud)
+            perf_enabled = true;
+        curwp->w_flag |= WFMODE;
+        mlwrite("perf: HUD %s", perf_hud ? "on" : "off");
+        return;
+    }
+    if (strcasecmp(args, "reset") == 0) {
+        perf_reset();
+        mlwrite("perf: samples cleared");
+        return;
+    }
+
+    if (!perf_enabled && rings[PERF_KEY_TO_PAINT].count == 0) {
+        mlwrite("perf: not collecting (use 'perf on' or 'perf hud')");
+        return;
+    }
+
+    if (*args == '\0') {
+        perf_summary();
+        return;
+    }
+
+    for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+        if (strcasecmp(args, stage_names[i]) == 0) {
+            perf_stats_t st;
+            perf_stats((perf_stage_t)i, &st);
+            char msg[NSTRING];
+            snprintf(msg, sizeof(msg), "%s: n=%u p50 %.3fms p95 %.3fms p99 %.3fms max %.3fms",
+                     stage_names[i], st.count, ms(st.p50), ms(st.p95), ms(st.p99), ms(st.max));
+            mlwrite("%s", msg);
+            return;
+        }
+    }
+    mlwrite("Usage: perf [on|off|hud|reset|key|getcmd|execute|highlight|reframe|draw|updupd|flush]");
+}
@@ -0,0 +1,53 @@
+#ifndef PERF_H_
+#define PERF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Keystroke-to-paint latency instrumentation.
+ *
+ * Each stage of the input/redisplay pipeline is bracketed with
+ * perf_begin()/perf_end(); samples land in a per-stage ring buffer and the
+ * percentiles are computed on demand by the "perf" command.  When collection
+ * is off the brackets cost a single load and branch.
+ */
+typedef enum {
+    PERF_KEY_TO_PAINT = 0,  /* first key byte read -> terminal flushed */
+    PERF_GETCMD,            /* key sequence decoding */
+    PERF_EXECUTE,
+    PERF_HIGHLIGHT,         /* highlight_incremental_step() */
+    PERF_REFRAME,
+    PERF_DRAW,              /* updall()/updone(), i.e. show_line() */
+    PERF_UPDUPD,
+    PERF_FLUSH,
+    PERF_STAGE_COUNT
+} perf_stage_t;
+
+extern bool perf_enabled;
+
+uint64_t perf_now_ns(void);
+void perf_record(perf_stage_t stage, uint64_t ns);
+
+static inline uint64_t perf_begin(void)
+{
+    return perf_enabled ? perf_now_ns() : 0;
+}
+
+static inline void perf_end(perf_stage_t stage, uint64_t start)
+{
+    if (perf_enabled && start != 0)
+        perf_record(stage, perf_now_ns() - start);
+}
+
+void perf_key_arrived(void);
+uint64_t perf_key_start(void);
+void perf_key_painted(void);
+
+bool perf_hud_active(void);
+void perf_hud_text(char *buf, size_t size);
+
+void perf_command(const char *args);
+
+#endif              /* PERF_H_ */
@@ -1,5 +1,5 @@
 #include "utf8.h"
-#include <wchar.h>
+#include "width_table.h"
 
 /*
  * utf8_to_unicode()
@@ -130,26 +130,24 @@ unsigned unicode_to_utf8(unsigned int c, unsigned char *utf8)
  * unicode_width()
  *
  * Return the display width of a Unicode character.
- * Uses wcwidth() for proper handling of East Asian wide characters,
- * combining characters, and other special cases.
+ * Printable ASCII takes the fast path; everything else is looked up in the
+ * generated two-level table (utils/width_table.h), so the result does not
+ * depend on the C library or the current locale.
  */
 int unicode_width(unicode_t c)
 {
-    int width;
-    
+    if (c >= 0x20 && c < 0x7F)
+        return 1;
+
     /* Handle special control characters */
     if (c < 0x20 || c == 0x7F)
         return 2;  /* Control chars displayed as ^X */
     
     if (c >= 0x80 && c <= 0xA0)
         return 3;  /* Displayed as \xx */
-    
-    /* Use wcwidth for proper Unicode width calculation */
-    width = wcwidth((wchar_t)c);
-    
-    /* wcwidth returns -1 for non-printable chars, treat as 1 */
-    if (width < 0)
+
+    if (c >= 0x110000)
         return 1;
-    
-    return width;
+
+    return (width_stage2[width_stage1[c >> 8]][(c & 0xFF) >> 2] >> ((c & 3) * 2)) & 3;
 }